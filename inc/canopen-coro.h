@@ -0,0 +1,142 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Stackless coroutines for drivers
+ *
+ * These let a driver write a sequence of SDO accesses as straight-line code
+ * instead of a chain of callbacks, without blocking a worker thread while the
+ * node answers:
+ *
+ *	static int configure(struct co_coro* coro)
+ *	{
+ *		struct my_driver* self = co_coro_get_context(coro);
+ *
+ *		CO_CORO_BEGIN(coro);
+ *
+ *		CO_AWAIT_SDO_READ(coro, 0x1008, 0);
+ *		if (co_coro_get_status(coro) != CO_SDO_REQ_OK)
+ *			CO_CORO_RETURN(coro, -1);
+ *
+ *		memcpy(self->name, co_coro_get_data(coro), ...);
+ *
+ *		CO_AWAIT_SDO_WRITE(coro, 0x1017, 0, &self->period, 2);
+ *
+ *		CO_CORO_END(coro);
+ *	}
+ *
+ * A coroutine function is re-entered from the top each time it is resumed and
+ * CO_CORO_BEGIN() jumps back to where it left off. Local variables do not
+ * survive an await, so any state must be kept in the context. Awaits can not
+ * be placed inside switch statements and there can be only one per line.
+ *
+ * co_coro_start() runs the coroutine up to its first await in the calling
+ * thread. From then on it is resumed on the main loop whenever the request it
+ * waits for has finished.
+ */
+
+#ifndef _CANOPEN_CORO_H
+#define _CANOPEN_CORO_H
+
+#include "canopen-driver.h"
+
+/* Returned by a coroutine function that is waiting for something */
+#define CO_CORO_SUSPENDED 1
+
+struct co_coro;
+
+typedef int (*co_coro_fn)(struct co_coro*);
+typedef void (*co_coro_done_fn)(struct co_coro*, int result);
+
+/* Only the macros below should touch the members that end in _ */
+struct co_coro {
+	int line_;
+	co_coro_fn fn_;
+	co_coro_done_fn done_fn_;
+	struct co_drv* drv_;
+	void* context_;
+	struct co_sdo_req* req_;
+	enum co_sdo_status status_;
+};
+
+#define CO_CORO_BEGIN(coro) \
+	switch ((coro)->line_) { \
+	case 0:
+
+#define CO_CORO_END(coro) \
+	default: \
+		break; \
+	} \
+	(coro)->line_ = -1; \
+	return 0
+
+#define CO_CORO_RETURN(coro, result) \
+	do { \
+		(coro)->line_ = -1; \
+		return (result); \
+	} while (0)
+
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define CO_CORO__FALLTHROUGH __attribute__((fallthrough))
+#else
+#define CO_CORO__FALLTHROUGH do { } while (0)
+#endif
+
+/* If the request can not be started, the coroutine carries on at once with
+ * CO_SDO_REQ_NOMEM as the status.
+ */
+#define CO_CORO__AWAIT(coro, start) \
+	do { \
+		(coro)->line_ = __LINE__; \
+		if ((start) == 0) \
+			return CO_CORO_SUSPENDED; \
+		CO_CORO__FALLTHROUGH; \
+	case __LINE__: \
+		; \
+	} while (0)
+
+#define CO_AWAIT_SDO_READ(coro, index, subindex) \
+	CO_CORO__AWAIT(coro, co_coro_sdo_read(coro, index, subindex))
+
+#define CO_AWAIT_SDO_WRITE(coro, index, subindex, data, size) \
+	CO_CORO__AWAIT(coro, co_coro_sdo_write(coro, index, subindex, data, \
+					       size))
+
+void co_coro_init(struct co_coro* self, struct co_drv* drv, co_coro_fn fn,
+		  void* context);
+void co_coro_set_done_fn(struct co_coro* self, co_coro_done_fn fn);
+
+/* Returns CO_CORO_SUSPENDED if the coroutine is waiting or else whatever it
+ * returned. The done function is called in either case once it has finished.
+ */
+int co_coro_start(struct co_coro* self);
+
+/* Release the request of the last await. This is only needed if a coroutine
+ * is abandoned before it has finished, e.g. when the driver is unloaded.
+ */
+void co_coro_cancel(struct co_coro* self);
+
+struct co_drv* co_coro_get_driver(const struct co_coro* self);
+void* co_coro_get_context(const struct co_coro* self);
+
+/* Results of the last await; valid until the next one */
+enum co_sdo_status co_coro_get_status(const struct co_coro* self);
+const void* co_coro_get_data(const struct co_coro* self);
+size_t co_coro_get_size(const struct co_coro* self);
+
+int co_coro_sdo_read(struct co_coro* self, int index, int subindex);
+int co_coro_sdo_write(struct co_coro* self, int index, int subindex,
+		      const void* data, size_t size);
+
+#endif /* _CANOPEN_CORO_H */
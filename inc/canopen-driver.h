@@ -21,6 +21,8 @@
 
 struct co_drv;
 struct co_sdo_req;
+struct co_timer;
+struct co_cycle;
 
 enum co_sdo_type {
 	CO_SDO_DOWNLOAD = 1,
@@ -34,6 +36,42 @@ enum co_sdo_status {
 	CO_SDO_REQ_REMOTE_ABORT,
 	CO_SDO_REQ_CANCELLED,
 	CO_SDO_REQ_NOMEM,
+	CO_SDO_REQ_NODE_DOWN,
+};
+
+enum co_sdo_prio {
+	CO_SDO_PRIO_NORMAL = 0,
+	CO_SDO_PRIO_HIGH,
+	CO_SDO_PRIO_LOW,
+};
+
+enum co_timer_type {
+	CO_TIMER_ONESHOT = 0,
+	CO_TIMER_PERIODIC,
+	CO_TIMER_SYNC,
+};
+
+enum co_rpdo_mode {
+	CO_RPDO_IMMEDIATE = 0,
+	CO_RPDO_ON_CHANGE,
+	CO_RPDO_ON_SYNC,
+	CO_RPDO_ON_FLUSH,
+};
+
+enum co_pdo_signal_type {
+	CO_PDO_SIGNAL_UNSIGNED = 0,
+	CO_PDO_SIGNAL_SIGNED,
+	CO_PDO_SIGNAL_REAL,
+};
+
+struct co_pdo_signal {
+	int index, subindex;
+	enum co_pdo_signal_type type;
+	union {
+		uint64_t u;
+		int64_t i;
+		double real;
+	} value;
 };
 
 struct co_emcy {
@@ -46,6 +84,11 @@ typedef void (*co_free_fn)(void*);
 typedef void (*co_pdo_fn)(struct co_drv*, const void* data, size_t size);
 typedef void (*co_sdo_done_fn)(struct co_drv*, struct co_sdo_req* req);
 typedef void (*co_emcy_fn)(struct co_drv*, struct co_emcy*);
+typedef void (*co_pdo_signal_fn)(struct co_drv*, int pdo,
+				 const struct co_pdo_signal* signals,
+				 size_t n_signals);
+typedef void (*co_timer_fn)(struct co_drv*, struct co_timer*);
+typedef void (*co_cycle_fn)(struct co_drv*, const struct co_cycle*);
 
 const char* co_get_network_name(const struct co_drv* self);
 int co_get_nodeid(const struct co_drv* self);
@@ -64,6 +107,71 @@ void co_set_pdo3_fn(struct co_drv* self, co_pdo_fn fn);
 void co_set_pdo4_fn(struct co_drv* self, co_pdo_fn fn);
 void co_set_emcy_fn(struct co_drv* self, co_emcy_fn fn);
 
+/* Mapped PDOs. The mappings are read from the node's 0x1A00-0x1A03 and
+ * 0x1600-0x1603 objects, or taken from the defaults in its EDS, the first time
+ * the driver calls one of the functions below or sets up a staged RPDO. As that
+ * blocks, it must happen in the driver's init function. Received TPDOs are
+ * decoded into signals and bound variables, which hold host byte order values
+ * of 1, 2, 4 or 8 bytes. Reals are bound to float or double.
+ */
+void co_set_tpdo_signal_fn(struct co_drv* self, co_pdo_signal_fn fn);
+int co_tpdo_bind(struct co_drv* self, int pdo, int index, int subindex,
+		 void* dst, size_t size);
+int co_rpdo_bind(struct co_drv* self, int pdo, int index, int subindex,
+		 const void* src, size_t size);
+/* Encode an RPDO from its bound variables and send it */
+int co_rpdo_send(struct co_drv* self, int pdo);
+/* Encode an RPDO from signals given in the order of its mapping and send it */
+int co_rpdo_send_signals(struct co_drv* self, int pdo,
+			 const struct co_pdo_signal* signals, size_t n_signals);
+
+/* TPDO filtering. A filtered TPDO only reaches the PDO and signal functions if
+ * it differs from the last one that did, or once per keep-alive interval. The
+ * master decides whether TPDOs are filtered by default. With a deadband, a
+ * mapped TPDO has only changed if one of its objects has moved by more than
+ * the deadband.
+ */
+int co_tpdo_set_filter(struct co_drv* self, int pdo, int is_enabled);
+int co_tpdo_set_deadband(struct co_drv* self, int pdo, double deadband);
+
+/* Tell the master how often the node sends the TPDO, in us, so that late and
+ * missing TPDOs show up in its statistics. Otherwise the period is learned.
+ */
+int co_tpdo_set_period(struct co_drv* self, int pdo, uint64_t period);
+
+/* Synchronous cycles. When the master produces SYNC, queued RPDOs are sent in
+ * a batch right after the next SYNC, and the cycle function is called with
+ * the TPDOs that arrived between two SYNCs once the second one has been sent.
+ * Without a SYNC producer queued RPDOs are sent at once and the cycle function
+ * is never called.
+ */
+void co_set_cycle_fn(struct co_drv* self, co_cycle_fn fn);
+int co_rpdo_queue(struct co_drv* self, int pdo, const void* data, size_t size);
+unsigned int co_cycle_get_counter(const struct co_cycle* cycle);
+uint64_t co_cycle_get_time(const struct co_cycle* cycle); /* us */
+/* Returns the size of the TPDO or -1 if the node did not send it */
+ssize_t co_cycle_get_tpdo(const struct co_cycle* cycle, int nodeid, int pdo,
+			  void* dst, size_t size);
+
+/* Staged RPDOs. By default co_rpdo1-4() and co_rpdo_send() send at once.
+ * Once a mode, inhibit time or deadband has been set for an RPDO, its value is
+ * kept in a staging slot where a newer value replaces one that has not been
+ * sent yet. Depending on the mode, the latest value is sent:
+ *
+ *  CO_RPDO_IMMEDIATE: at once, but no more often than the inhibit time allows.
+ *  CO_RPDO_ON_CHANGE: like the above, but only if a mapped object has changed
+ *  by more than the deadband since the value that was last sent. Without a
+ *  mapping, any change counts.
+ *  CO_RPDO_ON_SYNC: right after the next SYNC.
+ *  CO_RPDO_ON_FLUSH: by co_rpdo_flush(), which sends staged values in any mode.
+ *
+ * The inhibit time is in milliseconds.
+ */
+int co_rpdo_set_mode(struct co_drv* self, int pdo, enum co_rpdo_mode mode);
+int co_rpdo_set_inhibit_time(struct co_drv* self, int pdo, unsigned long time);
+int co_rpdo_set_deadband(struct co_drv* self, int pdo, double deadband);
+int co_rpdo_flush(struct co_drv* self, int pdo);
+
 int co_rpdo1(struct co_drv* self, const void* data, size_t size);
 int co_rpdo2(struct co_drv* self, const void* data, size_t size);
 int co_rpdo3(struct co_drv* self, const void* data, size_t size);
@@ -74,8 +182,13 @@ void co_sdo_req_ref(struct co_sdo_req* self);
 int co_sdo_req_unref(struct co_sdo_req* self);
 void co_sdo_req_set_indices(struct co_sdo_req* self, int index, int subindex);
 void co_sdo_req_set_type(struct co_sdo_req* self, enum co_sdo_type type);
+/* The data is copied; an upload buffer that was set before is no longer used */
 void co_sdo_req_set_data(struct co_sdo_req* self, const void* data, size_t sz);
+void co_sdo_req_set_upload_buffer(struct co_sdo_req* self, void* buffer,
+				  size_t size);
 void co_sdo_req_set_done_fn(struct co_sdo_req* self, co_sdo_done_fn fn);
+/* Driver requests have high priority unless set otherwise */
+void co_sdo_req_set_priority(struct co_sdo_req* self, enum co_sdo_prio prio);
 void co_sdo_req_set_context(struct co_sdo_req* self, void* context,
 			    co_free_fn free_fn);
 void* co_sdo_req_get_context(const struct co_sdo_req* self);
@@ -86,6 +199,34 @@ int co_sdo_req_get_index(const struct co_sdo_req* self);
 int co_sdo_req_get_subindex(const struct co_sdo_req* self);
 enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self);
 
+/* Cyclic reads, shared with other readers of the same object. co_sdo_poll_read()
+ * returns the size of the latest value or -1 if there is none. Polls that are
+ * still running are stopped when the driver is unloaded.
+ */
+int co_sdo_poll_start(struct co_drv* self, int index, int subindex,
+		      unsigned long period);
+void co_sdo_poll_stop(struct co_drv* self, int handle);
+ssize_t co_sdo_poll_read(const struct co_drv* self, int index, int subindex,
+			 void* dst, size_t size);
+
+/* Timers run on the master's event loop and are freed when the driver is
+ * unloaded. The period is in milliseconds, except for CO_TIMER_SYNC timers
+ * which fire on every period-th SYNC message. A timer may be restarted, stopped
+ * or freed from within its own callback.
+ *
+ * The master owns the timers. A driver may still free them itself, including
+ * from the free function of its context; by then they have been stopped and
+ * their own contexts freed, and co_timer_free() does nothing.
+ */
+struct co_timer* co_timer_new(struct co_drv* drv, enum co_timer_type type,
+			      co_timer_fn fn);
+void co_timer_free(struct co_timer* self);
+void co_timer_set_context(struct co_timer* self, void* context,
+			  co_free_fn free_fn);
+void* co_timer_get_context(const struct co_timer* self);
+int co_timer_start(struct co_timer* self, unsigned long period);
+int co_timer_stop(struct co_timer* self);
+
 void co_byteorder(void* dst, const void* src, size_t dst_size, size_t src_size);
 
 #endif /* _CANOPEN_DRIVER_H */
@@ -0,0 +1,80 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef CANOPEN_BOOT_CACHE_H_
+#define CANOPEN_BOOT_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "canopen/sdo_req.h"
+
+/* What the master found out about each node the last time it booted, kept in
+ * a file so that it survives restarts. Before an entry is used, a single
+ * object that identifies the physical node is read back and compared with the
+ * value that was stored, so a node that has been replaced gets the full
+ * treatment.
+ *
+ * The file is written whenever an entry changes. It is only valid for the
+ * build that wrote it; a file with another version is ignored.
+ */
+#define BOOT_CACHE_MAGIC 0x43424f43 /* "COBC" */
+#define BOOT_CACHE_VERSION 1
+
+#define BOOT_CACHE_NODES 128 /* indexed by node id; 0 is unused */
+
+struct boot_cache_entry {
+	uint32_t is_valid;
+
+	/* Read back on bootup and compared with value */
+	uint16_t verify_index;
+	uint8_t verify_subindex;
+	uint8_t reserved;
+	uint32_t verify_value;
+
+	uint32_t device_type;
+	uint32_t vendor_id, product_code, revision_number;
+	uint32_t driver_type; /* enum co_master_driver_type */
+
+	uint32_t n_channels; /* Additional SDO channels */
+	struct {
+		uint16_t req_cobid, res_cobid;
+	} channels[SDO_REQ_CHANNELS_MAX - 1];
+
+	char name[64];
+	char hw_version[64];
+	char sw_version[64];
+};
+
+struct boot_cache_stats {
+	unsigned long n_hits;
+	unsigned long n_misses; /* No entry */
+	unsigned long n_invalidated; /* E.g. the node had been replaced */
+	unsigned long n_write_errors;
+};
+
+/* A missing or unreadable file is not an error; the cache starts out empty */
+int boot_cache_init(const char* path);
+void boot_cache_cleanup(void);
+
+int boot_cache_is_enabled(void);
+
+/* Returns 0 if there is a valid entry for the node and -1 otherwise */
+int boot_cache_get(int nodeid, struct boot_cache_entry* entry);
+int boot_cache_put(int nodeid, const struct boot_cache_entry* entry);
+void boot_cache_invalidate(int nodeid);
+
+void boot_cache_get_stats(struct boot_cache_stats* stats);
+void boot_cache_print_stats(FILE* out);
+
+#endif /* CANOPEN_BOOT_CACHE_H_ */
@@ -0,0 +1,51 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_DISPATCH_H_
+#define CANOPEN_DISPATCH_H_
+
+#include <linux/can.h>
+
+/* One route per standard COB-ID */
+#define CO_DISPATCH_SIZE (CAN_SFF_MASK + 1)
+
+typedef int (*co_dispatch_fn)(void* context, const struct can_frame* cf);
+
+struct co_dispatch_route {
+	co_dispatch_fn fn;
+	void* context;
+};
+
+extern struct co_dispatch_route co_dispatch_table_[CO_DISPATCH_SIZE];
+
+/* Routes are only changed and used on the main loop. A NULL fn removes the
+ * route.
+ */
+void co_dispatch_set(unsigned int cobid, co_dispatch_fn fn, void* context);
+void co_dispatch_clear(void);
+
+/* Returns -1 if there is no route for the frame */
+static inline int co_dispatch(const struct can_frame* cf)
+{
+	const struct co_dispatch_route* route =
+		&co_dispatch_table_[cf->can_id & CAN_SFF_MASK];
+
+	if (!route->fn)
+		return -1;
+
+	return route->fn(route->context, cf);
+}
+
+#endif /* CANOPEN_DISPATCH_H_ */
@@ -36,6 +36,8 @@ enum co_dump_options {
 
 	CO_DUMP_FILTER_PDO = CO_DUMP_FILTER_PDO1 | CO_DUMP_FILTER_PDO2
 			   | CO_DUMP_FILTER_PDO3 | CO_DUMP_FILTER_PDO4,
+
+	CO_DUMP_RING = 1 << 16,
 };
 
 int co_dump(const char* addr, enum co_dump_options options);
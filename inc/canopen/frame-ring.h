@@ -0,0 +1,99 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_FRAME_RING_H_
+#define CANOPEN_FRAME_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/can.h>
+
+/* The ring is a shared memory object named /canopen2.<interface>.frames into
+ * which the master writes every frame that it receives or sends. Any number
+ * of local readers may map it read-only and follow it, each at its own pace.
+ * The master never waits for readers; a reader that falls more than a whole
+ * ring behind loses the frames that were overwritten and is told how many.
+ */
+#define FRAME_RING_MAGIC 0x46524f43 /* "COFR" */
+#define FRAME_RING_VERSION 1
+
+#define FRAME_RING_CAPACITY_MIN 64
+
+/* Readers poll this often while they wait for frames */
+#define FRAME_RING_POLL_INTERVAL 1 /* ms */
+
+enum frame_ring_flags {
+	FRAME_RING_TX = 1, /* Sent by the master */
+};
+
+struct frame_ring_frame {
+	uint64_t timestamp; /* us, CLOCK_REALTIME */
+	uint32_t flags;
+	uint32_t reserved;
+	struct can_frame cf;
+};
+
+/* A slot holds the frame with sequence number n once its seq is 2n + 2; it is
+ * odd while the slot is being written.
+ */
+struct frame_ring_slot {
+	uint64_t seq;
+	uint64_t reserved[3];
+	struct frame_ring_frame frame;
+};
+
+struct frame_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity; /* Number of slots; a power of two */
+	uint32_t reserved;
+	uint8_t pad0[48];
+
+	uint64_t head; /* Sequence number of the next frame */
+	uint8_t pad1[56];
+
+	struct frame_ring_slot slots[];
+};
+
+/* Writer; used by the master. frame_ring_write() does nothing if the ring has
+ * not been initialised and may be called from any thread.
+ */
+int frame_ring_init(const char* iface, size_t capacity);
+void frame_ring_cleanup(void);
+
+void frame_ring_write(const struct can_frame* cf, enum frame_ring_flags flags);
+
+/* Readers */
+struct frame_ring_reader {
+	const struct frame_ring* ring;
+	size_t size;
+	uint64_t cursor; /* Sequence number of the next frame to read */
+	uint64_t n_lost; /* Frames overwritten before they could be read */
+};
+
+/* Reading starts with the next frame that is written */
+int frame_ring_reader_open(struct frame_ring_reader* self, const char* iface);
+void frame_ring_reader_close(struct frame_ring_reader* self);
+
+/* Copy up to max frames without blocking; returns the number copied */
+size_t frame_ring_read(struct frame_ring_reader* self,
+		       struct frame_ring_frame* frames, size_t max);
+
+/* Wait until there is something to read. The timeout is in ms; -1 means wait
+ * forever. Returns 1 if frames are ready and 0 on timeout.
+ */
+int frame_ring_wait(struct frame_ring_reader* self, int timeout);
+
+#endif /* CANOPEN_FRAME_RING_H_ */
@@ -18,13 +18,19 @@
 
 #include <stddef.h>
 #include <assert.h>
+#include <sys/queue.h>
 #include "canopen.h"
 #include "canopen-driver.h"
+#include "canopen/sdo_req_enums.h"
 #include "type-macros.h"
 
 enum co_master_options_flags {
 	CO_MASTER_OPTION_WITH_QUIRKS = 1,
 	CO_MASTER_OPTION_USE_TCP     = 1 << 1,
+	CO_MASTER_OPTION_SDO_CACHE   = 1 << 2,
+	CO_MASTER_OPTION_SDO_LAST_WRITER_WINS = 1 << 3,
+	CO_MASTER_OPTION_PROCESS_IMAGE = 1 << 4,
+	CO_MASTER_OPTION_TPDO_FILTER = 1 << 5,
 };
 
 enum co_master_driver_type {
@@ -44,11 +50,33 @@ struct co_master_options {
 	uint32_t heartbeat_period;
 	uint32_t heartbeat_timeout;
 	uint32_t ntimeouts_max;
+	uint64_t sdo_cache_max_age;
+	unsigned long sdo_timeout_min, sdo_timeout_max;
+	unsigned long sdo_rate; /* frames/s; 0 means unlimited */
+	unsigned int sdo_rate_share[SDO_REQ_PRIO_COUNT]; /* % of sdo_rate */
+	unsigned int sdo_breaker_threshold; /* 0 means disabled */
+	unsigned int sdo_max_retries;
+	unsigned int sdo_channels; /* per node, including the default one */
+	unsigned long sdo_poll_rate; /* polls/s */
+	int sdo_gateway_port; /* 0 means disabled */
+	size_t frame_ring_size; /* frames; 0 means disabled */
+	unsigned long sync_period; /* us; 0 means no SYNC producer */
+	unsigned int sync_counter_overflow; /* 0 means no counter */
+	int sync_priority; /* SCHED_FIFO priority; 0 means none */
+	unsigned long tpdo_keepalive; /* ms; 0 means never */
+	const char* boot_cache; /* path; NULL means disabled */
+	const char* manifest; /* path; NULL means none */
+	const char* firmware_dir; /* path; NULL means no firmware updates */
 	struct { int start, stop; } range;
 };
 
 typedef int (*co_drv_init_fn)(struct co_drv*);
 
+#define CO_DRV_PDO_COUNT 4
+
+struct pdo_map;
+struct rpdo_stage;
+
 struct co_drv {
 	void* dso;
 	co_drv_init_fn init_fn;
@@ -61,6 +89,22 @@ struct co_drv {
 	co_pdo_fn pdo1_fn, pdo2_fn, pdo3_fn, pdo4_fn;
 	co_emcy_fn emcy_fn;
 
+	/* NULL where the node has no mapping for the PDO. Only read once the
+	 * driver or the process image needs them.
+	 */
+	struct pdo_map* tpdo_map[CO_DRV_PDO_COUNT];
+	struct pdo_map* rpdo_map[CO_DRV_PDO_COUNT];
+	int is_pdo_map_loaded;
+	co_pdo_signal_fn tpdo_signal_fn;
+
+	/* NULL until the driver changes how the RPDO is sent */
+	struct rpdo_stage* rpdo_stage[CO_DRV_PDO_COUNT];
+
+	co_cycle_fn cycle_fn;
+
+	LIST_HEAD(, co_timer) timers;
+	LIST_HEAD(, co_sdo_poll) sdo_polls;
+
 	char iface[256];
 };
 
@@ -112,11 +156,19 @@ static inline struct co_master_node* co_master_get_node(int nodeid)
 
 int co_master_run(const struct co_master_options* options);
 
+struct canopen_eds;
+const struct canopen_eds* co_master_find_eds(int nodeid);
+
 int co_drv_load(struct co_drv* drv, const char* name);
 int co_drv_init(struct co_drv* drv);
 void co_drv_unload(struct co_drv* drv);
+void co_drv_process_sync(void);
+void co_drv_process_tpdo(struct co_drv* drv, int pdo, const void* data,
+			 size_t size);
 
 int co__rpdox(int nodeid, int type, const void* data, size_t size);
+/* Reads the PDO mappings from the node; must not be called from the main loop */
+void co__load_pdo_maps(struct co_drv* drv);
 
 static inline struct co_master_node* co_drv_node(const struct co_drv* drv)
 {
@@ -49,6 +49,24 @@ int co_net_probe(const struct sock* sock, char* nodes_seen, int start, int end,
 int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 		     int end, int timeout);
 
+/* When the transmit queue is full, wait this long (ms) for room before
+ * trying again, up to this many times.
+ */
+#define CO_NET_PROBE_PACE 1
+#define CO_NET_PROBE_SEND_RETRIES 100
+
+/* Reset the nodes in the range and probe for the ones that are expected.
+ *
+ * expected and nodes_seen must be arrays of length 128; prior values of
+ * nodes_seen are not cleared. Other nodes that answer meanwhile are marked as
+ * seen too. Returns as soon as every expected node has been seen or else after
+ * at most twice the timeout, which is in ms. Returns the number of expected
+ * nodes that were not seen.
+ */
+int co_net_probe_expected(const struct sock* sock, char* nodes_seen,
+			  const char* expected, int start, int end,
+			  int timeout);
+
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid);
 int co_net__request_device_type(const struct sock* sock, int nodeid);
 
@@ -0,0 +1,62 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef CANOPEN_NODE_MANIFEST_H_
+#define CANOPEN_NODE_MANIFEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* The nodes that are expected on the bus. A manifest has one node per line:
+ *
+ *	<nodeid> [<vendor id> [<product code> [<revision number>]]]
+ *
+ * Numbers may be given in decimal or hex. Identity fields that are left out
+ * are not checked. Everything after a '#' is a comment.
+ *
+ * Knowing which nodes to wait for lets bootup go ahead as soon as they have
+ * all answered. Nodes that are not in the manifest are still taken care of if
+ * they turn up later.
+ */
+
+#define NODE_MANIFEST_NODES 128 /* indexed by node id; 0 is unused */
+
+enum node_manifest_state {
+	NODE_MANIFEST_UNKNOWN = 0,
+	NODE_MANIFEST_PRESENT,
+	NODE_MANIFEST_MISSING,
+	NODE_MANIFEST_MISMATCH, /* Present, but with another identity */
+};
+
+int node_manifest_load(const char* path);
+int node_manifest_parse(FILE* input);
+void node_manifest_cleanup(void);
+
+int node_manifest_is_loaded(void);
+int node_manifest_is_expected(int nodeid);
+
+/* expected must be an array of length NODE_MANIFEST_NODES */
+void node_manifest_get_expected(char* expected);
+
+void node_manifest_set_present(int nodeid, int is_present);
+
+/* Returns -1 if the node is expected with another identity and 0 otherwise */
+int node_manifest_check_identity(int nodeid, uint32_t vendor_id,
+				 uint32_t product_code,
+				 uint32_t revision_number);
+
+enum node_manifest_state node_manifest_get_state(int nodeid);
+void node_manifest_print_stats(FILE* out);
+
+#endif /* CANOPEN_NODE_MANIFEST_H_ */
@@ -0,0 +1,103 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_PDO_MAP_H_
+#define CANOPEN_PDO_MAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen-driver.h"
+#include "canopen/types.h"
+
+/* A PDO carries at most 8 bytes, so 64 one-bit objects */
+#define PDO_MAP_ENTRIES_MAX 64
+#define PDO_MAP_BITS_MAX 64
+
+#define PDO_MAP_TPDO_INDEX 0x1A00
+#define PDO_MAP_RPDO_INDEX 0x1600
+
+struct pdo_map_entry {
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t offset; /* bits */
+	uint8_t length; /* bits */
+	enum co_pdo_signal_type signal_type;
+	uint64_t mask;
+	void* binding;
+	size_t binding_size;
+};
+
+/* The layout of one PDO, compiled from its mapping object. Dummy entries only
+ * take up space and are not listed.
+ */
+struct pdo_map {
+	unsigned int length; /* bits */
+	unsigned int n_entries;
+	struct pdo_map_entry entries[PDO_MAP_ENTRIES_MAX];
+};
+
+void pdo_map_init(struct pdo_map* self);
+
+/* Append an entry of a mapping object, i.e. index << 16 | subindex << 8 |
+ * length. The type decides how the value is interpreted; CANOPEN_UNKNOWN is
+ * taken to be unsigned.
+ *
+ * Returns -1 if the entry is not valid or the PDO would exceed 64 bits.
+ */
+int pdo_map_add(struct pdo_map* self, uint32_t mapping, enum canopen_type type);
+
+/* Number of bytes that the mapped objects take up */
+static inline size_t pdo_map_size(const struct pdo_map* self)
+{
+	return (self->length + 7) / 8;
+}
+
+struct pdo_map_entry* pdo_map_find(struct pdo_map* self, int index,
+				   int subindex);
+
+/* Bound variables are updated by pdo_map_decode() and read by
+ * pdo_map_encode(). The size must be 1, 2, 4 or 8 for integers and 4 (float)
+ * or 8 (double) for reals.
+ */
+int pdo_map_bind(struct pdo_map* self, int index, int subindex, void* ptr,
+		 size_t size);
+
+/* Unpack all mapped objects of a received PDO into signals, which must have
+ * room for self->n_entries, and update bound variables.
+ *
+ * Returns the number of signals or -1 if the PDO is too short.
+ */
+int pdo_map_decode(const struct pdo_map* self, struct co_pdo_signal* signals,
+		   const void* data, size_t size);
+
+/* Pack signals into a PDO. Signals are matched to entries by position; if
+ * signals is NULL, bound variables are used instead and unbound entries are
+ * zero.
+ *
+ * Returns the size of the PDO. dst must have room for 8 bytes.
+ */
+size_t pdo_map_encode(const struct pdo_map* self, void* dst,
+		      const struct co_pdo_signal* signals);
+
+/* Check whether any mapped object differs between two PDOs of the given size
+ * by more than the deadband. Unmapped bits are ignored. Bound variables are
+ * not touched.
+ *
+ * Returns 1 if so, 0 if not and -1 if the PDOs are too short.
+ */
+int pdo_map_differs(const struct pdo_map* self, const void* a, const void* b,
+		    size_t size, double deadband);
+
+#endif /* CANOPEN_PDO_MAP_H_ */
@@ -0,0 +1,65 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef CANOPEN_PDO_STATS_H_
+#define CANOPEN_PDO_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Arrival statistics for every TPDO seen on the bus, whether or not a driver
+ * has been loaded for the node. Jitter is how far an interval is from the
+ * expected period. The expected period is either set explicitly or learned
+ * from the average interval. Intervals of more than one and a half expected
+ * periods are counted as gaps and kept out of the average and the jitter. A
+ * learned period is learned anew if the node keeps sending more slowly, i.e.
+ * after PDO_STATS_RELEARN_GAPS gaps in a row.
+ *
+ * Everything here is used on the main loop only.
+ */
+
+#define PDO_STATS_NODES 128 /* indexed by node id; 0 is unused */
+#define PDO_STATS_PDOS 4
+
+/* Intervals needed before the average is used as the expected period */
+#define PDO_STATS_LEARN_FRAMES 8
+
+/* Consecutive gaps after which a learned period is discarded */
+#define PDO_STATS_RELEARN_GAPS 8
+
+struct can_frame;
+
+struct pdo_stats {
+	uint64_t n_frames;
+	uint64_t first_seen, last_seen; /* us, CLOCK_MONOTONIC */
+	uint64_t interval; /* moving average in us; 0 until two frames */
+	uint64_t n_averaged; /* Intervals in the average since it was learned */
+	uint64_t expected_period; /* us; 0 if it is learned */
+	uint64_t n_timed; /* Intervals that count towards the jitter */
+	int64_t jitter_min, jitter_max; /* us */
+	uint64_t n_gaps;
+	uint64_t gap_max; /* us */
+	uint64_t n_consecutive_gaps;
+	uint64_t n_relearned;
+};
+
+void pdo_stats_feed(const struct can_frame* cf);
+void pdo_stats_add(int nodeid, int pdo, uint64_t now);
+
+int pdo_stats_set_expected_period(int nodeid, int pdo, uint64_t period);
+
+int pdo_stats_get(int nodeid, int pdo, struct pdo_stats* stats);
+void pdo_stats_print_stats(FILE* out);
+
+#endif /* CANOPEN_PDO_STATS_H_ */
@@ -0,0 +1,114 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_PROCESS_IMAGE_H_
+#define CANOPEN_PROCESS_IMAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen-driver.h"
+
+/* The image is a shared memory object named /canopen2.<interface>.image that
+ * is written by the master and may be mapped read-only by any number of local
+ * readers. Readers must check the magic number and version; the version is
+ * increased whenever the layout changes.
+ */
+#define PROCESS_IMAGE_MAGIC 0x49504f43 /* "COPI" */
+#define PROCESS_IMAGE_VERSION 1
+
+#define PROCESS_IMAGE_NODES 128 /* indexed by node id; 0 is unused */
+#define PROCESS_IMAGE_PDOS 4
+#define PROCESS_IMAGE_SIGNALS_MAX 64
+
+struct process_image_identity {
+	uint32_t device_type;
+	uint32_t vendor_id;
+	uint32_t product_code;
+	uint32_t revision_number;
+	char name[64];
+};
+
+/* Every slot is guarded by a sequence number that is odd while the slot is
+ * being written.
+ */
+struct process_image_node {
+	uint32_t seq;
+	uint32_t is_active; /* A driver has been initialised */
+	uint32_t state; /* enum nmt_state of the last heartbeat */
+	uint32_t error_register;
+	uint64_t last_seen; /* us, CLOCK_REALTIME; 0 if never seen */
+	struct process_image_identity identity;
+};
+
+struct process_image_signal {
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t type; /* enum co_pdo_signal_type */
+	uint32_t reserved;
+	union {
+		uint64_t u;
+		int64_t i;
+		double real;
+	} value;
+};
+
+struct process_image_pdo {
+	uint32_t seq;
+	uint32_t count; /* Number of PDOs received */
+	uint64_t timestamp; /* us, CLOCK_MONOTONIC */
+	uint8_t size;
+	uint8_t data[8];
+	uint8_t n_signals; /* 0 unless the node's driver has a mapping */
+	uint8_t reserved[6];
+	struct process_image_signal signals[PROCESS_IMAGE_SIGNALS_MAX];
+};
+
+struct process_image {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; /* of the whole image */
+	uint32_t reserved;
+	struct process_image_node nodes[PROCESS_IMAGE_NODES];
+	struct process_image_pdo tpdos[PROCESS_IMAGE_NODES][PROCESS_IMAGE_PDOS];
+};
+
+/* Writer; used by the master. The functions do nothing if the image has not
+ * been initialised.
+ */
+int process_image_init(const char* iface);
+void process_image_cleanup(void);
+
+void process_image_set_active(int nodeid, int is_active,
+			      const struct process_image_identity* identity);
+void process_image_set_state(int nodeid, uint32_t state);
+void process_image_set_error_register(int nodeid, uint32_t error_register);
+void process_image_set_tpdo(int nodeid, int pdo, const void* data, size_t size,
+			    const struct co_pdo_signal* signals,
+			    size_t n_signals);
+
+/* Readers. Reads do not lock and do not disturb the master; they are retried
+ * while a slot is being written. If the slot stays busy, e.g. because the
+ * master died while writing it, they give up and return -1 with errno set to
+ * EAGAIN.
+ */
+const struct process_image* process_image_open(const char* iface);
+void process_image_close(const struct process_image* image);
+
+int process_image_read_node(const struct process_image* image, int nodeid,
+			    struct process_image_node* node);
+int process_image_read_tpdo(const struct process_image* image, int nodeid,
+			    int pdo, struct process_image_pdo* tpdo);
+
+#endif /* CANOPEN_PROCESS_IMAGE_H_ */
@@ -0,0 +1,49 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_RPDO_STAGE_H_
+#define CANOPEN_RPDO_STAGE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include "canopen-driver.h"
+
+struct pdo_map;
+struct rpdo_stage;
+
+/* Stages are used on the main loop only. The map, if any, is used for the
+ * deadband and must outlive the stage.
+ */
+struct rpdo_stage* rpdo_stage_new(int nodeid, int pdo,
+				  const struct pdo_map* map);
+void rpdo_stage_free(struct rpdo_stage* self);
+
+void rpdo_stage_set_mode(struct rpdo_stage* self, enum co_rpdo_mode mode);
+void rpdo_stage_set_inhibit_time(struct rpdo_stage* self, unsigned long time);
+void rpdo_stage_set_deadband(struct rpdo_stage* self, double deadband);
+
+/* Returns 0 if the value was staged or sent and -1 if sending failed */
+int rpdo_stage_write(struct rpdo_stage* self, const void* data, size_t size);
+int rpdo_stage_flush(struct rpdo_stage* self);
+
+/* Send what has been staged for SYNC. This is called on every SYNC, but has
+ * nothing to do while the master produces SYNC because staged values are then
+ * queued for the SYNC producer straight away.
+ */
+void rpdo_stage_process_sync(void);
+
+void rpdo_stage_print_stats(FILE* out);
+
+#endif /* CANOPEN_RPDO_STAGE_H_ */
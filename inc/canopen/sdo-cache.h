@@ -0,0 +1,63 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_SDO_CACHE_H_
+#define CANOPEN_SDO_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "canopen/eds.h"
+#include "vector.h"
+
+#define SDO_CACHE_FOREVER UINT64_MAX
+
+struct sdo_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stores;
+	uint64_t invalidations;
+	size_t entries;
+};
+
+/* Enable the cache. max_age is the time in ms for which values of objects
+ * that may change are considered fresh.
+ */
+int sdo_cache_init(uint64_t max_age);
+void sdo_cache_cleanup(void);
+
+int sdo_cache_is_enabled(void);
+
+/* Get the maximum age (ms) of a cached value for the given object according
+ * to its access type. Returns 0 if the object should not be cached.
+ */
+uint64_t sdo_cache_max_age(int index, enum eds_obj_access access);
+
+/* Copy a cached value that is at most max_age ms old into dst.
+ *
+ * Returns 0 on hit and -1 on miss.
+ */
+int sdo_cache_lookup(int nodeid, int index, int subindex, uint64_t max_age,
+		     struct vector* dst, int* is_size_indicated);
+
+void sdo_cache_store(int nodeid, int index, int subindex, const void* data,
+		     size_t size, int is_size_indicated);
+
+/* Drop all cached values for a node; e.g. on bootup or when unloaded. */
+void sdo_cache_invalidate(int nodeid);
+
+void sdo_cache_get_stats(int nodeid, struct sdo_cache_stats* stats);
+void sdo_cache_print_stats(FILE* out);
+
+#endif /* CANOPEN_SDO_CACHE_H_ */
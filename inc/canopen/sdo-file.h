@@ -0,0 +1,55 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_SDO_FILE_H_
+#define CANOPEN_SDO_FILE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct sdo_req;
+struct sdo_req_info;
+
+/* A file that an SDO transfer is streamed from or to.
+ *
+ * Sources are mapped into memory, so only the pages around the segment being
+ * sent need to be resident. Sinks are written at the offset of each segment
+ * and are truncated when a transfer is restarted from the beginning.
+ */
+struct sdo_file {
+	int fd;
+	const void* map;
+	size_t size;
+};
+
+struct sdo_file* sdo_file_open_source(const char* path);
+struct sdo_file* sdo_file_open_sink(const char* path);
+
+void sdo_file_close(void* ptr);
+
+/* These match sdo_async_read_fn and sdo_async_write_fn */
+ssize_t sdo_file_read(void* ptr, void* dst, size_t size, size_t offset);
+int sdo_file_write(void* ptr, const void* src, size_t size, size_t offset);
+
+/* Create a request that downloads the contents of a file or uploads an object
+ * into a file. The stream fields of info are filled in and the file is closed
+ * when the request is freed.
+ */
+struct sdo_req* sdo_file_new_download(struct sdo_req_info* info,
+				      const char* path);
+struct sdo_req* sdo_file_new_upload(struct sdo_req_info* info,
+				    const char* path);
+
+#endif /* CANOPEN_SDO_FILE_H_ */
@@ -0,0 +1,69 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_SDO_GOVERNOR_H_
+#define CANOPEN_SDO_GOVERNOR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "canopen/sdo_req_enums.h"
+
+/* Worst case length of a CAN frame with 8 data bytes, including stuff bits */
+#define SDO_GOVERNOR_BITS_PER_FRAME 135
+
+typedef void (*sdo_governor_wakeup_fn)(void);
+
+/* rate is in frames per second and each share is a percentage of that which
+ * requests of the given priority may use.
+ */
+struct sdo_governor_config {
+	unsigned long rate;
+	unsigned int share[SDO_REQ_PRIO_COUNT];
+};
+
+struct sdo_governor_stats {
+	uint64_t frames;
+	uint64_t throttled;
+};
+
+static inline unsigned long
+sdo_governor_rate_from_bitrate(unsigned long bitrate, unsigned int percent)
+{
+	return (uint64_t)bitrate * percent / 100 / SDO_GOVERNOR_BITS_PER_FRAME;
+}
+
+int sdo_governor_init(const struct sdo_governor_config* config);
+void sdo_governor_cleanup(void);
+
+int sdo_governor_is_enabled(void);
+
+/* Take a token for sending one SDO frame of the given priority.
+ *
+ * Returns 0 if the frame may be sent right away. Otherwise, no token is taken
+ * and the number of ms until one becomes available is returned.
+ */
+unsigned long sdo_governor_acquire(enum sdo_req_prio prio);
+
+/* Have fn called after delay ms, or earlier if some other caller asked for an
+ * earlier wakeup. There is only one wakeup function.
+ */
+void sdo_governor_set_wakeup_fn(sdo_governor_wakeup_fn fn);
+void sdo_governor_request_wakeup(unsigned long delay);
+
+void sdo_governor_get_stats(enum sdo_req_prio prio,
+			    struct sdo_governor_stats* stats);
+void sdo_governor_print_stats(FILE* out);
+
+#endif /* CANOPEN_SDO_GOVERNOR_H_ */
@@ -0,0 +1,85 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_SDO_POLL_H_
+#define CANOPEN_SDO_POLL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen/sdo.h"
+#include "canopen/sdo_req_enums.h"
+#include "canopen/types.h"
+
+/* Number of distinct objects that can be polled */
+#define SDO_POLL_OBJECTS_MAX 1024
+
+/* Number of registrations, some of which may refer to the same object */
+#define SDO_POLL_REGISTRATIONS_MAX 4096
+
+/* Values that do not fit are reported as SDO_ABORT_TOO_LONG */
+#define SDO_POLL_VALUE_MAX 32
+
+/* Every poll costs a request and a response frame */
+#define SDO_POLL_FRAMES_PER_POLL 2
+
+struct sdo_poll_info {
+	int nodeid, index, subindex;
+	unsigned long period; /* ms */
+	enum canopen_type type; /* CANOPEN_UNKNOWN if not known */
+};
+
+struct sdo_poll_value {
+	enum canopen_type type;
+	enum sdo_req_status status;
+	enum sdo_abort_code abort_code;
+	uint64_t timestamp; /* us, CLOCK_MONOTONIC; 0 until the first poll ends */
+	size_t size;
+	unsigned char data[SDO_POLL_VALUE_MAX];
+};
+
+/* rate is the number of polls per second that may be sent; 0 means that only
+ * the SDO governor limits them, if it is enabled.
+ */
+int sdo_poll_init(unsigned long rate);
+void sdo_poll_cleanup(void);
+
+/* Poll an object every info->period ms. Registrations of the same object are
+ * merged and the object is polled at the shortest period among them.
+ *
+ * Returns a handle for sdo_poll_unregister() or -1 on failure.
+ */
+int sdo_poll_register(const struct sdo_poll_info* info);
+void sdo_poll_unregister(int handle);
+
+/* Get the latest value of a polled object. This does not lock and may be
+ * called from any thread.
+ *
+ * Returns -1 if the object is not being polled.
+ */
+int sdo_poll_read(int nodeid, int index, int subindex,
+		  struct sdo_poll_value* value);
+
+void sdo_poll_print_stats(FILE* out);
+
+/* Send the polls that are due at the given time (us). This is what the timer
+ * does; it is exposed for testing.
+ */
+void sdo_poll__run(uint64_t now);
+
+/* The number of table slots left behind by removed objects, for testing */
+size_t sdo_poll__count_tombstones(void);
+
+#endif /* CANOPEN_SDO_POLL_H_ */
@@ -33,6 +33,13 @@
 #define SDO_MULTIPLEXER_IDX 1
 #define SDO_MULTIPLEXER_SIZE 3
 
+/* SDO server parameters of the additional channels follow at 0x1201 */
+#define SDO_SERVER_PARAM_INDEX 0x1200
+
+/* Flags in the COB-ID entries of the SDO parameter objects */
+#define SDO_COBID_INVALID (1UL << 31)
+#define SDO_COBID_EXTENDED (1UL << 29)
+
 enum sdo_ccs {
 	SDO_CCS_DL_SEG_REQ = 0,
 	SDO_CCS_DL_INIT_REQ = 1,
@@ -72,6 +79,9 @@ enum sdo_abort_code {
 	SDO_ABORT_SUBNEXIST     = 0x06090011,
 	SDO_ABORT_NVAL     	= 0x06090030,
 	SDO_ABORT_GENERAL       = 0x08000000,
+	SDO_ABORT_STORE         = 0x08000020,
+	SDO_ABORT_LOCAL_CONTROL = 0x08000021,
+	SDO_ABORT_DEVICE_STATE  = 0x08000022,
 
 };
 
@@ -178,12 +188,13 @@ static inline void sdo_indicate_size(struct can_frame* frame)
 
 static inline void sdo_set_indicated_size(struct can_frame* frame, size_t size)
 {
-	byteorder(&frame->data[SDO_INDICATED_SIZE_IDX], &size, 4);
+	uint32_t size32 = size;
+	byteorder(&frame->data[SDO_INDICATED_SIZE_IDX], &size32, 4);
 }
 
 static inline size_t sdo_get_indicated_size(const struct can_frame* frame)
 {
-	size_t size;
+	uint32_t size;
 	byteorder(&size, &frame->data[SDO_INDICATED_SIZE_IDX], 4);
 	return size;
 }
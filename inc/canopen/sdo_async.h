@@ -16,6 +16,8 @@
 #ifndef SDO_ASYNC_H_
 #define SDO_ASYNC_H_
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <mloop.h>
 #include "vector.h"
 #include "canopen/sdo_req_enums.h"
@@ -28,6 +30,16 @@ struct can_frame;
 typedef void (*sdo_async_fn)(struct sdo_async* async);
 typedef void (*sdo_async_free_fn)(void* ptr);
 
+/* Stream callbacks for transfers that do not fit in memory. Offsets are from the
+ * start of the object; a transfer that is restarted starts again at offset 0.
+ * The read function must fill the whole destination. Both return a negative
+ * value on failure, which aborts the transfer.
+ */
+typedef ssize_t (*sdo_async_read_fn)(void* context, void* dst, size_t size,
+				     size_t offset);
+typedef int (*sdo_async_write_fn)(void* context, const void* src, size_t size,
+				  size_t offset);
+
 enum sdo_async_comm_state {
 	SDO_ASYNC_COMM_START = 0,
 	SDO_ASYNC_COMM_INIT_RESPONSE,
@@ -41,14 +53,46 @@ enum sdo_async_quirks_flags {
 	SDO_ASYNC_QUIRK_ALL = 0xff,
 };
 
+/* The timeout is fixed unless the lower bound is set below the upper one, as a
+ * node that answers reads quickly may still take long to store a value.
+ */
+#define SDO_ASYNC_TIMEOUT_MIN 1000 /* ms */
+#define SDO_ASYNC_TIMEOUT_MAX 1000 /* ms */
+
+/* Round-trip time estimation for adaptive timeouts as in RFC 6298.
+ *
+ * Times are in microseconds except for the timeout bounds, which are in
+ * milliseconds.
+ */
+struct sdo_async_rtt {
+	uint64_t srtt;
+	uint64_t rttvar;
+	uint64_t last;
+	unsigned long min_timeout, max_timeout;
+	unsigned int backoff;
+	unsigned long n_samples;
+	unsigned long n_timeouts;
+};
+
 struct sdo_async {
 	struct sock sock;
 	unsigned int nodeid;
+	unsigned int req_cobid, res_cobid;
 	enum sdo_req_type type;
 	int is_running;
 	enum sdo_async_comm_state comm_state;
 	struct mloop_timer* timer;
 	struct vector buffer;
+	const void* dl_data;
+	size_t dl_size;
+	void* ul_buffer;
+	size_t ul_buffer_size;
+	size_t ul_size;
+	size_t ul_indicated_size;
+	sdo_async_read_fn read_fn;
+	sdo_async_write_fn write_fn;
+	void* stream_context;
+	sdo_async_fn on_progress;
 	sdo_async_fn on_done;
 	int index, subindex;
 	int is_toggled;
@@ -59,14 +103,46 @@ struct sdo_async {
 	void* context;
 	sdo_async_free_fn free_fn;
 	int is_size_indicated;
+	unsigned long timeout;
+	enum sdo_req_prio prio;
+	int is_deferred;
+	uint64_t send_time;
+	struct sdo_async_rtt rtt;
 };
 
+/* A timeout of 0 means that the timeout is derived from the measured round-trip
+ * time of the node.
+ *
+ * Download data is borrowed; it is not copied and must stay valid until the
+ * transfer is done or stopped.
+ *
+ * Uploads are received into the internal buffer unless ul_buffer is set, in
+ * which case the data is written directly into ul_buffer and the transfer is
+ * aborted if it does not fit. The number of bytes received is then available
+ * in ul_size.
+ *
+ * If read_fn is set for a download, size bytes are pulled from it as they are
+ * sent instead of being taken from data. If write_fn is set for an upload, the
+ * data is pushed to it as it arrives and nothing is buffered. on_progress is
+ * called for each segment that has been sent or received; pos or ul_size then
+ * hold the number of bytes transferred so far.
+ *
+ * Segment requests are subject to the SDO rate governor according to prio and
+ * may be deferred until the governor allows them to be sent.
+ */
 struct sdo_async_info {
 	enum sdo_req_type type;
 	int index, subindex;
 	unsigned long timeout;
+	enum sdo_req_prio prio;
 	const void* data;
 	size_t size;
+	void* ul_buffer;
+	size_t ul_buffer_size;
+	sdo_async_read_fn read_fn;
+	sdo_async_write_fn write_fn;
+	void* stream_context;
+	sdo_async_fn on_progress;
 	sdo_async_fn on_done;
 	void* context;
 	sdo_async_free_fn free_fn;
@@ -75,10 +151,23 @@ struct sdo_async_info {
 int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid);
 void sdo_async_destroy(struct sdo_async* self);
 
+/* Use another SDO channel than the default one. req_cobid is the COB-ID for
+ * requests to the server and res_cobid is the COB-ID of its responses.
+ */
+void sdo_async_set_cobids(struct sdo_async* self, unsigned int req_cobid,
+			  unsigned int res_cobid);
+
 int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info);
 int sdo_async_stop(struct sdo_async* self);
 
 int sdo_async_feed(struct sdo_async* self, const struct can_frame* frame);
 
+void sdo_async_set_timeout_bounds(struct sdo_async* self, unsigned long min,
+				  unsigned long max);
+
+/* Get the timeout (ms) that an adaptive transfer would use */
+unsigned long sdo_async_rtt_timeout(const struct sdo_async_rtt* rtt);
+void sdo_async_rtt_update(struct sdo_async_rtt* rtt, uint64_t sample);
+
 #endif /* SDO_ASYNC_H_ */
 
@@ -18,32 +18,75 @@
 
 #include <sys/queue.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <mloop.h>
 #include "vector.h"
 #include "canopen/sdo.h"
 #include "arc.h"
+#include "mpsc-queue.h"
 
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req_enums.h"
 #include "type-macros.h"
 
+/* Including the default channel */
+#define SDO_REQ_CHANNELS_MAX 4
+
 struct sdo_req;
 struct sock;
 
 typedef void (*sdo_req_fn)(struct sdo_req*);
 typedef void (*sdo_req_free_fn)(void*);
+typedef void (*sdo_req_progress_fn)(struct sdo_req*, size_t done,
+				    size_t total);
 
+/* If ul_buffer is set for an upload, the data is received directly into it
+ * and req->data refers to it when done. The buffer must remain valid until the
+ * request has been freed.
+ *
+ * Large objects can be streamed instead: if dl_source is set for a download,
+ * dl_size bytes are pulled from it while the data is sent. If ul_sink is set for
+ * an upload, the data is pushed to it as it arrives and req->data stays empty.
+ * Both are called with stream_context, which is freed with stream_free_fn along
+ * with the request. Streamed uploads are never coalesced with other requests.
+ *
+ * on_progress is called from the main loop as segments are transferred. The
+ * total is 0 if the size of an upload has not been indicated.
+ *
+ * If timeout (ms) is 0, the timeout is chosen according to the object and the
+ * measured round-trip time of the node.
+ *
+ * Requests of higher priority are generally processed first, but lower
+ * priorities are not starved. By convention, drivers use high priority, the
+ * master itself uses normal priority and requests from the REST service use
+ * low priority.
+ */
 struct sdo_req_info {
 	enum sdo_req_type type;
 	int index, subindex;
 	sdo_req_fn on_done;
 	const void* dl_data;
 	size_t dl_size;
+	void* ul_buffer;
+	size_t ul_buffer_size;
+	sdo_async_read_fn dl_source;
+	sdo_async_write_fn ul_sink;
+	void* stream_context;
+	sdo_req_free_fn stream_free_fn;
+	sdo_req_progress_fn on_progress;
+	unsigned long timeout;
+	enum sdo_req_prio prio;
 	void* context;
 };
 
 struct sdo_req_queue;
 
+TAILQ_HEAD(sdo_req_list, sdo_req);
+
+/* Requests that are coalesced with another request are kept in that request's
+ * list of followers and complete along with it.
+ */
 struct sdo_req {
 	int ref;
 	TAILQ_ENTRY(sdo_req) links;
@@ -57,18 +100,97 @@ struct sdo_req {
 	void* context;
 	sdo_req_free_fn context_free_fn;
 	int is_size_indicated;
+	int is_data_borrowed;
+	unsigned long timeout;
+	enum sdo_req_prio prio;
+	struct sdo_req_list followers;
+	struct mpsc_node inbox_link;
+	unsigned int n_retries;
+	int is_requeued;
+	sdo_async_read_fn read_fn;
+	sdo_async_write_fn write_fn;
+	void* stream_context;
+	sdo_req_free_fn stream_free_fn;
+	sdo_req_progress_fn on_progress;
+	size_t stream_size;
+	size_t transferred;
 };
 
-TAILQ_HEAD(sdo_req_list, sdo_req);
+enum sdo_req_queue_flags {
+	/* Drop queued downloads that are superseded by a newer download to the
+	 * same object. The dropped requests complete with the status of the
+	 * newer one.
+	 */
+	SDO_REQ_QUEUE_LAST_WRITER_WINS = 1,
+};
+
+struct sdo_req_queue_stats {
+	unsigned long coalesced_uploads;
+	unsigned long superseded_downloads;
+	unsigned long retries;
+};
+
+/* The circuit breaker of a queue opens after a number of consecutive timeouts.
+ * While it is open, requests fail immediately with SDO_REQ_NODE_DOWN, except
+ * that one request is let through as a probe after each back-off period. The
+ * back-off doubles each time a probe times out. The breaker closes when the
+ * node answers an SDO or announces itself by heartbeat or boot-up.
+ */
+enum sdo_req_breaker_state {
+	SDO_REQ_BREAKER_CLOSED = 0,
+	SDO_REQ_BREAKER_OPEN,
+	SDO_REQ_BREAKER_HALF_OPEN,
+};
+
+struct sdo_req_breaker {
+	enum sdo_req_breaker_state state;
+	unsigned int threshold; /* 0 means disabled */
+	unsigned int n_timeouts;
+	unsigned long backoff; /* ms */
+	uint64_t next_probe; /* us */
+	unsigned long n_trips;
+	unsigned long n_rejected;
+};
+
+/* A node may have more than one SDO server channel. The queue then runs one
+ * client per channel, so that e.g. a long domain transfer does not hold up
+ * other requests to the same node. Channel 0 is the default channel.
+ */
+struct sdo_req_channel {
+	struct sdo_async client;
+	struct sdo_req* current;
+	struct sdo_req_queue* queue;
+};
 
+/* Requests are enqueued without locking by pushing them onto the inbox, from
+ * which the main loop moves them into the priority lists. Everything else,
+ * apart from size, is owned by the main loop and protected by the mutex.
+ *
+ * size counts the requests in the inbox and the lists and is updated
+ * atomically, so that it can be checked without locking.
+ */
 struct sdo_req_queue {
 	pthread_mutex_t mutex;
 	size_t size;
 	size_t limit;
-	struct sdo_req_list list;
-	struct sdo_async sdo_client;
+	struct mpsc_queue inbox;
+	struct sdo_req_list list[SDO_REQ_PRIO_COUNT];
+	unsigned int credit[SDO_REQ_PRIO_COUNT];
+	struct sdo_req_channel channel[SDO_REQ_CHANNELS_MAX];
+	unsigned int n_channels;
+	const struct sock* sock;
+	enum sdo_async_quirks_flags quirks;
 	struct mloop_idle* idle;
 	int nodeid;
+	enum sdo_req_queue_flags flags;
+	int is_throttled;
+	struct sdo_req_queue_stats stats;
+	struct sdo_req_breaker breaker;
+	unsigned int max_retries;
+	struct mloop_timer* retry_timer;
+	int is_retry_pending;
+	/* The next request waits for a transfer on another channel */
+	int is_blocked;
 };
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
@@ -81,20 +203,46 @@ void sdo_req_queues_cleanup();
 
 struct sdo_req_queue* sdo_req_queue_get(int nodeid);
 void sdo_req_queue_flush(struct sdo_req_queue* self);
+void sdo_req_queue_set_flags(struct sdo_req_queue* self,
+			     enum sdo_req_queue_flags flags);
+void sdo_req_queue_get_stats(struct sdo_req_queue* self,
+			     struct sdo_req_queue_stats* stats);
+void sdo_req_queue_set_timeout_bounds(struct sdo_req_queue* self,
+				      unsigned long min, unsigned long max);
+void sdo_req_queue_set_breaker(struct sdo_req_queue* self,
+			       unsigned int threshold);
+void sdo_req_queue_set_max_retries(struct sdo_req_queue* self,
+				   unsigned int max_retries);
+void sdo_req_queue_close_breaker(struct sdo_req_queue* self);
+int sdo_req_queue_add_channel(struct sdo_req_queue* self,
+			      unsigned int req_cobid, unsigned int res_cobid);
+void sdo_req_queue_remove_channels(struct sdo_req_queue* self);
+struct sdo_async* sdo_req_find_channel(unsigned int res_cobid);
+void sdo_req_print_stats(FILE* out);
+void sdo_req_print_rtt_stats(FILE* out);
+void sdo_req_print_breaker_stats(FILE* out);
 
 struct sdo_req* sdo_req_new(struct sdo_req_info* info);
 void sdo_req_free(struct sdo_req* self);
 
+void sdo_req_set_ul_buffer(struct sdo_req* self, void* buffer, size_t size);
+
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue);
 void sdo_req_wait(struct sdo_req* self);
 
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req);
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self);
 
+static inline
+struct sdo_req_channel* sdo_req_channel__from_async(const struct sdo_async* async)
+{
+	return container_of(async, struct sdo_req_channel, client);
+}
+
 static inline
 struct sdo_req_queue* sdo_req_queue__from_async(const struct sdo_async* async)
 {
-	return container_of(async, struct sdo_req_queue, sdo_client);
+	return sdo_req_channel__from_async(async)->queue;
 }
 
 ARC_PROTOTYPE(sdo_req)
@@ -28,6 +28,15 @@ enum sdo_req_status {
 	SDO_REQ_REMOTE_ABORT,
 	SDO_REQ_CANCELLED,
 	SDO_REQ_NOMEM,
+	SDO_REQ_NODE_DOWN,
 };
 
+enum sdo_req_prio {
+	SDO_REQ_PRIO_NORMAL = 0,
+	SDO_REQ_PRIO_HIGH,
+	SDO_REQ_PRIO_LOW,
+};
+
+#define SDO_REQ_PRIO_COUNT 3
+
 #endif /* SDO_REQ_ENUMS_H_ */
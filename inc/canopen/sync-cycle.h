@@ -0,0 +1,100 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_SYNC_CYCLE_H_
+#define CANOPEN_SYNC_CYCLE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen-driver.h"
+
+struct sock;
+struct can_frame;
+
+#define SYNC_CYCLE_NODES 128 /* indexed by node id; 0 is unused */
+#define SYNC_CYCLE_PDOS 4
+
+/* RPDOs that can be queued for a single cycle; one per node and PDO */
+#define SYNC_CYCLE_RPDOS_MAX ((SYNC_CYCLE_NODES - 1) * SYNC_CYCLE_PDOS)
+
+/* The SYNC counter runs from 1 to the overflow value (CiA 301, 0x1019) */
+#define SYNC_CYCLE_COUNTER_MIN 2
+#define SYNC_CYCLE_COUNTER_MAX 240
+
+/* A cycle starts when SYNC is sent and ends when the next one is. It holds
+ * the last of each TPDO that arrived in between.
+ */
+struct co_cycle {
+	unsigned int counter; /* 0 if SYNC has no counter */
+	uint64_t time; /* us, CLOCK_MONOTONIC, when SYNC was sent */
+	uint8_t is_received[SYNC_CYCLE_NODES];  /* bit n - 1 for TPDO n */
+	struct {
+		uint8_t size;
+		uint8_t data[8];
+	} tpdos[SYNC_CYCLE_NODES][SYNC_CYCLE_PDOS];
+};
+
+typedef void (*sync_cycle_sync_fn)(void);
+typedef void (*sync_cycle_done_fn)(const struct co_cycle* cycle);
+
+struct sync_cycle_config {
+	unsigned long period; /* us */
+	unsigned int counter_overflow; /* 0 for SYNC without a counter */
+	int priority; /* SCHED_FIFO priority of the producer; 0 for none */
+
+	/* Called on the main loop after every SYNC */
+	sync_cycle_sync_fn sync_fn;
+	/* Called on the main loop when a cycle has ended, before sync_fn */
+	sync_cycle_done_fn done_fn;
+};
+
+struct sync_cycle_stats {
+	uint64_t n_cycles;
+	uint64_t n_missed; /* SYNCs skipped because the producer was late */
+	uint64_t n_overruns; /* Cycles that ended before the main loop saw them */
+	uint64_t n_rpdos;
+	uint64_t n_rpdos_replaced; /* Queued again before they were sent */
+	/* How late SYNC was sent, in us */
+	uint64_t jitter_min, jitter_max, jitter_avg;
+};
+
+/* SYNC is sent on the given socket from a thread of its own. init must be
+ * called on the main loop.
+ */
+int sync_cycle_init(const struct sync_cycle_config* config,
+		    const struct sock* sock);
+void sync_cycle_cleanup(void);
+
+int sync_cycle_is_running(void);
+
+/* Queue an RPDO to be sent right after the next SYNC. If the same RPDO has
+ * already been queued for the cycle, the new value replaces it. May be called
+ * from any thread.
+ */
+int sync_cycle_queue_rpdo(int nodeid, int pdo, const void* data, size_t size);
+
+/* Pass received frames through here so that TPDOs are added to the cycle */
+void sync_cycle_feed(const struct can_frame* cf);
+
+void sync_cycle_get_stats(struct sync_cycle_stats* stats);
+void sync_cycle_print_stats(FILE* out);
+
+/* End the current cycle and begin a new one. This is what happens on the main
+ * loop after each SYNC; it is exposed for testing.
+ */
+void sync_cycle__begin(unsigned int counter, uint64_t time);
+
+#endif /* CANOPEN_SYNC_CYCLE_H_ */
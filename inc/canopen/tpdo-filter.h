@@ -0,0 +1,65 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef CANOPEN_TPDO_FILTER_H_
+#define CANOPEN_TPDO_FILTER_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Drops TPDOs that carry nothing new before they reach the driver. A TPDO is
+ * new if its payload differs from the last one that was passed on or, if a
+ * deadband has been set and the PDO is mapped, if any mapped object has moved
+ * by more than the deadband since then. Unchanged TPDOs are still passed on
+ * once per keep-alive interval so that drivers can tell that the node is
+ * sending.
+ *
+ * Everything here is used on the main loop only.
+ */
+
+#define TPDO_FILTER_NODES 128 /* indexed by node id; 0 is unused */
+#define TPDO_FILTER_PDOS 4
+
+struct pdo_map;
+
+struct tpdo_filter_stats {
+	unsigned long n_received;
+	unsigned long n_passed;
+	unsigned long n_unchanged; /* Dropped */
+	unsigned long n_keepalive; /* Unchanged, but passed on to show liveness */
+};
+
+/* Set whether PDOs are filtered unless a driver says otherwise, and how often
+ * unchanged PDOs are passed on anyway, in ms. A keep-alive interval of 0 means
+ * never.
+ */
+void tpdo_filter_set_default(int is_enabled, unsigned long keepalive);
+
+int tpdo_filter_set_enabled(int nodeid, int pdo, int is_enabled);
+
+/* The map must stay valid until tpdo_filter_reset() is called for the node */
+int tpdo_filter_set_deadband(int nodeid, int pdo, const struct pdo_map* map,
+			     double deadband);
+
+/* Forget everything about the node, including settings */
+void tpdo_filter_reset(int nodeid);
+
+/* Returns 1 if the PDO should be passed on and 0 if it should be dropped */
+int tpdo_filter_pass(int nodeid, int pdo, const void* data, size_t size);
+
+int tpdo_filter_get_stats(int nodeid, int pdo,
+			  struct tpdo_filter_stats* stats);
+void tpdo_filter_print_stats(FILE* out);
+
+#endif /* CANOPEN_TPDO_FILTER_H_ */
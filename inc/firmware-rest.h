@@ -0,0 +1,11 @@
+#ifndef FIRMWARE_REST_H_
+#define FIRMWARE_REST_H_
+
+/* Allow updates with the images in dir. Updates are refused until this has
+ * been called.
+ */
+int firmware_rest_init(const char* dir);
+
+void firmware_rest_service(struct rest_client* client, const void* content);
+
+#endif /* FIRMWARE_REST_H_ */
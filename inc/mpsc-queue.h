@@ -0,0 +1,93 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Intrusive multi-producer, single-consumer queue
+ *
+ * This is Dmitry Vyukov's non-blocking MPSC queue. Pushing is wait-free and
+ * may be done from any number of threads. Only one thread may pop at a time;
+ * if more than one thread needs to pop, they must serialise among themselves.
+ *
+ * Popping may return NULL while a push is in progress in another thread, even
+ * though the queue is not empty. The element becomes available as soon as the
+ * push has finished.
+ */
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <stddef.h>
+#include "co_atomic.h"
+
+struct mpsc_node {
+	struct mpsc_node* next;
+};
+
+struct mpsc_queue {
+	struct mpsc_node* head; /* Producers push here */
+	struct mpsc_node* tail; /* The consumer pops from here */
+	struct mpsc_node stub;
+};
+
+static inline void mpsc_queue_init(struct mpsc_queue* self)
+{
+	self->stub.next = NULL;
+	self->head = &self->stub;
+	self->tail = &self->stub;
+}
+
+static inline void mpsc_queue_push(struct mpsc_queue* self,
+				   struct mpsc_node* node)
+{
+	co_atomic_store(&node->next, NULL);
+	struct mpsc_node* prev = co_atomic_exchange(&self->head, node);
+	co_atomic_store(&prev->next, node);
+}
+
+static inline struct mpsc_node* mpsc_queue_pop(struct mpsc_queue* self)
+{
+	struct mpsc_node* tail = self->tail;
+	struct mpsc_node* next = co_atomic_load(&tail->next);
+
+	if (tail == &self->stub) {
+		if (!next)
+			return NULL;
+
+		self->tail = next;
+		tail = next;
+		next = co_atomic_load(&next->next);
+	}
+
+	if (next) {
+		self->tail = next;
+		return tail;
+	}
+
+	/* A producer has swapped the head but not yet linked it in */
+	if (tail != co_atomic_load(&self->head))
+		return NULL;
+
+	/* tail is the last element; put the stub behind it so it can go */
+	mpsc_queue_push(self, &self->stub);
+
+	next = co_atomic_load(&tail->next);
+	if (next) {
+		self->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+#endif /* MPSC_QUEUE_H_ */
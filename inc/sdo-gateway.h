@@ -0,0 +1,62 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_GATEWAY_H_
+#define SDO_GATEWAY_H_
+
+#include "canopen/types.h"
+
+/* Commands longer than this are rejected */
+#define SDO_GATEWAY_LINE_MAX 1024
+
+/* Commands that may be outstanding on one connection. Further commands are
+ * held back until replies come in, up to SDO_GATEWAY_BUFFER_MAX bytes of them.
+ */
+#define SDO_GATEWAY_PENDING_MAX 256
+#define SDO_GATEWAY_BUFFER_MAX (1024 * 1024)
+
+/* Error codes from CiA 309-3 */
+enum sdo_gateway_error {
+	SDO_GATEWAY_ERROR_NOT_SUPPORTED = 100,
+	SDO_GATEWAY_ERROR_SYNTAX = 101,
+	SDO_GATEWAY_ERROR_NOT_PROCESSED = 102,
+	SDO_GATEWAY_ERROR_TIMEOUT = 103,
+	SDO_GATEWAY_ERROR_UNSUPPORTED_NODE = 107,
+};
+
+enum sdo_gateway_cmd_type {
+	SDO_GATEWAY_READ = 1,
+	SDO_GATEWAY_WRITE,
+};
+
+struct sdo_gateway_cmd {
+	unsigned long seq;
+	enum sdo_gateway_cmd_type type;
+	int nodeid, index, subindex;
+	enum canopen_type datatype;
+	const char* value; /* points into the parsed line */
+};
+
+int sdo_gateway_init(int port);
+void sdo_gateway_cleanup(void);
+
+/* Parse "[seq] r|w node index subindex type [value]". The line is modified.
+ *
+ * Returns 0 on success or a negative sdo_gateway_error.
+ */
+int sdo_gateway__parse(struct sdo_gateway_cmd* cmd, char* line);
+enum canopen_type sdo_gateway__type_from_string(const char* str);
+
+#endif /* SDO_GATEWAY_H_ */
@@ -0,0 +1,6 @@
+#ifndef STATS_REST_H_
+#define STATS_REST_H_
+
+void stats_rest_service(struct rest_client* client, const void* content);
+
+#endif /* STATS_REST_H_ */
@@ -0,0 +1,88 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Token bucket rate limiter
+ *
+ * Tokens are counted in thousandths so that rates of less than one per second
+ * work. The caller provides the time and any locking.
+ */
+
+#ifndef TOKEN_BUCKET_H_
+#define TOKEN_BUCKET_H_
+
+#include <stdint.h>
+
+#define TOKEN_BUCKET_TOKEN 1000ULL
+
+struct token_bucket {
+	uint64_t rate; /* tokens/s */
+	uint64_t tokens;
+	uint64_t capacity;
+	uint64_t last_refill; /* us */
+};
+
+/* The bucket starts out full and holds up to burst ms worth of tokens, but at
+ * least one.
+ */
+static inline void token_bucket_init(struct token_bucket* self, uint64_t rate,
+				     uint64_t burst, uint64_t now)
+{
+	uint64_t capacity = rate * burst / 1000;
+
+	self->rate = rate;
+	self->capacity = (capacity > 1 ? capacity : 1) * TOKEN_BUCKET_TOKEN;
+	self->tokens = self->capacity;
+	self->last_refill = now;
+}
+
+static inline void token_bucket_refill(struct token_bucket* self, uint64_t now)
+{
+	uint64_t elapsed = now - self->last_refill;
+	uint64_t tokens = elapsed * self->rate * TOKEN_BUCKET_TOKEN / 1000000ULL;
+
+	/* Keep the remainder for later if not even a fraction was earned */
+	if (tokens == 0)
+		return;
+
+	self->tokens += tokens;
+	if (self->tokens > self->capacity)
+		self->tokens = self->capacity;
+
+	self->last_refill = now;
+}
+
+/* Time in us until the bucket holds a whole token. An empty bucket with a rate
+ * of 0 is never refilled; a second is returned so that the caller tries again
+ * later.
+ */
+static inline uint64_t token_bucket_wait(const struct token_bucket* self)
+{
+	if (self->tokens >= TOKEN_BUCKET_TOKEN)
+		return 0;
+
+	if (self->rate == 0)
+		return 1000000ULL;
+
+	return ((TOKEN_BUCKET_TOKEN - self->tokens) * 1000000ULL
+		+ self->rate * TOKEN_BUCKET_TOKEN - 1)
+	       / (self->rate * TOKEN_BUCKET_TOKEN);
+}
+
+static inline void token_bucket_take(struct token_bucket* self)
+{
+	self->tokens -= TOKEN_BUCKET_TOKEN;
+}
+
+#endif /* TOKEN_BUCKET_H_ */
@@ -24,4 +24,6 @@
 	(type *)( (char *)__mptr - offsetof(type,member) ); \
 })
 
+#define ARRAY_LENGTH(a) (sizeof(a) / sizeof((a)[0]))
+
 #endif /* TYPE_MACROS_H_ */
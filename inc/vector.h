@@ -95,4 +95,11 @@ static inline int vector_copy(struct vector* dst, const struct vector* src)
 	return vector_assign(dst, src->data, src->index);
 }
 
+static inline void vector_swap(struct vector* a, struct vector* b)
+{
+	struct vector tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
 #endif /* _VECTOR_H_INCLUDED */
@@ -0,0 +1,66 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_VNODE_OD_H_
+#define CANOPEN_VNODE_OD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen/types.h"
+#include "canopen/eds.h"
+#include "canopen/sdo.h"
+#include "vector.h"
+
+struct ini_file;
+
+#define VNODE_OD_MUX(index, subindex) \
+	(((uint32_t)(index) << 8) | (uint32_t)(subindex))
+
+struct vnode_od_entry {
+	uint32_t mux;
+	enum canopen_type type;
+	enum eds_obj_access access;
+	struct vector value;
+};
+
+/* Object dictionary of a virtual node.
+ *
+ * The dictionary is compiled from the node's configuration when it is loaded.
+ * Values are kept encoded as they are sent on the bus and the entries are
+ * sorted by multiplexer, so serving an SDO is a binary search and a copy.
+ */
+struct vnode_od {
+	struct vnode_od_entry* entries;
+	size_t length;
+};
+
+/* The configuration is either a vnode configuration, where objects are
+ * sections named [<index>sub<subindex>] with type, value and optionally access
+ * keys, or an EDS, in which case objects get their default values. "$NODEID"
+ * in values is replaced by the node id. Objects are read-only unless stated
+ * otherwise.
+ */
+int vnode_od_load(struct vnode_od* self, const struct ini_file* ini,
+		  int nodeid);
+void vnode_od_destroy(struct vnode_od* self);
+
+struct vnode_od_entry* vnode_od_find(const struct vnode_od* self, int index,
+				     int subindex);
+
+/* Returns 0 on success or the abort code to reply with */
+enum sdo_abort_code vnode_od_write(struct vnode_od_entry* entry,
+				   const void* data, size_t size);
+
+#endif /* CANOPEN_VNODE_OD_H_ */
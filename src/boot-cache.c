@@ -0,0 +1,238 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "canopen/boot-cache.h"
+#include "plog.h"
+
+/* Nodes are booted from worker threads, so everything is done under the lock.
+ * Writes are rare enough that the whole file is rewritten each time.
+ */
+
+struct boot_cache_file {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t n_entries;
+	struct boot_cache_entry entries[BOOT_CACHE_NODES];
+};
+
+static pthread_mutex_t boot_cache__mutex = PTHREAD_MUTEX_INITIALIZER;
+static char boot_cache__path[256];
+static int boot_cache__is_enabled = 0;
+static struct boot_cache_file boot_cache__file;
+static struct boot_cache_stats boot_cache__stats;
+
+static int boot_cache__is_nodeid_valid(int nodeid)
+{
+	return 1 <= nodeid && nodeid < BOOT_CACHE_NODES;
+}
+
+static void boot_cache__reset(void)
+{
+	memset(&boot_cache__file, 0, sizeof(boot_cache__file));
+	boot_cache__file.magic = BOOT_CACHE_MAGIC;
+	boot_cache__file.version = BOOT_CACHE_VERSION;
+	boot_cache__file.entry_size = sizeof(struct boot_cache_entry);
+	boot_cache__file.n_entries = BOOT_CACHE_NODES;
+}
+
+static int boot_cache__is_file_valid(const struct boot_cache_file* file)
+{
+	return file->magic == BOOT_CACHE_MAGIC
+	    && file->version == BOOT_CACHE_VERSION
+	    && file->entry_size == sizeof(struct boot_cache_entry)
+	    && file->n_entries == BOOT_CACHE_NODES;
+}
+
+static void boot_cache__load(void)
+{
+	FILE* input = fopen(boot_cache__path, "rb");
+	if (!input) {
+		if (errno != ENOENT)
+			plog(LOG_WARNING, "boot_cache: Could not open \"%s\": %m",
+			     boot_cache__path);
+		return;
+	}
+
+	size_t size = fread(&boot_cache__file, 1, sizeof(boot_cache__file),
+			    input);
+	fclose(input);
+
+	if (size == sizeof(boot_cache__file)
+	 && boot_cache__is_file_valid(&boot_cache__file))
+		return;
+
+	plog(LOG_WARNING, "boot_cache: Ignoring \"%s\"; it was not written by this version",
+	     boot_cache__path);
+	boot_cache__reset();
+}
+
+/* A new file is renamed into place so that the old one stays intact if the
+ * master dies while writing.
+ */
+static int boot_cache__save(void)
+{
+	char tmp_path[sizeof(boot_cache__path) + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", boot_cache__path);
+
+	FILE* output = fopen(tmp_path, "wb");
+	if (!output)
+		goto failure;
+
+	size_t size = fwrite(&boot_cache__file, 1, sizeof(boot_cache__file),
+			     output);
+
+	if (fclose(output) != 0 || size != sizeof(boot_cache__file))
+		goto write_failure;
+
+	if (rename(tmp_path, boot_cache__path) < 0)
+		goto write_failure;
+
+	return 0;
+
+write_failure:
+	unlink(tmp_path);
+failure:
+	boot_cache__stats.n_write_errors++;
+	plog(LOG_WARNING, "boot_cache: Could not write \"%s\": %m",
+	     boot_cache__path);
+	return -1;
+}
+
+int boot_cache_init(const char* path)
+{
+	if (strlen(path) >= sizeof(boot_cache__path))
+		return -1;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	strcpy(boot_cache__path, path);
+	memset(&boot_cache__stats, 0, sizeof(boot_cache__stats));
+	boot_cache__reset();
+	boot_cache__load();
+	boot_cache__is_enabled = 1;
+
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return 0;
+}
+
+void boot_cache_cleanup(void)
+{
+	pthread_mutex_lock(&boot_cache__mutex);
+	boot_cache__is_enabled = 0;
+	pthread_mutex_unlock(&boot_cache__mutex);
+}
+
+int boot_cache_is_enabled(void)
+{
+	pthread_mutex_lock(&boot_cache__mutex);
+	int is_enabled = boot_cache__is_enabled;
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return is_enabled;
+}
+
+int boot_cache_get(int nodeid, struct boot_cache_entry* entry)
+{
+	int rc = -1;
+
+	if (!boot_cache__is_nodeid_valid(nodeid))
+		return -1;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	if (!boot_cache__is_enabled)
+		goto done;
+
+	const struct boot_cache_entry* src = &boot_cache__file.entries[nodeid];
+	if (!src->is_valid) {
+		boot_cache__stats.n_misses++;
+		goto done;
+	}
+
+	*entry = *src;
+	boot_cache__stats.n_hits++;
+	rc = 0;
+
+done:
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return rc;
+}
+
+int boot_cache_put(int nodeid, const struct boot_cache_entry* entry)
+{
+	int rc = -1;
+
+	if (!boot_cache__is_nodeid_valid(nodeid))
+		return -1;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	if (!boot_cache__is_enabled)
+		goto done;
+
+	struct boot_cache_entry* dst = &boot_cache__file.entries[nodeid];
+
+	*dst = *entry;
+	dst->is_valid = 1;
+
+	rc = boot_cache__save();
+
+done:
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return rc;
+}
+
+void boot_cache_invalidate(int nodeid)
+{
+	if (!boot_cache__is_nodeid_valid(nodeid))
+		return;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	struct boot_cache_entry* entry = &boot_cache__file.entries[nodeid];
+
+	if (boot_cache__is_enabled && entry->is_valid) {
+		entry->is_valid = 0;
+		boot_cache__stats.n_invalidated++;
+		boot_cache__save();
+	}
+
+	pthread_mutex_unlock(&boot_cache__mutex);
+}
+
+void boot_cache_get_stats(struct boot_cache_stats* stats)
+{
+	pthread_mutex_lock(&boot_cache__mutex);
+	*stats = boot_cache__stats;
+	pthread_mutex_unlock(&boot_cache__mutex);
+}
+
+void boot_cache_print_stats(FILE* out)
+{
+	struct boot_cache_stats stats;
+	boot_cache_get_stats(&stats);
+
+	fprintf(out, "{\n \"enabled\": %s,\n \"hits\": %lu,\n \"misses\": %lu,\n"
+		" \"invalidated\": %lu,\n \"write_errors\": %lu\n}\n",
+		boot_cache_is_enabled() ? "true" : "false",
+		stats.n_hits, stats.n_misses, stats.n_invalidated,
+		stats.n_write_errors);
+}
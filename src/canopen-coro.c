@@ -0,0 +1,159 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "canopen-coro.h"
+
+#pragma GCC visibility push(default)
+
+static void co_coro__release(struct co_coro* self)
+{
+	if (!self->req_)
+		return;
+
+	co_sdo_req_unref(self->req_);
+	self->req_ = NULL;
+}
+
+static int co_coro__run(struct co_coro* self)
+{
+	int result = self->fn_(self);
+
+	/* Someone else may own the coroutine by now, so don't touch it */
+	if (result == CO_CORO_SUSPENDED)
+		return result;
+
+	co_coro__release(self);
+
+	/* This may free the coroutine */
+	if (self->done_fn_)
+		self->done_fn_(self, result);
+
+	return result;
+}
+
+static void co_coro__on_sdo_done(struct co_drv* drv, struct co_sdo_req* req)
+{
+	(void)drv;
+
+	struct co_coro* self = co_sdo_req_get_context(req);
+
+	self->status_ = co_sdo_req_get_status(req);
+	co_coro__run(self);
+}
+
+static int co_coro__start_sdo(struct co_coro* self, enum co_sdo_type type,
+			      int index, int subindex, const void* data,
+			      size_t size)
+{
+	co_coro__release(self);
+
+	struct co_sdo_req* req = co_sdo_req_new(self->drv_);
+	if (!req)
+		goto failure;
+
+	co_sdo_req_set_type(req, type);
+	co_sdo_req_set_indices(req, index, subindex);
+	co_sdo_req_set_done_fn(req, co_coro__on_sdo_done);
+	co_sdo_req_set_context(req, self, NULL);
+
+	if (type == CO_SDO_DOWNLOAD)
+		co_sdo_req_set_data(req, data, size);
+
+	self->req_ = req;
+	self->status_ = CO_SDO_REQ_PENDING;
+
+	if (co_sdo_req_start(req) < 0) {
+		co_coro__release(self);
+		goto failure;
+	}
+
+	return 0;
+
+failure:
+	self->status_ = CO_SDO_REQ_NOMEM;
+	return -1;
+}
+
+void co_coro_init(struct co_coro* self, struct co_drv* drv, co_coro_fn fn,
+		  void* context)
+{
+	self->line_ = 0;
+	self->fn_ = fn;
+	self->done_fn_ = NULL;
+	self->drv_ = drv;
+	self->context_ = context;
+	self->req_ = NULL;
+	self->status_ = CO_SDO_REQ_PENDING;
+}
+
+void co_coro_set_done_fn(struct co_coro* self, co_coro_done_fn fn)
+{
+	self->done_fn_ = fn;
+}
+
+int co_coro_start(struct co_coro* self)
+{
+	return co_coro__run(self);
+}
+
+void co_coro_cancel(struct co_coro* self)
+{
+	if (self->req_)
+		co_sdo_req_set_done_fn(self->req_, NULL);
+
+	co_coro__release(self);
+	self->line_ = -1;
+}
+
+struct co_drv* co_coro_get_driver(const struct co_coro* self)
+{
+	return self->drv_;
+}
+
+void* co_coro_get_context(const struct co_coro* self)
+{
+	return self->context_;
+}
+
+enum co_sdo_status co_coro_get_status(const struct co_coro* self)
+{
+	return self->status_;
+}
+
+const void* co_coro_get_data(const struct co_coro* self)
+{
+	return self->req_ ? co_sdo_req_get_data(self->req_) : NULL;
+}
+
+size_t co_coro_get_size(const struct co_coro* self)
+{
+	return self->req_ ? co_sdo_req_get_size(self->req_) : 0;
+}
+
+int co_coro_sdo_read(struct co_coro* self, int index, int subindex)
+{
+	return co_coro__start_sdo(self, CO_SDO_UPLOAD, index, subindex, NULL,
+				  0);
+}
+
+int co_coro_sdo_write(struct co_coro* self, int index, int subindex,
+		      const void* data, size_t size)
+{
+	return co_coro__start_sdo(self, CO_SDO_DOWNLOAD, index, subindex, data,
+				  size);
+}
+
+#pragma GCC visibility pop
@@ -27,6 +27,8 @@ const char usage_[] =
 "Options:\n"
 "    -h, --help                 Get help.\n"
 "    -T, --tcp                  Connect via TCP.\n"
+"    -r, --ring                 Read the frame ring of the master that runs\n"
+"                               on the interface.\n"
 "    -n, --nmt                  Show NMT.\n"
 "    -S, --sync                 Show SYNC.\n"
 "    -e, --emcy                 Show EMCY.\n"
@@ -37,6 +39,7 @@ const char usage_[] =
 "Examples:\n"
 "    $ canopen-dump can0\n"
 "    $ canopen-dump -T 127.0.0.1\n"
+"    $ canopen-dump -r can0\n"
 "\n";
 
 static inline int print_usage(FILE* output, int status)
@@ -57,6 +60,7 @@ int main(int argc, char* argv[])
 	static const struct option long_options[] = {
 		{ "help",      no_argument,       0, 'h' },
 		{ "tcp",       no_argument,       0, 'T' },
+		{ "ring",      no_argument,       0, 'r' },
 		{ "nmt",       no_argument,       0, 'n' },
 		{ "sync",      no_argument,       0, 'S' },
 		{ "emcy",      no_argument,       0, 'e' },
@@ -69,13 +73,14 @@ int main(int argc, char* argv[])
 	enum co_dump_options opt = 0;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "hTnSepsiH", long_options, NULL);
+		int c = getopt_long(argc, argv, "hTrnSepsiH", long_options, NULL);
 		if (c < 0)
 			break;
 
 		switch (c) {
 		case 'h': return print_usage(stdout, 0);
 		case 'T': opt |= CO_DUMP_TCP; break;
+		case 'r': opt |= CO_DUMP_RING; break;
 		case 'n': opt |= CO_DUMP_FILTER_NMT; break;
 		case 'S': opt |= CO_DUMP_FILTER_SYNC; break;
 		case 'e': opt |= CO_DUMP_FILTER_EMCY; break;
@@ -27,7 +27,7 @@ const char usage_[] =
 "Options:\n"
 "    -h, --help                 Get help.\n"
 "    -T, --tcp                  Connect via TCP.\n"
-"    -c, --config               Set path to config file.\n"
+"    -c, --config               Set path to config file or EDS.\n"
 "\n"
 "Examples:\n"
 "    $ canopen-vnode can0\n"
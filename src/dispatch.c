@@ -0,0 +1,43 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* COB-ID dispatch table
+ *
+ * Received frames are routed by COB-ID through a table that is filled in when
+ * the master starts and updated when drivers are loaded and unloaded, so that
+ * a frame is handed to its handler with one indexed load and an indirect call
+ * instead of being classified anew every time.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "canopen/dispatch.h"
+
+struct co_dispatch_route co_dispatch_table_[CO_DISPATCH_SIZE];
+
+void co_dispatch_set(unsigned int cobid, co_dispatch_fn fn, void* context)
+{
+	assert(cobid < CO_DISPATCH_SIZE);
+
+	struct co_dispatch_route* route = &co_dispatch_table_[cobid];
+	route->fn = fn;
+	route->context = fn ? context : NULL;
+}
+
+void co_dispatch_clear(void)
+{
+	memset(co_dispatch_table_, 0, sizeof(co_dispatch_table_));
+}
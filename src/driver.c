@@ -14,12 +14,21 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <dlfcn.h>
 #include <unistd.h>
+#include <mloop.h>
 #include "socketcan.h"
 #include "canopen/master.h"
 #include "canopen/sdo_req.h"
+#include "canopen/sdo-poll.h"
+#include "canopen/pdo-map.h"
+#include "canopen/process-image.h"
+#include "canopen/sync-cycle.h"
+#include "canopen/rpdo-stage.h"
+#include "canopen/tpdo-filter.h"
+#include "canopen/pdo-stats.h"
 #include "canopen/emcy.h"
 #include "canopen-driver.h"
 #include "string-utils.h"
@@ -36,6 +45,35 @@ struct co_sdo_req {
 	co_sdo_done_fn on_done;
 };
 
+struct co_timer {
+	LIST_ENTRY(co_timer) links;
+	LIST_ENTRY(co_timer) sync_links;
+	struct co_drv* drv;
+	struct mloop_timer* timer;
+	enum co_timer_type type;
+	co_timer_fn fn;
+	void* context;
+	co_free_fn free_fn;
+	unsigned long period;
+	unsigned long sync_count;
+	int is_started;
+	int is_freed;
+};
+
+/* Poll registrations of a driver are released when it is unloaded */
+struct co_sdo_poll {
+	LIST_ENTRY(co_sdo_poll) links;
+	int handle;
+};
+
+static LIST_HEAD(, co_timer) co__sync_timers =
+	LIST_HEAD_INITIALIZER(co__sync_timers);
+
+/* Timers that are freed while SYNC timers are being processed are unlinked
+ * afterwards. Their memory is held by the event loop until then.
+ */
+static int co__is_processing_sync = 0;
+
 const char* co__drv_find_dso(const char* name)
 {
 	static __thread char result[256];
@@ -81,11 +119,124 @@ int co_drv_init(struct co_drv* drv)
 	return drv->init_fn(drv);
 }
 
+/* Stop the timer and free its context, but leave it to the caller to unlink it
+ * from its driver and drop the event loop's reference.
+ */
+static void co__timer_retire(struct co_timer* self)
+{
+	if (self->is_started)
+		co_timer_stop(self);
+
+	self->is_freed = 1;
+
+	/* The free function may live in the driver, so it must be called before
+	 * the driver is unloaded rather than when the event loop frees the timer.
+	 */
+	if (self->context && self->free_fn)
+		self->free_fn(self->context);
+
+	if (self->type == CO_TIMER_SYNC && !co__is_processing_sync)
+		LIST_REMOVE(self, sync_links);
+}
+
+static void co__timer_release(struct co_timer* self)
+{
+	LIST_REMOVE(self, links);
+	co__timer_retire(self);
+	mloop_timer_unref(self->timer);
+}
+
+void co_drv_process_sync(void)
+{
+	struct co_timer* timer;
+
+	rpdo_stage_process_sync();
+
+	co__is_processing_sync = 1;
+
+	LIST_FOREACH(timer, &co__sync_timers, sync_links) {
+		if (!timer->is_started || timer->is_freed)
+			continue;
+
+		if (++timer->sync_count < timer->period)
+			continue;
+
+		timer->sync_count = 0;
+		timer->fn(timer->drv, timer);
+	}
+
+	co__is_processing_sync = 0;
+
+	struct co_timer* next;
+	for (timer = LIST_FIRST(&co__sync_timers); timer; timer = next) {
+		next = LIST_NEXT(timer, sync_links);
+		if (timer->is_freed)
+			LIST_REMOVE(timer, sync_links);
+	}
+}
+
+void co_drv_process_tpdo(struct co_drv* drv, int pdo, const void* data,
+			 size_t size)
+{
+	int nodeid = co_get_nodeid(drv);
+	int is_passed = tpdo_filter_pass(nodeid, pdo, data, size);
+
+	co_pdo_fn fn = NULL;
+	switch (pdo) {
+	case 1: fn = drv->pdo1_fn; break;
+	case 2: fn = drv->pdo2_fn; break;
+	case 3: fn = drv->pdo3_fn; break;
+	case 4: fn = drv->pdo4_fn; break;
+	default: abort();
+	}
+
+	if (fn && is_passed)
+		fn(drv, data, size);
+
+	/* The process image still gets every PDO */
+	const struct pdo_map* map = drv->tpdo_map[pdo - 1];
+	struct co_pdo_signal signals[PDO_MAP_ENTRIES_MAX];
+	int n_signals = map ? pdo_map_decode(map, signals, data, size) : -1;
+
+	process_image_set_tpdo(nodeid, pdo, data, size, signals,
+			       n_signals > 0 ? n_signals : 0);
+
+	if (n_signals >= 0 && drv->tpdo_signal_fn && is_passed)
+		drv->tpdo_signal_fn(drv, pdo, signals, n_signals);
+}
+
 void co_drv_unload(struct co_drv* drv)
 {
+	struct co_timer* timer;
+
+	/* The driver may free its timers from its own free function, so they
+	 * are only retired here and released once that has been called.
+	 */
+	LIST_FOREACH(timer, &drv->timers, links)
+		co__timer_retire(timer);
+
+	while (!LIST_EMPTY(&drv->sdo_polls))
+		co_sdo_poll_stop(drv, LIST_FIRST(&drv->sdo_polls)->handle);
+
+	/* The filter may refer to the maps */
+	tpdo_filter_reset(co_get_nodeid(drv));
+
+	for (int i = 0; i < CO_DRV_PDO_COUNT; ++i) {
+		pdo_stats_set_expected_period(co_get_nodeid(drv), i + 1, 0);
+		rpdo_stage_free(drv->rpdo_stage[i]);
+		free(drv->tpdo_map[i]);
+		free(drv->rpdo_map[i]);
+	}
+
 	if (drv->context && drv->free_fn)
 		drv->free_fn(drv->context);
 
+	while (!LIST_EMPTY(&drv->timers)) {
+		timer = LIST_FIRST(&drv->timers);
+		LIST_REMOVE(timer, links);
+		mloop_timer_unref(timer->timer);
+	}
+
 	dlclose(drv->dso);
 
 	memset(drv, 0, sizeof(*drv));
@@ -154,24 +305,229 @@ void co_set_pdo4_fn(struct co_drv* self, co_pdo_fn fn)
 	self->pdo4_fn = fn;
 }
 
+static struct rpdo_stage* co__get_rpdo_stage(struct co_drv* self, int pdo)
+{
+	if (pdo < 1 || pdo > CO_DRV_PDO_COUNT)
+		return NULL;
+
+	struct rpdo_stage** stage = &self->rpdo_stage[pdo - 1];
+	if (*stage)
+		return *stage;
+
+	/* The stage compares mapped objects against its deadband */
+	co__load_pdo_maps(self);
+
+	*stage = rpdo_stage_new(co_get_nodeid(self), pdo,
+				self->rpdo_map[pdo - 1]);
+
+	return *stage;
+}
+
+static int co__rpdo(struct co_drv* self, int pdo, const void* data,
+		    size_t size)
+{
+	static const int types[CO_DRV_PDO_COUNT] = {
+		R_RPDO1, R_RPDO2, R_RPDO3, R_RPDO4
+	};
+
+	struct rpdo_stage* stage = self->rpdo_stage[pdo - 1];
+	if (stage)
+		return rpdo_stage_write(stage, data, size);
+
+	return co__rpdox(co_get_nodeid(self), types[pdo - 1], data, size);
+}
+
 int co_rpdo1(struct co_drv* self, const void* data, size_t size)
 {
-	return co__rpdox(co_get_nodeid(self), R_RPDO1, data, size);
+	return co__rpdo(self, 1, data, size);
 }
 
 int co_rpdo2(struct co_drv* self, const void* data, size_t size)
 {
-	return co__rpdox(co_get_nodeid(self), R_RPDO2, data, size);
+	return co__rpdo(self, 2, data, size);
 }
 
 int co_rpdo3(struct co_drv* self, const void* data, size_t size)
 {
-	return co__rpdox(co_get_nodeid(self), R_RPDO3, data, size);
+	return co__rpdo(self, 3, data, size);
 }
 
 int co_rpdo4(struct co_drv* self, const void* data, size_t size)
 {
-	return co__rpdox(co_get_nodeid(self), R_RPDO4, data, size);
+	return co__rpdo(self, 4, data, size);
+}
+
+int co_rpdo_set_mode(struct co_drv* self, int pdo, enum co_rpdo_mode mode)
+{
+	struct rpdo_stage* stage = co__get_rpdo_stage(self, pdo);
+	if (!stage)
+		return -1;
+
+	rpdo_stage_set_mode(stage, mode);
+	return 0;
+}
+
+int co_rpdo_set_inhibit_time(struct co_drv* self, int pdo, unsigned long time)
+{
+	struct rpdo_stage* stage = co__get_rpdo_stage(self, pdo);
+	if (!stage)
+		return -1;
+
+	rpdo_stage_set_inhibit_time(stage, time);
+	return 0;
+}
+
+int co_rpdo_set_deadband(struct co_drv* self, int pdo, double deadband)
+{
+	struct rpdo_stage* stage = co__get_rpdo_stage(self, pdo);
+	if (!stage)
+		return -1;
+
+	rpdo_stage_set_deadband(stage, deadband);
+	return 0;
+}
+
+int co_rpdo_flush(struct co_drv* self, int pdo)
+{
+	if (pdo < 1 || pdo > CO_DRV_PDO_COUNT)
+		return -1;
+
+	struct rpdo_stage* stage = self->rpdo_stage[pdo - 1];
+	return stage ? rpdo_stage_flush(stage) : 0;
+}
+
+void co_set_cycle_fn(struct co_drv* self, co_cycle_fn fn)
+{
+	self->cycle_fn = fn;
+}
+
+int co_rpdo_queue(struct co_drv* self, int pdo, const void* data, size_t size)
+{
+	if (sync_cycle_is_running())
+		return sync_cycle_queue_rpdo(co_get_nodeid(self), pdo, data,
+					     size);
+
+	switch (pdo) {
+	case 1: return co_rpdo1(self, data, size);
+	case 2: return co_rpdo2(self, data, size);
+	case 3: return co_rpdo3(self, data, size);
+	case 4: return co_rpdo4(self, data, size);
+	}
+
+	return -1;
+}
+
+unsigned int co_cycle_get_counter(const struct co_cycle* cycle)
+{
+	return cycle->counter;
+}
+
+uint64_t co_cycle_get_time(const struct co_cycle* cycle)
+{
+	return cycle->time;
+}
+
+ssize_t co_cycle_get_tpdo(const struct co_cycle* cycle, int nodeid, int pdo,
+			  void* dst, size_t size)
+{
+	if (nodeid < 1 || nodeid >= SYNC_CYCLE_NODES)
+		return -1;
+
+	if (pdo < 1 || pdo > SYNC_CYCLE_PDOS)
+		return -1;
+
+	if (!(cycle->is_received[nodeid] & (1 << (pdo - 1))))
+		return -1;
+
+	size_t tpdo_size = cycle->tpdos[nodeid][pdo - 1].size;
+	memcpy(dst, cycle->tpdos[nodeid][pdo - 1].data,
+	       size < tpdo_size ? size : tpdo_size);
+
+	return tpdo_size;
+}
+
+static struct pdo_map* co__get_pdo_map(struct co_drv* self,
+				       struct pdo_map** maps, int pdo)
+{
+	if (pdo < 1 || pdo > CO_DRV_PDO_COUNT)
+		return NULL;
+
+	co__load_pdo_maps(self);
+
+	return maps[pdo - 1];
+}
+
+void co_set_tpdo_signal_fn(struct co_drv* self, co_pdo_signal_fn fn)
+{
+	co__load_pdo_maps(self);
+
+	self->tpdo_signal_fn = fn;
+}
+
+int co_tpdo_bind(struct co_drv* self, int pdo, int index, int subindex,
+		 void* dst, size_t size)
+{
+	struct pdo_map* map = co__get_pdo_map(self, self->tpdo_map, pdo);
+	if (!map)
+		return -1;
+
+	return pdo_map_bind(map, index, subindex, dst, size);
+}
+
+int co_rpdo_bind(struct co_drv* self, int pdo, int index, int subindex,
+		 const void* src, size_t size)
+{
+	struct pdo_map* map = co__get_pdo_map(self, self->rpdo_map, pdo);
+	if (!map)
+		return -1;
+
+	/* RPDO bindings are only read from */
+	return pdo_map_bind(map, index, subindex, (void*)src, size);
+}
+
+int co_tpdo_set_filter(struct co_drv* self, int pdo, int is_enabled)
+{
+	return tpdo_filter_set_enabled(co_get_nodeid(self), pdo, is_enabled);
+}
+
+int co_tpdo_set_deadband(struct co_drv* self, int pdo, double deadband)
+{
+	return tpdo_filter_set_deadband(co_get_nodeid(self), pdo,
+					co__get_pdo_map(self, self->tpdo_map, pdo),
+					deadband);
+}
+
+int co_tpdo_set_period(struct co_drv* self, int pdo, uint64_t period)
+{
+	return pdo_stats_set_expected_period(co_get_nodeid(self), pdo, period);
+}
+
+static int co__rpdo_send(struct co_drv* self, int pdo,
+			 const struct co_pdo_signal* signals)
+{
+	const struct pdo_map* map = co__get_pdo_map(self, self->rpdo_map, pdo);
+	if (!map)
+		return -1;
+
+	unsigned char data[sizeof(uint64_t)];
+	size_t size = pdo_map_encode(map, data, signals);
+
+	return co__rpdo(self, pdo, data, size);
+}
+
+int co_rpdo_send(struct co_drv* self, int pdo)
+{
+	return co__rpdo_send(self, pdo, NULL);
+}
+
+int co_rpdo_send_signals(struct co_drv* self, int pdo,
+			 const struct co_pdo_signal* signals, size_t n_signals)
+{
+	const struct pdo_map* map = co__get_pdo_map(self, self->rpdo_map, pdo);
+	if (!map || !signals || n_signals != map->n_entries)
+		return -1;
+
+	return co__rpdo_send(self, pdo, signals);
 }
 
 void co_set_emcy_fn(struct co_drv* self, co_emcy_fn fn)
@@ -215,6 +571,8 @@ struct co_sdo_req* co_sdo_req_new(struct co_drv* drv)
 
 	req->ref = 1;
 	req->on_done = co__sdo_req_on_done;
+	req->prio = SDO_REQ_PRIO_HIGH;
+	TAILQ_INIT(&req->followers);
 	self->drv = drv;
 
 	return self;
@@ -242,14 +600,43 @@ void co_sdo_req_set_type(struct co_sdo_req* self, enum co_sdo_type type)
 
 void co_sdo_req_set_data(struct co_sdo_req* self, const void* data, size_t size)
 {
+	/* An upload buffer set earlier belongs to the driver */
+	if (self->req.is_data_borrowed) {
+		memset(&self->req.data, 0, sizeof(self->req.data));
+		self->req.is_data_borrowed = 0;
+	}
+
 	vector_assign(&self->req.data, data, size);
 }
 
+void co_sdo_req_set_upload_buffer(struct co_sdo_req* self, void* buffer,
+				  size_t size)
+{
+	sdo_req_set_ul_buffer(&self->req, buffer, size);
+}
+
 void co_sdo_req_set_done_fn(struct co_sdo_req* self, co_sdo_done_fn fn)
 {
 	self->on_done = fn;
 }
 
+void co_sdo_req_set_priority(struct co_sdo_req* self, enum co_sdo_prio prio)
+{
+	switch (prio) {
+	case CO_SDO_PRIO_NORMAL:
+		self->req.prio = SDO_REQ_PRIO_NORMAL;
+		break;
+	case CO_SDO_PRIO_HIGH:
+		self->req.prio = SDO_REQ_PRIO_HIGH;
+		break;
+	case CO_SDO_PRIO_LOW:
+		self->req.prio = SDO_REQ_PRIO_LOW;
+		break;
+	default:
+		abort();
+	}
+}
+
 void co_sdo_req_set_context(struct co_sdo_req* self, void* context,
 			    co_free_fn free_fn)
 {
@@ -297,12 +684,169 @@ enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self)
 	case SDO_REQ_REMOTE_ABORT: return CO_SDO_REQ_REMOTE_ABORT;
 	case SDO_REQ_CANCELLED: return CO_SDO_REQ_CANCELLED;
 	case SDO_REQ_NOMEM: return CO_SDO_REQ_NOMEM;
+	case SDO_REQ_NODE_DOWN: return CO_SDO_REQ_NODE_DOWN;
 	}
 
 	abort();
 	return -1;
 }
 
+int co_sdo_poll_start(struct co_drv* self, int index, int subindex,
+		      unsigned long period)
+{
+	struct sdo_poll_info info = {
+		.nodeid = co_get_nodeid(self),
+		.index = index,
+		.subindex = subindex,
+		.period = period
+	};
+
+	struct co_sdo_poll* poll = malloc(sizeof(*poll));
+	if (!poll)
+		return -1;
+
+	poll->handle = sdo_poll_register(&info);
+	if (poll->handle < 0) {
+		free(poll);
+		return -1;
+	}
+
+	LIST_INSERT_HEAD(&self->sdo_polls, poll, links);
+	return poll->handle;
+}
+
+/* Handles that the driver does not own are ignored, e.g. when it stops its
+ * polls after they have been released by co_drv_unload().
+ */
+void co_sdo_poll_stop(struct co_drv* self, int handle)
+{
+	struct co_sdo_poll* poll;
+
+	LIST_FOREACH(poll, &self->sdo_polls, links)
+		if (poll->handle == handle)
+			break;
+
+	if (!poll)
+		return;
+
+	LIST_REMOVE(poll, links);
+	sdo_poll_unregister(handle);
+	free(poll);
+}
+
+ssize_t co_sdo_poll_read(const struct co_drv* self, int index, int subindex,
+			 void* dst, size_t size)
+{
+	struct sdo_poll_value value;
+
+	if (sdo_poll_read(co_get_nodeid(self), index, subindex, &value) < 0)
+		return -1;
+
+	if (value.timestamp == 0 || value.size > size)
+		return -1;
+
+	memcpy(dst, value.data, value.size);
+	return value.size;
+}
+
+static void co__timer_on_timeout(struct mloop_timer* timer)
+{
+	struct co_timer* self = mloop_timer_get_context(timer);
+
+	/* The mloop timer is always periodic so that a one-shot timer can be
+	 * restarted from its callback.
+	 */
+	if (self->type == CO_TIMER_ONESHOT)
+		co_timer_stop(self);
+
+	self->fn(self->drv, self);
+}
+
+struct co_timer* co_timer_new(struct co_drv* drv, enum co_timer_type type,
+			      co_timer_fn fn)
+{
+	struct co_timer* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->drv = drv;
+	self->type = type;
+	self->fn = fn;
+
+	self->timer = mloop_timer_new(mloop_default());
+	if (!self->timer)
+		goto timer_failure;
+
+	mloop_timer_set_type(self->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_context(self->timer, self, free);
+	mloop_timer_set_callback(self->timer, co__timer_on_timeout);
+
+	LIST_INSERT_HEAD(&drv->timers, self, links);
+
+	if (type == CO_TIMER_SYNC)
+		LIST_INSERT_HEAD(&co__sync_timers, self, sync_links);
+
+	return self;
+
+timer_failure:
+	free(self);
+	return NULL;
+}
+
+void co_timer_free(struct co_timer* self)
+{
+	if (self && !self->is_freed)
+		co__timer_release(self);
+}
+
+void co_timer_set_context(struct co_timer* self, void* context,
+			  co_free_fn free_fn)
+{
+	self->context = context;
+	self->free_fn = free_fn;
+}
+
+void* co_timer_get_context(const struct co_timer* self)
+{
+	return self->context;
+}
+
+int co_timer_start(struct co_timer* self, unsigned long period)
+{
+	if (period == 0)
+		return -1;
+
+	if (self->is_started)
+		co_timer_stop(self);
+
+	self->period = period;
+	self->sync_count = 0;
+
+	if (self->type != CO_TIMER_SYNC) {
+		mloop_timer_set_time(self->timer, period * 1000000ULL);
+		if (mloop_timer_start(self->timer) < 0)
+			return -1;
+	}
+
+	self->is_started = 1;
+	return 0;
+}
+
+int co_timer_stop(struct co_timer* self)
+{
+	if (!self->is_started)
+		return -1;
+
+	self->is_started = 0;
+
+	if (self->type == CO_TIMER_SYNC)
+		return 0;
+
+	return mloop_timer_stop(self->timer);
+}
+
 void co_byteorder(void* dst, const void* src, size_t dst_size, size_t src_size)
 {
 	return byteorder2(dst, src, dst_size, src_size);
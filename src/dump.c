@@ -24,6 +24,7 @@
 #include "canopen/heartbeat.h"
 #include "canopen/emcy.h"
 #include "canopen/dump.h"
+#include "canopen/frame-ring.h"
 #include "net-util.h"
 #include "sock.h"
 #include "canopen/sdo-dict.h"
@@ -35,6 +36,8 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#define RING_BATCH_SIZE 64
+
 struct node_state {
 	uint32_t current_mux;
 	struct vector sdo_data;
@@ -93,8 +96,11 @@ static int dump_sync(struct can_frame* cf)
 	if (!(options_ & CO_DUMP_FILTER_SYNC))
 		return 0;
 
-	(void)cf;
-	printf("SYNC TODO\n");
+	if (cf->can_dlc >= 1)
+		printf("SYNC counter=%d\n", cf->data[0]);
+	else
+		printf("SYNC\n");
+
 	return 0;
 }
 
@@ -456,6 +462,40 @@ static void run_dumper(struct sock* sock)
 		multiplex(&cf);
 }
 
+static void run_ring_dumper(struct frame_ring_reader* reader)
+{
+	struct frame_ring_frame frames[RING_BATCH_SIZE];
+
+	while (1) {
+		frame_ring_wait(reader, -1);
+
+		uint64_t n_lost = reader->n_lost;
+		size_t n = frame_ring_read(reader, frames, RING_BATCH_SIZE);
+
+		if (reader->n_lost != n_lost)
+			printf("LOST %llu\n",
+			       (unsigned long long)(reader->n_lost - n_lost));
+
+		for (size_t i = 0; i < n; ++i)
+			multiplex(&frames[i].cf);
+	}
+}
+
+static int dump_ring(const char* iface)
+{
+	struct frame_ring_reader reader;
+
+	if (frame_ring_reader_open(&reader, iface) < 0) {
+		fprintf(stderr, "Could not open frame ring for %s\n", iface);
+		return 1;
+	}
+
+	run_ring_dumper(&reader);
+
+	frame_ring_reader_close(&reader);
+	return 0;
+}
+
 static void resolve_filters(enum co_dump_options options)
 {
 	options_ |= options & ~CO_DUMP_FILTER_MASK;
@@ -473,6 +513,9 @@ int co_dump(const char* addr, enum co_dump_options options)
 
 	resolve_filters(options);
 
+	if (options & CO_DUMP_RING)
+		return dump_ring(addr);
+
 	struct sock sock;
 	enum sock_type type = options & CO_DUMP_TCP ? SOCK_TYPE_TCP
 						    : SOCK_TYPE_CAN;
@@ -0,0 +1,439 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Firmware update
+ *
+ * PUT /firmware/<nodeid>[,<nodeid>...] with the name of an image file in the
+ * firmware directory as content programs the given nodes in parallel as
+ * described in CiA 302-3: the program is stopped via 0x1F51, the image is
+ * streamed from the file to 0x1F50 and the program is started again. The
+ * program number is 1 unless another one is given with ?program=<n>.
+ *
+ * Only plain file names are accepted and updates are refused unless a firmware
+ * directory has been set with firmware_rest_init().
+ *
+ * The reply is sent as soon as the updates have been started. GET /firmware
+ * replies with a JSON document describing the progress of each update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "canopen.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo-file.h"
+#include "canopen/boot-cache.h"
+#include "rest.h"
+#include "firmware-rest.h"
+#include "string-utils.h"
+
+#define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+
+#define FIRMWARE_PROGRAM_DATA 0x1F50
+#define FIRMWARE_PROGRAM_CONTROL 0x1F51
+
+enum firmware_rest_control {
+	FIRMWARE_REST_STOP = 0,
+	FIRMWARE_REST_START = 1,
+};
+
+enum firmware_rest_state {
+	FIRMWARE_REST_IDLE = 0,
+	FIRMWARE_REST_STOPPING,
+	FIRMWARE_REST_DOWNLOADING,
+	FIRMWARE_REST_STARTING,
+	FIRMWARE_REST_DONE,
+	FIRMWARE_REST_FAILED,
+};
+
+static const char* firmware_rest__state_str[] = {
+	[FIRMWARE_REST_IDLE] = "idle",
+	[FIRMWARE_REST_STOPPING] = "stopping",
+	[FIRMWARE_REST_DOWNLOADING] = "downloading",
+	[FIRMWARE_REST_STARTING] = "starting",
+	[FIRMWARE_REST_DONE] = "done",
+	[FIRMWARE_REST_FAILED] = "failed",
+};
+
+struct firmware_rest_job {
+	enum firmware_rest_state state;
+	int nodeid;
+	int program;
+	char path[PATH_MAX];
+	size_t done, total;
+	const char* error;
+};
+
+/* Empty if firmware updates are disabled */
+static char firmware_rest__dir[PATH_MAX];
+
+/* Only accessed from the main loop */
+static struct firmware_rest_job firmware_rest__jobs[CANOPEN_NODEID_MAX + 1];
+
+static void firmware_rest__reply(struct rest_client* client,
+				 const char* status_code,
+				 const char* content_type, const char* message,
+				 size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = content_type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client->output, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void firmware_rest__reply_text(struct rest_client* client,
+				      const char* status_code,
+				      const char* message)
+{
+	firmware_rest__reply(client, status_code, "text/plain", message,
+			     strlen(message));
+}
+
+static inline int firmware_rest__is_busy(const struct firmware_rest_job* job)
+{
+	return job->state != FIRMWARE_REST_IDLE
+	    && job->state != FIRMWARE_REST_DONE
+	    && job->state != FIRMWARE_REST_FAILED;
+}
+
+static void firmware_rest__fail(struct firmware_rest_job* job,
+				const char* error)
+{
+	job->state = FIRMWARE_REST_FAILED;
+	job->error = error;
+}
+
+static void firmware_rest__fail_req(struct firmware_rest_job* job,
+				    const struct sdo_req* req)
+{
+	firmware_rest__fail(job, req->status == SDO_REQ_NODE_DOWN
+				 ? "Node is not responding"
+				 : sdo_strerror(req->abort_code));
+}
+
+static int firmware_rest__start(struct firmware_rest_job* job,
+				struct sdo_req* req)
+{
+	if (!req)
+		return -1;
+
+	int rc = sdo_req_start(req, sdo_req_queue_get(job->nodeid));
+	sdo_req_unref(req);
+	return rc;
+}
+
+static int firmware_rest__control(struct firmware_rest_job* job,
+				  enum firmware_rest_control control,
+				  sdo_req_fn on_done)
+{
+	uint8_t value = control;
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = FIRMWARE_PROGRAM_CONTROL,
+		.subindex = job->program,
+		.dl_data = &value,
+		.dl_size = sizeof(value),
+		.prio = SDO_REQ_PRIO_LOW,
+		.on_done = on_done,
+		.context = job
+	};
+
+	return firmware_rest__start(job, sdo_req_new(&info));
+}
+
+static void firmware_rest__on_started(struct sdo_req* req)
+{
+	struct firmware_rest_job* job = req->context;
+
+	if (req->status != SDO_REQ_OK) {
+		firmware_rest__fail_req(job, req);
+		return;
+	}
+
+	/* The node comes back with new software */
+	boot_cache_invalidate(job->nodeid);
+
+	job->state = FIRMWARE_REST_DONE;
+}
+
+static void firmware_rest__on_downloaded(struct sdo_req* req)
+{
+	struct firmware_rest_job* job = req->context;
+
+	if (req->status != SDO_REQ_OK) {
+		firmware_rest__fail_req(job, req);
+		return;
+	}
+
+	job->done = req->transferred;
+	job->state = FIRMWARE_REST_STARTING;
+
+	if (firmware_rest__control(job, FIRMWARE_REST_START,
+				   firmware_rest__on_started) < 0)
+		firmware_rest__fail(job, "Failed to start sdo request");
+}
+
+static void firmware_rest__on_progress(struct sdo_req* req, size_t done,
+				       size_t total)
+{
+	struct firmware_rest_job* job = req->context;
+
+	job->done = done;
+	job->total = total;
+}
+
+static void firmware_rest__on_stopped(struct sdo_req* req)
+{
+	struct firmware_rest_job* job = req->context;
+
+	if (req->status != SDO_REQ_OK) {
+		firmware_rest__fail_req(job, req);
+		return;
+	}
+
+	struct sdo_req_info info = {
+		.index = FIRMWARE_PROGRAM_DATA,
+		.subindex = job->program,
+		.prio = SDO_REQ_PRIO_LOW,
+		.on_done = firmware_rest__on_downloaded,
+		.on_progress = firmware_rest__on_progress,
+		.context = job
+	};
+
+	struct sdo_req* download = sdo_file_new_download(&info, job->path);
+	if (!download) {
+		firmware_rest__fail(job, "Could not open image");
+		return;
+	}
+
+	job->total = info.dl_size;
+	job->state = FIRMWARE_REST_DOWNLOADING;
+
+	if (firmware_rest__start(job, download) < 0)
+		firmware_rest__fail(job, "Failed to start sdo request");
+}
+
+/* Parse a comma separated list of node ids into a bit mask */
+static int firmware_rest__parse_nodes(uint8_t* mask, const char* list)
+{
+	char buffer[256];
+	char* saveptr = NULL;
+	int n = 0;
+
+	if (strlen(list) >= sizeof(buffer))
+		return -1;
+
+	strcpy(buffer, list);
+
+	for (char* token = strtok_r(buffer, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		char* end = NULL;
+		long nodeid = strtol(token, &end, 10);
+
+		if (*end != '\0' || !is_in_range(nodeid, CANOPEN_NODEID_MIN,
+						  CANOPEN_NODEID_MAX))
+			return -1;
+
+		mask[nodeid / 8] |= 1 << (nodeid % 8);
+		++n;
+	}
+
+	return n > 0 ? 0 : -1;
+}
+
+/* Resolves the name of an image to its path in the firmware directory */
+static int firmware_rest__resolve(char* resolved, const char* name)
+{
+	char path[PATH_MAX];
+
+	if (name[0] == '\0' || strchr(name, '/') || strstr(name, ".."))
+		return -1;
+
+	if ((size_t)snprintf(path, sizeof(path), "%s/%s", firmware_rest__dir,
+			     name) >= sizeof(path))
+		return -1;
+
+	if (!realpath(path, resolved))
+		return -1;
+
+	size_t dir_length = strlen(firmware_rest__dir);
+
+	/* Symbolic links must not lead out of the directory */
+	if (strncmp(resolved, firmware_rest__dir, dir_length) != 0
+	 || resolved[dir_length] != '/')
+		return -1;
+
+	return access(resolved, R_OK);
+}
+
+static inline int firmware_rest__is_set(const uint8_t* mask, int nodeid)
+{
+	return !!(mask[nodeid / 8] & (1 << (nodeid % 8)));
+}
+
+static void firmware_rest__put(struct rest_client* client, const void* content)
+{
+	uint8_t mask[(CANOPEN_NODEID_MAX + 1) / 8] = { 0 };
+	char name[PATH_MAX];
+	char image[PATH_MAX];
+	int program = 1;
+
+	if (firmware_rest__dir[0] == '\0') {
+		firmware_rest__reply_text(client, "403 Forbidden",
+					  "Firmware updates are disabled\r\n");
+		return;
+	}
+
+	if (client->req.url_index != 2
+	 || firmware_rest__parse_nodes(mask, client->req.url[1]) < 0) {
+		firmware_rest__reply_text(client, "404 Not Found",
+			"Wrong URL format. Must be /firmware/<nodeid>[,<nodeid>...]\r\n");
+		return;
+	}
+
+	const char* program_str = http_req_query(&client->req, "program");
+	if (program_str)
+		program = strtoul(program_str, NULL, 10);
+
+	if (!is_in_range(program, 1, 254)) {
+		firmware_rest__reply_text(client, "400 Bad Request",
+					  "Program number is out of range\r\n");
+		return;
+	}
+
+	if (client->req.content_length >= sizeof(name)) {
+		firmware_rest__reply_text(client, "400 Bad Request",
+					  "Name is too long\r\n");
+		return;
+	}
+
+	memcpy(name, content, client->req.content_length);
+	name[client->req.content_length] = '\0';
+
+	if (firmware_rest__resolve(image, string_trim(name)) < 0) {
+		firmware_rest__reply_text(client, "400 Bad Request",
+					  "Could not open image\r\n");
+		return;
+	}
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i)
+		if (firmware_rest__is_set(mask, i)
+		 && firmware_rest__is_busy(&firmware_rest__jobs[i])) {
+			firmware_rest__reply_text(client, "409 Conflict",
+				"An update is already in progress\r\n");
+			return;
+		}
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		if (!firmware_rest__is_set(mask, i))
+			continue;
+
+		struct firmware_rest_job* job = &firmware_rest__jobs[i];
+
+		memset(job, 0, sizeof(*job));
+		job->nodeid = i;
+		job->program = program;
+		strcpy(job->path, image);
+		job->state = FIRMWARE_REST_STOPPING;
+
+		if (firmware_rest__control(job, FIRMWARE_REST_STOP,
+					   firmware_rest__on_stopped) < 0)
+			firmware_rest__fail(job, "Failed to start sdo request");
+	}
+
+	firmware_rest__reply_text(client, "202 Accepted", "");
+}
+
+static void firmware_rest__print_jobs(FILE* out)
+{
+	const char* separator = "";
+
+	fprintf(out, "{");
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		const struct firmware_rest_job* job = &firmware_rest__jobs[i];
+		if (job->state == FIRMWARE_REST_IDLE)
+			continue;
+
+		fprintf(out, "%s\n \"%d\": {\"state\": \"%s\", \"done\": %zu, \"total\": %zu",
+			separator, i, firmware_rest__state_str[job->state],
+			job->done, job->total);
+
+		if (job->error)
+			fprintf(out, ", \"error\": \"%s\"", job->error);
+
+		fprintf(out, "}");
+		separator = ",";
+	}
+
+	fprintf(out, "\n}\n");
+}
+
+static void firmware_rest__get(struct rest_client* client)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		firmware_rest__reply_text(client, "500 Internal Server Error",
+					  "Out of memory\r\n");
+		return;
+	}
+
+	firmware_rest__print_jobs(out);
+	fclose(out);
+
+	firmware_rest__reply(client, "200 OK", "application/json", buffer,
+			     size);
+
+	free(buffer);
+}
+
+int firmware_rest_init(const char* dir)
+{
+	if (!realpath(dir, firmware_rest__dir)) {
+		firmware_rest__dir[0] = '\0';
+		return -1;
+	}
+
+	return 0;
+}
+
+void firmware_rest_service(struct rest_client* client, const void* content)
+{
+	switch (client->req.method) {
+	case HTTP_GET:
+		firmware_rest__get(client);
+		return;
+	case HTTP_PUT:
+		firmware_rest__put(client, content);
+		return;
+	default:
+		break;
+	}
+
+	firmware_rest__reply_text(client, "405 Method Not Allowed", "");
+}
@@ -0,0 +1,280 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+/* Shared memory frame ring
+ *
+ * Frames are sent from the main loop as well as from worker threads, so a
+ * writer first reserves a sequence number by incrementing the head and then
+ * fills in the slot that the number maps to. The slot's own sequence number
+ * tells readers when the frame is complete and whether it has since been
+ * overwritten, so the head only tells them how far to look. A writer that is
+ * held up for a whole lap of the ring stalls readers at its slot until the
+ * slot is reused, after which they skip it.
+ *
+ * Readers keep their cursors to themselves. Nothing that a reader does is
+ * visible to the master, so the cost of having observers is the same whether
+ * there are none or many.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canopen/frame-ring.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+
+static struct frame_ring* frame_ring__ = NULL;
+static size_t frame_ring__size = 0;
+static char frame_ring__name[256];
+
+static void frame_ring__format_name(char* dst, size_t size, const char* iface)
+{
+	snprintf(dst, size, "/canopen2.%s.frames", iface);
+	dst[size - 1] = '\0';
+
+	/* Only the leading slash is allowed */
+	for (char* p = dst + 1; *p; ++p)
+		if (*p == '/')
+			*p = '_';
+}
+
+static size_t frame_ring__round_capacity(size_t capacity)
+{
+	size_t result = FRAME_RING_CAPACITY_MIN;
+
+	while (result < capacity)
+		result <<= 1;
+
+	return result;
+}
+
+static inline size_t frame_ring__size_of(size_t capacity)
+{
+	return sizeof(struct frame_ring)
+	     + capacity * sizeof(struct frame_ring_slot);
+}
+
+int frame_ring_init(const char* iface, size_t capacity)
+{
+	capacity = frame_ring__round_capacity(capacity);
+	size_t size = frame_ring__size_of(capacity);
+
+	frame_ring__format_name(frame_ring__name, sizeof(frame_ring__name),
+				iface);
+
+	/* Stale rings are replaced so that readers never see an old layout */
+	shm_unlink(frame_ring__name);
+
+	int fd = shm_open(frame_ring__name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0)
+		goto failure;
+
+	struct frame_ring* ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				       MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	/* The object is zero filled, so no slot holds a frame yet */
+	ring->version = FRAME_RING_VERSION;
+	ring->capacity = capacity;
+
+	/* Readers check the magic number last */
+	co_atomic_store(&ring->magic, FRAME_RING_MAGIC);
+
+	frame_ring__size = size;
+	co_atomic_store(&frame_ring__, ring);
+	return 0;
+
+failure:
+	close(fd);
+	shm_unlink(frame_ring__name);
+	return -1;
+}
+
+void frame_ring_cleanup(void)
+{
+	struct frame_ring* ring = co_atomic_exchange(&frame_ring__, NULL);
+	if (!ring)
+		return;
+
+	munmap(ring, frame_ring__size);
+	shm_unlink(frame_ring__name);
+}
+
+void frame_ring_write(const struct can_frame* cf, enum frame_ring_flags flags)
+{
+	struct frame_ring* ring = frame_ring__;
+	if (!ring)
+		return;
+
+	uint64_t seq = co_atomic_add_fetch(&ring->head, 1) - 1;
+	struct frame_ring_slot* slot = &ring->slots[seq & (ring->capacity - 1)];
+
+	/* Readers must see the odd number before any part of the new frame */
+	co_atomic_store(&slot->seq, 2 * seq + 1);
+	co_atomic_fence();
+
+	slot->frame.timestamp = gettime_us(CLOCK_REALTIME);
+	slot->frame.flags = flags;
+	slot->frame.cf = *cf;
+
+	co_atomic_fence();
+	co_atomic_store(&slot->seq, 2 * seq + 2);
+}
+
+#pragma GCC visibility push(default)
+
+int frame_ring_reader_open(struct frame_ring_reader* self, const char* iface)
+{
+	char name[256];
+	frame_ring__format_name(name, sizeof(name), iface);
+
+	memset(self, 0, sizeof(*self));
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0
+	 || (size_t)st.st_size < sizeof(struct frame_ring))
+		goto failure;
+
+	size_t size = st.st_size;
+
+	const struct frame_ring* ring = mmap(NULL, size, PROT_READ, MAP_SHARED,
+					     fd, 0);
+	if (ring == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	if (co_atomic_load(&ring->magic) != FRAME_RING_MAGIC
+	 || ring->version != FRAME_RING_VERSION
+	 || ring->capacity < FRAME_RING_CAPACITY_MIN
+	 || (ring->capacity & (ring->capacity - 1)) != 0
+	 || frame_ring__size_of(ring->capacity) != size) {
+		munmap((void*)ring, size);
+		return -1;
+	}
+
+	self->ring = ring;
+	self->size = size;
+	self->cursor = co_atomic_load(&ring->head);
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+void frame_ring_reader_close(struct frame_ring_reader* self)
+{
+	if (self->ring)
+		munmap((void*)self->ring, self->size);
+
+	self->ring = NULL;
+}
+
+static void frame_ring__skip_lost(struct frame_ring_reader* self,
+				  uint64_t head)
+{
+	uint64_t capacity = self->ring->capacity;
+
+	if (head - self->cursor <= capacity)
+		return;
+
+	uint64_t oldest = head - capacity;
+	self->n_lost += oldest - self->cursor;
+	self->cursor = oldest;
+}
+
+size_t frame_ring_read(struct frame_ring_reader* self,
+		       struct frame_ring_frame* frames, size_t max)
+{
+	const struct frame_ring* ring = self->ring;
+	uint64_t mask = ring->capacity - 1;
+	size_t n = 0;
+
+	uint64_t head = co_atomic_load(&ring->head);
+	frame_ring__skip_lost(self, head);
+
+	while (n < max && self->cursor < head) {
+		const struct frame_ring_slot* slot =
+			&ring->slots[self->cursor & mask];
+		uint64_t expected = 2 * self->cursor + 2;
+
+		uint64_t seq = co_atomic_load(&slot->seq);
+
+		/* The writer has not finished with it yet */
+		if (seq < expected)
+			break;
+
+		if (seq == expected) {
+			frames[n] = slot->frame;
+			co_atomic_fence();
+
+			if (co_atomic_load(&slot->seq) == expected) {
+				++self->cursor;
+				++n;
+				continue;
+			}
+		}
+
+		/* The slot has been reused, so the writer is at least a whole
+		 * ring ahead.
+		 */
+		head = co_atomic_load(&ring->head);
+		frame_ring__skip_lost(self, head);
+	}
+
+	return n;
+}
+
+static int frame_ring__is_ready(const struct frame_ring_reader* self)
+{
+	const struct frame_ring* ring = self->ring;
+	const struct frame_ring_slot* slot =
+		&ring->slots[self->cursor & (ring->capacity - 1)];
+
+	return co_atomic_load(&ring->head) != self->cursor
+	    && co_atomic_load(&slot->seq) >= 2 * self->cursor + 2;
+}
+
+int frame_ring_wait(struct frame_ring_reader* self, int timeout)
+{
+	uint64_t t_end = gettime_ms(CLOCK_MONOTONIC) + timeout;
+
+	while (!frame_ring__is_ready(self)) {
+		if (timeout >= 0 && gettime_ms(CLOCK_MONOTONIC) >= t_end)
+			return 0;
+
+		usleep(FRAME_RING_POLL_INTERVAL * 1000);
+	}
+
+	return 1;
+}
+
+#pragma GCC visibility pop
@@ -24,11 +24,19 @@
 
 #include "socketcan.h"
 #include "canopen/master.h"
+#include "canopen/sdo_async.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo-governor.h"
+#include "canopen/sdo-poll.h"
 
 #define SDO_FIFO_MAX_LENGTH 1024
 #define REST_DEFAULT_PORT 9191
 #define HEARTBEAT_PERIOD 10000 /* ms */
 #define HEARTBEAT_TIMEOUT 1000 /* ms */
+#define SDO_CACHE_MAX_AGE 500 /* ms */
+#define BITRATE 250000 /* bit/s */
+#define SDO_POLL_SHARE 10 /* % of the bitrate */
+#define TPDO_KEEPALIVE 1000 /* ms */
 
 #define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
 
@@ -48,6 +56,49 @@ const char usage_[] =
 "    -p, --heartbeat-period    Set heartbeat period (default 10000ms).\n"
 "    -P, --heartbeat-timeout   Set heartbeat timeout (default 1000ms).\n"
 "    -x, --ntimeouts-max       Set maximum number of timeouts (default 0).\n"
+"    -C, --sdo-cache           Serve repeated SDO reads from a cache.\n"
+"    -A, --sdo-cache-max-age   Set maximum age of cached values (default 500ms).\n"
+"    -L, --last-writer-wins    Drop queued SDO writes superseded by newer ones.\n"
+"    -t, --sdo-timeout-min     Set lower bound of SDO timeouts; below the\n"
+"                              upper bound, timeouts adapt to measured\n"
+"                              round-trip times (default 1000ms = fixed).\n"
+"    -M, --sdo-timeout-max     Set upper bound of SDO timeouts (default 1000ms).\n"
+"    -B, --sdo-rate            Limit SDO traffic to <frames/s> or <percent>%\n"
+"                              of the bitrate, optionally followed by\n"
+"                              :<driver>,<boot>,<rest> shares in percent\n"
+"                              (default unlimited, shares 100,50,25).\n"
+"    -b, --bitrate             Set the bitrate of the bus (default 250000).\n"
+"    -F, --sdo-fail-fast       Fail SDOs to a node at once after this many\n"
+"                              consecutive timeouts (default 0 = never).\n"
+"    -Y, --sdo-retries         Retry SDOs aborted for transient reasons up to\n"
+"                              this many times (default 0).\n"
+"    -N, --sdo-channels        Use up to this many SDO channels per node, if\n"
+"                              the node has them (default 1, max 4).\n"
+"    -o, --sdo-poll-rate       Limit cyclic SDO polls to <polls/s>, 0 for no\n"
+"                              limit (default 10% of the bitrate, or no limit\n"
+"                              of their own with -B).\n"
+"    -G, --sdo-gateway-port    Serve ASCII SDO commands on this TCP port\n"
+"                              (default disabled).\n"
+"    -I, --process-image       Publish node status and TPDOs in shared memory.\n"
+"    -K, --frame-ring          Publish all frames in a shared memory ring of\n"
+"                              this many frames (default disabled).\n"
+"    -y, --sync-period         Produce SYNC every <us> and run synchronous\n"
+"                              PDO cycles (default disabled).\n"
+"    -z, --sync-counter        Add a counter to SYNC that overflows at this\n"
+"                              value, 2 to 240 (default none).\n"
+"    -Z, --sync-priority       Run the SYNC producer with this SCHED_FIFO\n"
+"                              priority (default none).\n"
+"    -E, --tpdo-filter         Do not pass unchanged TPDOs on to drivers.\n"
+"    -e, --tpdo-keepalive      Pass unchanged TPDOs on anyway every <ms>\n"
+"                              (default 1000ms, 0 = never).\n"
+"    -D, --boot-cache          Remember nodes in this file and only verify\n"
+"                              their serial numbers when they boot again\n"
+"                              (default disabled).\n"
+"    -X, --manifest            Read the nodes that are expected on the bus\n"
+"                              from this file and finish probing as soon as\n"
+"                              they have all answered.\n"
+"    -U, --firmware-dir        Allow firmware updates with images from this\n"
+"                              directory (default disabled).\n"
 "\n";
 
 #ifndef NO_MAREL_CODE
@@ -111,6 +162,39 @@ static int parse_range(struct co_master_options* opt, char* range)
 	return 0;
 }
 
+/* <rate>[%][:<driver>,<boot>,<rest>] */
+static int parse_sdo_rate(struct co_master_options* opt, unsigned long bitrate,
+			  char* arg)
+{
+	char* end;
+
+	unsigned long rate = strtoul(arg, &end, 0);
+	if (end == arg)
+		return -1;
+
+	if (*end == '%') {
+		if (rate > 100)
+			return -1;
+
+		rate = sdo_governor_rate_from_bitrate(bitrate, rate);
+		++end;
+	}
+
+	opt->sdo_rate = rate;
+
+	if (*end == '\0')
+		return 0;
+
+	if (*end != ':')
+		return -1;
+
+	unsigned int* share = opt->sdo_rate_share;
+	int n = sscanf(end + 1, "%u,%u,%u", &share[SDO_REQ_PRIO_HIGH],
+		       &share[SDO_REQ_PRIO_NORMAL], &share[SDO_REQ_PRIO_LOW]);
+
+	return n == 3 ? 0 : -1;
+}
+
 int main(int argc, char* argv[])
 {
 	int rc = 0;
@@ -132,9 +216,23 @@ int main(int argc, char* argv[])
 		.rest_port = REST_DEFAULT_PORT,
 		.heartbeat_period = HEARTBEAT_PERIOD,
 		.heartbeat_timeout = HEARTBEAT_TIMEOUT,
+		.sdo_cache_max_age = SDO_CACHE_MAX_AGE,
+		.sdo_timeout_min = SDO_ASYNC_TIMEOUT_MIN,
+		.sdo_timeout_max = SDO_ASYNC_TIMEOUT_MAX,
+		.sdo_channels = 1,
+		.tpdo_keepalive = TPDO_KEEPALIVE,
+		.sdo_rate_share = {
+			[SDO_REQ_PRIO_HIGH] = 100,
+			[SDO_REQ_PRIO_NORMAL] = 50,
+			[SDO_REQ_PRIO_LOW] = 25,
+		},
 		.flags = CO_MASTER_OPTION_WITH_QUIRKS
 	};
 
+	char* sdo_rate = NULL;
+	char* sdo_poll_rate = NULL;
+	unsigned long bitrate = BITRATE;
+
 	static const struct option long_options[] = {
 		{ "worker-threads",    required_argument, 0, 'W' },
 		{ "worker-stack-size", required_argument, 0, 's' },
@@ -147,11 +245,33 @@ int main(int argc, char* argv[])
 		{ "heartbeat-period",  required_argument, 0, 'p' },
 		{ "heartbeat-timeout", required_argument, 0, 'P' },
 		{ "ntimeouts-max",     required_argument, 0, 'x' },
+		{ "sdo-cache",         no_argument,       0, 'C' },
+		{ "sdo-cache-max-age", required_argument, 0, 'A' },
+		{ "last-writer-wins",  no_argument,       0, 'L' },
+		{ "sdo-timeout-min",   required_argument, 0, 't' },
+		{ "sdo-timeout-max",   required_argument, 0, 'M' },
+		{ "sdo-rate",          required_argument, 0, 'B' },
+		{ "bitrate",           required_argument, 0, 'b' },
+		{ "sdo-fail-fast",     required_argument, 0, 'F' },
+		{ "sdo-retries",       required_argument, 0, 'Y' },
+		{ "sdo-channels",      required_argument, 0, 'N' },
+		{ "sdo-poll-rate",     required_argument, 0, 'o' },
+		{ "sdo-gateway-port",  required_argument, 0, 'G' },
+		{ "process-image",     no_argument,       0, 'I' },
+		{ "frame-ring",        required_argument, 0, 'K' },
+		{ "sync-period",       required_argument, 0, 'y' },
+		{ "sync-counter",      required_argument, 0, 'z' },
+		{ "sync-priority",     required_argument, 0, 'Z' },
+		{ "tpdo-filter",       no_argument,       0, 'E' },
+		{ "tpdo-keepalive",    required_argument, 0, 'e' },
+		{ "boot-cache",        required_argument, 0, 'D' },
+		{ "manifest",          required_argument, 0, 'X' },
+		{ "firmware-dir",      required_argument, 0, 'U' },
 		{ 0, 0, 0, 0 }
 	};
 
 	while (1) {
-		int c = getopt_long(argc, argv, "W:s:j:S:R:fTn:p:P:x:",
+		int c = getopt_long(argc, argv, "W:s:j:S:R:fTn:p:P:x:CA:Lt:M:B:b:F:Y:N:o:G:IK:y:z:Z:Ee:D:X:U:",
 				    long_options, NULL);
 		if (c < 0)
 			break;
@@ -172,15 +292,65 @@ int main(int argc, char* argv[])
 		case 'R': mopt.rest_port = atoi(optarg); break;
 		case 'f': mopt.flags &= ~CO_MASTER_OPTION_WITH_QUIRKS; break;
 		case 'T': mopt.flags |= CO_MASTER_OPTION_USE_TCP; break;
+		case 'C': mopt.flags |= CO_MASTER_OPTION_SDO_CACHE; break;
+		case 'A': mopt.sdo_cache_max_age = strtoull(optarg, NULL, 0);
+			  break;
 		case 'n': if (parse_range(&mopt, optarg) < 0)
 				  return print_usage(stderr, 1);
 			  break;
+		case 'L': mopt.flags |= CO_MASTER_OPTION_SDO_LAST_WRITER_WINS;
+			  break;
+		case 't': mopt.sdo_timeout_min = strtoul(optarg, NULL, 0);
+			  break;
+		case 'M': mopt.sdo_timeout_max = strtoul(optarg, NULL, 0);
+			  break;
+		case 'B': sdo_rate = optarg; break;
+		case 'b': bitrate = strtoul(optarg, NULL, 0); break;
+		case 'F': mopt.sdo_breaker_threshold = strtoul(optarg, NULL, 0);
+			  break;
+		case 'Y': mopt.sdo_max_retries = strtoul(optarg, NULL, 0);
+			  break;
+		case 'N': mopt.sdo_channels = strtoul(optarg, NULL, 0);
+			  if (!is_in_range(mopt.sdo_channels, 1,
+					   SDO_REQ_CHANNELS_MAX))
+				  return print_usage(stderr, 1);
+			  break;
+		case 'o': sdo_poll_rate = optarg; break;
+		case 'G': mopt.sdo_gateway_port = atoi(optarg); break;
+		case 'I': mopt.flags |= CO_MASTER_OPTION_PROCESS_IMAGE; break;
+		case 'K': mopt.frame_ring_size = strtoul(optarg, NULL, 0);
+			  break;
+		case 'y': mopt.sync_period = strtoul(optarg, NULL, 0); break;
+		case 'z': mopt.sync_counter_overflow = strtoul(optarg, NULL, 0);
+			  if (!is_in_range(mopt.sync_counter_overflow, 2, 240))
+				  return print_usage(stderr, 1);
+			  break;
+		case 'Z': mopt.sync_priority = atoi(optarg); break;
+		case 'E': mopt.flags |= CO_MASTER_OPTION_TPDO_FILTER; break;
+		case 'e': mopt.tpdo_keepalive = strtoul(optarg, NULL, 0);
+			  break;
+		case 'D': mopt.boot_cache = optarg; break;
+		case 'X': mopt.manifest = optarg; break;
+		case 'U': mopt.firmware_dir = optarg; break;
 		case 'h': return print_usage(stdout, 0);
 		case '?': break;
 		default:  return print_usage(stderr, 1);
 		}
 	}
 
+	/* The bitrate may be given after the rate */
+	if (sdo_rate && parse_sdo_rate(&mopt, bitrate, sdo_rate) < 0)
+		return print_usage(stderr, 1);
+
+	/* Polls are low priority requests, so the governor already limits them
+	 * if it is enabled
+	 */
+	if (sdo_poll_rate)
+		mopt.sdo_poll_rate = strtoul(sdo_poll_rate, NULL, 0);
+	else if (mopt.sdo_rate == 0)
+		mopt.sdo_poll_rate = sdo_governor_rate_from_bitrate(bitrate,
+					SDO_POLL_SHARE) / SDO_POLL_FRAMES_PER_POLL;
+
 	int nargs = argc - optind;
 	char** args = &argv[optind];
 
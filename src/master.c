@@ -35,8 +35,24 @@
 #include "canopen/eds.h"
 #include "canopen/master.h"
 #include "canopen/sdo_sync.h"
+#include "canopen/sdo-cache.h"
+#include "canopen/sdo-governor.h"
+#include "canopen/sdo-poll.h"
+#include "canopen/pdo-map.h"
+#include "canopen/dispatch.h"
+#include "canopen/process-image.h"
+#include "canopen/frame-ring.h"
+#include "canopen/sync-cycle.h"
+#include "canopen/tpdo-filter.h"
+#include "canopen/pdo-stats.h"
+#include "canopen/boot-cache.h"
+#include "canopen/node-manifest.h"
 #include "rest.h"
 #include "sdo-rest.h"
+#include "sdo-gateway.h"
+#include "stats-rest.h"
+#include "firmware-rest.h"
+#include "sdo-poll-rest.h"
 #include "time-utils.h"
 #include "profiling.h"
 #include "string-utils.h"
@@ -94,6 +110,7 @@ static int master_send_sdo(int nodeid, int index, int subindex,
 static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size);
 static void unload_legacy_module(int device_type, void* driver);
 static void on_bootup_done(struct mloop_work* self);
+static void mux_route_driver(int nodeid);
 
 struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
 /* Note: node_[0] is unused */
@@ -115,9 +132,28 @@ static inline uint32_t get_device_type(int nodeid)
 	return sdo_sync_read_u32(nodeid, 0x1000, 0);
 }
 
-static inline int node_has_identity(int nodeid)
+const struct canopen_eds* co_master_find_eds(int nodeid)
 {
-	return !!sdo_sync_read_u32(nodeid, 0x1018, 0);
+	struct co_master_node* node = co_master_get_node(nodeid);
+	assert(node);
+
+	const struct canopen_eds* eds;
+
+	if (node->vendor_id == 0)
+		return eds_db_find_by_name(node->name);
+
+	eds = eds_db_find(node->vendor_id, node->product_code,
+			  node->revision_number);
+	if (eds)
+		return eds;
+
+	return eds_db_find(node->vendor_id, node->product_code, -1);
+}
+
+/* The number of entries in the identity object; 0 if there is none */
+static inline uint32_t get_identity_size(int nodeid)
+{
+	return sdo_sync_read_u32(nodeid, 0x1018, 0);
 }
 
 static inline uint32_t get_vendor_id(int nodeid)
@@ -215,11 +251,14 @@ static void unload_driver(int nodeid)
 		turn_off_heartbeat(nodeid);
 
 	sdo_req_queue_flush(sdo_req_queue_get(nodeid));
+	sdo_req_queue_remove_channels(sdo_req_queue_get(nodeid));
+	sdo_cache_invalidate(nodeid);
 
 	switch (node->driver_type) {
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
 		unload_legacy_driver(nodeid);
+		tpdo_filter_reset(nodeid);
 		break;
 #endif /* NO_MAREL_CODE */
 	case CO_MASTER_DRIVER_NEW:
@@ -234,6 +273,8 @@ static void unload_driver(int nodeid)
 	node->device_type = 0;
 	node->is_heartbeat_supported = 0;
 	node->driver_type = CO_MASTER_DRIVER_NONE;
+	mux_route_driver(nodeid);
+	process_image_set_active(nodeid, 0, NULL);
 
 	if (master_state_ == MASTER_STATE_STOPPING)
 		co_net_send_nmt(&socket_, NMT_CS_STOP, nodeid);
@@ -332,6 +373,82 @@ static void unload_legacy_module(int device_type, void* driver)
 }
 #endif /* NO_MAREL_CODE */
 
+/* Mapping values that can not be read from the node are taken from the EDS.
+ */
+static int get_pdo_mapping_value(int nodeid, const struct canopen_eds* eds,
+				 int index, int subindex, uint32_t* value)
+{
+	errno = 0;
+	*value = sdo_sync_read_u32(nodeid, index, subindex);
+	if (*value != 0 || errno == 0)
+		return 0;
+
+	const struct eds_obj* obj = eds ? eds_obj_find(eds, index, subindex)
+					: NULL;
+	if (!obj || !obj->default_value || !*obj->default_value)
+		return -1;
+
+	char* end = NULL;
+	*value = strtoul(obj->default_value, &end, 0);
+	return *end == '\0' ? 0 : -1;
+}
+
+static struct pdo_map* load_pdo_map(int nodeid, int index)
+{
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
+
+	if (eds && !eds_obj_find(eds, index, 0))
+		return NULL;
+
+	uint32_t n_entries;
+	if (get_pdo_mapping_value(nodeid, eds, index, 0, &n_entries) < 0
+	    || n_entries == 0 || n_entries > PDO_MAP_ENTRIES_MAX)
+		return NULL;
+
+	struct pdo_map* map = malloc(sizeof(*map));
+	if (!map)
+		return NULL;
+
+	pdo_map_init(map);
+
+	for (uint32_t i = 1; i <= n_entries; ++i) {
+		uint32_t mapping;
+		if (get_pdo_mapping_value(nodeid, eds, index, i, &mapping) < 0)
+			goto failure;
+
+		const struct eds_obj* obj = eds
+			? eds_obj_find(eds, mapping >> 16, (mapping >> 8) & 0xff)
+			: NULL;
+
+		if (pdo_map_add(map, mapping, obj ? obj->type
+						  : CANOPEN_UNKNOWN) < 0)
+			goto failure;
+	}
+
+	return map;
+
+failure:
+	plog(LOG_WARNING, "load_pdo_map: Invalid PDO mapping 0x%x of node %d",
+	     index, nodeid);
+	free(map);
+	return NULL;
+}
+
+void co__load_pdo_maps(struct co_drv* drv)
+{
+	if (drv->is_pdo_map_loaded)
+		return;
+
+	drv->is_pdo_map_loaded = 1;
+
+	int nodeid = co_master_get_node_id(co_drv_node(drv));
+
+	for (int i = 0; i < CO_DRV_PDO_COUNT; ++i) {
+		drv->tpdo_map[i] = load_pdo_map(nodeid, PDO_MAP_TPDO_INDEX + i);
+		drv->rpdo_map[i] = load_pdo_map(nodeid, PDO_MAP_RPDO_INDEX + i);
+	}
+}
+
 static int load_new_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
@@ -339,6 +456,12 @@ static int load_new_driver(int nodeid)
 	if (co_drv_load(&node->ndrv, node->name) < 0)
 		return -1;
 
+	/* The process image decodes the TPDOs of every node. Otherwise the
+	 * maps are left until the driver asks for them.
+	 */
+	if (options_.flags & CO_MASTER_OPTION_PROCESS_IMAGE)
+		co__load_pdo_maps(&node->ndrv);
+
 	node->driver_type = CO_MASTER_DRIVER_NEW;
 
 	return 0;
@@ -401,6 +524,48 @@ static void load_error_register(int nodeid)
 }
 #endif /* NO_MAREL_CODE */
 
+/* Use the additional SDO server channels that the node has been configured
+ * with. The EDS, if any, tells which channels exist so that we need not ask for
+ * the others. Channels whose COB-IDs are not valid are left alone, as we have
+ * no way of telling which COB-IDs are free on the bus.
+ */
+static void discover_sdo_channels(int nodeid, struct boot_cache_entry* entry)
+{
+	struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
+
+	for (unsigned int i = 1; i < options_.sdo_channels; ++i) {
+		int index = SDO_SERVER_PARAM_INDEX + i;
+
+		if (eds && !eds_obj_find(eds, index, 1))
+			break;
+
+		errno = 0;
+		uint32_t req_cobid = sdo_sync_read_u32(nodeid, index, 1);
+		if (req_cobid == 0 && errno != 0)
+			break;
+
+		uint32_t res_cobid = sdo_sync_read_u32(nodeid, index, 2);
+		if (res_cobid == 0 && errno != 0)
+			break;
+
+		if ((req_cobid | res_cobid)
+		    & (SDO_COBID_INVALID | SDO_COBID_EXTENDED))
+			continue;
+
+		if (sdo_req_queue_add_channel(queue, req_cobid & CAN_SFF_MASK,
+					      res_cobid & CAN_SFF_MASK) < 0)
+			break;
+
+		unsigned int n = entry->n_channels++;
+		entry->channels[n].req_cobid = req_cobid & CAN_SFF_MASK;
+		entry->channels[n].res_cobid = res_cobid & CAN_SFF_MASK;
+
+		plog(LOG_DEBUG, "discover_sdo_channels: Using SDO channel %u of node %d (0x%x/0x%x)",
+		     i, nodeid, req_cobid, res_cobid);
+	}
+}
+
 static const char* driver_type_str(enum co_master_driver_type type)
 {
 	switch (type) {
@@ -431,15 +596,94 @@ static int load_any_driver(int nodeid)
 	return -1;
 }
 
-static int load_driver(int nodeid)
+static int load_cached_driver(int nodeid, enum co_master_driver_type type)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
-		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
-		     nodeid);
+	switch (type) {
+#ifndef NO_MAREL_CODE
+	case CO_MASTER_DRIVER_LEGACY:
+		if (load_legacy_driver(nodeid) >= 0)
+			return 0;
+		break;
+#endif /* NO_MAREL_CODE */
+	case CO_MASTER_DRIVER_NEW:
+		if (load_new_driver(nodeid) >= 0)
+			return 0;
+		break;
+	default:
+		break;
+	}
+
+	return load_any_driver(nodeid);
+}
+
+/* The serial number tells apart nodes of the same kind. Nodes that have none
+ * are checked by their device type and, as device types are shared between
+ * vendors, by their vendor id and product code too.
+ */
+static void set_boot_cache_key(int nodeid, uint32_t identity_size,
+			       struct boot_cache_entry* entry)
+{
+	entry->verify_index = 0x1000;
+	entry->verify_subindex = 0;
+	entry->verify_value = entry->device_type;
+
+	if (identity_size < 4)
+		return;
+
+	errno = 0;
+	uint32_t serial_number = sdo_sync_read_u32(nodeid, 0x1018, 4);
+	if (serial_number == 0 && errno != 0)
+		return;
+
+	entry->verify_index = 0x1018;
+	entry->verify_subindex = 4;
+	entry->verify_value = serial_number;
+}
+
+/* Returns 0 if the node is the one in the entry, 1 if it is not and -1 if it
+ * could not be asked.
+ */
+static int verify_boot_cache_value(int nodeid, int index, int subindex,
+				   uint32_t expected)
+{
+	errno = 0;
+	uint32_t value = sdo_sync_read_u32(nodeid, index, subindex);
+	if (value == 0 && errno != 0)
 		return -1;
+
+	return value == expected ? 0 : 1;
+}
+
+static int verify_boot_cache_entry(int nodeid,
+				   const struct boot_cache_entry* entry)
+{
+	int rc = verify_boot_cache_value(nodeid, entry->verify_index,
+					 entry->verify_subindex,
+					 entry->verify_value);
+	if (rc != 0 || entry->verify_index == 0x1018)
+		return rc;
+
+	/* Identity entries that were not there when the node was cached are
+	 * left out
+	 */
+	if (entry->vendor_id != 0) {
+		rc = verify_boot_cache_value(nodeid, 0x1018, 1,
+					     entry->vendor_id);
+		if (rc != 0)
+			return rc;
 	}
 
+	if (entry->product_code != 0)
+		rc = verify_boot_cache_value(nodeid, 0x1018, 2,
+					     entry->product_code);
+
+	return rc;
+}
+
+static int identify_node(int nodeid, struct boot_cache_entry* entry)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
 	errno = 0;
 	node->device_type = get_device_type(nodeid);
 	if (node->device_type == 0 && errno != 0) {
@@ -458,14 +702,14 @@ static int load_driver(int nodeid)
 	string_keep_if(is_nodename_char, name);
 	strlcpy(node->name, name, sizeof(node->name));
 
-	if (node_has_identity(nodeid)) {
+	uint32_t identity_size = get_identity_size(nodeid);
+	if (identity_size > 0) {
 		node->vendor_id = get_vendor_id(nodeid);
 		node->product_code = get_product_code(nodeid);
 		node->revision_number = get_revision_number(nodeid);
 	}
 
-	node->is_heartbeat_supported =
-		set_heartbeat_period(nodeid, options_.heartbeat_period) >= 0;
+	discover_sdo_channels(nodeid, entry);
 
 	char* hw_version = get_string(nodeid, 0x1009, 0);
 	if (!hw_version)
@@ -481,6 +725,87 @@ static int load_driver(int nodeid)
 	strlcpy(node->sw_version, string_trim(sw_version),
 		sizeof(node->sw_version));
 
+	entry->device_type = node->device_type;
+	entry->vendor_id = node->vendor_id;
+	entry->product_code = node->product_code;
+	entry->revision_number = node->revision_number;
+	strlcpy(entry->name, node->name, sizeof(entry->name));
+	strlcpy(entry->hw_version, node->hw_version, sizeof(entry->hw_version));
+	strlcpy(entry->sw_version, node->sw_version, sizeof(entry->sw_version));
+
+	set_boot_cache_key(nodeid, identity_size, entry);
+
+	return 0;
+}
+
+static void restore_node(int nodeid, const struct boot_cache_entry* entry)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+
+	node->device_type = entry->device_type;
+	node->vendor_id = entry->vendor_id;
+	node->product_code = entry->product_code;
+	node->revision_number = entry->revision_number;
+	strlcpy(node->name, entry->name, sizeof(node->name));
+	strlcpy(node->hw_version, entry->hw_version, sizeof(node->hw_version));
+	strlcpy(node->sw_version, entry->sw_version, sizeof(node->sw_version));
+
+	for (unsigned int i = 0; i < entry->n_channels
+			      && i < ARRAY_LENGTH(entry->channels)
+			      && i + 1 < options_.sdo_channels; ++i)
+		sdo_req_queue_add_channel(queue, entry->channels[i].req_cobid,
+					  entry->channels[i].res_cobid);
+}
+
+/* A node that is in the boot cache only has to prove that it is the same
+ * node as last time. Everything else is read only when it is not.
+ */
+static int load_identity(int nodeid, struct boot_cache_entry* entry)
+{
+	if (boot_cache_get(nodeid, entry) >= 0) {
+		int rc = verify_boot_cache_entry(nodeid, entry);
+		if (rc < 0)
+			return -1;
+
+		if (rc == 0) {
+			restore_node(nodeid, entry);
+			return 1;
+		}
+
+		plog(LOG_NOTICE, "load_driver: Node %d has changed since it was cached",
+		     nodeid);
+		boot_cache_invalidate(nodeid);
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	return identify_node(nodeid, entry);
+}
+
+static int load_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
+		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
+		     nodeid);
+		return -1;
+	}
+
+	struct boot_cache_entry entry;
+	int is_cached = load_identity(nodeid, &entry);
+	if (is_cached < 0)
+		return -1;
+
+	if (node_manifest_check_identity(nodeid, node->vendor_id,
+					 node->product_code,
+					 node->revision_number) < 0)
+		plog(LOG_WARNING, "load_driver: Node %d is not the expected device (0x%x/0x%x/0x%x)",
+		     nodeid, node->vendor_id, node->product_code,
+		     node->revision_number);
+
+	node->is_heartbeat_supported =
+		set_heartbeat_period(nodeid, options_.heartbeat_period) >= 0;
+
 #ifndef NO_MAREL_CODE
 	initialize_info_structure(nodeid);
 
@@ -489,7 +814,16 @@ static int load_driver(int nodeid)
 
 	apply_quirks(node);
 
-	if (load_any_driver(nodeid) < 0) {
+	int rc = is_cached ? load_cached_driver(nodeid, entry.driver_type)
+			   : load_any_driver(nodeid);
+
+	/* Nodes without a driver are cached too, as they keep booting */
+	if (!is_cached || entry.driver_type != (uint32_t)node->driver_type) {
+		entry.driver_type = node->driver_type;
+		boot_cache_put(nodeid, &entry);
+	}
+
+	if (rc < 0) {
 		if (node->is_heartbeat_supported)
 			turn_off_heartbeat(nodeid);
 
@@ -499,8 +833,9 @@ static int load_driver(int nodeid)
 		return -1;
 	}
 
-	plog(LOG_DEBUG, "load_driver: Successfully loaded %s for \"%s\" at id %d",
-	     driver_type_str(node->driver_type), node->name, nodeid);
+	plog(LOG_DEBUG, "load_driver: Successfully loaded %s for \"%s\" at id %d%s",
+	     driver_type_str(node->driver_type), node->name, nodeid,
+	     is_cached ? " (cached)" : "");
 
 	return 0;
 
@@ -582,10 +917,38 @@ static int initialize_driver(int nodeid)
 	}
 }
 
+static void run_expected_net_probe(void)
+{
+	char expected[NODE_MANIFEST_NODES];
+	int i;
+
+	profile("Probe network for expected nodes...\n");
+
+	node_manifest_get_expected(expected);
+
+	co_net_probe_expected(&socket_, nodes_seen_, expected, nodeid_min(),
+			      nodeid_max(), 100);
+
+	for_each_node(i) {
+		if (!expected[i])
+			continue;
+
+		node_manifest_set_present(i, nodes_seen_[i]);
+
+		if (!nodes_seen_[i])
+			plog(LOG_WARNING, "Expected node %d is missing", i);
+	}
+}
+
 static void run_net_probe(struct mloop_work* self)
 {
 	(void)self;
 
+	if (node_manifest_is_loaded()) {
+		run_expected_net_probe();
+		return;
+	}
+
 	profile("Probe network...\n");
 
 	int start = CANOPEN_NODEID_MIN, stop = CANOPEN_NODEID_MAX;
@@ -610,6 +973,22 @@ static void run_load_driver(struct mloop_work* self)
 	node->is_loading = 0;
 }
 
+static void update_process_image(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	struct process_image_identity identity = {
+		.device_type = node->device_type,
+		.vendor_id = node->vendor_id,
+		.product_code = node->product_code,
+		.revision_number = node->revision_number,
+	};
+
+	strlcpy(identity.name, node->name, sizeof(identity.name));
+
+	process_image_set_active(nodeid, 1, &identity);
+}
+
 static void on_load_driver_done(struct mloop_work* self)
 {
 	struct co_master_node* node = mloop_work_get_context(self);
@@ -620,9 +999,13 @@ static void on_load_driver_done(struct mloop_work* self)
 	if (node->driver_type == CO_MASTER_DRIVER_NONE)
 		return;
 
-	if (initialize_driver(nodeid) < 0)
+	int rc = initialize_driver(nodeid);
+	mux_route_driver(nodeid);
+	if (rc < 0)
 		return;
 
+	update_process_image(nodeid);
+
 	if (master_state_ == MASTER_STATE_STARTUP)
 		return;
 
@@ -662,6 +1045,10 @@ static int handle_bootup(struct co_master_node* node)
 {
 	int nodeid = co_master_get_node_id(node);
 
+	/* The node may have been reconfigured or replaced */
+	sdo_cache_invalidate(nodeid);
+	sdo_req_queue_close_breaker(sdo_req_queue_get(nodeid));
+
 	if (master_state_ == MASTER_STATE_STARTUP) {
 		nodes_seen_late_[nodeid] = 1;
 		return 0;
@@ -683,6 +1070,8 @@ static int handle_emcy(struct co_master_node* node,
 
 	int nodeid = co_master_get_node_id(node);
 
+	process_image_set_error_register(nodeid, error_register);
+
 #ifndef NO_MAREL_CODE
 	canopen_info_get(nodeid)->error_register = error_register;
 #endif /* NO_MAREL_CODE */
@@ -718,15 +1107,19 @@ static int handle_heartbeat(struct co_master_node* node,
 	if (!heartbeat_is_valid(frame))
 		return -1;
 
+	int nodeid = co_master_get_node_id(node);
+
+	process_image_set_state(nodeid, heartbeat_get_state(frame));
+
 	if (heartbeat_is_bootup(frame)
 	 && !(node->quirks & CO_NODE_QUIRK_ZERO_GUARD_STATUS))
 		return handle_bootup(node);
 
+	sdo_req_queue_close_breaker(sdo_req_queue_get(nodeid));
+
 	if (master_state_ == MASTER_STATE_STARTUP)
 		return 0;
 
-	int nodeid = co_master_get_node_id(node);
-
 	/* This can happen if the CAN bus is disconnected but not the power to
 	 * the node. We reset communication to refresh the state.
 	 */
@@ -755,133 +1148,143 @@ static int handle_heartbeat(struct co_master_node* node,
 static int handle_sdo(struct co_master_node* node, const struct can_frame* cf)
 {
 	int nodeid = co_master_get_node_id(node);
-	struct sdo_async* sdo_proc = &sdo_req_queue_get(nodeid)->sdo_client;
+	struct sdo_async* sdo_proc = &sdo_req_queue_get(nodeid)->channel[0].client;
 	return sdo_async_feed(sdo_proc, cf);
 }
 
-static int handle_not_loaded(struct co_master_node* node,
-			     const struct canopen_msg* msg,
-			     const struct can_frame* frame)
+static int mux_emcy(void* context, const struct can_frame* cf)
 {
-	switch (msg->object)
-	{
-	case CANOPEN_EMCY:
-		return handle_emcy(node, frame);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, frame);
-	case CANOPEN_TSDO:
-		return handle_sdo(node, frame);
-	default:
-		break;
-	}
+	return handle_emcy(context, cf);
+}
 
-	return -1;
+static int mux_heartbeat(void* context, const struct can_frame* cf)
+{
+	return handle_heartbeat(context, cf);
+}
+
+static int mux_sdo(void* context, const struct can_frame* cf)
+{
+	return handle_sdo(context, cf);
+}
+
+static inline int mux_tpdo_number(const struct can_frame* cf)
+{
+	return ((cf->can_id & CAN_SFF_MASK) - R_TPDO1) / 0x100 + 1;
+}
+
+/* Only used when there is no driver to pass the PDO on to */
+static int mux_image_tpdo(void* context, const struct can_frame* cf)
+{
+	struct co_master_node* node = context;
+	process_image_set_tpdo(co_master_get_node_id(node), mux_tpdo_number(cf),
+			       cf->data, cf->can_dlc, NULL, 0);
+	return 0;
 }
 
 #ifndef NO_MAREL_CODE
-static int handle_with_legacy(struct co_master_node* node,
-			      const struct canopen_msg* msg,
-			      const struct can_frame* cf)
+static int mux_legacy_tpdo(void* context, const struct can_frame* cf)
 {
+	struct co_master_node* node = context;
+	int n = mux_tpdo_number(cf);
+
+	int nodeid = co_master_get_node_id(node);
+
+	process_image_set_tpdo(nodeid, n, cf->data, cf->can_dlc, NULL, 0);
+
 	void* driver = node->driver;
 	if (!driver)
 		return -1;
 
-	switch (msg->object)
-	{
-	case CANOPEN_TPDO1:
-		return legacy_driver_iface_process_pdo(driver, 1, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO2:
-		return legacy_driver_iface_process_pdo(driver, 2, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO3:
-		return legacy_driver_iface_process_pdo(driver, 3, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TPDO4:
-		return legacy_driver_iface_process_pdo(driver, 4, cf->data,
-						       cf->can_dlc);
-	case CANOPEN_TSDO:
-		return handle_sdo(node, cf);
-	case CANOPEN_EMCY:
-		return handle_emcy(node, cf);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, cf);
-	default:
-		break;
-	}
+	if (!tpdo_filter_pass(nodeid, n, cf->data, cf->can_dlc))
+		return 0;
 
-	return -1;
+	return legacy_driver_iface_process_pdo(driver, n, cf->data,
+					       cf->can_dlc);
 }
 #endif /* NO_MAREL_CODE */
 
-static int handle_with_new_driver(struct co_master_node* node,
-				  const struct canopen_msg* msg,
-				  const struct can_frame* cf)
+static int mux_new_tpdo(void* context, const struct can_frame* cf)
 {
-	struct co_drv* drv = &node->ndrv;
-
-	switch (msg->object)
-	{
-	case CANOPEN_TPDO1:
-		if (drv->pdo1_fn)
-			drv->pdo1_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO2:
-		if (drv->pdo2_fn)
-			drv->pdo2_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO3:
-		if (drv->pdo3_fn)
-			drv->pdo3_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TPDO4:
-		if (drv->pdo4_fn)
-			drv->pdo4_fn(drv, cf->data, cf->can_dlc);
-		return 0;
-	case CANOPEN_TSDO:
-		return handle_sdo(node, cf);
-	case CANOPEN_EMCY:
-		return handle_emcy(node, cf);
-	case CANOPEN_HEARTBEAT:
-		return handle_heartbeat(node, cf);
-	default:
-		break;
-	}
-
-	return -1;
+	struct co_master_node* node = context;
+	co_drv_process_tpdo(&node->ndrv, mux_tpdo_number(cf), cf->data,
+			    cf->can_dlc);
+	return 0;
 }
 
-static void mux_on_frame(const struct can_frame* cf)
+static int mux_nmt(void* context, const struct can_frame* cf)
 {
-	struct canopen_msg msg;
-
-	if (canopen_get_object_type(&msg, cf) < 0)
-		return;
-
-	if (msg.object == CANOPEN_NMT) {
-		plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
-		return;
-	}
+	(void)context;
+	(void)cf;
+	plog(LOG_ALERT, "Received NMT! Another CANopen master is not allowed on the bus!");
+	return 0;
+}
 
-	if (!(nodeid_min() <= msg.id && msg.id <= nodeid_max()))
-		return;
+static int mux_sync(void* context, const struct can_frame* cf)
+{
+	(void)context;
+	(void)cf;
+	co_drv_process_sync();
+	return 0;
+}
 
-	struct co_master_node* node = co_master_get_node(msg.id);
+/* TPDOs are only routed to drivers that have been initialised. Otherwise they
+ * only go into the process image, if there is one.
+ */
+static void mux_route_driver(int nodeid)
+{
+	static const int tpdos[] = { R_TPDO1, R_TPDO2, R_TPDO3, R_TPDO4 };
+	struct co_master_node* node = co_master_get_node(nodeid);
+	co_dispatch_fn fn = options_.flags & CO_MASTER_OPTION_PROCESS_IMAGE
+			  ? mux_image_tpdo : NULL;
 
 	switch (node->driver_type) {
-	case CO_MASTER_DRIVER_NONE:
-		handle_not_loaded(node, &msg, cf);
-		break;
 #ifndef NO_MAREL_CODE
 	case CO_MASTER_DRIVER_LEGACY:
-		handle_with_legacy(node, &msg, cf);
+		fn = mux_legacy_tpdo;
 		break;
 #endif /* NO_MAREL_CODE */
 	case CO_MASTER_DRIVER_NEW:
-		handle_with_new_driver(node, &msg, cf);
+		fn = mux_new_tpdo;
+		break;
+	case CO_MASTER_DRIVER_NONE:
+	default:
 		break;
 	}
+
+	for (size_t i = 0; i < ARRAY_LENGTH(tpdos); ++i)
+		co_dispatch_set(tpdos[i] + nodeid, fn, node);
+}
+
+static void init_routes(void)
+{
+	co_dispatch_clear();
+
+	co_dispatch_set(R_NMT, mux_nmt, NULL);
+	co_dispatch_set(R_SYNC, mux_sync, NULL);
+
+	for (int nodeid = nodeid_min(); nodeid <= nodeid_max(); ++nodeid) {
+		struct co_master_node* node = co_master_get_node(nodeid);
+
+		co_dispatch_set(R_EMCY + nodeid, mux_emcy, node);
+		co_dispatch_set(R_TSDO + nodeid, mux_sdo, node);
+		co_dispatch_set(R_HEARTBEAT + nodeid, mux_heartbeat, node);
+
+		mux_route_driver(nodeid);
+	}
+}
+
+static void mux_on_frame(const struct can_frame* cf)
+{
+	/* Responses on additional SDO channels may have any COB-ID */
+	struct sdo_async* sdo_channel = sdo_req_find_channel(cf->can_id);
+	if (sdo_channel) {
+		sdo_async_feed(sdo_channel, cf);
+		return;
+	}
+
+	pdo_stats_feed(cf);
+	sync_cycle_feed(cf);
+	co_dispatch(cf);
 }
 
 static void mux_handler_fn(struct mloop_socket* self)
@@ -902,6 +1305,8 @@ static void mux_handler_fn(struct mloop_socket* self)
 
 static int init_multiplexer()
 {
+	init_routes();
+
 	mux_handler_ = mloop_socket_new(mloop_default());
 	if (!mux_handler_)
 		return -1;
@@ -912,6 +1317,30 @@ static int init_multiplexer()
 	return mloop_socket_start(mux_handler_);
 }
 
+static void on_sync_cycle_done(const struct co_cycle* cycle)
+{
+	for (int nodeid = nodeid_min(); nodeid <= nodeid_max(); ++nodeid) {
+		struct co_master_node* node = co_master_get_node(nodeid);
+		struct co_drv* drv = &node->ndrv;
+
+		if (node->driver_type == CO_MASTER_DRIVER_NEW && drv->cycle_fn)
+			drv->cycle_fn(drv, cycle);
+	}
+}
+
+static int init_sync_cycle(const struct co_master_options* opt)
+{
+	struct sync_cycle_config config = {
+		.period = opt->sync_period,
+		.counter_overflow = opt->sync_counter_overflow,
+		.priority = opt->sync_priority,
+		.sync_fn = co_drv_process_sync,
+		.done_fn = on_sync_cycle_done,
+	};
+
+	return sync_cycle_init(&config, &socket_);
+}
+
 static void wait_for_bootup(struct mloop_work* self)
 {
 	(void)self;
@@ -1079,6 +1508,7 @@ static int master_request_sdo(int nodeid, int index, int subindex)
 		.type = SDO_REQ_UPLOAD,
 		.index = index,
 		.subindex = subindex,
+		.prio = SDO_REQ_PRIO_HIGH,
 		.on_done = on_master_sdo_request_done
 	};
 
@@ -1106,6 +1536,7 @@ static int master_send_sdo(int nodeid, int index, int subindex,
 		.subindex = subindex,
 		.dl_data = data,
 		.dl_size = size,
+		.prio = SDO_REQ_PRIO_HIGH,
 		.on_done = on_master_sdo_send_done
 	};
 
@@ -1286,6 +1717,22 @@ int co_master_run(const struct co_master_options* opt)
 				  "sdo", sdo_rest_service) < 0)
 		goto rest_service_failure;
 
+	if (rest_register_service(HTTP_GET, "stats", stats_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (opt->firmware_dir && firmware_rest_init(opt->firmware_dir) < 0) {
+		perror("Could not open firmware directory");
+		goto rest_service_failure;
+	}
+
+	if (rest_register_service(HTTP_GET | HTTP_PUT, "firmware",
+				  firmware_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET | HTTP_PUT, "poll",
+				  sdo_poll_rest_service) < 0)
+		goto rest_service_failure;
+
 	profile("Open interface...\n");
 	enum sock_type sock_type = opt->flags & CO_MASTER_OPTION_USE_TCP
 				 ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
@@ -1301,6 +1748,22 @@ int co_master_run(const struct co_master_options* opt)
 	}
 #endif /* NO_MAREL_CODE */
 
+	if (opt->flags & CO_MASTER_OPTION_PROCESS_IMAGE) {
+		profile("Initialize process image...\n");
+		if (process_image_init(opt->iface) < 0) {
+			perror("Could not initialize process image");
+			goto process_image_failure;
+		}
+	}
+
+	if (opt->frame_ring_size > 0) {
+		profile("Initialize frame ring...\n");
+		if (frame_ring_init(opt->iface, opt->frame_ring_size) < 0) {
+			perror("Could not initialize frame ring");
+			goto frame_ring_failure;
+		}
+	}
+
 	enum sdo_async_quirks_flags sdo_quirks;
 	sdo_quirks = opt->flags & CO_MASTER_OPTION_WITH_QUIRKS
 		   ? SDO_ASYNC_QUIRK_ALL : SDO_ASYNC_QUIRK_NONE;
@@ -1310,10 +1773,76 @@ int co_master_run(const struct co_master_options* opt)
 			< 0)
 		goto sdo_req_queues_failure;
 
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct sdo_req_queue* queue = sdo_req_queue_get(i);
+
+		sdo_req_queue_set_timeout_bounds(queue, opt->sdo_timeout_min,
+						 opt->sdo_timeout_max);
+		sdo_req_queue_set_breaker(queue, opt->sdo_breaker_threshold);
+		sdo_req_queue_set_max_retries(queue, opt->sdo_max_retries);
+
+		if (opt->flags & CO_MASTER_OPTION_SDO_LAST_WRITER_WINS)
+			sdo_req_queue_set_flags(queue,
+						SDO_REQ_QUEUE_LAST_WRITER_WINS);
+	}
+
+	tpdo_filter_set_default(opt->flags & CO_MASTER_OPTION_TPDO_FILTER,
+				opt->tpdo_keepalive);
+
+	struct sdo_governor_config governor_config = { .rate = opt->sdo_rate };
+	memcpy(governor_config.share, opt->sdo_rate_share,
+	       sizeof(governor_config.share));
+
+	profile("Initialize SDO governor...\n");
+	if (sdo_governor_init(&governor_config) < 0)
+		goto sdo_governor_failure;
+
+	if (opt->flags & CO_MASTER_OPTION_SDO_CACHE) {
+		profile("Initialize SDO cache...\n");
+		if (sdo_cache_init(opt->sdo_cache_max_age) < 0)
+			goto sdo_cache_failure;
+	}
+
+	profile("Initialize SDO polling...\n");
+	if (sdo_poll_init(opt->sdo_poll_rate) < 0)
+		goto sdo_poll_failure;
+
+	if (opt->sdo_gateway_port > 0) {
+		profile("Initialize SDO gateway...\n");
+		if (sdo_gateway_init(opt->sdo_gateway_port) < 0) {
+			perror("Could not initialize SDO gateway");
+			goto sdo_gateway_failure;
+		}
+	}
+
+	if (opt->boot_cache) {
+		profile("Load boot cache...\n");
+		if (boot_cache_init(opt->boot_cache) < 0) {
+			fprintf(stderr, "Invalid boot cache path\n");
+			goto boot_cache_failure;
+		}
+	}
+
+	if (opt->manifest) {
+		profile("Load node manifest...\n");
+		if (node_manifest_load(opt->manifest) < 0) {
+			fprintf(stderr, "Could not load node manifest\n");
+			goto node_manifest_failure;
+		}
+	}
+
 	profile("Initialize node structure...\n");
 	if (init_all_node_structures() < 0)
 		goto node_init_failure;
 
+	if (opt->sync_period > 0) {
+		profile("Start SYNC producer...\n");
+		if (init_sync_cycle(opt) < 0) {
+			perror("Could not start SYNC producer");
+			goto sync_cycle_failure;
+		}
+	}
+
 	if (sock_type == SOCK_TYPE_CAN)
 		net_fix_sndbuf(socket_.fd);
 
@@ -1360,12 +1889,40 @@ worker_failure:
 #endif /* NO_MAREL_CODE */
 
 driver_manager_failure:
+	sync_cycle_cleanup();
+
+sync_cycle_failure:
 	destroy_all_node_structures();
 
 node_init_failure:
+	node_manifest_cleanup();
+
+node_manifest_failure:
+	boot_cache_cleanup();
+
+boot_cache_failure:
+	sdo_gateway_cleanup();
+
+sdo_gateway_failure:
+	sdo_poll_rest_cleanup();
+	sdo_poll_cleanup();
+
+sdo_poll_failure:
+	sdo_cache_cleanup();
+
+sdo_cache_failure:
+	sdo_governor_cleanup();
+
+sdo_governor_failure:
 	sdo_req_queues_cleanup();
 
 sdo_req_queues_failure:
+	frame_ring_cleanup();
+
+frame_ring_failure:
+	process_image_cleanup();
+
+process_image_failure:
 	if (socket_.fd >= 0)
 		sock_close(&socket_);
 
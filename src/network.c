@@ -14,6 +14,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
 #include <poll.h>
@@ -150,3 +152,140 @@ int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 
 	return co_net__wait_for_sdo(sock, nodes_seen, start, end, timeout);
 }
+
+/* Probing for a known set of nodes. Frames are sent without blocking, and when
+ * the transmit queue is full, answers are collected until there is room again.
+ * Waiting stops as soon as every expected node has answered.
+ */
+struct co_net__probe {
+	const struct sock* sock;
+	char* nodes_seen;
+	const char* expected;
+	int start, end;
+	int n_missing;
+};
+
+static void co_net__probe_feed(struct co_net__probe* self,
+			       const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+	canopen_get_object_type(&msg, cf);
+
+	if (msg.object != CANOPEN_HEARTBEAT)
+		return;
+
+	if (!(self->start <= msg.id && msg.id <= self->end))
+		return;
+
+	if (self->nodes_seen[msg.id])
+		return;
+
+	self->nodes_seen[msg.id] = 1;
+
+	if (self->expected[msg.id])
+		self->n_missing--;
+}
+
+/* Returns 0 on timeout */
+static int co_net__probe_wait(struct co_net__probe* self, int timeout)
+{
+	struct can_frame cf;
+
+	int t = gettime_ms(CLOCK_MONOTONIC);
+	int t_end = t + timeout;
+
+	while (self->n_missing > 0) {
+		if (sock_timed_recv(self->sock, &cf, MAX(0, t_end - t)) <= 0)
+			return 0;
+
+		co_net__probe_feed(self, &cf);
+		t = gettime_ms(CLOCK_MONOTONIC);
+	}
+
+	return 1;
+}
+
+/* Gives the transmit queue time to drain. Heartbeats that arrive meanwhile
+ * are taken in, but the full time is waited even when none are missing.
+ */
+static void co_net__probe_pace(struct co_net__probe* self)
+{
+	int t_end = gettime_ms(CLOCK_MONOTONIC) + CO_NET_PROBE_PACE;
+
+	co_net__probe_wait(self, CO_NET_PROBE_PACE);
+
+	int remaining = t_end - gettime_ms(CLOCK_MONOTONIC);
+	if (remaining > 0)
+		usleep(remaining * 1000);
+}
+
+static int co_net__probe_send(struct co_net__probe* self, struct can_frame* cf)
+{
+	for (int i = 0; i < CO_NET_PROBE_SEND_RETRIES; ++i) {
+		if (sock_send(self->sock, cf, MSG_DONTWAIT) > 0)
+			return 0;
+
+		if (errno != ENOBUFS && errno != EAGAIN)
+			return -1;
+
+		co_net__probe_pace(self);
+	}
+
+	return -1;
+}
+
+static int co_net__probe_send_nmt(struct co_net__probe* self, int cs,
+				  int nodeid)
+{
+	struct can_frame cf = { 0 };
+	cf.can_id = 0;
+	cf.can_dlc = 2;
+	nmt_set_cs(&cf, cs);
+	nmt_set_nodeid(&cf, nodeid);
+	return co_net__probe_send(self, &cf);
+}
+
+static int co_net__probe_request_heartbeat(struct co_net__probe* self,
+					   int nodeid)
+{
+	struct can_frame cf = { 0 };
+	cf.can_id = (R_HEARTBEAT + nodeid) | CAN_RTR_FLAG;
+	return co_net__probe_send(self, &cf);
+}
+
+int co_net_probe_expected(const struct sock* sock, char* nodes_seen,
+			  const char* expected, int start, int end,
+			  int timeout)
+{
+	struct co_net__probe probe = {
+		.sock = sock,
+		.nodes_seen = nodes_seen,
+		.expected = expected,
+		.start = start,
+		.end = end,
+	};
+
+	for (int i = start; i <= end; ++i)
+		if (expected[i] && !nodes_seen[i])
+			probe.n_missing++;
+
+	if (start == CANOPEN_NODEID_MIN && end == CANOPEN_NODEID_MAX) {
+		co_net__probe_send_nmt(&probe, NMT_CS_RESET_COMMUNICATION, 0);
+	} else {
+		for (int i = start; i <= end; ++i)
+			co_net__probe_send_nmt(&probe,
+					       NMT_CS_RESET_COMMUNICATION, i);
+	}
+
+	if (co_net__probe_wait(&probe, timeout))
+		return 0;
+
+	/* Nodes that missed the reset may still answer a heartbeat request */
+	for (int i = start; i <= end; ++i)
+		if (expected[i] && !nodes_seen[i])
+			co_net__probe_request_heartbeat(&probe, i);
+
+	co_net__probe_wait(&probe, timeout);
+
+	return probe.n_missing;
+}
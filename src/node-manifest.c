@@ -0,0 +1,304 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "canopen/node-manifest.h"
+#include "string-utils.h"
+#include "plog.h"
+
+enum node_manifest__fields {
+	NODE_MANIFEST__VENDOR_ID = 1,
+	NODE_MANIFEST__PRODUCT_CODE = 1 << 1,
+	NODE_MANIFEST__REVISION_NUMBER = 1 << 2,
+};
+
+struct node_manifest__node {
+	int is_expected;
+	enum node_manifest__fields fields;
+	uint32_t vendor_id, product_code, revision_number;
+	enum node_manifest_state state;
+};
+
+/* Identities are checked from worker threads */
+static pthread_mutex_t node_manifest__mutex = PTHREAD_MUTEX_INITIALIZER;
+static int node_manifest__is_loaded = 0;
+static struct node_manifest__node node_manifest__nodes[NODE_MANIFEST_NODES];
+
+static int node_manifest__is_nodeid_valid(int nodeid)
+{
+	return 1 <= nodeid && nodeid < NODE_MANIFEST_NODES;
+}
+
+static int node_manifest__parse_number(char** str, uint32_t* value)
+{
+	char* end;
+
+	while (**str == ' ' || **str == '\t')
+		++*str;
+
+	if (**str == '\0')
+		return 0;
+
+	unsigned long long number = strtoull(*str, &end, 0);
+	if (end == *str || number > UINT32_MAX)
+		return -1;
+
+	if (*end != '\0' && *end != ' ' && *end != '\t')
+		return -1;
+
+	*value = number;
+	*str = end;
+	return 1;
+}
+
+static int node_manifest__parse_line(char* line)
+{
+	static const enum node_manifest__fields fields[] = {
+		NODE_MANIFEST__VENDOR_ID,
+		NODE_MANIFEST__PRODUCT_CODE,
+		NODE_MANIFEST__REVISION_NUMBER,
+	};
+
+	char* comment = strchr(line, '#');
+	if (comment)
+		*comment = '\0';
+
+	char* str = string_trim(line);
+	uint32_t nodeid;
+
+	int rc = node_manifest__parse_number(&str, &nodeid);
+	if (rc <= 0)
+		return rc;
+
+	if (!node_manifest__is_nodeid_valid(nodeid))
+		return -1;
+
+	struct node_manifest__node* node = &node_manifest__nodes[nodeid];
+	uint32_t* values[] = {
+		&node->vendor_id, &node->product_code, &node->revision_number
+	};
+
+	memset(node, 0, sizeof(*node));
+	node->is_expected = 1;
+
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		rc = node_manifest__parse_number(&str, values[i]);
+		if (rc < 0)
+			return -1;
+
+		if (rc == 0)
+			return 1;
+
+		node->fields |= fields[i];
+	}
+
+	return *string_trim(str) == '\0' ? 1 : -1;
+}
+
+int node_manifest_parse(FILE* input)
+{
+	char line[256];
+	int lineno = 0;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+
+	memset(node_manifest__nodes, 0, sizeof(node_manifest__nodes));
+
+	while (fgets(line, sizeof(line), input)) {
+		++lineno;
+
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (node_manifest__parse_line(line) < 0) {
+			plog(LOG_ERROR, "node_manifest: Syntax error on line %d",
+			     lineno);
+			goto failure;
+		}
+	}
+
+	node_manifest__is_loaded = 1;
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return 0;
+
+failure:
+	memset(node_manifest__nodes, 0, sizeof(node_manifest__nodes));
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return -1;
+}
+
+int node_manifest_load(const char* path)
+{
+	FILE* input = fopen(path, "r");
+	if (!input) {
+		plog(LOG_ERROR, "node_manifest: Could not open \"%s\": %m",
+		     path);
+		return -1;
+	}
+
+	int rc = node_manifest_parse(input);
+	fclose(input);
+	return rc;
+}
+
+void node_manifest_cleanup(void)
+{
+	pthread_mutex_lock(&node_manifest__mutex);
+	node_manifest__is_loaded = 0;
+	memset(node_manifest__nodes, 0, sizeof(node_manifest__nodes));
+	pthread_mutex_unlock(&node_manifest__mutex);
+}
+
+int node_manifest_is_loaded(void)
+{
+	pthread_mutex_lock(&node_manifest__mutex);
+	int is_loaded = node_manifest__is_loaded;
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return is_loaded;
+}
+
+int node_manifest_is_expected(int nodeid)
+{
+	if (!node_manifest__is_nodeid_valid(nodeid))
+		return 0;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+	int is_expected = node_manifest__nodes[nodeid].is_expected;
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return is_expected;
+}
+
+void node_manifest_get_expected(char* expected)
+{
+	pthread_mutex_lock(&node_manifest__mutex);
+
+	for (int i = 0; i < NODE_MANIFEST_NODES; ++i)
+		expected[i] = node_manifest__nodes[i].is_expected;
+
+	pthread_mutex_unlock(&node_manifest__mutex);
+}
+
+void node_manifest_set_present(int nodeid, int is_present)
+{
+	if (!node_manifest__is_nodeid_valid(nodeid))
+		return;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+
+	struct node_manifest__node* node = &node_manifest__nodes[nodeid];
+	if (node->is_expected)
+		node->state = is_present ? NODE_MANIFEST_PRESENT
+					 : NODE_MANIFEST_MISSING;
+
+	pthread_mutex_unlock(&node_manifest__mutex);
+}
+
+static int node_manifest__is_match(const struct node_manifest__node* node,
+				   uint32_t vendor_id, uint32_t product_code,
+				   uint32_t revision_number)
+{
+	if (node->fields & NODE_MANIFEST__VENDOR_ID
+	 && node->vendor_id != vendor_id)
+		return 0;
+
+	if (node->fields & NODE_MANIFEST__PRODUCT_CODE
+	 && node->product_code != product_code)
+		return 0;
+
+	if (node->fields & NODE_MANIFEST__REVISION_NUMBER
+	 && node->revision_number != revision_number)
+		return 0;
+
+	return 1;
+}
+
+int node_manifest_check_identity(int nodeid, uint32_t vendor_id,
+				 uint32_t product_code,
+				 uint32_t revision_number)
+{
+	int rc = 0;
+
+	if (!node_manifest__is_nodeid_valid(nodeid))
+		return 0;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+
+	struct node_manifest__node* node = &node_manifest__nodes[nodeid];
+	if (!node->is_expected)
+		goto done;
+
+	if (node_manifest__is_match(node, vendor_id, product_code,
+				    revision_number)) {
+		node->state = NODE_MANIFEST_PRESENT;
+	} else {
+		node->state = NODE_MANIFEST_MISMATCH;
+		rc = -1;
+	}
+
+done:
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return rc;
+}
+
+enum node_manifest_state node_manifest_get_state(int nodeid)
+{
+	if (!node_manifest__is_nodeid_valid(nodeid))
+		return NODE_MANIFEST_UNKNOWN;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+	enum node_manifest_state state = node_manifest__nodes[nodeid].state;
+	pthread_mutex_unlock(&node_manifest__mutex);
+	return state;
+}
+
+static const char* node_manifest__state_str(enum node_manifest_state state)
+{
+	switch (state) {
+	case NODE_MANIFEST_UNKNOWN: return "unknown";
+	case NODE_MANIFEST_PRESENT: return "present";
+	case NODE_MANIFEST_MISSING: return "missing";
+	case NODE_MANIFEST_MISMATCH: return "mismatch";
+	}
+
+	return "unknown";
+}
+
+void node_manifest_print_stats(FILE* out)
+{
+	int is_first = 1;
+
+	pthread_mutex_lock(&node_manifest__mutex);
+
+	fprintf(out, "[");
+
+	for (int nodeid = 1; nodeid < NODE_MANIFEST_NODES; ++nodeid) {
+		const struct node_manifest__node* node =
+			&node_manifest__nodes[nodeid];
+
+		if (!node->is_expected)
+			continue;
+
+		fprintf(out, "%s\n { \"node\": %d, \"state\": \"%s\" }",
+			is_first ? "" : ",", nodeid,
+			node_manifest__state_str(node->state));
+		is_first = 0;
+	}
+
+	fprintf(out, "\n]\n");
+
+	pthread_mutex_unlock(&node_manifest__mutex);
+}
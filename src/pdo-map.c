@@ -0,0 +1,344 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* PDO mappings
+ *
+ * A mapping object lists the objects that make up a PDO in the order in which
+ * they are packed, least significant bit first. It is compiled into a list of
+ * bit offsets and masks so that a received PDO can be loaded as a single 64 bit
+ * little endian word and every signal taken out of it with a shift and a mask.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "canopen/pdo-map.h"
+#include "canopen/byteorder.h"
+
+void pdo_map_init(struct pdo_map* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+static int pdo_map__signal_type(enum co_pdo_signal_type* signal_type,
+				enum canopen_type type, unsigned int length)
+{
+	if (canopen_type_is_real(type)) {
+		if (length != 32 && length != 64)
+			return -1;
+
+		*signal_type = CO_PDO_SIGNAL_REAL;
+	} else if (canopen_type_is_signed_integer(type)) {
+		*signal_type = CO_PDO_SIGNAL_SIGNED;
+	} else {
+		*signal_type = CO_PDO_SIGNAL_UNSIGNED;
+	}
+
+	return 0;
+}
+
+int pdo_map_add(struct pdo_map* self, uint32_t mapping, enum canopen_type type)
+{
+	int index = mapping >> 16;
+	int subindex = (mapping >> 8) & 0xff;
+	unsigned int length = mapping & 0xff;
+
+	if (length == 0 || self->length + length > PDO_MAP_BITS_MAX)
+		return -1;
+
+	/* Dummy entries refer to data type definitions */
+	if (index < 0x1000) {
+		self->length += length;
+		return 0;
+	}
+
+	if (self->n_entries >= PDO_MAP_ENTRIES_MAX)
+		return -1;
+
+	struct pdo_map_entry* entry = &self->entries[self->n_entries];
+	memset(entry, 0, sizeof(*entry));
+
+	if (pdo_map__signal_type(&entry->signal_type, type, length) < 0)
+		return -1;
+
+	entry->index = index;
+	entry->subindex = subindex;
+	entry->offset = self->length;
+	entry->length = length;
+	entry->mask = length == 64 ? UINT64_MAX : (1ULL << length) - 1;
+
+	self->length += length;
+	self->n_entries++;
+	return 0;
+}
+
+struct pdo_map_entry* pdo_map_find(struct pdo_map* self, int index,
+				   int subindex)
+{
+	for (unsigned int i = 0; i < self->n_entries; ++i) {
+		struct pdo_map_entry* entry = &self->entries[i];
+		if (entry->index == index && entry->subindex == subindex)
+			return entry;
+	}
+
+	return NULL;
+}
+
+int pdo_map_bind(struct pdo_map* self, int index, int subindex, void* ptr,
+		 size_t size)
+{
+	struct pdo_map_entry* entry = pdo_map_find(self, index, subindex);
+	if (!entry)
+		return -1;
+
+	switch (size) {
+	case 1:
+	case 2:
+		if (entry->signal_type == CO_PDO_SIGNAL_REAL)
+			return -1;
+		break;
+	case 4:
+	case 8:
+		break;
+	default:
+		return -1;
+	}
+
+	entry->binding = ptr;
+	entry->binding_size = size;
+	return 0;
+}
+
+static void pdo_map__store(const struct pdo_map_entry* entry,
+			   const struct co_pdo_signal* signal)
+{
+	void* dst = entry->binding;
+
+	if (entry->signal_type == CO_PDO_SIGNAL_REAL) {
+		if (entry->binding_size == sizeof(float)) {
+			float value = signal->value.real;
+			memcpy(dst, &value, sizeof(value));
+		} else {
+			double value = signal->value.real;
+			memcpy(dst, &value, sizeof(value));
+		}
+		return;
+	}
+
+	/* The value is truncated the same way for signed and unsigned */
+	uint8_t u8 = signal->value.u;
+	uint16_t u16 = signal->value.u;
+	uint32_t u32 = signal->value.u;
+	uint64_t u64 = signal->value.u;
+
+	switch (entry->binding_size) {
+	case 1: memcpy(dst, &u8, sizeof(u8)); break;
+	case 2: memcpy(dst, &u16, sizeof(u16)); break;
+	case 4: memcpy(dst, &u32, sizeof(u32)); break;
+	case 8: memcpy(dst, &u64, sizeof(u64)); break;
+	default: abort();
+	}
+}
+
+static void pdo_map__load(const struct pdo_map_entry* entry,
+			  struct co_pdo_signal* signal)
+{
+	const void* src = entry->binding;
+
+	if (entry->signal_type == CO_PDO_SIGNAL_REAL) {
+		if (entry->binding_size == sizeof(float)) {
+			float value;
+			memcpy(&value, src, sizeof(value));
+			signal->value.real = value;
+		} else {
+			double value;
+			memcpy(&value, src, sizeof(value));
+			signal->value.real = value;
+		}
+		return;
+	}
+
+	/* Bits above the mapped length are masked off, so there is no need to
+	 * sign extend.
+	 */
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+	switch (entry->binding_size) {
+	case 1: memcpy(&u8, src, sizeof(u8)); u64 = u8; break;
+	case 2: memcpy(&u16, src, sizeof(u16)); u64 = u16; break;
+	case 4: memcpy(&u32, src, sizeof(u32)); u64 = u32; break;
+	case 8: memcpy(&u64, src, sizeof(u64)); break;
+	default: abort();
+	}
+
+	signal->value.u = u64;
+}
+
+static void pdo_map__from_bits(const struct pdo_map_entry* entry,
+			       struct co_pdo_signal* signal, uint64_t bits)
+{
+	unsigned int shift = 64 - entry->length;
+
+	switch (entry->signal_type) {
+	case CO_PDO_SIGNAL_UNSIGNED:
+		signal->value.u = bits;
+		break;
+	case CO_PDO_SIGNAL_SIGNED:
+		signal->value.i = (int64_t)(bits << shift) >> shift;
+		break;
+	case CO_PDO_SIGNAL_REAL:
+		if (entry->length == 32) {
+			uint32_t u32 = bits;
+			float value;
+			memcpy(&value, &u32, sizeof(value));
+			signal->value.real = value;
+		} else {
+			double value;
+			memcpy(&value, &bits, sizeof(value));
+			signal->value.real = value;
+		}
+		break;
+	}
+}
+
+static uint64_t pdo_map__to_bits(const struct pdo_map_entry* entry,
+				 const struct co_pdo_signal* signal)
+{
+	if (entry->signal_type != CO_PDO_SIGNAL_REAL)
+		return signal->value.u & entry->mask;
+
+	if (entry->length == 32) {
+		float value = signal->value.real;
+		uint32_t u32;
+		memcpy(&u32, &value, sizeof(u32));
+		return u32;
+	}
+
+	uint64_t u64;
+	memcpy(&u64, &signal->value.real, sizeof(u64));
+	return u64;
+}
+
+int pdo_map_decode(const struct pdo_map* self, struct co_pdo_signal* signals,
+		   const void* data, size_t size)
+{
+	if (size * 8 < self->length || size > sizeof(uint64_t))
+		return -1;
+
+	uint64_t raw = 0;
+	byteorder2(&raw, data, sizeof(raw), size);
+
+	for (unsigned int i = 0; i < self->n_entries; ++i) {
+		const struct pdo_map_entry* entry = &self->entries[i];
+		struct co_pdo_signal* signal = &signals[i];
+
+		signal->index = entry->index;
+		signal->subindex = entry->subindex;
+		signal->type = entry->signal_type;
+
+		pdo_map__from_bits(entry, signal,
+				   (raw >> entry->offset) & entry->mask);
+
+		if (entry->binding)
+			pdo_map__store(entry, signal);
+	}
+
+	return self->n_entries;
+}
+
+static inline double pdo_map__abs(double x)
+{
+	return x < 0.0 ? -x : x;
+}
+
+static double pdo_map__distance(const struct co_pdo_signal* a,
+				const struct co_pdo_signal* b)
+{
+	switch (a->type) {
+	case CO_PDO_SIGNAL_UNSIGNED:
+		return a->value.u > b->value.u ? a->value.u - b->value.u
+					       : b->value.u - a->value.u;
+	case CO_PDO_SIGNAL_SIGNED:
+		return pdo_map__abs((double)a->value.i - (double)b->value.i);
+	case CO_PDO_SIGNAL_REAL:
+		return pdo_map__abs(a->value.real - b->value.real);
+	}
+
+	return 0.0;
+}
+
+int pdo_map_differs(const struct pdo_map* self, const void* a, const void* b,
+		    size_t size, double deadband)
+{
+	if (size * 8 < self->length || size > sizeof(uint64_t))
+		return -1;
+
+	uint64_t raw_a = 0, raw_b = 0;
+	byteorder2(&raw_a, a, sizeof(raw_a), size);
+	byteorder2(&raw_b, b, sizeof(raw_b), size);
+
+	for (unsigned int i = 0; i < self->n_entries; ++i) {
+		const struct pdo_map_entry* entry = &self->entries[i];
+
+		uint64_t bits_a = (raw_a >> entry->offset) & entry->mask;
+		uint64_t bits_b = (raw_b >> entry->offset) & entry->mask;
+
+		if (bits_a == bits_b)
+			continue;
+
+		struct co_pdo_signal signal_a = { .type = entry->signal_type };
+		struct co_pdo_signal signal_b = { .type = entry->signal_type };
+
+		pdo_map__from_bits(entry, &signal_a, bits_a);
+		pdo_map__from_bits(entry, &signal_b, bits_b);
+
+		/* NaN never compares greater, so any change to or from it
+		 * counts.
+		 */
+		double distance = pdo_map__distance(&signal_a, &signal_b);
+		if (!(distance <= deadband))
+			return 1;
+	}
+
+	return 0;
+}
+
+size_t pdo_map_encode(const struct pdo_map* self, void* dst,
+		      const struct co_pdo_signal* signals)
+{
+	uint64_t raw = 0;
+
+	for (unsigned int i = 0; i < self->n_entries; ++i) {
+		const struct pdo_map_entry* entry = &self->entries[i];
+		struct co_pdo_signal bound;
+		const struct co_pdo_signal* signal = &bound;
+
+		if (signals) {
+			signal = &signals[i];
+		} else if (entry->binding) {
+			pdo_map__load(entry, &bound);
+		} else {
+			continue;
+		}
+
+		raw |= pdo_map__to_bits(entry, signal) << entry->offset;
+	}
+
+	byteorder(dst, &raw, sizeof(raw));
+	return pdo_map_size(self);
+}
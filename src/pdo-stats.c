@@ -0,0 +1,203 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <string.h>
+#include <time.h>
+#include <linux/can.h>
+
+#include "canopen.h"
+#include "canopen/pdo-stats.h"
+#include "time-utils.h"
+
+/* The average moves 1/8 of the way towards each new interval */
+#define PDO_STATS_EWMA_SHIFT 3
+
+static struct pdo_stats pdo_stats__pdos[PDO_STATS_NODES][PDO_STATS_PDOS];
+
+static struct pdo_stats* pdo_stats__get(int nodeid, int pdo)
+{
+	if (nodeid < 1 || nodeid >= PDO_STATS_NODES)
+		return NULL;
+
+	if (pdo < 1 || pdo > PDO_STATS_PDOS)
+		return NULL;
+
+	return &pdo_stats__pdos[nodeid][pdo - 1];
+}
+
+static uint64_t pdo_stats__expected(const struct pdo_stats* self)
+{
+	if (self->expected_period)
+		return self->expected_period;
+
+	return self->n_averaged >= PDO_STATS_LEARN_FRAMES ? self->interval : 0;
+}
+
+static void pdo_stats__add_jitter(struct pdo_stats* self, int64_t jitter)
+{
+	if (self->n_timed++ == 0) {
+		self->jitter_min = jitter;
+		self->jitter_max = jitter;
+		return;
+	}
+
+	if (jitter < self->jitter_min)
+		self->jitter_min = jitter;
+
+	if (jitter > self->jitter_max)
+		self->jitter_max = jitter;
+}
+
+/* The node has slowed down for good, so the old period is no use as a
+ * reference. The interval that tipped it over starts the new average.
+ */
+static void pdo_stats__relearn(struct pdo_stats* self, uint64_t interval)
+{
+	self->interval = interval;
+	self->n_averaged = 1;
+	self->n_consecutive_gaps = 0;
+	self->n_timed = 0;
+	self->jitter_min = 0;
+	self->jitter_max = 0;
+	self->n_relearned++;
+}
+
+static void pdo_stats__add_interval(struct pdo_stats* self, uint64_t interval)
+{
+	uint64_t expected = pdo_stats__expected(self);
+
+	if (expected && interval * 2 > expected * 3) {
+		self->n_gaps++;
+		if (interval > self->gap_max)
+			self->gap_max = interval;
+
+		if (!self->expected_period && ++self->n_consecutive_gaps
+					      >= PDO_STATS_RELEARN_GAPS)
+			pdo_stats__relearn(self, interval);
+
+		return;
+	}
+
+	self->n_consecutive_gaps = 0;
+	self->n_averaged++;
+
+	if (expected)
+		pdo_stats__add_jitter(self, (int64_t)interval
+					    - (int64_t)expected);
+
+	if (self->interval == 0) {
+		self->interval = interval;
+		return;
+	}
+
+	int64_t diff = (int64_t)interval - (int64_t)self->interval;
+	self->interval += diff / (1 << PDO_STATS_EWMA_SHIFT);
+}
+
+void pdo_stats_add(int nodeid, int pdo, uint64_t now)
+{
+	struct pdo_stats* self = pdo_stats__get(nodeid, pdo);
+	if (!self)
+		return;
+
+	if (self->n_frames == 0)
+		self->first_seen = now;
+	else if (now > self->last_seen)
+		pdo_stats__add_interval(self, now - self->last_seen);
+
+	self->n_frames++;
+	self->last_seen = now;
+}
+
+void pdo_stats_feed(const struct can_frame* cf)
+{
+	uint32_t id = cf->can_id & CAN_SFF_MASK;
+	if (id < R_TPDO1 || cf->can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG))
+		return;
+
+	/* TPDOn is 0x180 + 0x100 * (n - 1) + nodeid; RPDOs have bit 7 set */
+	unsigned int offset = id - R_TPDO1;
+	unsigned int pdo = offset >> 8;
+	unsigned int nodeid = offset & 0xff;
+
+	if (pdo >= PDO_STATS_PDOS || nodeid == 0 || nodeid >= PDO_STATS_NODES)
+		return;
+
+	pdo_stats_add(nodeid, pdo + 1, gettime_us(CLOCK_MONOTONIC));
+}
+
+int pdo_stats_set_expected_period(int nodeid, int pdo, uint64_t period)
+{
+	struct pdo_stats* self = pdo_stats__get(nodeid, pdo);
+	if (!self)
+		return -1;
+
+	self->expected_period = period;
+	self->n_consecutive_gaps = 0;
+	self->n_timed = 0;
+	self->jitter_min = 0;
+	self->jitter_max = 0;
+	return 0;
+}
+
+int pdo_stats_get(int nodeid, int pdo, struct pdo_stats* stats)
+{
+	const struct pdo_stats* self = pdo_stats__get(nodeid, pdo);
+	if (!self)
+		return -1;
+
+	*stats = *self;
+	return 0;
+}
+
+void pdo_stats_print_stats(FILE* out)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	int is_first = 1;
+
+	fprintf(out, "[");
+
+	for (int nodeid = 1; nodeid < PDO_STATS_NODES; ++nodeid)
+		for (int pdo = 1; pdo <= PDO_STATS_PDOS; ++pdo) {
+			const struct pdo_stats* self =
+				pdo_stats__get(nodeid, pdo);
+
+			if (self->n_frames == 0)
+				continue;
+
+			double rate = self->interval
+				    ? 1e6 / (double)self->interval : 0.0;
+
+			fprintf(out, "%s\n { \"node\": %d, \"pdo\": %d, "
+				"\"frames\": %llu, \"rate\": %.1f, "
+				"\"interval\": %llu, \"expected\": %llu, "
+				"\"jitter_min\": %lld, \"jitter_max\": %lld, "
+				"\"gaps\": %llu, \"gap_max\": %llu, "
+				"\"relearned\": %llu, \"age\": %llu }",
+				is_first ? "" : ",", nodeid, pdo,
+				(unsigned long long)self->n_frames, rate,
+				(unsigned long long)self->interval,
+				(unsigned long long)pdo_stats__expected(self),
+				(long long)self->jitter_min,
+				(long long)self->jitter_max,
+				(unsigned long long)self->n_gaps,
+				(unsigned long long)self->gap_max,
+				(unsigned long long)self->n_relearned,
+				(unsigned long long)(now - self->last_seen)
+					/ 1000);
+			is_first = 0;
+		}
+
+	fprintf(out, "\n]\n");
+}
@@ -0,0 +1,333 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Shared memory process image
+ *
+ * The master keeps the status of every node and the latest TPDOs, raw and
+ * decoded, in a shared memory object so that local applications can read them
+ * at any rate without writing a driver or asking the master for anything.
+ *
+ * Each node and each PDO has its own slot, guarded by a sequence lock. The
+ * writer makes the sequence number odd, updates the slot and makes it even
+ * again. A reader copies the slot and tries again if the sequence number was
+ * odd or changed while it was copying, but gives up after a while so that it
+ * does not hang if the master died in the middle of a write. PDO slots are only written on the main
+ * loop; node slots may also be written by workers, so those writes are
+ * serialised with a mutex.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canopen/process-image.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+
+#define PROCESS_IMAGE_READ_RETRIES 1000
+
+static struct process_image* process_image__ = NULL;
+static char process_image__name[256];
+static pthread_mutex_t process_image__node_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void process_image__format_name(char* dst, size_t size,
+				       const char* iface)
+{
+	snprintf(dst, size, "/canopen2.%s.image", iface);
+	dst[size - 1] = '\0';
+
+	/* Only the leading slash is allowed */
+	for (char* p = dst + 1; *p; ++p)
+		if (*p == '/')
+			*p = '_';
+}
+
+static inline int process_image__is_nodeid_valid(int nodeid)
+{
+	return 1 <= nodeid && nodeid < PROCESS_IMAGE_NODES;
+}
+
+static inline void process_image__write_begin(uint32_t* seq)
+{
+	co_atomic_add_fetch(seq, 1);
+	co_atomic_fence();
+}
+
+static inline void process_image__write_end(uint32_t* seq)
+{
+	co_atomic_fence();
+	co_atomic_add_fetch(seq, 1);
+}
+
+int process_image_init(const char* iface)
+{
+	process_image__format_name(process_image__name,
+				   sizeof(process_image__name), iface);
+
+	/* Stale images are replaced so that readers never see an old layout */
+	shm_unlink(process_image__name);
+
+	int fd = shm_open(process_image__name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, sizeof(struct process_image)) < 0)
+		goto failure;
+
+	struct process_image* image = mmap(NULL, sizeof(*image),
+					   PROT_READ | PROT_WRITE, MAP_SHARED,
+					   fd, 0);
+	if (image == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	memset(image, 0, sizeof(*image));
+	image->version = PROCESS_IMAGE_VERSION;
+	image->size = sizeof(*image);
+
+	/* Readers check the magic number last */
+	co_atomic_store(&image->magic, PROCESS_IMAGE_MAGIC);
+
+	process_image__ = image;
+	return 0;
+
+failure:
+	close(fd);
+	shm_unlink(process_image__name);
+	return -1;
+}
+
+void process_image_cleanup(void)
+{
+	if (!process_image__)
+		return;
+
+	munmap(process_image__, sizeof(*process_image__));
+	shm_unlink(process_image__name);
+	process_image__ = NULL;
+}
+
+void process_image_set_active(int nodeid, int is_active,
+			      const struct process_image_identity* identity)
+{
+	if (!process_image__ || !process_image__is_nodeid_valid(nodeid))
+		return;
+
+	struct process_image_node* node = &process_image__->nodes[nodeid];
+
+	pthread_mutex_lock(&process_image__node_mutex);
+	process_image__write_begin(&node->seq);
+
+	node->is_active = !!is_active;
+
+	if (identity) {
+		node->identity = *identity;
+		node->identity.name[sizeof(node->identity.name) - 1] = '\0';
+	}
+
+	process_image__write_end(&node->seq);
+	pthread_mutex_unlock(&process_image__node_mutex);
+}
+
+void process_image_set_state(int nodeid, uint32_t state)
+{
+	if (!process_image__ || !process_image__is_nodeid_valid(nodeid))
+		return;
+
+	struct process_image_node* node = &process_image__->nodes[nodeid];
+	uint64_t now = gettime_us(CLOCK_REALTIME);
+
+	pthread_mutex_lock(&process_image__node_mutex);
+	process_image__write_begin(&node->seq);
+
+	node->state = state;
+	node->last_seen = now;
+
+	process_image__write_end(&node->seq);
+	pthread_mutex_unlock(&process_image__node_mutex);
+}
+
+void process_image_set_error_register(int nodeid, uint32_t error_register)
+{
+	if (!process_image__ || !process_image__is_nodeid_valid(nodeid))
+		return;
+
+	struct process_image_node* node = &process_image__->nodes[nodeid];
+
+	pthread_mutex_lock(&process_image__node_mutex);
+	process_image__write_begin(&node->seq);
+
+	node->error_register = error_register;
+
+	process_image__write_end(&node->seq);
+	pthread_mutex_unlock(&process_image__node_mutex);
+}
+
+void process_image_set_tpdo(int nodeid, int pdo, const void* data, size_t size,
+			    const struct co_pdo_signal* signals,
+			    size_t n_signals)
+{
+	if (!process_image__ || !process_image__is_nodeid_valid(nodeid))
+		return;
+
+	if (pdo < 1 || pdo > PROCESS_IMAGE_PDOS)
+		return;
+
+	struct process_image_pdo* slot = &process_image__->tpdos[nodeid][pdo - 1];
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	if (size > sizeof(slot->data))
+		size = sizeof(slot->data);
+
+	if (n_signals > PROCESS_IMAGE_SIGNALS_MAX)
+		n_signals = PROCESS_IMAGE_SIGNALS_MAX;
+
+	process_image__write_begin(&slot->seq);
+
+	slot->count++;
+	slot->timestamp = now;
+	slot->size = size;
+	memcpy(slot->data, data, size);
+	slot->n_signals = n_signals;
+
+	for (size_t i = 0; i < n_signals; ++i) {
+		struct process_image_signal* dst = &slot->signals[i];
+		const struct co_pdo_signal* src = &signals[i];
+
+		dst->index = src->index;
+		dst->subindex = src->subindex;
+		dst->type = src->type;
+		dst->value.u = src->value.u;
+	}
+
+	process_image__write_end(&slot->seq);
+}
+
+#pragma GCC visibility push(default)
+
+const struct process_image* process_image_open(const char* iface)
+{
+	char name[256];
+	process_image__format_name(name, sizeof(name), iface);
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0
+	 || (size_t)st.st_size != sizeof(struct process_image))
+		goto failure;
+
+	struct process_image* image = mmap(NULL, sizeof(*image), PROT_READ,
+					   MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED)
+		goto failure;
+
+	close(fd);
+
+	if (co_atomic_load(&image->magic) != PROCESS_IMAGE_MAGIC
+	 || image->version != PROCESS_IMAGE_VERSION
+	 || image->size != sizeof(*image)) {
+		munmap(image, sizeof(*image));
+		return NULL;
+	}
+
+	return image;
+
+failure:
+	close(fd);
+	return NULL;
+}
+
+void process_image_close(const struct process_image* image)
+{
+	if (image)
+		munmap((void*)image, sizeof(*image));
+}
+
+int process_image_read_node(const struct process_image* image, int nodeid,
+			    struct process_image_node* node)
+{
+	if (!process_image__is_nodeid_valid(nodeid))
+		return -1;
+
+	const struct process_image_node* slot = &image->nodes[nodeid];
+
+	for (int i = 0; i < PROCESS_IMAGE_READ_RETRIES; ++i) {
+		uint32_t seq = co_atomic_load(&slot->seq);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		memcpy(node, slot, sizeof(*node));
+		co_atomic_fence();
+
+		if (co_atomic_load(&slot->seq) == seq)
+			return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+int process_image_read_tpdo(const struct process_image* image, int nodeid,
+			    int pdo, struct process_image_pdo* tpdo)
+{
+	if (!process_image__is_nodeid_valid(nodeid))
+		return -1;
+
+	if (pdo < 1 || pdo > PROCESS_IMAGE_PDOS)
+		return -1;
+
+	const struct process_image_pdo* slot = &image->tpdos[nodeid][pdo - 1];
+
+	for (int i = 0; i < PROCESS_IMAGE_READ_RETRIES; ++i) {
+		uint32_t seq = co_atomic_load(&slot->seq);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		/* Only the signals that are in use are copied */
+		memcpy(tpdo, slot, offsetof(struct process_image_pdo, signals));
+
+		size_t n_signals = tpdo->n_signals;
+		if (n_signals > PROCESS_IMAGE_SIGNALS_MAX)
+			n_signals = PROCESS_IMAGE_SIGNALS_MAX;
+
+		memcpy(tpdo->signals, slot->signals,
+		       n_signals * sizeof(tpdo->signals[0]));
+		co_atomic_fence();
+
+		if (co_atomic_load(&slot->seq) == seq)
+			return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+#pragma GCC visibility pop
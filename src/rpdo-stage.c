@@ -0,0 +1,302 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+/* RPDO staging
+ *
+ * Drivers often compute outputs faster than there is any point in sending
+ * them. A stage holds the latest value of one RPDO and decides when it goes
+ * out, so that values that would have been overwritten by the next one before
+ * the node acts on them are never put on the bus.
+ *
+ * The value that was last sent is kept for the inhibit time and for change
+ * detection. A value that has to wait for the inhibit time to pass is sent by
+ * a one-shot timer; anything written in the meantime replaces it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/queue.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/master.h"
+#include "canopen/pdo-map.h"
+#include "canopen/rpdo-stage.h"
+#include "canopen/sync-cycle.h"
+#include "time-utils.h"
+
+struct rpdo_stage {
+	LIST_ENTRY(rpdo_stage) links;
+
+	int nodeid, pdo;
+	enum co_rpdo_mode mode;
+	uint64_t inhibit_time; /* us */
+	const struct pdo_map* map;
+	double deadband;
+
+	struct mloop_timer* timer;
+
+	int is_dirty;
+	size_t size;
+	unsigned char data[8];
+
+	int has_sent;
+	uint64_t sent_time;
+	size_t sent_size;
+	unsigned char sent_data[8];
+
+	unsigned long n_writes;
+	unsigned long n_sent;
+	unsigned long n_replaced; /* Overwritten before they were sent */
+	unsigned long n_unchanged; /* Within the deadband */
+};
+
+static LIST_HEAD(, rpdo_stage) rpdo_stage__list =
+	LIST_HEAD_INITIALIZER(rpdo_stage__list);
+
+static const char* rpdo_stage__mode_str(enum co_rpdo_mode mode)
+{
+	switch (mode) {
+	case CO_RPDO_IMMEDIATE: return "immediate";
+	case CO_RPDO_ON_CHANGE: return "on-change";
+	case CO_RPDO_ON_SYNC: return "on-sync";
+	case CO_RPDO_ON_FLUSH: return "on-flush";
+	}
+
+	return "unknown";
+}
+
+static void rpdo_stage__mark_sent(struct rpdo_stage* self, uint64_t now)
+{
+	self->is_dirty = 0;
+	self->has_sent = 1;
+	self->sent_time = now;
+	self->sent_size = self->size;
+	memcpy(self->sent_data, self->data, self->size);
+	self->n_sent++;
+}
+
+static int rpdo_stage__send(struct rpdo_stage* self, uint64_t now)
+{
+	static const int types[CO_DRV_PDO_COUNT] = {
+		R_RPDO1, R_RPDO2, R_RPDO3, R_RPDO4
+	};
+
+	if (mloop_timer_is_started(self->timer))
+		mloop_timer_stop(self->timer);
+
+	/* A value that could not be sent stays staged for the next attempt */
+	if (co__rpdox(self->nodeid, types[self->pdo - 1], self->data,
+		      self->size) < 0)
+		return -1;
+
+	rpdo_stage__mark_sent(self, now);
+	return 0;
+}
+
+static void rpdo_stage__on_timeout(struct mloop_timer* timer)
+{
+	struct rpdo_stage* self = mloop_timer_get_context(timer);
+
+	/* The timer is periodic so that it can be stopped here */
+	mloop_timer_stop(timer);
+
+	if (self->is_dirty)
+		rpdo_stage__send(self, gettime_us(CLOCK_MONOTONIC));
+}
+
+struct rpdo_stage* rpdo_stage_new(int nodeid, int pdo,
+				  const struct pdo_map* map)
+{
+	if (pdo < 1 || pdo > CO_DRV_PDO_COUNT)
+		return NULL;
+
+	struct rpdo_stage* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->nodeid = nodeid;
+	self->pdo = pdo;
+	self->map = map;
+
+	self->timer = mloop_timer_new(mloop_default());
+	if (!self->timer)
+		goto failure;
+
+	/* The event loop frees the stage along with the timer */
+	mloop_timer_set_type(self->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_context(self->timer, self, free);
+	mloop_timer_set_callback(self->timer, rpdo_stage__on_timeout);
+
+	LIST_INSERT_HEAD(&rpdo_stage__list, self, links);
+	return self;
+
+failure:
+	free(self);
+	return NULL;
+}
+
+void rpdo_stage_free(struct rpdo_stage* self)
+{
+	if (!self)
+		return;
+
+	if (mloop_timer_is_started(self->timer))
+		mloop_timer_stop(self->timer);
+
+	LIST_REMOVE(self, links);
+	mloop_timer_unref(self->timer);
+}
+
+void rpdo_stage_set_mode(struct rpdo_stage* self, enum co_rpdo_mode mode)
+{
+	self->mode = mode;
+}
+
+void rpdo_stage_set_inhibit_time(struct rpdo_stage* self, unsigned long time)
+{
+	self->inhibit_time = time * 1000ULL;
+}
+
+void rpdo_stage_set_deadband(struct rpdo_stage* self, double deadband)
+{
+	self->deadband = deadband;
+}
+
+static int rpdo_stage__is_changed(const struct rpdo_stage* self,
+				  const void* data, size_t size)
+{
+	if (!self->has_sent || size != self->sent_size)
+		return 1;
+
+	if (!self->map)
+		return memcmp(data, self->sent_data, size) != 0;
+
+	return pdo_map_differs(self->map, data, self->sent_data, size,
+			       self->deadband) != 0;
+}
+
+static int rpdo_stage__send_when_allowed(struct rpdo_stage* self)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	uint64_t allowed = self->sent_time + self->inhibit_time;
+
+	if (!self->has_sent || now >= allowed)
+		return rpdo_stage__send(self, now);
+
+	if (!mloop_timer_is_started(self->timer)) {
+		mloop_timer_set_time(self->timer, (allowed - now) * 1000ULL);
+		mloop_timer_start(self->timer);
+	}
+
+	return 0;
+}
+
+static int rpdo_stage__queue_for_sync(struct rpdo_stage* self)
+{
+	if (sync_cycle_queue_rpdo(self->nodeid, self->pdo, self->data,
+				  self->size) < 0)
+		return -1;
+
+	rpdo_stage__mark_sent(self, gettime_us(CLOCK_MONOTONIC));
+	return 0;
+}
+
+int rpdo_stage_write(struct rpdo_stage* self, const void* data, size_t size)
+{
+	if (!data || size > sizeof(self->data))
+		return -1;
+
+	self->n_writes++;
+
+	if (self->mode == CO_RPDO_ON_CHANGE
+	 && !rpdo_stage__is_changed(self, data, size)) {
+		/* What the node has is close enough, so anything still
+		 * waiting for the inhibit time is no longer needed.
+		 */
+		self->is_dirty = 0;
+		self->n_unchanged++;
+		return 0;
+	}
+
+	if (self->is_dirty)
+		self->n_replaced++;
+
+	memcpy(self->data, data, size);
+	self->size = size;
+	self->is_dirty = 1;
+
+	switch (self->mode) {
+	case CO_RPDO_ON_SYNC:
+		return sync_cycle_is_running()
+		     ? rpdo_stage__queue_for_sync(self) : 0;
+	case CO_RPDO_ON_FLUSH:
+		return 0;
+	case CO_RPDO_IMMEDIATE:
+	case CO_RPDO_ON_CHANGE:
+		break;
+	}
+
+	return rpdo_stage__send_when_allowed(self);
+}
+
+int rpdo_stage_flush(struct rpdo_stage* self)
+{
+	if (!self->is_dirty)
+		return 0;
+
+	return rpdo_stage__send(self, gettime_us(CLOCK_MONOTONIC));
+}
+
+void rpdo_stage_process_sync(void)
+{
+	struct rpdo_stage* stage;
+	uint64_t now = 0;
+
+	LIST_FOREACH(stage, &rpdo_stage__list, links) {
+		if (stage->mode != CO_RPDO_ON_SYNC || !stage->is_dirty)
+			continue;
+
+		if (now == 0)
+			now = gettime_us(CLOCK_MONOTONIC);
+
+		rpdo_stage__send(stage, now);
+	}
+}
+
+void rpdo_stage_print_stats(FILE* out)
+{
+	const struct rpdo_stage* stage;
+	int is_first = 1;
+
+	fprintf(out, "[");
+
+	LIST_FOREACH(stage, &rpdo_stage__list, links) {
+		fprintf(out, "%s\n { \"node\": %d, \"pdo\": %d, \"mode\": \"%s\", "
+			"\"inhibit_time\": %llu, \"writes\": %lu, \"sent\": %lu, "
+			"\"replaced\": %lu, \"unchanged\": %lu, \"dirty\": %s }",
+			is_first ? "" : ",", stage->nodeid, stage->pdo,
+			rpdo_stage__mode_str(stage->mode),
+			(unsigned long long)stage->inhibit_time / 1000,
+			stage->n_writes, stage->n_sent, stage->n_replaced,
+			stage->n_unchanged, stage->is_dirty ? "true" : "false");
+		is_first = 0;
+	}
+
+	fprintf(out, "\n]\n");
+}
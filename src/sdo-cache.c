@@ -0,0 +1,340 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Object dictionary cache
+ *
+ * Keeps the last known value of objects that have been uploaded from or
+ * downloaded to a node so that repeated reads, e.g. from REST clients, can be
+ * served without going to the bus.
+ *
+ * Constant and identity objects are considered fresh until the node boots up
+ * again. Other readable objects are fresh for a configurable amount of time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sys/tree.h"
+#include "canopen.h"
+#include "canopen/sdo-cache.h"
+#include "time-utils.h"
+
+/* Larger objects are mostly domains that are not worth keeping around */
+#define SDO_CACHE_MAX_OBJ_SIZE 1024
+
+#define SDO_CACHE_KEY(index, subindex) (((index) << 8) | (subindex))
+
+struct sdo_cache_entry {
+	RB_ENTRY(sdo_cache_entry) rb_entry;
+	uint32_t key;
+	uint64_t timestamp;
+	int is_size_indicated;
+	struct vector value;
+};
+
+RB_HEAD(sdo_cache_tree, sdo_cache_entry);
+
+struct sdo_cache_node {
+	pthread_mutex_t mutex;
+	struct sdo_cache_tree tree;
+	struct sdo_cache_stats stats;
+};
+
+static inline int sdo_cache_entry_cmp(const struct sdo_cache_entry* e1,
+				      const struct sdo_cache_entry* e2)
+{
+	return e1->key < e2->key ? -1 : e1->key > e2->key;
+}
+
+/* Not all of the generated functions are used */
+RB_GENERATE_INTERNAL(sdo_cache_tree, sdo_cache_entry, rb_entry,
+		     sdo_cache_entry_cmp, __attribute__((unused)) static)
+
+static int sdo_cache__is_enabled = 0;
+static uint64_t sdo_cache__max_age = 0;
+
+/* Index 0 is unused */
+static struct sdo_cache_node sdo_cache__node[CANOPEN_NODEID_MAX + 1];
+
+static inline struct sdo_cache_node* sdo_cache__get_node(int nodeid)
+{
+	return &sdo_cache__node[nodeid];
+}
+
+static inline int sdo_cache__is_valid_nodeid(int nodeid)
+{
+	return CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX;
+}
+
+static inline uint64_t sdo_cache__now(void)
+{
+	return gettime_ms(CLOCK_MONOTONIC);
+}
+
+static void sdo_cache__entry_free(struct sdo_cache_entry* entry)
+{
+	vector_destroy(&entry->value);
+	free(entry);
+}
+
+static void sdo_cache__clear(struct sdo_cache_node* node)
+{
+	struct sdo_cache_entry* entry;
+
+	while (!RB_EMPTY(&node->tree)) {
+		entry = RB_MIN(sdo_cache_tree, &node->tree);
+		RB_REMOVE(sdo_cache_tree, &node->tree, entry);
+		sdo_cache__entry_free(entry);
+	}
+
+	node->stats.entries = 0;
+}
+
+int sdo_cache_init(uint64_t max_age)
+{
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct sdo_cache_node* node = sdo_cache__get_node(i);
+		memset(node, 0, sizeof(*node));
+		pthread_mutex_init(&node->mutex, NULL);
+		RB_INIT(&node->tree);
+	}
+
+	sdo_cache__max_age = max_age;
+	sdo_cache__is_enabled = 1;
+
+	return 0;
+}
+
+void sdo_cache_cleanup(void)
+{
+	if (!sdo_cache__is_enabled)
+		return;
+
+	sdo_cache__is_enabled = 0;
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		struct sdo_cache_node* node = sdo_cache__get_node(i);
+		sdo_cache__clear(node);
+		pthread_mutex_destroy(&node->mutex);
+	}
+}
+
+int sdo_cache_is_enabled(void)
+{
+	return sdo_cache__is_enabled;
+}
+
+static int sdo_cache__is_identity(int index)
+{
+	switch (index) {
+	case 0x1000: /* Device type */
+	case 0x1008: /* Device name */
+	case 0x1009: /* Hardware version */
+	case 0x100A: /* Software version */
+	case 0x1018: /* Identity */
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Writing to these is a command rather than setting a value */
+static int sdo_cache__is_command(int index)
+{
+	switch (index) {
+	case 0x1010: /* Store parameters */
+	case 0x1011: /* Restore default parameters */
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t sdo_cache_max_age(int index, enum eds_obj_access access)
+{
+	if (!sdo_cache__is_enabled)
+		return 0;
+
+	if (access & EDS_OBJ_CONST || sdo_cache__is_identity(index))
+		return SDO_CACHE_FOREVER;
+
+	if (!(access & EDS_OBJ_R) || sdo_cache__is_command(index))
+		return 0;
+
+	return sdo_cache__max_age;
+}
+
+static struct sdo_cache_entry*
+sdo_cache__find(struct sdo_cache_node* node, uint32_t key)
+{
+	struct sdo_cache_entry cmp = { .key = key };
+	return RB_FIND(sdo_cache_tree, &node->tree, &cmp);
+}
+
+static inline int sdo_cache__is_fresh(const struct sdo_cache_entry* entry,
+				      uint64_t max_age)
+{
+	return max_age == SDO_CACHE_FOREVER
+	    || sdo_cache__now() - entry->timestamp <= max_age;
+}
+
+int sdo_cache_lookup(int nodeid, int index, int subindex, uint64_t max_age,
+		     struct vector* dst, int* is_size_indicated)
+{
+	if (!sdo_cache__is_enabled || max_age == 0
+	 || !sdo_cache__is_valid_nodeid(nodeid))
+		return -1;
+
+	int rc = -1;
+	struct sdo_cache_node* node = sdo_cache__get_node(nodeid);
+
+	pthread_mutex_lock(&node->mutex);
+
+	struct sdo_cache_entry* entry;
+	entry = sdo_cache__find(node, SDO_CACHE_KEY(index, subindex));
+	if (!entry || !sdo_cache__is_fresh(entry, max_age))
+		goto done;
+
+	if (vector_assign(dst, entry->value.data, entry->value.index) < 0)
+		goto done;
+
+	if (is_size_indicated)
+		*is_size_indicated = entry->is_size_indicated;
+
+	rc = 0;
+done:
+	if (rc == 0)
+		node->stats.hits++;
+	else
+		node->stats.misses++;
+
+	pthread_mutex_unlock(&node->mutex);
+	return rc;
+}
+
+void sdo_cache_store(int nodeid, int index, int subindex, const void* data,
+		     size_t size, int is_size_indicated)
+{
+	if (!sdo_cache__is_enabled || !sdo_cache__is_valid_nodeid(nodeid))
+		return;
+
+	if (size > SDO_CACHE_MAX_OBJ_SIZE || sdo_cache__is_command(index))
+		return;
+
+	struct sdo_cache_node* node = sdo_cache__get_node(nodeid);
+	uint32_t key = SDO_CACHE_KEY(index, subindex);
+
+	pthread_mutex_lock(&node->mutex);
+
+	struct sdo_cache_entry* entry = sdo_cache__find(node, key);
+	if (!entry) {
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+			goto done;
+
+		memset(entry, 0, sizeof(*entry));
+		entry->key = key;
+
+		RB_INSERT(sdo_cache_tree, &node->tree, entry);
+		node->stats.entries++;
+	}
+
+	if (vector_assign(&entry->value, data, size) < 0) {
+		RB_REMOVE(sdo_cache_tree, &node->tree, entry);
+		sdo_cache__entry_free(entry);
+		node->stats.entries--;
+		goto done;
+	}
+
+	entry->timestamp = sdo_cache__now();
+	entry->is_size_indicated = is_size_indicated;
+	node->stats.stores++;
+
+done:
+	pthread_mutex_unlock(&node->mutex);
+}
+
+void sdo_cache_invalidate(int nodeid)
+{
+	if (!sdo_cache__is_enabled || !sdo_cache__is_valid_nodeid(nodeid))
+		return;
+
+	struct sdo_cache_node* node = sdo_cache__get_node(nodeid);
+
+	pthread_mutex_lock(&node->mutex);
+	if (!RB_EMPTY(&node->tree))
+		node->stats.invalidations++;
+	sdo_cache__clear(node);
+	pthread_mutex_unlock(&node->mutex);
+}
+
+void sdo_cache_get_stats(int nodeid, struct sdo_cache_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!sdo_cache__is_enabled || !sdo_cache__is_valid_nodeid(nodeid))
+		return;
+
+	struct sdo_cache_node* node = sdo_cache__get_node(nodeid);
+
+	pthread_mutex_lock(&node->mutex);
+	*stats = node->stats;
+	pthread_mutex_unlock(&node->mutex);
+}
+
+static void sdo_cache__print_node_stats(FILE* out,
+					const struct sdo_cache_stats* stats)
+{
+	fprintf(out, "{ \"hits\": %llu, \"misses\": %llu, \"stores\": %llu, "
+		"\"invalidations\": %llu, \"entries\": %zu }",
+		(unsigned long long)stats->hits,
+		(unsigned long long)stats->misses,
+		(unsigned long long)stats->stores,
+		(unsigned long long)stats->invalidations,
+		stats->entries);
+}
+
+void sdo_cache_print_stats(FILE* out)
+{
+	struct sdo_cache_stats total = { 0 };
+	struct sdo_cache_stats stats;
+	int is_first = 1;
+
+	fprintf(out, "{\n \"enabled\": %s,\n \"max-age\": %llu,\n \"nodes\": {",
+		sdo_cache__is_enabled ? "true" : "false",
+		(unsigned long long)sdo_cache__max_age);
+
+	for (int i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		sdo_cache_get_stats(i, &stats);
+		if (!stats.hits && !stats.misses && !stats.stores)
+			continue;
+
+		total.hits += stats.hits;
+		total.misses += stats.misses;
+		total.stores += stats.stores;
+		total.invalidations += stats.invalidations;
+		total.entries += stats.entries;
+
+		fprintf(out, "%s\n  \"%d\": ", is_first ? "" : ",", i);
+		sdo_cache__print_node_stats(out, &stats);
+		is_first = 0;
+	}
+
+	fprintf(out, "\n },\n \"total\": ");
+	sdo_cache__print_node_stats(out, &total);
+	fprintf(out, "\n}\n");
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Streaming SDO transfers from and to files
+ *
+ * Large domain objects such as firmware images or data logs are transferred
+ * directly between the file and the CAN frames, so memory use does not depend
+ * on the size of the object.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canopen/sdo_req.h"
+#include "canopen/sdo-file.h"
+
+static struct sdo_file* sdo_file__new(int fd)
+{
+	struct sdo_file* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+	self->fd = fd;
+
+	return self;
+}
+
+struct sdo_file* sdo_file_open_source(const char* path)
+{
+	struct stat st;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0)
+		goto failure;
+
+	/* There is nothing to map and nothing worth streaming */
+	if (st.st_size == 0) {
+		errno = EINVAL;
+		goto failure;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto failure;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	struct sdo_file* self = sdo_file__new(fd);
+	if (!self)
+		goto new_failure;
+
+	self->map = map;
+	self->size = st.st_size;
+
+	return self;
+
+new_failure:
+	munmap(map, st.st_size);
+failure:
+	close(fd);
+	return NULL;
+}
+
+struct sdo_file* sdo_file_open_sink(const char* path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	struct sdo_file* self = sdo_file__new(fd);
+	if (!self)
+		close(fd);
+
+	return self;
+}
+
+void sdo_file_close(void* ptr)
+{
+	struct sdo_file* self = ptr;
+
+	if (self->map)
+		munmap((void*)self->map, self->size);
+
+	close(self->fd);
+	free(self);
+}
+
+ssize_t sdo_file_read(void* ptr, void* dst, size_t size, size_t offset)
+{
+	struct sdo_file* self = ptr;
+
+	if (offset > self->size || size > self->size - offset)
+		return -1;
+
+	memcpy(dst, (const char*)self->map + offset, size);
+	return size;
+}
+
+int sdo_file_write(void* ptr, const void* src, size_t size, size_t offset)
+{
+	struct sdo_file* self = ptr;
+
+	/* Drop what was written by an earlier attempt of the transfer */
+	if (offset == 0 && self->size > 0 && ftruncate(self->fd, 0) < 0)
+		return -1;
+
+	if (pwrite(self->fd, src, size, offset) != (ssize_t)size)
+		return -1;
+
+	self->size = offset + size;
+	return 0;
+}
+
+struct sdo_req* sdo_file_new_download(struct sdo_req_info* info,
+				      const char* path)
+{
+	struct sdo_file* file = sdo_file_open_source(path);
+	if (!file)
+		return NULL;
+
+	info->type = SDO_REQ_DOWNLOAD;
+	info->dl_source = sdo_file_read;
+	info->dl_size = file->size;
+	info->stream_context = file;
+	info->stream_free_fn = sdo_file_close;
+
+	struct sdo_req* req = sdo_req_new(info);
+	if (!req)
+		sdo_file_close(file);
+
+	return req;
+}
+
+struct sdo_req* sdo_file_new_upload(struct sdo_req_info* info,
+				    const char* path)
+{
+	struct sdo_file* file = sdo_file_open_sink(path);
+	if (!file)
+		return NULL;
+
+	info->type = SDO_REQ_UPLOAD;
+	info->ul_sink = sdo_file_write;
+	info->stream_context = file;
+	info->stream_free_fn = sdo_file_close;
+
+	struct sdo_req* req = sdo_req_new(info);
+	if (!req)
+		sdo_file_close(file);
+
+	return req;
+}
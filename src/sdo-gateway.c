@@ -0,0 +1,586 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* ASCII SDO gateway
+ *
+ * A line based TCP service for scripted SDO access in the style of CiA 309-3:
+ *
+ *	[<seq>] r[ead] <node> <index> <subindex> <datatype>
+ *	[<seq>] w[rite] <node> <index> <subindex> <datatype> <value>
+ *
+ * Unlike the REST service, a connection is kept open for any number of
+ * commands and a client does not have to wait for a reply before sending the
+ * next command. Commands to different nodes run concurrently, so replies may
+ * come back out of order; each reply starts with the sequence number of its
+ * command:
+ *
+ *	[<seq>] <value>
+ *	[<seq>] OK
+ *	[<seq>] ERROR: <SDO abort code in hex or CiA 309-3 error code>
+ *
+ * Data types are given as CiA 309-3 mnemonics, e.g. u16 or vs, or by their
+ * full names, e.g. UNSIGNED16.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <mloop.h>
+
+#include "canopen/sdo_req.h"
+#include "canopen.h"
+#include "conversions.h"
+#include "net-util.h"
+#include "rest.h"
+#include "sdo-gateway.h"
+#include "stream.h"
+#include "string-utils.h"
+#include "type-macros.h"
+#include "vector.h"
+
+#define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+
+struct sdo_gateway_client {
+	int ref;
+	int is_connected;
+	int is_discarding; /* the rest of a line that was too long */
+	unsigned int n_pending;
+	struct vector buffer;
+	FILE* output;
+};
+
+struct sdo_gateway_context {
+	struct sdo_gateway_client* client;
+	unsigned long seq;
+	enum canopen_type datatype;
+};
+
+struct sdo_gateway_type {
+	const char* name;
+	enum canopen_type type;
+};
+
+static const struct sdo_gateway_type sdo_gateway__types[] = {
+	{ "b", CANOPEN_BOOLEAN },
+	{ "i8", CANOPEN_INTEGER8 },
+	{ "i16", CANOPEN_INTEGER16 },
+	{ "i24", CANOPEN_INTEGER24 },
+	{ "i32", CANOPEN_INTEGER32 },
+	{ "i40", CANOPEN_INTEGER40 },
+	{ "i48", CANOPEN_INTEGER48 },
+	{ "i56", CANOPEN_INTEGER56 },
+	{ "i64", CANOPEN_INTEGER64 },
+	{ "u8", CANOPEN_UNSIGNED8 },
+	{ "u16", CANOPEN_UNSIGNED16 },
+	{ "u24", CANOPEN_UNSIGNED24 },
+	{ "u32", CANOPEN_UNSIGNED32 },
+	{ "u40", CANOPEN_UNSIGNED40 },
+	{ "u48", CANOPEN_UNSIGNED48 },
+	{ "u56", CANOPEN_UNSIGNED56 },
+	{ "u64", CANOPEN_UNSIGNED64 },
+	{ "r32", CANOPEN_REAL32 },
+	{ "r64", CANOPEN_REAL64 },
+	{ "t", CANOPEN_TIME_OF_DAY },
+	{ "td", CANOPEN_TIME_DIFFERENCE },
+	{ "vs", CANOPEN_VISIBLE_STRING },
+	{ "os", CANOPEN_OCTET_STRING },
+	{ "us", CANOPEN_UNICODE_STRING },
+	{ "d", CANOPEN_DOMAIN },
+};
+
+static struct mloop_socket* sdo_gateway__server = NULL;
+
+enum canopen_type sdo_gateway__type_from_string(const char* str)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(sdo_gateway__types); ++i)
+		if (strcasecmp(sdo_gateway__types[i].name, str) == 0)
+			return sdo_gateway__types[i].type;
+
+	return canopen_type_from_string(str);
+}
+
+/* These are the types that conversions.c knows how to handle */
+static int sdo_gateway__is_supported(enum canopen_type type)
+{
+	return type == CANOPEN_BOOLEAN
+	    || canopen_type_is_integer(type)
+	    || canopen_type_is_real(type)
+	    || canopen_type_is_string(type);
+}
+
+static char* sdo_gateway__next_token(char** cursor)
+{
+	char* token = string_trim_left(*cursor);
+	if (!*token)
+		return NULL;
+
+	char* end = token + strcspn(token, " \t");
+	if (*end)
+		*end++ = '\0';
+
+	*cursor = end;
+	return token;
+}
+
+static int sdo_gateway__parse_number(int* dst, const char* str, int min,
+				     int max)
+{
+	char* end = NULL;
+	long value = strtol(str, &end, 0);
+
+	if (*end != '\0' || !is_in_range(value, min, max))
+		return -1;
+
+	*dst = value;
+	return 0;
+}
+
+static int sdo_gateway__parse_seq(struct sdo_gateway_cmd* cmd, char** cursor)
+{
+	char* str = string_trim_left(*cursor);
+	if (*str++ != '[')
+		return -1;
+
+	char* end = NULL;
+	cmd->seq = strtoul(str, &end, 0);
+	if (end == str || *end != ']')
+		return -1;
+
+	*cursor = end + 1;
+	return 0;
+}
+
+static int sdo_gateway__parse_type(struct sdo_gateway_cmd* cmd,
+				   const char* str)
+{
+	if (strcasecmp(str, "r") == 0 || strcasecmp(str, "read") == 0)
+		cmd->type = SDO_GATEWAY_READ;
+	else if (strcasecmp(str, "w") == 0 || strcasecmp(str, "write") == 0)
+		cmd->type = SDO_GATEWAY_WRITE;
+	else
+		return -1;
+
+	return 0;
+}
+
+/* String values may be quoted so that leading or trailing space is kept */
+static const char* sdo_gateway__unquote(char* str)
+{
+	size_t length = strlen(str);
+
+	if (length >= 2 && str[0] == '"' && str[length - 1] == '"') {
+		str[length - 1] = '\0';
+		return str + 1;
+	}
+
+	return str;
+}
+
+int sdo_gateway__parse(struct sdo_gateway_cmd* cmd, char* line)
+{
+	char* cursor = line;
+
+	memset(cmd, 0, sizeof(*cmd));
+
+	if (sdo_gateway__parse_seq(cmd, &cursor) < 0)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	char* type = sdo_gateway__next_token(&cursor);
+	char* node = sdo_gateway__next_token(&cursor);
+	char* index = sdo_gateway__next_token(&cursor);
+	char* subindex = sdo_gateway__next_token(&cursor);
+	char* datatype = sdo_gateway__next_token(&cursor);
+
+	if (!datatype)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	if (sdo_gateway__parse_type(cmd, type) < 0)
+		return -SDO_GATEWAY_ERROR_NOT_SUPPORTED;
+
+	if (sdo_gateway__parse_number(&cmd->nodeid, node, 0, 255) < 0
+	 || sdo_gateway__parse_number(&cmd->index, index, 0, 0xffff) < 0
+	 || sdo_gateway__parse_number(&cmd->subindex, subindex, 0, 0xff) < 0)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	if (!is_in_range(cmd->nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX))
+		return -SDO_GATEWAY_ERROR_UNSUPPORTED_NODE;
+
+	cmd->datatype = sdo_gateway__type_from_string(datatype);
+	if (cmd->datatype == CANOPEN_UNKNOWN)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	if (!sdo_gateway__is_supported(cmd->datatype))
+		return -SDO_GATEWAY_ERROR_NOT_SUPPORTED;
+
+	char* value = string_trim(cursor);
+
+	if (cmd->type == SDO_GATEWAY_READ)
+		return *value ? -SDO_GATEWAY_ERROR_SYNTAX : 0;
+
+	if (!*value)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	cmd->value = sdo_gateway__unquote(value);
+	return 0;
+}
+
+static struct sdo_gateway_client* sdo_gateway_client_new(void)
+{
+	struct sdo_gateway_client* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->ref = 1;
+	self->is_connected = 1;
+
+	if (vector_init(&self->buffer, 256) < 0)
+		goto failure;
+
+	return self;
+
+failure:
+	free(self);
+	return NULL;
+}
+
+static void sdo_gateway_client_ref(struct sdo_gateway_client* self)
+{
+	++self->ref;
+}
+
+static int sdo_gateway_client_unref(struct sdo_gateway_client* self)
+{
+	int ref = --self->ref;
+	if (ref == 0) {
+		vector_destroy(&self->buffer);
+		free(self);
+	}
+
+	return ref;
+}
+
+static void sdo_gateway__reply_error(struct sdo_gateway_client* client,
+				     unsigned long seq, int error)
+{
+	fprintf(client->output, "[%lu] ERROR: %d\r\n", seq, error);
+}
+
+static void sdo_gateway__reply_abort(struct sdo_gateway_client* client,
+				     unsigned long seq,
+				     enum sdo_abort_code code)
+{
+	fprintf(client->output, "[%lu] ERROR: 0x%08x\r\n", seq, code);
+}
+
+static void sdo_gateway__reply_value(struct sdo_gateway_client* client,
+				     const struct sdo_gateway_context* context,
+				     const struct sdo_req* req)
+{
+	struct canopen_data data = {
+		.type = context->datatype,
+		.data = req->data.data ? req->data.data : "",
+		.size = req->data.index,
+		.is_size_unknown = !req->is_size_indicated
+	};
+
+	char buffer[SDO_GATEWAY_LINE_MAX];
+	if (!canopen_data_tostring(buffer, sizeof(buffer), &data)) {
+		sdo_gateway__reply_abort(client, context->seq, SDO_ABORT_SIZE);
+		return;
+	}
+
+	fprintf(client->output, "[%lu] %s\r\n", context->seq, buffer);
+}
+
+static void sdo_gateway__reply(struct sdo_gateway_client* client,
+			       const struct sdo_gateway_context* context,
+			       const struct sdo_req* req)
+{
+	switch (req->status) {
+	case SDO_REQ_OK:
+		if (req->type == SDO_REQ_UPLOAD)
+			sdo_gateway__reply_value(client, context, req);
+		else
+			fprintf(client->output, "[%lu] OK\r\n", context->seq);
+		break;
+	case SDO_REQ_LOCAL_ABORT:
+	case SDO_REQ_REMOTE_ABORT:
+		sdo_gateway__reply_abort(client, context->seq, req->abort_code);
+		break;
+	case SDO_REQ_NODE_DOWN:
+		sdo_gateway__reply_error(client, context->seq,
+					 SDO_GATEWAY_ERROR_TIMEOUT);
+		break;
+	default:
+		sdo_gateway__reply_error(client, context->seq,
+					 SDO_GATEWAY_ERROR_NOT_PROCESSED);
+		break;
+	}
+}
+
+static void sdo_gateway__process_input(struct sdo_gateway_client* client);
+
+static void sdo_gateway__on_done(struct sdo_req* req)
+{
+	struct sdo_gateway_context* context = req->context;
+	struct sdo_gateway_client* client = context->client;
+
+	client->n_pending--;
+
+	if (client->is_connected) {
+		sdo_gateway__reply(client, context, req);
+		sdo_gateway__process_input(client);
+	}
+
+	sdo_gateway_client_unref(client);
+	free(context);
+}
+
+static int sdo_gateway__start(struct sdo_gateway_client* client,
+			      const struct sdo_gateway_cmd* cmd)
+{
+	struct canopen_data data = { 0 };
+
+	if (cmd->type == SDO_GATEWAY_WRITE
+	 && canopen_data_fromstring(&data, cmd->datatype, cmd->value) < 0)
+		return -SDO_GATEWAY_ERROR_SYNTAX;
+
+	if (client->n_pending >= SDO_GATEWAY_PENDING_MAX)
+		return -SDO_GATEWAY_ERROR_NOT_PROCESSED;
+
+	struct sdo_gateway_context* context = malloc(sizeof(*context));
+	if (!context)
+		return -SDO_GATEWAY_ERROR_NOT_PROCESSED;
+
+	context->client = client;
+	context->seq = cmd->seq;
+	context->datatype = cmd->datatype;
+
+	struct sdo_req_info info = {
+		.type = cmd->type == SDO_GATEWAY_WRITE
+		      ? SDO_REQ_DOWNLOAD : SDO_REQ_UPLOAD,
+		.index = cmd->index,
+		.subindex = cmd->subindex,
+		.dl_data = data.data,
+		.dl_size = data.size,
+		.prio = SDO_REQ_PRIO_LOW,
+		.on_done = sdo_gateway__on_done,
+		.context = context
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		goto failure;
+
+	int rc = sdo_req_start(req, sdo_req_queue_get(cmd->nodeid));
+	sdo_req_unref(req);
+	if (rc < 0)
+		goto failure;
+
+	sdo_gateway_client_ref(client);
+	client->n_pending++;
+	return 0;
+
+failure:
+	free(context);
+	return -SDO_GATEWAY_ERROR_NOT_PROCESSED;
+}
+
+static void sdo_gateway__process_line(struct sdo_gateway_client* client,
+				      char* line)
+{
+	struct sdo_gateway_cmd cmd;
+
+	if (!*string_trim(line))
+		return;
+
+	int rc = sdo_gateway__parse(&cmd, line);
+	if (rc == 0)
+		rc = sdo_gateway__start(client, &cmd);
+
+	if (rc < 0)
+		sdo_gateway__reply_error(client, cmd.seq, -rc);
+}
+
+/* Commands beyond SDO_GATEWAY_PENDING_MAX wait in the buffer until replies
+ * come back, unless the client keeps sending regardless.
+ */
+static void sdo_gateway__process_input(struct sdo_gateway_client* client)
+{
+	struct vector* buffer = &client->buffer;
+	char* data = buffer->data;
+	size_t start = 0;
+	int is_line_incomplete = 0;
+
+	while (start < buffer->index) {
+		if (client->n_pending >= SDO_GATEWAY_PENDING_MAX
+		 && buffer->index - start <= SDO_GATEWAY_BUFFER_MAX)
+			break;
+
+		char* line = data + start;
+		char* end = memchr(line, '\n', buffer->index - start);
+		if (!end) {
+			is_line_incomplete = 1;
+			break;
+		}
+
+		*end = '\0';
+		start = end - data + 1;
+
+		if (client->is_discarding) {
+			client->is_discarding = 0;
+			continue;
+		}
+
+		sdo_gateway__process_line(client, line);
+	}
+
+	memmove(data, data + start, buffer->index - start);
+	buffer->index -= start;
+
+	if (is_line_incomplete && buffer->index > SDO_GATEWAY_LINE_MAX) {
+		if (!client->is_discarding)
+			sdo_gateway__reply_error(client, 0,
+						 SDO_GATEWAY_ERROR_SYNTAX);
+
+		client->is_discarding = 1;
+		buffer->index = 0;
+	}
+
+	fflush(client->output);
+}
+
+static void sdo_gateway__on_client_data(struct mloop_socket* socket)
+{
+	struct sdo_gateway_client* client = mloop_socket_get_context(socket);
+	int fd = mloop_socket_get_fd(socket);
+	char input[256];
+
+	while (1) {
+		ssize_t size = read(fd, input, sizeof(input));
+		if (size == 0)
+			goto disconnect;
+
+		if (size < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			goto disconnect;
+		}
+
+		if (vector_append(&client->buffer, input, size) < 0)
+			goto disconnect;
+
+		sdo_gateway__process_input(client);
+	}
+
+disconnect:
+	mloop_socket_stop(socket);
+}
+
+static void sdo_gateway__on_socket_free(void* ptr)
+{
+	struct sdo_gateway_client* client = ptr;
+	client->is_connected = 0;
+	fclose(client->output);
+	sdo_gateway_client_unref(client);
+}
+
+static void sdo_gateway__on_connection(struct mloop_socket* socket)
+{
+	int sfd = mloop_socket_get_fd(socket);
+
+	int cfd = accept(sfd, NULL, 0);
+	if (cfd < 0)
+		return;
+
+	net_dont_block(cfd);
+	net_dont_delay(cfd);
+
+	struct mloop_socket* client = mloop_socket_new(mloop_default());
+	if (!client)
+		goto socket_failure;
+
+	struct sdo_gateway_client* state = sdo_gateway_client_new();
+	if (!state)
+		goto state_failure;
+
+	int nfd = dup(cfd);
+	if (nfd < 0)
+		goto nfd_failure;
+
+	state->output = stream_open(nfd, "w");
+	if (!state->output)
+		goto fdopen_failure;
+
+	mloop_socket_set_fd(client, cfd);
+	mloop_socket_set_callback(client, sdo_gateway__on_client_data);
+	mloop_socket_set_context(client, state, sdo_gateway__on_socket_free);
+	mloop_socket_start(client);
+
+	mloop_socket_unref(client);
+	return;
+
+fdopen_failure:
+	close(nfd);
+nfd_failure:
+	sdo_gateway_client_unref(state);
+state_failure:
+	mloop_socket_unref(client);
+socket_failure:
+	close(cfd);
+}
+
+int sdo_gateway_init(int port)
+{
+	int lfd = rest__open_server(port);
+	if (lfd < 0)
+		return -1;
+
+	sdo_gateway__server = mloop_socket_new(mloop_default());
+	if (!sdo_gateway__server)
+		goto socket_failure;
+
+	mloop_socket_set_fd(sdo_gateway__server, lfd);
+	mloop_socket_set_callback(sdo_gateway__server,
+				  sdo_gateway__on_connection);
+	if (mloop_socket_start(sdo_gateway__server) < 0)
+		goto start_failure;
+
+	return 0;
+
+start_failure:
+	mloop_socket_unref(sdo_gateway__server);
+	sdo_gateway__server = NULL;
+	return -1;
+
+socket_failure:
+	close(lfd);
+	return -1;
+}
+
+void sdo_gateway_cleanup(void)
+{
+	if (!sdo_gateway__server)
+		return;
+
+	mloop_socket_stop(sdo_gateway__server);
+	mloop_socket_unref(sdo_gateway__server);
+	sdo_gateway__server = NULL;
+}
@@ -0,0 +1,238 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Bus-wide SDO rate governor
+ *
+ * Limits the total rate of SDO request frames sent by the master so that PDO
+ * traffic is not crowded out by bulk SDO transfers, e.g. during boot-up or when
+ * REST clients read whole object dictionaries.
+ *
+ * The limit is enforced with token buckets: one for all SDO traffic and one for
+ * each priority class, whose rate is a share of the total. A frame may only be
+ * sent if both the total bucket and the bucket of its class hold a token.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <mloop.h>
+
+#include "canopen/sdo-governor.h"
+#include "time-utils.h"
+#include "token-bucket.h"
+
+/* Allow bursts of up to this many ms worth of frames */
+#define SDO_GOVERNOR_BURST 50 /* ms */
+
+#define USEC_IN_SEC 1000000ULL
+
+static int sdo_governor__is_enabled = 0;
+static pthread_mutex_t sdo_governor__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct token_bucket sdo_governor__total;
+static struct token_bucket sdo_governor__class[SDO_REQ_PRIO_COUNT];
+static struct sdo_governor_stats sdo_governor__stats[SDO_REQ_PRIO_COUNT];
+
+/* Frame rate over the last full second */
+static uint64_t sdo_governor__window_start;
+static uint64_t sdo_governor__window_frames;
+static uint64_t sdo_governor__last_rate;
+
+static struct mloop_timer* sdo_governor__timer = NULL;
+static uint64_t sdo_governor__wakeup_time;
+static sdo_governor_wakeup_fn sdo_governor__wakeup_fn = NULL;
+
+static const char* sdo_governor__class_name[SDO_REQ_PRIO_COUNT] = {
+	[SDO_REQ_PRIO_HIGH] = "high",
+	[SDO_REQ_PRIO_NORMAL] = "normal",
+	[SDO_REQ_PRIO_LOW] = "low",
+};
+
+static inline uint64_t sdo_governor__now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+static void sdo_governor__on_timeout(struct mloop_timer* timer)
+{
+	(void)timer;
+
+	sdo_governor__wakeup_time = 0;
+
+	sdo_governor_wakeup_fn fn = sdo_governor__wakeup_fn;
+	if (fn)
+		fn();
+}
+
+int sdo_governor_init(const struct sdo_governor_config* config)
+{
+	if (config->rate == 0)
+		return 0;
+
+	sdo_governor__timer = mloop_timer_new(mloop_default());
+	if (!sdo_governor__timer)
+		return -1;
+
+	mloop_timer_set_callback(sdo_governor__timer, sdo_governor__on_timeout);
+
+	uint64_t now = sdo_governor__now();
+
+	token_bucket_init(&sdo_governor__total, config->rate, SDO_GOVERNOR_BURST,
+			  now);
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		token_bucket_init(&sdo_governor__class[i],
+				  config->rate * config->share[i] / 100,
+				  SDO_GOVERNOR_BURST, now);
+
+	memset(sdo_governor__stats, 0, sizeof(sdo_governor__stats));
+	sdo_governor__window_start = now;
+	sdo_governor__window_frames = 0;
+	sdo_governor__last_rate = 0;
+	sdo_governor__wakeup_time = 0;
+
+	sdo_governor__is_enabled = 1;
+	return 0;
+}
+
+void sdo_governor_cleanup(void)
+{
+	if (!sdo_governor__is_enabled)
+		return;
+
+	sdo_governor__is_enabled = 0;
+
+	mloop_timer_stop(sdo_governor__timer);
+	mloop_timer_unref(sdo_governor__timer);
+	sdo_governor__timer = NULL;
+}
+
+int sdo_governor_is_enabled(void)
+{
+	return sdo_governor__is_enabled;
+}
+
+static void sdo_governor__count_frame(enum sdo_req_prio prio, uint64_t now)
+{
+	sdo_governor__stats[prio].frames++;
+
+	uint64_t elapsed = now - sdo_governor__window_start;
+	if (elapsed >= USEC_IN_SEC) {
+		sdo_governor__last_rate = sdo_governor__window_frames
+					* USEC_IN_SEC / elapsed;
+		sdo_governor__window_start = now;
+		sdo_governor__window_frames = 0;
+	}
+
+	sdo_governor__window_frames++;
+}
+
+unsigned long sdo_governor_acquire(enum sdo_req_prio prio)
+{
+	if (!sdo_governor__is_enabled)
+		return 0;
+
+	struct token_bucket* total = &sdo_governor__total;
+	struct token_bucket* class = &sdo_governor__class[prio];
+	uint64_t now = sdo_governor__now();
+	unsigned long delay = 0;
+
+	pthread_mutex_lock(&sdo_governor__mutex);
+
+	token_bucket_refill(total, now);
+	token_bucket_refill(class, now);
+
+	uint64_t wait = token_bucket_wait(total);
+	uint64_t class_wait = token_bucket_wait(class);
+	if (class_wait > wait)
+		wait = class_wait;
+
+	if (wait > 0) {
+		sdo_governor__stats[prio].throttled++;
+		delay = (wait + 999) / 1000;
+		goto done;
+	}
+
+	token_bucket_take(total);
+	token_bucket_take(class);
+	sdo_governor__count_frame(prio, now);
+
+done:
+	pthread_mutex_unlock(&sdo_governor__mutex);
+	return delay;
+}
+
+void sdo_governor_set_wakeup_fn(sdo_governor_wakeup_fn fn)
+{
+	sdo_governor__wakeup_fn = fn;
+}
+
+void sdo_governor_request_wakeup(unsigned long delay)
+{
+	if (!sdo_governor__is_enabled)
+		return;
+
+	uint64_t wakeup_time = sdo_governor__now() + delay * 1000ULL;
+
+	if (mloop_timer_is_started(sdo_governor__timer)) {
+		if (sdo_governor__wakeup_time <= wakeup_time)
+			return;
+
+		mloop_timer_stop(sdo_governor__timer);
+	}
+
+	sdo_governor__wakeup_time = wakeup_time;
+	mloop_timer_set_time(sdo_governor__timer, delay * 1000000ULL);
+	mloop_timer_start(sdo_governor__timer);
+}
+
+void sdo_governor_get_stats(enum sdo_req_prio prio,
+			    struct sdo_governor_stats* stats)
+{
+	pthread_mutex_lock(&sdo_governor__mutex);
+	*stats = sdo_governor__stats[prio];
+	pthread_mutex_unlock(&sdo_governor__mutex);
+}
+
+void sdo_governor_print_stats(FILE* out)
+{
+	pthread_mutex_lock(&sdo_governor__mutex);
+
+	uint64_t rate = sdo_governor__total.rate;
+	uint64_t last_rate = sdo_governor__last_rate;
+
+	fprintf(out, "{\n \"enabled\": %s,\n \"rate\": %llu,\n"
+		" \"current-rate\": %llu,\n \"utilization\": %llu,\n"
+		" \"classes\": {",
+		sdo_governor__is_enabled ? "true" : "false",
+		(unsigned long long)rate, (unsigned long long)last_rate,
+		(unsigned long long)(rate ? last_rate * 100 / rate : 0));
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i) {
+		const struct sdo_governor_stats* stats = &sdo_governor__stats[i];
+
+		fprintf(out, "%s\n  \"%s\": { \"rate\": %llu, \"frames\": %llu, "
+			"\"throttled\": %llu }", i == 0 ? "" : ",",
+			sdo_governor__class_name[i],
+			(unsigned long long)sdo_governor__class[i].rate,
+			(unsigned long long)stats->frames,
+			(unsigned long long)stats->throttled);
+	}
+
+	fprintf(out, "\n }\n}\n");
+
+	pthread_mutex_unlock(&sdo_governor__mutex);
+}
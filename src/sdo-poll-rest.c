@@ -0,0 +1,352 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Cyclic SDO polling over REST
+ *
+ * PUT /poll/<nodeid>/<index>/<subindex> with a period in ms as content makes
+ * the master poll the object at that period. An optional ?type=<type> gives the
+ * type of the object. Another PUT for the same object changes its period and a
+ * period of 0 stops polling it. The registration is shared with drivers that
+ * poll the same object.
+ *
+ * GET /poll/<nodeid>/<index>/<subindex> replies with the latest value of a
+ * polled object, converted to text according to its type, or as hex if the
+ * type is not known. GET /poll replies with a JSON document describing all
+ * polled objects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canopen.h"
+#include "canopen/sdo-poll.h"
+#include "canopen/eds.h"
+#include "canopen/master.h"
+#include "canopen/types.h"
+#include "rest.h"
+#include "sdo-poll-rest.h"
+#include "conversions.h"
+#include "string-utils.h"
+
+#define is_in_range(x, min, max) ((min) <= (x) && (x) <= (max))
+
+/* Number of objects that can be polled through REST */
+#define SDO_POLL_REST_MAX 256
+
+struct sdo_poll_rest_path {
+	int nodeid, index, subindex;
+};
+
+struct sdo_poll_rest_entry {
+	struct sdo_poll_rest_path path;
+	int handle; /* -1 if unused */
+};
+
+/* Only accessed from the main loop */
+static struct sdo_poll_rest_entry sdo_poll_rest__entries[SDO_POLL_REST_MAX];
+static int sdo_poll_rest__is_initialized = 0;
+
+static void sdo_poll_rest__reply(struct rest_client* client,
+				 const char* status_code,
+				 const char* content_type, const char* message,
+				 size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = content_type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client->output, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void sdo_poll_rest__reply_text(struct rest_client* client,
+				      const char* status_code,
+				      const char* message)
+{
+	sdo_poll_rest__reply(client, status_code, "text/plain", message,
+			     strlen(message));
+}
+
+static void sdo_poll_rest__init(void)
+{
+	if (sdo_poll_rest__is_initialized)
+		return;
+
+	for (int i = 0; i < SDO_POLL_REST_MAX; ++i)
+		sdo_poll_rest__entries[i].handle = -1;
+
+	sdo_poll_rest__is_initialized = 1;
+}
+
+void sdo_poll_rest_cleanup(void)
+{
+	if (!sdo_poll_rest__is_initialized)
+		return;
+
+	for (int i = 0; i < SDO_POLL_REST_MAX; ++i) {
+		struct sdo_poll_rest_entry* entry = &sdo_poll_rest__entries[i];
+
+		if (entry->handle >= 0)
+			sdo_poll_unregister(entry->handle);
+
+		entry->handle = -1;
+	}
+}
+
+static int sdo_poll_rest__convert_path(struct sdo_poll_rest_path* dst,
+				       const struct rest_client* client)
+{
+	char* end_nodeid = NULL;
+	char* end_index = NULL;
+	char* end_subindex = NULL;
+
+	dst->nodeid = strtol(client->req.url[1], &end_nodeid, 10);
+	dst->index = strtol(client->req.url[2], &end_index, 16);
+	dst->subindex = strtol(client->req.url[3], &end_subindex, 10);
+
+	if (*end_nodeid != '\0' || *end_index != '\0' || *end_subindex != '\0')
+		return -1;
+
+	return (is_in_range(dst->nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)
+	     && is_in_range(dst->index, 0x1000, 0xffff)
+	     && is_in_range(dst->subindex, 0, 0xff)) ? 0 : -1;
+}
+
+static struct sdo_poll_rest_entry*
+sdo_poll_rest__find(const struct sdo_poll_rest_path* path)
+{
+	for (int i = 0; i < SDO_POLL_REST_MAX; ++i) {
+		struct sdo_poll_rest_entry* entry = &sdo_poll_rest__entries[i];
+
+		if (entry->handle >= 0
+		 && memcmp(&entry->path, path, sizeof(*path)) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct sdo_poll_rest_entry* sdo_poll_rest__find_unused(void)
+{
+	for (int i = 0; i < SDO_POLL_REST_MAX; ++i)
+		if (sdo_poll_rest__entries[i].handle < 0)
+			return &sdo_poll_rest__entries[i];
+
+	return NULL;
+}
+
+static enum canopen_type sdo_poll_rest__get_type(struct rest_client* client)
+{
+	const char* type = http_req_query(&client->req, "type");
+	return type ? canopen_type_from_string(type) : CANOPEN_UNKNOWN;
+}
+
+/* The registration is replaced rather than changed in place. The new one is
+ * made first so that the object is not dropped and re-phased in between.
+ */
+static void sdo_poll_rest__put(struct rest_client* client,
+			       const struct sdo_poll_rest_path* path,
+			       const void* content)
+{
+	char buffer[32];
+
+	if (client->req.content_length >= sizeof(buffer)) {
+		sdo_poll_rest__reply_text(client, "400 Bad Request",
+					  "Period is too long\r\n");
+		return;
+	}
+
+	memcpy(buffer, content, client->req.content_length);
+	buffer[client->req.content_length] = '\0';
+
+	char* period_str = string_trim(buffer);
+	char* end = NULL;
+	unsigned long period = strtoul(period_str, &end, 10);
+	if (*period_str == '\0' || *end != '\0') {
+		sdo_poll_rest__reply_text(client, "400 Bad Request",
+					  "Period must be a number of ms\r\n");
+		return;
+	}
+
+	struct sdo_poll_rest_entry* entry = sdo_poll_rest__find(path);
+
+	if (period == 0) {
+		if (!entry) {
+			sdo_poll_rest__reply_text(client, "404 Not Found",
+						  "Object is not polled\r\n");
+			return;
+		}
+
+		sdo_poll_unregister(entry->handle);
+		entry->handle = -1;
+		sdo_poll_rest__reply_text(client, "200 OK", "");
+		return;
+	}
+
+	if (!entry)
+		entry = sdo_poll_rest__find_unused();
+
+	if (!entry) {
+		sdo_poll_rest__reply_text(client, "503 Service Unavailable",
+					  "Too many polled objects\r\n");
+		return;
+	}
+
+	struct sdo_poll_info info = {
+		.nodeid = path->nodeid,
+		.index = path->index,
+		.subindex = path->subindex,
+		.period = period,
+		.type = sdo_poll_rest__get_type(client)
+	};
+
+	int handle = sdo_poll_register(&info);
+	if (handle < 0) {
+		sdo_poll_rest__reply_text(client, "409 Conflict",
+			"Could not poll object; its type may differ from that of other readers\r\n");
+		return;
+	}
+
+	if (entry->handle >= 0)
+		sdo_poll_unregister(entry->handle);
+
+	entry->path = *path;
+	entry->handle = handle;
+
+	sdo_poll_rest__reply_text(client, "200 OK", "");
+}
+
+static enum canopen_type
+sdo_poll_rest__find_type(struct rest_client* client,
+			 const struct sdo_poll_rest_path* path,
+			 const struct sdo_poll_value* value)
+{
+	enum canopen_type type = sdo_poll_rest__get_type(client);
+	if (type != CANOPEN_UNKNOWN)
+		return type;
+
+	if (value->type != CANOPEN_UNKNOWN)
+		return value->type;
+
+	const struct canopen_eds* eds = co_master_find_eds(path->nodeid);
+	if (!eds)
+		return CANOPEN_UNKNOWN;
+
+	const struct eds_obj* obj = eds_obj_find(eds, path->index,
+						 path->subindex);
+	return obj ? obj->type : CANOPEN_UNKNOWN;
+}
+
+static void sdo_poll_rest__get_value(struct rest_client* client,
+				     const struct sdo_poll_rest_path* path)
+{
+	struct sdo_poll_value value;
+
+	if (sdo_poll_read(path->nodeid, path->index, path->subindex,
+			  &value) < 0) {
+		sdo_poll_rest__reply_text(client, "404 Not Found",
+					  "Object is not polled\r\n");
+		return;
+	}
+
+	if (value.timestamp == 0) {
+		char reason[256];
+		snprintf(reason, sizeof(reason), "%s\r\n",
+			 value.status == SDO_REQ_PENDING
+			 ? "Object has not been polled yet"
+			 : sdo_strerror(value.abort_code));
+
+		sdo_poll_rest__reply_text(client, "503 Service Unavailable",
+					  reason);
+		return;
+	}
+
+	struct canopen_data data = {
+		.type = sdo_poll_rest__find_type(client, path, &value),
+		.data = value.data,
+		.size = value.size,
+	};
+
+	char buffer[2 * SDO_POLL_VALUE_MAX + 1];
+	char* message = canopen_data_tostring(buffer, sizeof(buffer), &data);
+
+	if (!message) {
+		for (size_t i = 0; i < value.size; ++i)
+			sprintf(&buffer[2 * i], "%02x", value.data[i]);
+
+		buffer[2 * value.size] = '\0';
+		message = buffer;
+	}
+
+	sdo_poll_rest__reply_text(client, "200 OK", message);
+}
+
+static void sdo_poll_rest__get_all(struct rest_client* client)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		sdo_poll_rest__reply_text(client, "500 Internal Server Error",
+					  "Out of memory\r\n");
+		return;
+	}
+
+	sdo_poll_print_stats(out);
+	fclose(out);
+
+	sdo_poll_rest__reply(client, "200 OK", "application/json", buffer,
+			     size);
+
+	free(buffer);
+}
+
+void sdo_poll_rest_service(struct rest_client* client, const void* content)
+{
+	sdo_poll_rest__init();
+
+	if (client->req.url_index == 1 && client->req.method == HTTP_GET) {
+		sdo_poll_rest__get_all(client);
+		return;
+	}
+
+	struct sdo_poll_rest_path path;
+
+	if (client->req.url_index != 4
+	 || sdo_poll_rest__convert_path(&path, client) < 0) {
+		sdo_poll_rest__reply_text(client, "404 Not Found",
+			"Wrong URL format. Must be /poll/<nodeid>/<index>/<subindex>\r\n");
+		return;
+	}
+
+	switch (client->req.method) {
+	case HTTP_GET:
+		sdo_poll_rest__get_value(client, &path);
+		return;
+	case HTTP_PUT:
+		sdo_poll_rest__put(client, &path, content);
+		return;
+	default:
+		break;
+	}
+
+	sdo_poll_rest__reply_text(client, "405 Method Not Allowed", "");
+}
@@ -0,0 +1,773 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Cyclic SDO polling
+ *
+ * Drivers and REST clients register objects that are to be read periodically
+ * and the latest value of each object is kept in a table that can be read
+ * without locking. Registrations of the same object are merged, so any number
+ * of readers of one object cost a single poll, made at the shortest of the
+ * periods they asked for.
+ *
+ * New objects get a phase within their period from a golden ratio sequence so
+ * that polls are spread out over time instead of bunching up when many objects
+ * are registered at once. Due polls are kept in a heap and a single timer is
+ * armed for the earliest one.
+ *
+ * The number of polls per second may be limited by a token bucket. Polls are
+ * sent as low priority requests, so the SDO governor limits them as well when
+ * it is enabled. Polls that are due while the bucket is empty are sent late
+ * rather than dropped, and an object is not
+ * polled again until its previous poll has finished, so a slow node or a full
+ * bus makes polls fall behind instead of piling up in the SDO queues.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <mloop.h>
+
+#include "canopen/sdo-poll.h"
+#include "canopen/sdo_req.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+#include "token-bucket.h"
+
+/* Open addressing with linear probing; must be a power of two */
+#define SDO_POLL_TABLE_BITS 11
+#define SDO_POLL_TABLE_SIZE (1U << SDO_POLL_TABLE_BITS)
+
+#define SDO_POLL_EMPTY 0
+#define SDO_POLL_TOMBSTONE UINT32_MAX
+
+/* Allow bursts of up to this many ms worth of polls */
+#define SDO_POLL_BURST 50 /* ms */
+
+struct sdo_poll__object {
+	/* Read by sdo_poll_read() without locking */
+	uint32_t key;
+	uint32_t seq;
+	struct sdo_poll_value value;
+
+	/* The rest is protected by sdo_poll__mutex */
+	unsigned long period; /* ms */
+	unsigned int n_refs;
+	uint64_t due; /* us */
+	int heap_index; /* -1 if not scheduled */
+	int is_in_flight;
+	unsigned long n_polls;
+	unsigned long n_failures;
+	unsigned long n_overruns;
+};
+
+struct sdo_poll__registration {
+	int is_used;
+	int slot;
+	unsigned long period;
+};
+
+static pthread_mutex_t sdo_poll__mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sdo_poll__is_initialized = 0;
+
+static struct sdo_poll__object sdo_poll__table[SDO_POLL_TABLE_SIZE];
+static size_t sdo_poll__n_objects;
+
+static struct sdo_poll__registration
+	sdo_poll__registrations[SDO_POLL_REGISTRATIONS_MAX];
+
+/* Min-heap of table slots, ordered by due time */
+static int sdo_poll__heap[SDO_POLL_OBJECTS_MAX];
+static size_t sdo_poll__heap_size;
+
+static uint16_t sdo_poll__phase;
+
+static struct token_bucket sdo_poll__bucket;
+static unsigned long sdo_poll__n_throttled;
+
+static struct mloop_timer* sdo_poll__timer = NULL;
+static uint64_t sdo_poll__wakeup_time;
+
+static inline uint64_t sdo_poll__now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+static inline uint32_t sdo_poll__key(int nodeid, int index, int subindex)
+{
+	return (uint32_t)nodeid << 24 | (uint32_t)index << 8 | subindex;
+}
+
+static inline size_t sdo_poll__hash(uint32_t key)
+{
+	return (uint32_t)(key * 2654435761U) >> (32 - SDO_POLL_TABLE_BITS);
+}
+
+static inline size_t sdo_poll__next(size_t slot)
+{
+	return (slot + 1) & (SDO_POLL_TABLE_SIZE - 1);
+}
+
+static inline size_t sdo_poll__prev(size_t slot)
+{
+	return (slot - 1) & (SDO_POLL_TABLE_SIZE - 1);
+}
+
+static int sdo_poll__find(uint32_t key)
+{
+	size_t slot = sdo_poll__hash(key);
+
+	for (size_t n = 0; n < SDO_POLL_TABLE_SIZE; ++n) {
+		uint32_t k = co_atomic_load(&sdo_poll__table[slot].key);
+		if (k == key)
+			return slot;
+
+		if (k == SDO_POLL_EMPTY)
+			return -1;
+
+		slot = sdo_poll__next(slot);
+	}
+
+	return -1;
+}
+
+/* A removed object keeps its slot until its last poll has finished */
+static int sdo_poll__find_free(uint32_t key)
+{
+	size_t slot = sdo_poll__hash(key);
+
+	for (size_t n = 0; n < SDO_POLL_TABLE_SIZE; ++n) {
+		const struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+		if (obj->key == SDO_POLL_EMPTY
+		 || (obj->key == SDO_POLL_TOMBSTONE && !obj->is_in_flight))
+			return slot;
+
+		slot = sdo_poll__next(slot);
+	}
+
+	return -1;
+}
+
+/* A tombstone that is followed by an empty slot ends its probe sequence, so it
+ * can be made empty too, and then so can the tombstones before it. Otherwise,
+ * lookups of objects that are not polled would scan ever more of the table.
+ */
+static void sdo_poll__clear_tombstones(size_t slot)
+{
+	for (size_t n = 0; n < SDO_POLL_TABLE_SIZE; ++n) {
+		struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+		if (obj->key != SDO_POLL_TOMBSTONE || obj->is_in_flight
+		 || sdo_poll__table[sdo_poll__next(slot)].key != SDO_POLL_EMPTY)
+			return;
+
+		co_atomic_store(&obj->key, SDO_POLL_EMPTY);
+		slot = sdo_poll__prev(slot);
+	}
+}
+
+static inline void sdo_poll__write_begin(struct sdo_poll__object* obj)
+{
+	co_atomic_add_fetch(&obj->seq, 1);
+	co_atomic_fence();
+}
+
+static inline void sdo_poll__write_end(struct sdo_poll__object* obj)
+{
+	co_atomic_fence();
+	co_atomic_add_fetch(&obj->seq, 1);
+}
+
+static inline uint64_t sdo_poll__due(int slot)
+{
+	return sdo_poll__table[slot].due;
+}
+
+static inline void sdo_poll__heap_set(size_t i, int slot)
+{
+	sdo_poll__heap[i] = slot;
+	sdo_poll__table[slot].heap_index = i;
+}
+
+static void sdo_poll__sift_up(size_t i)
+{
+	int slot = sdo_poll__heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (sdo_poll__due(sdo_poll__heap[parent]) <= sdo_poll__due(slot))
+			break;
+
+		sdo_poll__heap_set(i, sdo_poll__heap[parent]);
+		i = parent;
+	}
+
+	sdo_poll__heap_set(i, slot);
+}
+
+static void sdo_poll__sift_down(size_t i)
+{
+	int slot = sdo_poll__heap[i];
+
+	while (1) {
+		size_t child = 2 * i + 1;
+		if (child >= sdo_poll__heap_size)
+			break;
+
+		if (child + 1 < sdo_poll__heap_size
+		 && sdo_poll__due(sdo_poll__heap[child + 1])
+		    < sdo_poll__due(sdo_poll__heap[child]))
+			++child;
+
+		if (sdo_poll__due(slot) <= sdo_poll__due(sdo_poll__heap[child]))
+			break;
+
+		sdo_poll__heap_set(i, sdo_poll__heap[child]);
+		i = child;
+	}
+
+	sdo_poll__heap_set(i, slot);
+}
+
+static void sdo_poll__heap_push(int slot)
+{
+	size_t i = sdo_poll__heap_size++;
+	sdo_poll__heap[i] = slot;
+	sdo_poll__sift_up(i);
+}
+
+static void sdo_poll__heap_remove(int slot)
+{
+	size_t i = sdo_poll__table[slot].heap_index;
+	sdo_poll__table[slot].heap_index = -1;
+
+	int last = sdo_poll__heap[--sdo_poll__heap_size];
+	if (i == sdo_poll__heap_size)
+		return;
+
+	sdo_poll__heap_set(i, last);
+	sdo_poll__sift_up(i);
+	sdo_poll__sift_down(sdo_poll__table[last].heap_index);
+}
+
+static void sdo_poll__heap_update(int slot)
+{
+	sdo_poll__sift_up(sdo_poll__table[slot].heap_index);
+	sdo_poll__sift_down(sdo_poll__table[slot].heap_index);
+}
+
+/* The timer is periodic, so it keeps firing until it is re-armed or stopped.
+ * sdo_poll__run() always does one or the other.
+ */
+static void sdo_poll__wakeup(uint64_t time, uint64_t now)
+{
+	if (!sdo_poll__timer)
+		return;
+
+	if (sdo_poll__wakeup_time && sdo_poll__wakeup_time <= time)
+		return;
+
+	if (mloop_timer_is_started(sdo_poll__timer))
+		mloop_timer_stop(sdo_poll__timer);
+
+	/* A relative time of 0 would disarm the timer */
+	uint64_t delay = time > now ? time - now : 1;
+
+	sdo_poll__wakeup_time = time;
+	mloop_timer_set_time(sdo_poll__timer, delay * 1000ULL);
+	mloop_timer_start(sdo_poll__timer);
+}
+
+/* Advance to the next due time after now, counting any periods that were
+ * missed because the poll took too long or was throttled.
+ */
+static void sdo_poll__reschedule(int slot, uint64_t now)
+{
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+	uint64_t period = obj->period * 1000ULL;
+
+	obj->due += period;
+
+	if (obj->due <= now) {
+		uint64_t n_missed = (now - obj->due) / period + 1;
+		obj->due += n_missed * period;
+		obj->n_overruns += n_missed;
+	}
+
+	sdo_poll__heap_push(slot);
+	sdo_poll__wakeup(obj->due, now);
+}
+
+/* A failed poll leaves the last good value in place */
+static void sdo_poll__store(struct sdo_poll__object* obj,
+			    const struct sdo_req* req, uint64_t now)
+{
+	struct sdo_poll_value* value = &obj->value;
+	size_t size = req->data.index;
+
+	sdo_poll__write_begin(obj);
+
+	value->status = req->status;
+	value->abort_code = req->abort_code;
+
+	if (req->status == SDO_REQ_OK && size > SDO_POLL_VALUE_MAX) {
+		value->status = SDO_REQ_LOCAL_ABORT;
+		value->abort_code = SDO_ABORT_TOO_LONG;
+	} else if (req->status == SDO_REQ_OK) {
+		memcpy(value->data, req->data.data, size);
+		value->size = size;
+		value->timestamp = now;
+	}
+
+	sdo_poll__write_end(obj);
+}
+
+static void sdo_poll__on_done(struct sdo_req* req)
+{
+	struct sdo_poll__object* obj = req->context;
+	uint64_t now = sdo_poll__now();
+
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	obj->is_in_flight = 0;
+
+	/* The object was removed while it was being polled */
+	if (obj->n_refs == 0) {
+		sdo_poll__clear_tombstones(obj - sdo_poll__table);
+		goto done;
+	}
+
+	if (req->status != SDO_REQ_OK)
+		obj->n_failures++;
+
+	sdo_poll__store(obj, req, now);
+	sdo_poll__reschedule(obj - sdo_poll__table, now);
+
+done:
+	pthread_mutex_unlock(&sdo_poll__mutex);
+}
+
+static int sdo_poll__start(int slot)
+{
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+	uint32_t key = obj->key;
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = (key >> 8) & 0xffff,
+		.subindex = key & 0xff,
+		.prio = SDO_REQ_PRIO_LOW,
+		.on_done = sdo_poll__on_done,
+		.context = obj
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		return -1;
+
+	int rc = sdo_req_start(req, sdo_req_queue_get(key >> 24));
+	sdo_req_unref(req);
+	if (rc < 0)
+		return -1;
+
+	obj->is_in_flight = 1;
+	obj->n_polls++;
+	return 0;
+}
+
+void sdo_poll__run(uint64_t now)
+{
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	sdo_poll__wakeup_time = 0;
+
+	if (sdo_poll__bucket.rate)
+		token_bucket_refill(&sdo_poll__bucket, now);
+
+	while (sdo_poll__heap_size > 0) {
+		int slot = sdo_poll__heap[0];
+		struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+		if (obj->due > now) {
+			sdo_poll__wakeup(obj->due, now);
+			break;
+		}
+
+		uint64_t wait = sdo_poll__bucket.rate
+			      ? token_bucket_wait(&sdo_poll__bucket) : 0;
+		if (wait > 0) {
+			sdo_poll__n_throttled++;
+			sdo_poll__wakeup(now + wait, now);
+			break;
+		}
+
+		sdo_poll__heap_remove(slot);
+
+		if (sdo_poll__start(slot) < 0) {
+			obj->n_failures++;
+			sdo_poll__reschedule(slot, now);
+			continue;
+		}
+
+		if (sdo_poll__bucket.rate)
+			token_bucket_take(&sdo_poll__bucket);
+	}
+
+	/* Everything is in flight; the polls re-arm the timer when they end */
+	if (sdo_poll__wakeup_time == 0 && sdo_poll__timer
+	 && mloop_timer_is_started(sdo_poll__timer))
+		mloop_timer_stop(sdo_poll__timer);
+
+	pthread_mutex_unlock(&sdo_poll__mutex);
+}
+
+static void sdo_poll__on_timeout(struct mloop_timer* timer)
+{
+	(void)timer;
+	sdo_poll__run(sdo_poll__now());
+}
+
+int sdo_poll_init(unsigned long rate)
+{
+	sdo_poll__timer = mloop_timer_new(mloop_default());
+	if (!sdo_poll__timer)
+		return -1;
+
+	/* A one-shot timer would be stopped after its callback has re-armed it */
+	mloop_timer_set_type(sdo_poll__timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_callback(sdo_poll__timer, sdo_poll__on_timeout);
+
+	token_bucket_init(&sdo_poll__bucket, rate, SDO_POLL_BURST,
+			  sdo_poll__now());
+	sdo_poll__n_throttled = 0;
+	sdo_poll__wakeup_time = 0;
+
+	memset(sdo_poll__table, 0, sizeof(sdo_poll__table));
+	memset(sdo_poll__registrations, 0, sizeof(sdo_poll__registrations));
+	sdo_poll__n_objects = 0;
+	sdo_poll__heap_size = 0;
+	sdo_poll__phase = 0;
+
+	sdo_poll__is_initialized = 1;
+	return 0;
+}
+
+/* Polls that are still in flight find their objects unreferenced when they
+ * finish and are ignored.
+ */
+void sdo_poll_cleanup(void)
+{
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	if (!sdo_poll__is_initialized)
+		goto done;
+
+	sdo_poll__is_initialized = 0;
+
+	mloop_timer_stop(sdo_poll__timer);
+	mloop_timer_unref(sdo_poll__timer);
+	sdo_poll__timer = NULL;
+
+	memset(sdo_poll__table, 0, sizeof(sdo_poll__table));
+	memset(sdo_poll__registrations, 0, sizeof(sdo_poll__registrations));
+	sdo_poll__n_objects = 0;
+	sdo_poll__heap_size = 0;
+
+done:
+	pthread_mutex_unlock(&sdo_poll__mutex);
+}
+
+static int sdo_poll__add_object(uint32_t key, const struct sdo_poll_info* info,
+				uint64_t now)
+{
+	if (sdo_poll__n_objects >= SDO_POLL_OBJECTS_MAX)
+		return -1;
+
+	int slot = sdo_poll__find_free(key);
+	if (slot < 0)
+		return -1;
+
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+	sdo_poll__write_begin(obj);
+	memset(&obj->value, 0, sizeof(obj->value));
+	obj->value.type = info->type;
+	sdo_poll__write_end(obj);
+
+	obj->period = info->period;
+	obj->n_refs = 1;
+	obj->is_in_flight = 0;
+	obj->n_polls = 0;
+	obj->n_failures = 0;
+	obj->n_overruns = 0;
+
+	/* Successive multiples of the golden ratio spread out evenly */
+	sdo_poll__phase += 40503;
+	obj->due = now + obj->period * 1000ULL * sdo_poll__phase / 65536;
+
+	co_atomic_store(&obj->key, key);
+
+	sdo_poll__heap_push(slot);
+	sdo_poll__n_objects++;
+
+	return slot;
+}
+
+static int sdo_poll__add_ref(int slot, const struct sdo_poll_info* info,
+			     uint64_t now)
+{
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+	if (info->type != CANOPEN_UNKNOWN) {
+		if (obj->value.type == CANOPEN_UNKNOWN) {
+			sdo_poll__write_begin(obj);
+			obj->value.type = info->type;
+			sdo_poll__write_end(obj);
+		} else if (obj->value.type != info->type) {
+			return -1;
+		}
+	}
+
+	obj->n_refs++;
+
+	if (info->period >= obj->period)
+		return 0;
+
+	obj->period = info->period;
+
+	uint64_t due = now + info->period * 1000ULL;
+	if (obj->heap_index >= 0 && obj->due > due) {
+		obj->due = due;
+		sdo_poll__heap_update(slot);
+	}
+
+	return 0;
+}
+
+static int sdo_poll__find_unused_registration(void)
+{
+	for (int i = 0; i < SDO_POLL_REGISTRATIONS_MAX; ++i)
+		if (!sdo_poll__registrations[i].is_used)
+			return i;
+
+	return -1;
+}
+
+int sdo_poll_register(const struct sdo_poll_info* info)
+{
+	if (info->nodeid < 1 || info->nodeid > 127 || info->period == 0
+	 || info->index < 0 || info->index > 0xffff
+	 || info->subindex < 0 || info->subindex > 0xff)
+		return -1;
+
+	uint32_t key = sdo_poll__key(info->nodeid, info->index, info->subindex);
+	uint64_t now = sdo_poll__now();
+	int handle = -1;
+
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	if (!sdo_poll__is_initialized)
+		goto done;
+
+	int i = sdo_poll__find_unused_registration();
+	if (i < 0)
+		goto done;
+
+	int slot = sdo_poll__find(key);
+	if (slot >= 0) {
+		if (sdo_poll__add_ref(slot, info, now) < 0)
+			goto done;
+	} else {
+		slot = sdo_poll__add_object(key, info, now);
+		if (slot < 0)
+			goto done;
+	}
+
+	struct sdo_poll__registration* reg = &sdo_poll__registrations[i];
+	reg->is_used = 1;
+	reg->slot = slot;
+	reg->period = info->period;
+
+	if (sdo_poll__heap_size > 0)
+		sdo_poll__wakeup(sdo_poll__due(sdo_poll__heap[0]), now);
+
+	handle = i;
+done:
+	pthread_mutex_unlock(&sdo_poll__mutex);
+	return handle;
+}
+
+static unsigned long sdo_poll__min_period(int slot)
+{
+	unsigned long period = ULONG_MAX;
+
+	for (int i = 0; i < SDO_POLL_REGISTRATIONS_MAX; ++i) {
+		const struct sdo_poll__registration* reg =
+			&sdo_poll__registrations[i];
+
+		if (reg->is_used && reg->slot == slot && reg->period < period)
+			period = reg->period;
+	}
+
+	return period;
+}
+
+static void sdo_poll__remove_object(int slot)
+{
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+	co_atomic_store(&obj->key, SDO_POLL_TOMBSTONE);
+
+	if (obj->heap_index >= 0)
+		sdo_poll__heap_remove(slot);
+
+	sdo_poll__n_objects--;
+
+	sdo_poll__clear_tombstones(slot);
+}
+
+void sdo_poll_unregister(int handle)
+{
+	if (handle < 0 || handle >= SDO_POLL_REGISTRATIONS_MAX)
+		return;
+
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	struct sdo_poll__registration* reg = &sdo_poll__registrations[handle];
+	if (!reg->is_used)
+		goto done;
+
+	reg->is_used = 0;
+
+	struct sdo_poll__object* obj = &sdo_poll__table[reg->slot];
+
+	if (--obj->n_refs == 0)
+		sdo_poll__remove_object(reg->slot);
+	else if (reg->period == obj->period)
+		obj->period = sdo_poll__min_period(reg->slot);
+
+done:
+	pthread_mutex_unlock(&sdo_poll__mutex);
+}
+
+int sdo_poll_read(int nodeid, int index, int subindex,
+		  struct sdo_poll_value* value)
+{
+	uint32_t key = sdo_poll__key(nodeid, index, subindex);
+
+	int slot = sdo_poll__find(key);
+	if (slot < 0)
+		return -1;
+
+	struct sdo_poll__object* obj = &sdo_poll__table[slot];
+
+	while (1) {
+		uint32_t seq = co_atomic_load(&obj->seq);
+		if (seq & 1)
+			continue;
+
+		memcpy(value, &obj->value, sizeof(*value));
+		co_atomic_fence();
+
+		if (co_atomic_load(&obj->seq) == seq)
+			break;
+	}
+
+	/* The slot may have been reused for another object in the meantime */
+	return co_atomic_load(&obj->key) == key ? 0 : -1;
+}
+
+size_t sdo_poll__count_tombstones(void)
+{
+	size_t n = 0;
+
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	for (size_t i = 0; i < SDO_POLL_TABLE_SIZE; ++i)
+		if (sdo_poll__table[i].key == SDO_POLL_TOMBSTONE)
+			n++;
+
+	pthread_mutex_unlock(&sdo_poll__mutex);
+	return n;
+}
+
+static const char* sdo_poll__status_str(enum sdo_req_status status)
+{
+	switch (status) {
+	case SDO_REQ_PENDING: return "pending";
+	case SDO_REQ_OK: return "ok";
+	case SDO_REQ_LOCAL_ABORT: return "local-abort";
+	case SDO_REQ_REMOTE_ABORT: return "remote-abort";
+	case SDO_REQ_CANCELLED: return "cancelled";
+	case SDO_REQ_NOMEM: return "nomem";
+	case SDO_REQ_NODE_DOWN: return "node-down";
+	}
+
+	abort();
+	return NULL;
+}
+
+static void sdo_poll__print_value(FILE* out, const struct sdo_poll_value* value)
+{
+	fprintf(out, "\"");
+
+	for (size_t i = 0; i < value->size; ++i)
+		fprintf(out, "%02x", value->data[i]);
+
+	fprintf(out, "\"");
+}
+
+void sdo_poll_print_stats(FILE* out)
+{
+	uint64_t now = sdo_poll__now();
+	int is_first = 1;
+
+	pthread_mutex_lock(&sdo_poll__mutex);
+
+	fprintf(out, "{\n \"rate\": %llu,\n \"objects\": %zu,\n"
+		" \"throttled\": %lu,\n \"polls\": [",
+		(unsigned long long)sdo_poll__bucket.rate, sdo_poll__n_objects,
+		sdo_poll__n_throttled);
+
+	for (size_t i = 0; i < SDO_POLL_TABLE_SIZE; ++i) {
+		const struct sdo_poll__object* obj = &sdo_poll__table[i];
+
+		if (obj->key == SDO_POLL_EMPTY || obj->key == SDO_POLL_TOMBSTONE)
+			continue;
+
+		const struct sdo_poll_value* value = &obj->value;
+
+		fprintf(out, "%s\n  { \"node\": %u, \"index\": %u, "
+			"\"subindex\": %u, \"period\": %lu, \"refs\": %u, "
+			"\"polls\": %lu, \"failures\": %lu, \"overruns\": %lu, "
+			"\"status\": \"%s\", \"age\": %lld, \"value\": ",
+			is_first ? "" : ",", obj->key >> 24,
+			(obj->key >> 8) & 0xffff, obj->key & 0xff, obj->period,
+			obj->n_refs, obj->n_polls, obj->n_failures,
+			obj->n_overruns, sdo_poll__status_str(value->status),
+			value->timestamp
+			? (long long)((now - value->timestamp) / 1000) : -1LL);
+
+		sdo_poll__print_value(out, value);
+		fprintf(out, " }");
+		is_first = 0;
+	}
+
+	fprintf(out, "\n ]\n}\n");
+
+	pthread_mutex_unlock(&sdo_poll__mutex);
+}
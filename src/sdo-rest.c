@@ -19,6 +19,7 @@
 #include <mloop.h>
 
 #include "canopen/sdo_req.h"
+#include "canopen/sdo-cache.h"
 #include "canopen/eds.h"
 #include "canopen.h"
 #include "canopen/master.h"
@@ -61,24 +62,6 @@ static int sdo_rest__convert_path(struct sdo_rest_path* dst,
 	     && dst->index >= 0x1000) ? 0 : -1;
 }
 
-static const struct canopen_eds* sdo_rest__find_eds(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	assert(node);
-
-	const struct canopen_eds* eds;
-
-	if (node->vendor_id == 0)
-		return eds_db_find_by_name(node->name);
-
-	eds = eds_db_find(node->vendor_id, node->product_code,
-			  node->revision_number);
-	if (eds)
-		return eds;
-
-	return eds_db_find(node->vendor_id, node->product_code, -1);
-}
-
 static struct sdo_rest_context*
 sdo_rest_context_new(struct rest_client* client,
 		     const struct sdo_rest_path* path)
@@ -124,11 +107,35 @@ static void sdo_rest_server_error(struct rest_client* client,
 	client->state = REST_CLIENT_DONE;
 }
 
+static void sdo_rest_unavailable(struct rest_client* client,
+				 const char* message)
+{
+	struct rest_reply_data reply = {
+		.status_code = "503 Service Unavailable",
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
+
+	rest_reply(client->output, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void sdo_rest__reply_error(struct rest_client* client,
+				  const struct sdo_req* req)
+{
+	if (req->status == SDO_REQ_NODE_DOWN)
+		sdo_rest_unavailable(client, "Node is not responding\r\n");
+	else
+		sdo_rest_server_error(client, sdo_strerror(req->abort_code));
+}
+
 static const struct eds_obj*
 sdo_rest__get_eds_obj(const struct sdo_rest_path* path,
 		      struct rest_client* client)
 {
-	const struct canopen_eds* eds = sdo_rest__find_eds(path->nodeid);
+	const struct canopen_eds* eds = co_master_find_eds(path->nodeid);
 	if (!eds) {
 		sdo_rest_server_error(client, "Could not find EDS for node\r\n");
 		return NULL;
@@ -159,32 +166,23 @@ static void sdo_rest_bad_request(struct rest_client* client,
 	client->state = REST_CLIENT_DONE;
 }
 
-static void on_sdo_rest_upload_done(struct sdo_req* req)
+static void sdo_rest__reply_value(struct rest_client* client,
+				  enum canopen_type type,
+				  const struct vector* value,
+				  int is_size_indicated)
 {
-	struct sdo_rest_context* context = req->context;
-	assert(context);
-	struct rest_client* client = context->client;
-
-	if (client->state == REST_CLIENT_DISCONNECTED)
-		goto done;
-
-	if (req->status != SDO_REQ_OK) {
-		sdo_rest_server_error(client, sdo_strerror(req->abort_code));
-		goto done;
-	}
-
 	struct canopen_data data = {
-		.type = context->type,
-		.data = req->data.data,
-		.size = req->data.index,
-		.is_size_unknown = !req->is_size_indicated
+		.type = type,
+		.data = value->data,
+		.size = value->index,
+		.is_size_unknown = !is_size_indicated
 	};
 
 	char buffer[256];
 	char* message = canopen_data_tostring(buffer, sizeof(buffer), &data);
 	if (!message) {
 		sdo_rest_server_error(client, "Data conversion failed\r\n");
-		goto done;
+		return;
 	}
 
 	struct rest_reply_data reply = {
@@ -197,23 +195,81 @@ static void on_sdo_rest_upload_done(struct sdo_req* req)
 	rest_reply(client->output, &reply);
 
 	client->state = REST_CLIENT_DONE;
+}
+
+static void on_sdo_rest_upload_done(struct sdo_req* req)
+{
+	struct sdo_rest_context* context = req->context;
+	assert(context);
+	struct rest_client* client = context->client;
+
+	if (client->state == REST_CLIENT_DISCONNECTED)
+		goto done;
+
+	if (req->status != SDO_REQ_OK) {
+		sdo_rest__reply_error(client, req);
+		goto done;
+	}
+
+	sdo_rest__reply_value(client, context->type, &req->data,
+			      req->is_size_indicated);
 
 done:
 	rest_client_unref(client);
 	free(context);
 }
 
+static int sdo_rest__reply_from_cache(struct sdo_rest_context* context,
+				      enum eds_obj_access access)
+{
+	struct sdo_rest_path* path = &context->path;
+	struct vector value = { 0 };
+	int is_size_indicated = 0;
+
+	uint64_t max_age = sdo_cache_max_age(path->index, access);
+
+	if (sdo_cache_lookup(path->nodeid, path->index, path->subindex,
+			     max_age, &value, &is_size_indicated) < 0)
+		return -1;
+
+	sdo_rest__reply_value(context->client, context->type, &value,
+			      is_size_indicated);
+
+	vector_destroy(&value);
+	free(context);
+	return 0;
+}
+
 static enum canopen_type sdo_rest__get_type(struct rest_client* client)
 {
 	const char* type = http_req_query(&client->req, "type");
 	return type ? canopen_type_from_string(type) : CANOPEN_UNKNOWN;
 }
 
+/* REST requests yield to drivers and the master unless asked otherwise */
+static enum sdo_req_prio sdo_rest__get_priority(struct rest_client* client)
+{
+	const char* prio = http_req_query(&client->req, "priority");
+	if (!prio)
+		return SDO_REQ_PRIO_LOW;
+
+	if (strcmp(prio, "high") == 0)
+		return SDO_REQ_PRIO_HIGH;
+
+	if (strcmp(prio, "normal") == 0)
+		return SDO_REQ_PRIO_NORMAL;
+
+	return SDO_REQ_PRIO_LOW;
+}
+
 static int sdo_rest__get(struct sdo_rest_context* context)
 {
 	struct rest_client* client = context->client;
 	struct sdo_rest_path* path = &context->path;
 
+	/* Objects with an explicit type are treated as volatile */
+	enum eds_obj_access access = EDS_OBJ_R;
+
 	enum canopen_type type = sdo_rest__get_type(client);
 	if (type != CANOPEN_UNKNOWN) {
 		context->type = type;
@@ -230,12 +286,17 @@ static int sdo_rest__get(struct sdo_rest_context* context)
 		}
 
 		context->type = eds_obj->type;
+		access = eds_obj->access;
 	}
 
+	if (sdo_rest__reply_from_cache(context, access) == 0)
+		return 0;
+
 	struct sdo_req_info info = {
 		.type = SDO_REQ_UPLOAD,
 		.index = path->index,
 		.subindex = path->subindex,
+		.prio = sdo_rest__get_priority(client),
 		.on_done = on_sdo_rest_upload_done,
 		.context = context
 	};
@@ -268,7 +329,7 @@ static void on_sdo_rest_download_done(struct sdo_req* req)
 		goto done;
 
 	if (req->status != SDO_REQ_OK) {
-		sdo_rest_server_error(client, sdo_strerror(req->abort_code));
+		sdo_rest__reply_error(client, req);
 		goto done;
 	}
 
@@ -333,6 +394,7 @@ static int sdo_rest__put(struct sdo_rest_context* context, const void* content)
 		.type = SDO_REQ_DOWNLOAD,
 		.index = path->index,
 		.subindex = path->subindex,
+		.prio = sdo_rest__get_priority(client),
 		.on_done = on_sdo_rest_download_done,
 		.context = context,
 		.dl_data = data.data,
@@ -372,13 +434,57 @@ int sdo_rest__process(struct sdo_rest_context* context, const void* content)
 	return -1;
 }
 
-ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid, int index,
-			     int subindex, enum canopen_type type)
+static ssize_t sdo_rest__print_value(FILE* out, enum canopen_type type,
+				     const struct vector* value,
+				     int is_size_indicated)
 {
+	struct canopen_data data = {
+		.type = type,
+		.data = value->data,
+		.size = value->index,
+		.is_size_unknown = !is_size_indicated
+	};
+
+	char buffer[256];
+	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
+	if (!str)
+		return fprintf(out, "null");
+
+	return fprintf(out, "\"%s\"", str);
+}
+
+static ssize_t sdo_rest__read_cached_value(FILE* out, unsigned int nodeid,
+					   const struct eds_obj* obj)
+{
+	struct vector value = { 0 };
+	int is_size_indicated = 0;
+
+	int index = eds_obj_index(obj);
+	int subindex = eds_obj_subindex(obj);
+	uint64_t max_age = sdo_cache_max_age(index, obj->access);
+
+	if (sdo_cache_lookup(nodeid, index, subindex, max_age, &value,
+			     &is_size_indicated) < 0)
+		return -1;
+
+	ssize_t rc = sdo_rest__print_value(out, obj->type, &value,
+					   is_size_indicated);
+	vector_destroy(&value);
+	return rc;
+}
+
+ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid,
+			     const struct eds_obj* obj)
+{
+	ssize_t rc = sdo_rest__read_cached_value(out, nodeid, obj);
+	if (rc >= 0)
+		return rc;
+
 	struct sdo_req_info info = {
 		.type = SDO_REQ_UPLOAD,
-		.index = index,
-		.subindex = subindex
+		.index = eds_obj_index(obj),
+		.subindex = eds_obj_subindex(obj),
+		.prio = SDO_REQ_PRIO_LOW
 	};
 
 	struct sdo_req* req = sdo_req_new(&info);
@@ -393,20 +499,11 @@ ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid, int index,
 	if (req->status != SDO_REQ_OK)
 		goto failure;
 
-	struct canopen_data data = {
-		.type = type,
-		.data = req->data.data,
-		.size = req->data.index,
-		.is_size_unknown = !req->is_size_indicated
-	};
-
-	char buffer[256];
-	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
-	if (!str)
-		goto failure;
+	rc = sdo_rest__print_value(out, obj->type, &req->data,
+				   req->is_size_indicated);
 
 	sdo_req_unref(req);
-	return fprintf(out, "\"%s\"", str);
+	return rc;
 
 failure:
 	sdo_req_unref(req);
@@ -498,8 +595,7 @@ first_object:
 
 		if ((is_const || is_readable) && with_value) {
 			fprintf(out, ",\n  \"value\": ");
-			sdo_rest__read_value(out, nodeid, index,
-						    subindex, obj->type);
+			sdo_rest__read_value(out, nodeid, obj);
 		}
 
 		if (obj->name) {
@@ -588,7 +684,7 @@ int sdo_rest__send_eds(struct rest_client* client)
 		return -1;
 	}
 
-	const struct canopen_eds* eds = sdo_rest__find_eds(nodeid);
+	const struct canopen_eds* eds = co_master_find_eds(nodeid);
 	if (!eds) {
 		sdo_rest_server_error(client, "Could not find EDS for node\r\n");
 		return -1;
@@ -17,8 +17,14 @@
  *
  * Features:
  * - Converts between plain data buffers and SDO transactions.
+ * - Transfers directly from/to the caller's buffers; download data is
+ *   borrowed and uploads can be received into a caller-supplied buffer.
+ * - Streams data from/to callbacks, so that objects of any size can be
+ *   transferred without being held in memory.
  * - Chooses expediated/segmented mode based on data size.
- * - Automatic timeout with abort.
+ * - Automatic timeout with abort. The timeout is either fixed or derived from
+ *   the round-trip times measured for the node.
+ * - Paces segment requests according to the bus-wide SDO rate governor.
  * - Enforces correct communication according to standard.
  * - Validates data according to state and aborts when receiving unexpected
  *   data.
@@ -30,9 +36,11 @@
 #include <mloop.h>
 #include "canopen/sdo.h"
 #include "canopen/sdo_async.h"
+#include "canopen/sdo-governor.h"
 #include "canopen.h"
 #include "net-util.h"
 #include "sock.h"
+#include "time-utils.h"
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b);
 
@@ -42,14 +50,66 @@
 #define CAN_MAX_DLC 8
 #endif
 
+/* Lower bound on the variance term; clock granularity in RFC 6298 */
+#define SDO_ASYNC_RTT_GRANULARITY 1000 /* us */
+
 static int sdo_async__send(struct sdo_async* self, struct can_frame* cf)
 {
 	if (self->quirks & SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME)
 		cf->can_dlc = CAN_MAX_DLC;
 
+	self->send_time = gettime_us(CLOCK_MONOTONIC);
+
 	return sock_send(&self->sock, cf, 0);
 }
 
+void sdo_async_rtt_update(struct sdo_async_rtt* rtt, uint64_t sample)
+{
+	rtt->last = sample;
+	rtt->backoff = 0;
+
+	if (rtt->n_samples++ == 0) {
+		rtt->srtt = sample;
+		rtt->rttvar = sample / 2;
+		return;
+	}
+
+	uint64_t delta = rtt->srtt > sample ? rtt->srtt - sample
+					    : sample - rtt->srtt;
+
+	rtt->rttvar = (3 * rtt->rttvar + delta) / 4;
+	rtt->srtt = (7 * rtt->srtt + sample) / 8;
+}
+
+unsigned long sdo_async_rtt_timeout(const struct sdo_async_rtt* rtt)
+{
+	if (rtt->n_samples == 0)
+		return rtt->max_timeout;
+
+	uint64_t var = 4 * rtt->rttvar;
+	if (var < SDO_ASYNC_RTT_GRANULARITY)
+		var = SDO_ASYNC_RTT_GRANULARITY;
+
+	uint64_t timeout = (rtt->srtt + var + 999) / 1000;
+
+	if (timeout < rtt->min_timeout)
+		timeout = rtt->min_timeout;
+
+	timeout <<= rtt->backoff;
+
+	if (timeout > rtt->max_timeout)
+		timeout = rtt->max_timeout;
+
+	return timeout;
+}
+
+void sdo_async_set_timeout_bounds(struct sdo_async* self, unsigned long min,
+				  unsigned long max)
+{
+	self->rtt.min_timeout = min;
+	self->rtt.max_timeout = max;
+}
+
 int sdo_async_stop(struct sdo_async* self)
 {
 	int rc = -1;
@@ -89,7 +149,7 @@ static inline void sdo_async__init_frame(const struct sdo_async* self,
 					 struct can_frame* cf)
 {
 	sdo_clear_frame(cf);
-	cf->can_id = R_RSDO + self->nodeid;
+	cf->can_id = self->req_cobid;
 }
 
 static int sdo_async__abort(struct sdo_async* self, enum sdo_abort_code code)
@@ -105,9 +165,23 @@ static int sdo_async__abort(struct sdo_async* self, enum sdo_abort_code code)
 	return -1;
 }
 
+static void sdo_async__resume(struct sdo_async* self);
+
 void sdo_async__on_timeout(struct mloop_timer* timer)
 {
 	struct sdo_async* self = mloop_timer_get_context(timer);
+
+	if (self->is_deferred) {
+		sdo_async__resume(self);
+		return;
+	}
+
+	/* Back off exponentially in case the node has merely slowed down */
+	struct sdo_async_rtt* rtt = &self->rtt;
+	rtt->n_timeouts++;
+	if (sdo_async_rtt_timeout(rtt) < rtt->max_timeout)
+		rtt->backoff++;
+
 	sdo_async__abort(self, SDO_ABORT_TIMEOUT);
 }
 
@@ -124,6 +198,10 @@ int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid)
 
 	self->sock = *sock;
 	self->nodeid = nodeid;
+	self->req_cobid = R_RSDO + nodeid;
+	self->res_cobid = R_TSDO + nodeid;
+	sdo_async_set_timeout_bounds(self, SDO_ASYNC_TIMEOUT_MIN,
+				     SDO_ASYNC_TIMEOUT_MAX);
 	mloop_timer_set_context(self->timer, self, NULL);
 	mloop_timer_set_callback(self->timer, sdo_async__on_timeout);
 
@@ -140,9 +218,83 @@ void sdo_async_destroy(struct sdo_async* self)
 	mloop_timer_unref(self->timer);
 }
 
+void sdo_async_set_cobids(struct sdo_async* self, unsigned int req_cobid,
+			  unsigned int res_cobid)
+{
+	self->req_cobid = req_cobid;
+	self->res_cobid = res_cobid;
+}
+
 static inline int sdo_async__is_expediated(const struct sdo_async* self)
 {
-	return self->buffer.index <= SDO_EXPEDIATED_DATA_SIZE;
+	return self->dl_size <= SDO_EXPEDIATED_DATA_SIZE;
+}
+
+static int sdo_async__dl_read(struct sdo_async* self, void* dst, size_t size)
+{
+	if (!self->read_fn) {
+		memcpy(dst, (const char*)self->dl_data + self->pos, size);
+		return 0;
+	}
+
+	ssize_t rc = self->read_fn(self->stream_context, dst, size, self->pos);
+	return rc == (ssize_t)size ? 0 : -1;
+}
+
+static int sdo_async__ul_reserve(struct sdo_async* self, size_t size)
+{
+	self->ul_indicated_size = size;
+
+	if (self->write_fn)
+		return 0;
+
+	if (self->ul_buffer)
+		return size <= self->ul_buffer_size ? 0 : -1;
+
+	return vector_reserve(&self->buffer, size);
+}
+
+static int sdo_async__ul_append(struct sdo_async* self, const void* data,
+				size_t size)
+{
+	if (self->write_fn) {
+		if (self->write_fn(self->stream_context, data, size,
+				   self->ul_size) < 0)
+			return -1;
+
+		self->ul_size += size;
+		return 0;
+	}
+
+	if (!self->ul_buffer) {
+		if (vector_append(&self->buffer, data, size) < 0)
+			return -1;
+
+		self->ul_size += size;
+		return 0;
+	}
+
+	if (self->ul_size + size > self->ul_buffer_size)
+		return -1;
+
+	memcpy((char*)self->ul_buffer + self->ul_size, data, size);
+	self->ul_size += size;
+	return 0;
+}
+
+static inline enum sdo_abort_code
+sdo_async__ul_abort_code(const struct sdo_async* self)
+{
+	if (self->write_fn)
+		return SDO_ABORT_STORE;
+
+	return self->ul_buffer ? SDO_ABORT_TOO_LONG : SDO_ABORT_NOMEM;
+}
+
+static inline void sdo_async__progress(struct sdo_async* self)
+{
+	if (self->on_progress)
+		self->on_progress(self);
 }
 
 int sdo_async__send_init_dl(struct sdo_async* self)
@@ -155,12 +307,13 @@ int sdo_async__send_init_dl(struct sdo_async* self)
 	sdo_indicate_size(&cf);
 	if (sdo_async__is_expediated(self)) {
 		sdo_expediate(&cf);
-		sdo_set_expediated_size(&cf, self->buffer.index);
-		cf.can_dlc = SDO_EXPEDIATED_DATA_IDX + self->buffer.index;
-		memcpy(&cf.data[SDO_EXPEDIATED_DATA_IDX], self->buffer.data,
-		       self->buffer.index);
+		sdo_set_expediated_size(&cf, self->dl_size);
+		cf.can_dlc = SDO_EXPEDIATED_DATA_IDX + self->dl_size;
+		if (sdo_async__dl_read(self, &cf.data[SDO_EXPEDIATED_DATA_IDX],
+				       self->dl_size) < 0)
+			return sdo_async__abort(self, SDO_ABORT_STORE);
 	} else {
-		sdo_set_indicated_size(&cf, self->buffer.index);
+		sdo_set_indicated_size(&cf, self->dl_size);
 		cf.can_dlc = CAN_MAX_DLC;
 	}
 	mloop_timer_start(self->timer);
@@ -207,11 +360,25 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->is_size_indicated = 0;
-	mloop_timer_set_time(self->timer, info->timeout * 1000000ULL);
-
-	if (info->type == SDO_REQ_DOWNLOAD)
-		vector_assign(&self->buffer, info->data, info->size);
-	else
+	self->prio = info->prio;
+	self->is_deferred = 0;
+
+	self->timeout = info->timeout ? info->timeout
+				      : sdo_async_rtt_timeout(&self->rtt);
+	mloop_timer_set_time(self->timer, self->timeout * 1000000ULL);
+
+	self->dl_data = info->data;
+	self->dl_size = info->size;
+	self->ul_buffer = info->ul_buffer;
+	self->ul_buffer_size = info->ul_buffer_size;
+	self->ul_size = 0;
+	self->ul_indicated_size = 0;
+	self->read_fn = info->read_fn;
+	self->write_fn = info->write_fn;
+	self->stream_context = info->stream_context;
+	self->on_progress = info->on_progress;
+
+	if (info->type == SDO_REQ_UPLOAD && !info->ul_buffer && !info->write_fn)
 		vector_clear(&self->buffer);
 
 	self->comm_state = SDO_ASYNC_COMM_INIT_RESPONSE;
@@ -225,21 +392,41 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 
 static inline int sdo_async__is_at_end(const struct sdo_async* self)
 {
-	return self->pos >= self->buffer.index;
+	return self->pos >= self->dl_size;
+}
+
+/* Wait for the governor to allow the next segment request. The timer is reused
+ * for this since no response is expected in the meantime.
+ */
+static int sdo_async__defer(struct sdo_async* self)
+{
+	unsigned long delay = sdo_governor_acquire(self->prio);
+	if (delay == 0)
+		return 0;
+
+	self->is_deferred = 1;
+	mloop_timer_stop(self->timer);
+	mloop_timer_set_time(self->timer, delay * 1000000ULL);
+	mloop_timer_start(self->timer);
+	return 1;
 }
 
 int sdo_async__request_dl_segment(struct sdo_async* self)
 {
+	if (sdo_async__defer(self))
+		return 0;
+
 	struct can_frame cf;
 	sdo_async__init_frame(self, &cf);
 	sdo_set_cs(&cf, SDO_CCS_DL_SEG_REQ);
 	if (self->is_toggled) sdo_toggle(&cf);
 
-	size_t size = MIN(SDO_SEGMENT_MAX_SIZE, self->buffer.index - self->pos);
+	size_t size = MIN(SDO_SEGMENT_MAX_SIZE, self->dl_size - self->pos);
 	assert(size > 0);
 
 	sdo_set_segment_size(&cf, size);
-	memcpy(&cf.data[SDO_SEGMENT_IDX], self->buffer.data + self->pos, size);
+	if (sdo_async__dl_read(self, &cf.data[SDO_SEGMENT_IDX], size) < 0)
+		return sdo_async__abort(self, SDO_ABORT_STORE);
 
 	cf.can_dlc = SDO_SEGMENT_IDX + size;
 	self->pos += size;
@@ -289,8 +476,18 @@ int sdo_async__handle_expediated_ul(struct sdo_async* self,
 		    ? sdo_get_expediated_size(cf)
 		    : SDO_EXPEDIATED_DATA_SIZE;
 	assert(size <= SDO_EXPEDIATED_DATA_SIZE);
-	vector_assign(&self->buffer, &cf->data[SDO_EXPEDIATED_DATA_IDX],
-		      size);
+
+	if (self->ul_buffer || self->write_fn) {
+		if (sdo_async__ul_append(self, &cf->data[SDO_EXPEDIATED_DATA_IDX],
+					 size) < 0)
+			return sdo_async__abort(self,
+						sdo_async__ul_abort_code(self));
+	} else {
+		vector_assign(&self->buffer, &cf->data[SDO_EXPEDIATED_DATA_IDX],
+			      size);
+		self->ul_size = size;
+	}
+
 	self->status = SDO_REQ_OK;
 	sdo_async__on_done(self);
 	return 0;
@@ -298,6 +495,9 @@ int sdo_async__handle_expediated_ul(struct sdo_async* self,
 
 int sdo_async__request_ul_segment(struct sdo_async* self)
 {
+	if (sdo_async__defer(self))
+		return 0;
+
 	struct can_frame cf;
 	sdo_async__init_frame(self, &cf);
 	sdo_set_cs(&cf, SDO_CCS_UL_SEG_REQ);
@@ -313,8 +513,9 @@ int sdo_async__handle_init_segmented_ul(struct sdo_async* self,
 {
 	self->is_size_indicated = sdo_is_size_indicated(cf);
 	if (self->is_size_indicated && cf->can_dlc == CAN_MAX_DLC)
-		if (vector_reserve(&self->buffer, sdo_get_indicated_size(cf)) < 0)
-			return sdo_async__abort(self, SDO_ABORT_NOMEM);
+		if (sdo_async__ul_reserve(self, sdo_get_indicated_size(cf)) < 0)
+			return sdo_async__abort(self,
+						sdo_async__ul_abort_code(self));
 
 	sdo_async__request_ul_segment(self);
 	self->comm_state = SDO_ASYNC_COMM_SEG_RESPONSE;
@@ -371,6 +572,8 @@ int sdo_async__feed_dl_seg_response(struct sdo_async* self,
 
 	self->is_toggled ^= 1;
 
+	sdo_async__progress(self);
+
 	if (sdo_async__is_at_end(self)) {
 		self->status = SDO_REQ_OK;
 		sdo_async__on_done(self);
@@ -398,8 +601,10 @@ int sdo_async__feed_ul_seg_response(struct sdo_async* self,
 	size_t size = sdo_get_segment_size(cf);
 	const void* data = &cf->data[SDO_SEGMENT_IDX];
 
-	if (vector_append(&self->buffer, data, size) < 0)
-		return sdo_async__abort(self, SDO_ABORT_NOMEM);
+	if (sdo_async__ul_append(self, data, size) < 0)
+		return sdo_async__abort(self, sdo_async__ul_abort_code(self));
+
+	sdo_async__progress(self);
 
 	if (sdo_is_end_segment(cf)) {
 		self->status = SDO_REQ_OK;
@@ -411,6 +616,23 @@ int sdo_async__feed_ul_seg_response(struct sdo_async* self,
 	return 0;
 }
 
+static void sdo_async__resume(struct sdo_async* self)
+{
+	self->is_deferred = 0;
+	mloop_timer_set_time(self->timer, self->timeout * 1000000ULL);
+
+	switch (self->type) {
+	case SDO_REQ_DOWNLOAD:
+		sdo_async__request_dl_segment(self);
+		return;
+	case SDO_REQ_UPLOAD:
+		sdo_async__request_ul_segment(self);
+		return;
+	}
+
+	abort();
+}
+
 int sdo_async__feed_seg_response(struct sdo_async* self,
 				 const struct can_frame* cf)
 {
@@ -425,13 +647,22 @@ int sdo_async__feed_seg_response(struct sdo_async* self,
 
 int sdo_async_feed(struct sdo_async* self, const struct can_frame* cf)
 {
-	assert(cf->can_id == R_TSDO + self->nodeid);
+	assert(cf->can_id == self->res_cobid);
 
 	if (!self->is_running)
 		return -1;
 
+	/* No request is outstanding, so this is a late or duplicate response.
+	 * The timer is waiting for the governor and must be left alone.
+	 */
+	if (self->is_deferred)
+		return -1;
+
 	mloop_timer_stop(self->timer);
 
+	sdo_async_rtt_update(&self->rtt,
+			     gettime_us(CLOCK_MONOTONIC) - self->send_time);
+
 	if (sdo_get_cs(cf) == SDO_SCS_ABORT) {
 		self->status = SDO_REQ_REMOTE_ABORT;
 		self->abort_code = sdo_get_abort_code(cf);
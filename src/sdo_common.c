@@ -78,6 +78,12 @@ const char* sdo_strerror(enum sdo_abort_code code)
 		return "Invalid value for parameter";
 	case SDO_ABORT_GENERAL:
 		return "General error";
+	case SDO_ABORT_STORE:
+		return "Data cannot be transferred or stored to the application";
+	case SDO_ABORT_LOCAL_CONTROL:
+		return "Data cannot be transferred or stored to the application because of local control";
+	case SDO_ABORT_DEVICE_STATE:
+		return "Data cannot be transferred or stored to the application because of the present device state";
 	}
 	return "UNKNOWN";
 }
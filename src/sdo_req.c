@@ -20,32 +20,136 @@
  * When an SDO is requested, a request object is returned that can be used to
  * monitor the status and/or cancel the request. A request can be made to any
  * node with id between 1 and 127. Multiple requests can be made to the same
- * node at the same time. They will be queued up in FIFO order.
+ * node at the same time. They will be queued up in FIFO order within their
+ * priority class.
+ *
+ * The priority classes are served in weighted round-robin order: while
+ * requests of several classes are waiting, each class gets to send as many
+ * requests as its weight before the lower classes get their turn. A high
+ * priority request therefore waits for at most as many lower priority transfers
+ * as the sum of their weights, and the lower priorities are never starved.
  *
  * There are 127 queues available; one for each possible node.
  *
+ * If the node has more than one SDO server channel, a client is run for each
+ * channel that is added to the queue and requests are spread over them. Only
+ * requests for different objects run at the same time.
+ *
+ * Requests can be started from any thread. Starting a request never blocks:
+ * the request is pushed onto a lock-free inbox, from which the main loop picks
+ * it up.
+ *
  * A request can be handled in either a synchronous or asynchronous manner, by
  * either waiting for it to finish using sdo_req_wait() or registering an
  * "on_done" callback.
+ *
+ * The SDO client transfers directly from/to the request's data buffer:
+ * download data is borrowed for the duration of the transfer and uploaded data
+ * is handed over by swapping buffers, so it is never copied between the two.
+ * An upload may also be received into a buffer supplied by the caller. Objects
+ * that are too large to be held in memory, such as firmware images, can be
+ * streamed from a source or into a sink callback instead.
+ *
+ * An upload that is requested while another upload of the same object is
+ * pending is not sent on the bus. Instead, it is attached to the pending
+ * request and receives a copy of its result. Optionally, a queued download may
+ * be superseded by a newer download to the same object, in which case only the
+ * newer one is sent.
+ *
+ * Each queue has a circuit breaker so that requests to a node that has stopped
+ * answering fail immediately instead of each waiting for its own timeout. See
+ * sdo_req.h for details. Requests that are aborted by the node for reasons
+ * that are likely to be transient may optionally be retried after a short,
+ * randomised delay.
  */
 #include <assert.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include "vector.h"
 #include "sys/queue.h"
 #include "canopen/sdo.h"
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req.h"
+#include "canopen/sdo-cache.h"
+#include "canopen/sdo-governor.h"
+#include "co_atomic.h"
 #include "sock.h"
+#include "time-utils.h"
 
-#define SDO_REQ_TIMEOUT 1000 /* ms */
+/* For objects that are known to take a long time to process */
+#define SDO_REQ_SLOW_TIMEOUT 5000 /* ms */
 #define SDO_REQ_ASYNC_PRIO 1000
 
 #define SDO_BUFFER_INITIAL_SIZE 8
 
+#define SDO_REQ_BREAKER_BACKOFF_MIN 1000 /* ms */
+#define SDO_REQ_BREAKER_BACKOFF_MAX 60000 /* ms */
+
+/* Doubles with each retry */
+#define SDO_REQ_RETRY_DELAY 20 /* ms */
+
+#define SDO_REQ_COBID_COUNT (CAN_SFF_MASK + 1)
+
 /* Index 0 is unused */
 static struct sdo_req_queue sdo_req__queues[128];
 
+/* Clients of the additional channels by response COB-ID */
+static struct sdo_async* sdo_req__channels[SDO_REQ_COBID_COUNT];
+
+static const int sdo_req__slow_objects[] = {
+	0x1010, /* Store parameters */
+	0x1011, /* Restore default parameters */
+	0x1F50, /* Program data */
+	0x1F51, /* Program control */
+};
+
+/* In order of precedence */
+static const enum sdo_req_prio sdo_req__prio_order[SDO_REQ_PRIO_COUNT] = {
+	SDO_REQ_PRIO_HIGH,
+	SDO_REQ_PRIO_NORMAL,
+	SDO_REQ_PRIO_LOW,
+};
+
+static const unsigned int sdo_req__prio_weight[SDO_REQ_PRIO_COUNT] = {
+	[SDO_REQ_PRIO_HIGH] = 8,
+	[SDO_REQ_PRIO_NORMAL] = 4,
+	[SDO_REQ_PRIO_LOW] = 1,
+};
+
+/* Abort codes after which the same request may well succeed a little later */
+static const enum sdo_abort_code sdo_req__transient_aborts[] = {
+	SDO_ABORT_NOMEM,
+	SDO_ABORT_LOCAL_CONTROL,
+	SDO_ABORT_DEVICE_STATE,
+};
+
+/* Expediated transfers are sent in one go, so small objects are read up front
+ * rather than while the transfer is starting.
+ */
+static int sdo_req__init_dl_stream(struct sdo_req* self,
+				   const struct sdo_req_info* info)
+{
+	if (info->dl_size > SDO_EXPEDIATED_DATA_SIZE) {
+		self->read_fn = info->dl_source;
+		self->stream_size = info->dl_size;
+		return vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE);
+	}
+
+	if (vector_init(&self->data, SDO_EXPEDIATED_DATA_SIZE) < 0)
+		return -1;
+
+	if (info->dl_source(info->stream_context, self->data.data,
+			    info->dl_size, 0) != (ssize_t)info->dl_size) {
+		vector_destroy(&self->data);
+		return -1;
+	}
+
+	self->data.index = info->dl_size;
+	return 0;
+}
+
 struct sdo_req* sdo_req_new(struct sdo_req_info* info)
 {
 	struct sdo_req* self = malloc(sizeof(*self));
@@ -60,11 +164,28 @@ struct sdo_req* sdo_req_new(struct sdo_req_info* info)
 	self->subindex = info->subindex;
 	self->on_done = info->on_done;
 	self->context = info->context;
+	self->timeout = info->timeout;
+	self->prio = info->prio;
+	TAILQ_INIT(&self->followers);
+
+	self->stream_context = info->stream_context;
+	self->stream_free_fn = info->stream_free_fn;
+	self->on_progress = info->on_progress;
 
-	if (info->type == SDO_REQ_DOWNLOAD) {
+	if (info->type == SDO_REQ_DOWNLOAD && info->dl_source) {
+		if (sdo_req__init_dl_stream(self, info) < 0)
+			goto failure;
+	} else if (info->type == SDO_REQ_DOWNLOAD) {
 		if (vector_assign(&self->data, info->dl_data,
 				  info->dl_size) < 0)
 			goto failure;
+	} else if (info->ul_sink) {
+		self->write_fn = info->ul_sink;
+		if (vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE) < 0)
+			goto failure;
+	} else if (info->ul_buffer) {
+		sdo_req_set_ul_buffer(self, info->ul_buffer,
+				      info->ul_buffer_size);
 	} else {
 		if (vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE) < 0)
 			goto failure;
@@ -82,14 +203,31 @@ void sdo_req_free(struct sdo_req* self)
 	if (self->context && self->context_free_fn)
 		self->context_free_fn(self->context);
 
-	vector_destroy(&self->data);
+	if (self->stream_context && self->stream_free_fn)
+		self->stream_free_fn(self->stream_context);
+
+	if (!self->is_data_borrowed)
+		vector_destroy(&self->data);
+
 	free(self);
 }
 
+void sdo_req_set_ul_buffer(struct sdo_req* self, void* buffer, size_t size)
+{
+	if (!self->is_data_borrowed)
+		vector_destroy(&self->data);
+
+	self->data.data = buffer;
+	self->data.size = size;
+	self->data.index = 0;
+	self->is_data_borrowed = 1;
+}
+
 ARC_GENERATE(sdo_req, sdo_req_free)
 
 void sdo_req__process_queue(struct mloop_idle* idle);
 int sdo_req__have_req(struct mloop_idle* idle);
+static void sdo_req__on_retry_timeout(struct mloop_timer* timer);
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 			int nodeid, size_t limit,
@@ -97,9 +235,12 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 {
 	memset(self, 0, sizeof(*self));
 
-	if (sdo_async_init(&self->sdo_client, sock, nodeid) < 0)
+	if (sdo_async_init(&self->channel[0].client, sock, nodeid) < 0)
 		return -1;
 
+	self->channel[0].queue = self;
+	self->n_channels = 1;
+
 	self->idle = mloop_idle_new(mloop_default());
 	if (!self->idle)
 		goto failure;
@@ -109,8 +250,17 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 	mloop_idle_set_context(self->idle, self, NULL);
 	mloop_idle_start(self->idle);
 
-	self->sdo_client.quirks = quirks;
+	self->retry_timer = mloop_timer_new(mloop_default());
+	if (!self->retry_timer)
+		goto timer_failure;
+
+	mloop_timer_set_context(self->retry_timer, self, NULL);
+	mloop_timer_set_callback(self->retry_timer, sdo_req__on_retry_timeout);
+
+	self->channel[0].client.quirks = quirks;
 
+	self->sock = sock;
+	self->quirks = quirks;
 	self->limit = limit;
 	self->nodeid = nodeid;
 
@@ -120,39 +270,73 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 	pthread_mutex_init(&self->mutex, &attr);
 	pthread_mutexattr_destroy(&attr);
 
-	TAILQ_INIT(&self->list);
+	mpsc_queue_init(&self->inbox);
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		TAILQ_INIT(&self->list[i]);
 
 	return 0;
 
+timer_failure:
+	mloop_idle_unref(self->idle);
 failure:
-	sdo_async_destroy(&self->sdo_client);
+	sdo_async_destroy(&self->channel[0].client);
 	return -1;
 }
 
-void sdo_req__queue_clear(struct sdo_req_queue* self)
+static size_t sdo_req__cancel_list(struct sdo_req_list* list)
 {
-	while (!TAILQ_EMPTY(&self->list)) {
-		struct sdo_req* req = TAILQ_FIRST(&self->list);
-		TAILQ_REMOVE(&self->list, req, links);
+	struct sdo_req* req;
+	size_t n = 0;
+
+	while ((req = TAILQ_FIRST(list)) != NULL) {
+		TAILQ_REMOVE(list, req, links);
+		sdo_req__cancel_list(&req->followers);
 		req->status = SDO_REQ_CANCELLED;
 		sdo_req_unref(req);
+		++n;
 	}
-	self->size = 0;
+
+	return n;
+}
+
+static void sdo_req_queue__drain(struct sdo_req_queue* self);
+
+void sdo_req__queue_clear(struct sdo_req_queue* self)
+{
+	size_t n = 0;
+
+	sdo_req_queue__drain(self);
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		n += sdo_req__cancel_list(&self->list[i]);
+
+	self->is_blocked = 0;
+
+	/* Requests may be arriving concurrently, so size is not simply reset */
+	co_atomic_sub_fetch(&self->size, n);
 }
 
 void sdo_req__queue_destroy(struct sdo_req_queue* self)
 {
+	mloop_timer_stop(self->retry_timer);
+	mloop_timer_unref(self->retry_timer);
 	mloop_idle_unref(self->idle);
-	sdo_async_destroy(&self->sdo_client);
+	sdo_req_queue_remove_channels(self);
+	sdo_async_destroy(&self->channel[0].client);
 	sdo_req__queue_clear(self);
 	pthread_mutex_destroy(&self->mutex);
 }
 
+static void sdo_req__on_governor_wakeup(void);
+
 int sdo_req_queues_init(const struct sock* sock, size_t limit,
 			enum sdo_async_quirks_flags quirks)
 {
 	size_t i;
 
+	sdo_governor_set_wakeup_fn(sdo_req__on_governor_wakeup);
+
 	for (i = 1; i < 128; ++i)
 		if (sdo_req__queue_init(&sdo_req__queues[i], sock, i, limit,
 					quirks) < 0)
@@ -193,24 +377,42 @@ void sdo_req_queue_flush(struct sdo_req_queue* self)
 {
 	sdo_req_queue__lock(self);
 	sdo_req__queue_clear(self);
-	sdo_async_stop(&self->sdo_client);
+	for (unsigned int i = 0; i < self->n_channels; ++i)
+		sdo_async_stop(&self->channel[i].client);
 	sdo_req_queue__unlock(self);
 }
 
-int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
+int sdo_req_queue_add_channel(struct sdo_req_queue* self,
+			      unsigned int req_cobid, unsigned int res_cobid)
 {
-	assert(req->parent == NULL);
-
 	int rc = -1;
+
+	if (req_cobid >= SDO_REQ_COBID_COUNT
+	 || res_cobid >= SDO_REQ_COBID_COUNT)
+		return -1;
+
 	sdo_req_queue__lock(self);
-	if (self->size >= self->limit)
+
+	if (self->n_channels >= SDO_REQ_CHANNELS_MAX)
 		goto done;
-	else
-		++self->size;
 
-	req->parent = self;
-	TAILQ_INSERT_TAIL(&self->list, req, links);
-	mloop_iterate(mloop_default());
+	struct sdo_req_channel* channel = &self->channel[self->n_channels];
+	const struct sdo_async* main_client = &self->channel[0].client;
+
+	if (sdo_async_init(&channel->client, self->sock, self->nodeid) < 0)
+		goto done;
+
+	channel->client.quirks = self->quirks;
+	sdo_async_set_cobids(&channel->client, req_cobid, res_cobid);
+	sdo_async_set_timeout_bounds(&channel->client,
+				     main_client->rtt.min_timeout,
+				     main_client->rtt.max_timeout);
+
+	channel->queue = self;
+	channel->current = NULL;
+
+	co_atomic_store(&sdo_req__channels[res_cobid], &channel->client);
+	co_atomic_store(&self->n_channels, self->n_channels + 1);
 
 	rc = 0;
 done:
@@ -218,32 +420,476 @@ done:
 	return rc;
 }
 
+/* Stop and remove all but the default channel */
+void sdo_req_queue_remove_channels(struct sdo_req_queue* self)
+{
+	sdo_req_queue__lock(self);
+
+	while (self->n_channels > 1) {
+		struct sdo_req_channel* channel =
+			&self->channel[self->n_channels - 1];
+
+		sdo_async_stop(&channel->client);
+
+		co_atomic_store(&sdo_req__channels[channel->client.res_cobid],
+				NULL);
+		co_atomic_store(&self->n_channels, self->n_channels - 1);
+
+		sdo_async_destroy(&channel->client);
+	}
+
+	sdo_req_queue__unlock(self);
+}
+
+struct sdo_async* sdo_req_find_channel(unsigned int res_cobid)
+{
+	if (res_cobid >= SDO_REQ_COBID_COUNT)
+		return NULL;
+
+	return co_atomic_load(&sdo_req__channels[res_cobid]);
+}
+
+void sdo_req_queue_set_flags(struct sdo_req_queue* self,
+			     enum sdo_req_queue_flags flags)
+{
+	sdo_req_queue__lock(self);
+	self->flags = flags;
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_get_stats(struct sdo_req_queue* self,
+			     struct sdo_req_queue_stats* stats)
+{
+	sdo_req_queue__lock(self);
+	*stats = self->stats;
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_set_timeout_bounds(struct sdo_req_queue* self,
+				      unsigned long min, unsigned long max)
+{
+	sdo_req_queue__lock(self);
+	for (unsigned int i = 0; i < self->n_channels; ++i)
+		sdo_async_set_timeout_bounds(&self->channel[i].client, min,
+					     max);
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_set_breaker(struct sdo_req_queue* self,
+			       unsigned int threshold)
+{
+	sdo_req_queue__lock(self);
+	self->breaker.threshold = threshold;
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_set_max_retries(struct sdo_req_queue* self,
+				   unsigned int max_retries)
+{
+	sdo_req_queue__lock(self);
+	self->max_retries = max_retries;
+	sdo_req_queue__unlock(self);
+}
+
+static inline uint64_t sdo_req__now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+/* Somewhere between half and all of ms, so that retries to many nodes that
+ * failed at the same time do not happen in lockstep.
+ */
+static unsigned long sdo_req__jitter(unsigned long ms)
+{
+	return ms / 2 + random() % (ms / 2 + 1);
+}
+
+static void sdo_req__breaker_open(struct sdo_req_queue* self,
+				  unsigned long backoff)
+{
+	struct sdo_req_breaker* breaker = &self->breaker;
+
+	breaker->state = SDO_REQ_BREAKER_OPEN;
+	breaker->backoff = backoff;
+	breaker->next_probe = sdo_req__now()
+			    + sdo_req__jitter(backoff) * 1000ULL;
+}
+
+static void sdo_req__breaker_close(struct sdo_req_queue* self)
+{
+	struct sdo_req_breaker* breaker = &self->breaker;
+
+	breaker->state = SDO_REQ_BREAKER_CLOSED;
+	breaker->n_timeouts = 0;
+	breaker->backoff = 0;
+}
+
+static void sdo_req__breaker_on_timeout(struct sdo_req_queue* self)
+{
+	struct sdo_req_breaker* breaker = &self->breaker;
+	unsigned long backoff;
+
+	breaker->n_timeouts++;
+
+	switch (breaker->state) {
+	case SDO_REQ_BREAKER_CLOSED:
+		if (!breaker->threshold
+		 || breaker->n_timeouts < breaker->threshold)
+			break;
+
+		breaker->n_trips++;
+		sdo_req__breaker_open(self, SDO_REQ_BREAKER_BACKOFF_MIN);
+		break;
+	case SDO_REQ_BREAKER_HALF_OPEN:
+		backoff = breaker->backoff * 2;
+		if (backoff > SDO_REQ_BREAKER_BACKOFF_MAX)
+			backoff = SDO_REQ_BREAKER_BACKOFF_MAX;
+
+		sdo_req__breaker_open(self, backoff);
+		break;
+	case SDO_REQ_BREAKER_OPEN:
+		break;
+	}
+}
+
+/* Returns true if a request may be sent. If the breaker is open and it is time
+ * to probe, the request that is sent next becomes the probe.
+ */
+static int sdo_req__breaker_allows(struct sdo_req_queue* self)
+{
+	struct sdo_req_breaker* breaker = &self->breaker;
+
+	if (breaker->state != SDO_REQ_BREAKER_OPEN)
+		return 1;
+
+	if (sdo_req__now() < breaker->next_probe)
+		return 0;
+
+	breaker->state = SDO_REQ_BREAKER_HALF_OPEN;
+	return 1;
+}
+
+void sdo_req_queue_close_breaker(struct sdo_req_queue* self)
+{
+	/* This is called for every heartbeat, so the lock is only taken if
+	 * there is something to reset. A timeout that races with this check
+	 * is picked up by the next heartbeat.
+	 */
+	if (co_atomic_load(&self->breaker.state) == SDO_REQ_BREAKER_CLOSED
+	 && co_atomic_load(&self->breaker.n_timeouts) == 0)
+		return;
+
+	sdo_req_queue__lock(self);
+	sdo_req__breaker_close(self);
+	sdo_req_queue__unlock(self);
+}
+
+static const char*
+sdo_req__breaker_state_str(enum sdo_req_breaker_state state)
+{
+	switch (state) {
+	case SDO_REQ_BREAKER_CLOSED: return "closed";
+	case SDO_REQ_BREAKER_OPEN: return "open";
+	case SDO_REQ_BREAKER_HALF_OPEN: return "half-open";
+	}
+
+	abort();
+	return NULL;
+}
+
+void sdo_req_print_breaker_stats(FILE* out)
+{
+	int is_first = 1;
+
+	fprintf(out, "{");
+
+	for (int i = 1; i < 128; ++i) {
+		struct sdo_req_queue* queue = &sdo_req__queues[i];
+
+		sdo_req_queue__lock(queue);
+		struct sdo_req_breaker breaker = queue->breaker;
+		sdo_req_queue__unlock(queue);
+
+		if (breaker.state == SDO_REQ_BREAKER_CLOSED
+		 && !breaker.n_trips)
+			continue;
+
+		fprintf(out, "%s\n \"%d\": { \"state\": \"%s\", "
+			"\"timeouts\": %u, \"trips\": %lu, \"rejected\": %lu, "
+			"\"backoff\": %lu }", is_first ? "" : ",", i,
+			sdo_req__breaker_state_str(breaker.state),
+			breaker.n_timeouts, breaker.n_trips,
+			breaker.n_rejected, breaker.backoff);
+		is_first = 0;
+	}
+
+	fprintf(out, "\n}\n");
+}
+
+void sdo_req_print_rtt_stats(FILE* out)
+{
+	int is_first = 1;
+
+	fprintf(out, "{");
+
+	for (int i = 1; i < 128; ++i) {
+		struct sdo_req_queue* queue = &sdo_req__queues[i];
+
+		sdo_req_queue__lock(queue);
+		struct sdo_async_rtt rtt = queue->channel[0].client.rtt;
+		sdo_req_queue__unlock(queue);
+
+		if (!rtt.n_samples && !rtt.n_timeouts)
+			continue;
+
+		fprintf(out, "%s\n \"%d\": { \"srtt\": %llu, \"rttvar\": %llu, "
+			"\"last\": %llu, \"timeout\": %lu, \"samples\": %lu, "
+			"\"timeouts\": %lu }", is_first ? "" : ",", i,
+			(unsigned long long)rtt.srtt,
+			(unsigned long long)rtt.rttvar,
+			(unsigned long long)rtt.last,
+			sdo_async_rtt_timeout(&rtt), rtt.n_samples,
+			rtt.n_timeouts);
+		is_first = 0;
+	}
+
+	fprintf(out, "\n}\n");
+}
+
+void sdo_req_print_stats(FILE* out)
+{
+	struct sdo_req_queue_stats stats;
+	int is_first = 1;
+
+	fprintf(out, "{");
+
+	for (int i = 1; i < 128; ++i) {
+		sdo_req_queue_get_stats(&sdo_req__queues[i], &stats);
+		if (!stats.coalesced_uploads && !stats.superseded_downloads
+		 && !stats.retries)
+			continue;
+
+		fprintf(out, "%s\n \"%d\": { \"coalesced-uploads\": %lu, "
+			"\"superseded-downloads\": %lu, \"retries\": %lu }",
+			is_first ? "" : ",", i, stats.coalesced_uploads,
+			stats.superseded_downloads, stats.retries);
+		is_first = 0;
+	}
+
+	fprintf(out, "\n}\n");
+}
+
+static inline int sdo_req__is_same_object(const struct sdo_req* a,
+					  const struct sdo_req* b)
+{
+	return a->index == b->index && a->subindex == b->subindex;
+}
+
+static struct sdo_req* sdo_req__find_in_flight(struct sdo_req_queue* self,
+					       const struct sdo_req* req)
+{
+	for (unsigned int i = 0; i < self->n_channels; ++i) {
+		struct sdo_req* current = self->channel[i].current;
+		if (current && sdo_req__is_same_object(current, req))
+			return current;
+	}
+
+	return NULL;
+}
+
+/* Find the most recent request for the same object as req, either queued with
+ * the same priority or in progress. Requests for an object must not be
+ * reordered past each other, so this is the only one that req may be coalesced
+ * with.
+ */
+static struct sdo_req* sdo_req__find_last(struct sdo_req_queue* self,
+					  const struct sdo_req* req,
+					  int* is_queued)
+{
+	struct sdo_req* other;
+
+	TAILQ_FOREACH_REVERSE(other, &self->list[req->prio], sdo_req_list,
+			      links)
+		if (sdo_req__is_same_object(other, req)) {
+			*is_queued = 1;
+			return other;
+		}
+
+	other = sdo_req__find_in_flight(self, req);
+	if (other) {
+		*is_queued = 0;
+		return other;
+	}
+
+	return NULL;
+}
+
+static int sdo_req__coalesce_upload(struct sdo_req_queue* self,
+				    struct sdo_req* req)
+{
+	int is_queued;
+	struct sdo_req* leader = sdo_req__find_last(self, req, &is_queued);
+
+	/* A borrowed buffer may be too small for the other request and a
+	 * stream sink only takes data for its own request.
+	 */
+	if (req->write_fn || !leader || leader->type != SDO_REQ_UPLOAD
+	 || leader->is_data_borrowed || leader->write_fn)
+		return -1;
+
+	TAILQ_INSERT_TAIL(&leader->followers, req, links);
+	self->stats.coalesced_uploads++;
+	return 0;
+}
+
+static int sdo_req__supersede_download(struct sdo_req_queue* self,
+				       struct sdo_req* req)
+{
+	int is_queued;
+	struct sdo_req* old = sdo_req__find_last(self, req, &is_queued);
+
+	if (!old || !is_queued || old->type != SDO_REQ_DOWNLOAD)
+		return -1;
+
+	TAILQ_REMOVE(&self->list[req->prio], old, links);
+	TAILQ_INSERT_TAIL(&self->list[req->prio], req, links);
+
+	TAILQ_CONCAT(&req->followers, &old->followers, links);
+	TAILQ_INSERT_TAIL(&req->followers, old, links);
+
+	self->stats.superseded_downloads++;
+	return 0;
+}
+
+static int sdo_req__coalesce(struct sdo_req_queue* self, struct sdo_req* req)
+{
+	switch (req->type) {
+	case SDO_REQ_UPLOAD:
+		return sdo_req__coalesce_upload(self, req);
+	case SDO_REQ_DOWNLOAD:
+		if (!(self->flags & SDO_REQ_QUEUE_LAST_WRITER_WINS))
+			return -1;
+		return sdo_req__supersede_download(self, req);
+	}
+
+	return -1;
+}
+
+/* This may be called from any thread and does not lock the queue */
+int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
+{
+	assert(req->parent == NULL);
+	assert(req->prio < SDO_REQ_PRIO_COUNT);
+
+	/* Coalesced requests give their slot back when they are drained */
+	if (co_atomic_add_fetch(&self->size, 1) > self->limit) {
+		co_atomic_sub_fetch(&self->size, 1);
+		return -1;
+	}
+
+	req->parent = self;
+	mpsc_queue_push(&self->inbox, &req->inbox_link);
+	mloop_iterate(mloop_default());
+
+	return 0;
+}
+
+/* Move newly enqueued requests into their lists. The queue must be locked, which
+ * makes whichever thread holds the lock the single consumer of the inbox.
+ */
+static void sdo_req_queue__drain(struct sdo_req_queue* self)
+{
+	struct mpsc_node* node;
+
+	while ((node = mpsc_queue_pop(&self->inbox)) != NULL) {
+		struct sdo_req* req = container_of(node, struct sdo_req,
+						   inbox_link);
+
+		if (sdo_req__coalesce(self, req) == 0) {
+			co_atomic_sub_fetch(&self->size, 1);
+			continue;
+		}
+
+		TAILQ_INSERT_TAIL(&self->list[req->prio], req, links);
+	}
+}
+
+static struct sdo_req_list* sdo_req__next_list(struct sdo_req_queue* self)
+{
+	struct sdo_req_list* fallback = NULL;
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i) {
+		enum sdo_req_prio prio = sdo_req__prio_order[i];
+		struct sdo_req_list* list = &self->list[prio];
+
+		if (TAILQ_EMPTY(list))
+			continue;
+
+		if (self->credit[prio] > 0) {
+			self->credit[prio]--;
+			return list;
+		}
+
+		if (!fallback)
+			fallback = list;
+	}
+
+	if (!fallback)
+		return NULL;
+
+	/* Every waiting class has used up its share; start a new round */
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		self->credit[i] = sdo_req__prio_weight[i];
+
+	return sdo_req__next_list(self);
+}
+
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self)
 {
 	sdo_req_queue__lock(self);
+	sdo_req_queue__drain(self);
 
-	struct sdo_req* req = TAILQ_FIRST(&self->list);
-	if (!req)
+	struct sdo_req_list* list = sdo_req__next_list(self);
+	if (!list) {
+		sdo_req_queue__unlock(self);
 		return NULL;
+	}
 
-	assert(self->size);
-	--self->size;
+	struct sdo_req* req = TAILQ_FIRST(list);
 
-	TAILQ_REMOVE(&self->list, req, links);
+	assert(co_atomic_load(&self->size));
+	co_atomic_sub_fetch(&self->size, 1);
+
+	TAILQ_REMOVE(list, req, links);
 
 	sdo_req_queue__unlock(self);
 	return req;
 }
 
+/* Put back a request that was dequeued but could not be started */
+static void sdo_req_queue__requeue(struct sdo_req_queue* self,
+				   struct sdo_req* req)
+{
+	sdo_req_queue__lock(self);
+
+	TAILQ_INSERT_HEAD(&self->list[req->prio], req, links);
+	self->credit[req->prio]++;
+	co_atomic_add_fetch(&self->size, 1);
+
+	sdo_req_queue__unlock(self);
+}
+
 int sdo_req_queue_remove(struct sdo_req_queue* self, struct sdo_req* req)
 {
 	if (!req->parent)
 		return -1;
 
 	sdo_req_queue__lock(self);
+	sdo_req_queue__drain(self);
 
-	TAILQ_REMOVE(&self->list, req, links);
+	TAILQ_REMOVE(&self->list[req->prio], req, links);
 	req->parent = NULL;
+	co_atomic_sub_fetch(&self->size, 1);
 
 	sdo_req_queue__unlock(self);
 
@@ -252,8 +898,14 @@ int sdo_req_queue_remove(struct sdo_req_queue* self, struct sdo_req* req)
 
 struct sdo_req* sdo_req_queue_head(struct sdo_req_queue* self)
 {
+	struct sdo_req* req = NULL;
+
 	sdo_req_queue__lock(self);
-	struct sdo_req* req = TAILQ_FIRST(&self->list);
+	sdo_req_queue__drain(self);
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT && !req; ++i)
+		req = TAILQ_FIRST(&self->list[sdo_req__prio_order[i]]);
+
 	sdo_req_queue__unlock(self);
 	return req;
 }
@@ -266,50 +918,337 @@ void sdo_req_wait(struct sdo_req* self)
 
 void sdo_req__on_done(struct sdo_async* async);
 
+void sdo_req__on_progress(struct sdo_async* async)
+{
+	struct sdo_req* req = async->context;
+
+	size_t done, total;
+	if (req->type == SDO_REQ_DOWNLOAD) {
+		done = async->pos;
+		total = async->dl_size;
+	} else {
+		done = async->ul_size;
+		total = async->ul_indicated_size;
+	}
+
+	req->transferred = done;
+	req->on_progress(req, done, total);
+}
+
 void sdo_req__on_stop(void* ptr)
 {
 	struct sdo_req* req = ptr;
+	struct sdo_req_queue* queue = req->parent;
+
+	sdo_req_queue__lock(queue);
+	for (unsigned int i = 0; i < queue->n_channels; ++i)
+		if (queue->channel[i].current == req)
+			queue->channel[i].current = NULL;
 
-	if (req->status == SDO_REQ_PENDING)
+	queue->is_blocked = 0;
+
+	/* A request that is going to be retried keeps its followers */
+	int is_requeued = req->is_requeued;
+	req->is_requeued = 0;
+
+	if (!is_requeued)
+		sdo_req__cancel_list(&req->followers);
+	sdo_req_queue__unlock(queue);
+
+	if (!is_requeued && req->status == SDO_REQ_PENDING)
 		req->status = SDO_REQ_CANCELLED;
 
 	sdo_req_unref(req);
 }
 
+static struct sdo_req_channel*
+sdo_req__find_idle_channel(struct sdo_req_queue* self)
+{
+	unsigned int n_channels = co_atomic_load(&self->n_channels);
+
+	for (unsigned int i = 0; i < n_channels; ++i)
+		if (!self->channel[i].client.is_running)
+			return &self->channel[i];
+
+	return NULL;
+}
+
+static int sdo_req__is_any_running(const struct sdo_req_queue* self)
+{
+	for (unsigned int i = 0; i < self->n_channels; ++i)
+		if (self->channel[i].client.is_running)
+			return 1;
+
+	return 0;
+}
+
 int sdo_req__have_req(struct mloop_idle* idle)
 {
 	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	return !queue->sdo_client.is_running
-	    && sdo_req_queue_head(queue) != NULL;
+	/* This is checked on every iteration of the main loop, so it must not
+	 * lock. The requests that are counted may still be in the inbox or turn
+	 * out to be coalesced; process_queue() will then find nothing to do.
+	 */
+	return !queue->is_throttled
+	    && !queue->is_retry_pending
+	    && !queue->is_blocked
+	    && co_atomic_load(&queue->size) > 0
+	    && sdo_req__find_idle_channel(queue) != NULL;
 }
 
-void sdo_req__process_queue(struct mloop_idle* idle)
+static void sdo_req__on_retry_timeout(struct mloop_timer* timer)
 {
-	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	assert(!queue->sdo_client.is_running);
+	struct sdo_req_queue* queue = mloop_timer_get_context(timer);
 
 	sdo_req_queue__lock(queue);
+	queue->is_retry_pending = 0;
+	sdo_req_queue__unlock(queue);
+}
+
+static void sdo_req__on_governor_wakeup(void)
+{
+	for (int i = 1; i < 128; ++i) {
+		struct sdo_req_queue* queue = &sdo_req__queues[i];
+
+		sdo_req_queue__lock(queue);
+		queue->is_throttled = 0;
+		sdo_req_queue__unlock(queue);
+	}
+}
+
+static unsigned long sdo_req__get_timeout(const struct sdo_req* req)
+{
+	if (req->timeout)
+		return req->timeout;
+
+	for (size_t i = 0; i < ARRAY_LENGTH(sdo_req__slow_objects); ++i)
+		if (sdo_req__slow_objects[i] == req->index)
+			return SDO_REQ_SLOW_TIMEOUT;
+
+	return 0;
+}
+
+/* Remove all queued requests, e.g. when the node is known to be down */
+static void sdo_req__take_all(struct sdo_req_queue* self,
+			      struct sdo_req_list* list)
+{
+	size_t n = 0;
+	struct sdo_req* req;
+
+	sdo_req_queue__drain(self);
+
+	for (int i = 0; i < SDO_REQ_PRIO_COUNT; ++i)
+		TAILQ_CONCAT(list, &self->list[sdo_req__prio_order[i]], links);
+
+	TAILQ_FOREACH(req, list, links)
+		++n;
+
+	self->breaker.n_rejected += n;
+	co_atomic_sub_fetch(&self->size, n);
+}
+
+static void sdo_req__reject_list(struct sdo_req_list* list);
+
+/* Start the next request on an idle channel. Returns -1 if no more requests
+ * can be started for the time being.
+ */
+static int sdo_req__start_next(struct sdo_req_queue* queue,
+			       struct sdo_req_channel* channel,
+			       struct sdo_req_list* rejected)
+{
+	/* Nothing else is sent until the probe has been answered */
+	if (queue->breaker.state == SDO_REQ_BREAKER_HALF_OPEN
+	 && sdo_req__is_any_running(queue)) {
+		queue->is_blocked = 1;
+		return -1;
+	}
+
+	if (!sdo_req__breaker_allows(queue)) {
+		sdo_req__take_all(queue, rejected);
+		return -1;
+	}
 
 	struct sdo_req* req = sdo_req_queue__dequeue(queue);
 	if (!req)
-		goto done;
+		return -1;
+
+	/* Requests for the same object must not overtake each other */
+	if (sdo_req__find_in_flight(queue, req)) {
+		sdo_req_queue__requeue(queue, req);
+		queue->is_blocked = 1;
+		return -1;
+	}
+
+	unsigned long delay = sdo_governor_acquire(req->prio);
+	if (delay > 0) {
+		sdo_req_queue__requeue(queue, req);
+		queue->is_throttled = 1;
+		sdo_governor_request_wakeup(delay);
+		return -1;
+	}
+
+	channel->current = req;
 
 	struct sdo_async_info info = {
 		.type = req->type,
 		.index = req->index,
 		.subindex = req->subindex,
-		.timeout = SDO_REQ_TIMEOUT,
+		.timeout = sdo_req__get_timeout(req),
+		.prio = req->prio,
 		.data = req->data.data,
-		.size = req->data.index,
+		.size = req->read_fn ? req->stream_size : req->data.index,
+		.ul_buffer = req->is_data_borrowed ? req->data.data : NULL,
+		.ul_buffer_size = req->data.size,
+		.read_fn = req->read_fn,
+		.write_fn = req->write_fn,
+		.stream_context = req->stream_context,
+		.on_progress = req->on_progress ? sdo_req__on_progress : NULL,
 		.on_done = sdo_req__on_done,
 		.context = req,
 		.free_fn = sdo_req__on_stop
 	};
 
-	sdo_async_start(&queue->sdo_client, &info);
+	sdo_async_start(&channel->client, &info);
+	return 0;
+}
+
+void sdo_req__process_queue(struct mloop_idle* idle)
+{
+	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
+	struct sdo_req_channel* channel;
+
+	struct sdo_req_list rejected;
+	TAILQ_INIT(&rejected);
+
+	sdo_req_queue__lock(queue);
+
+	while ((channel = sdo_req__find_idle_channel(queue)) != NULL)
+		if (sdo_req__start_next(queue, channel, &rejected) < 0)
+			break;
 
-done:
 	sdo_req_queue__unlock(queue);
+
+	sdo_req__reject_list(&rejected);
+}
+
+static enum sdo_req_status sdo_req__copy_data(struct sdo_req* dst,
+					      const struct sdo_req* src)
+{
+	if (!dst->is_data_borrowed)
+		return vector_assign(&dst->data, src->data.data,
+				     src->data.index) < 0
+		       ? SDO_REQ_NOMEM : SDO_REQ_OK;
+
+	if (src->data.index > dst->data.size) {
+		dst->abort_code = SDO_ABORT_TOO_LONG;
+		return SDO_REQ_LOCAL_ABORT;
+	}
+
+	memcpy(dst->data.data, src->data.data, src->data.index);
+	dst->data.index = src->data.index;
+	return SDO_REQ_OK;
+}
+
+static void sdo_req__complete_followers(struct sdo_req* req,
+					struct sdo_req_list* followers)
+{
+	struct sdo_req* follower;
+
+	while ((follower = TAILQ_FIRST(followers)) != NULL) {
+		TAILQ_REMOVE(followers, follower, links);
+
+		enum sdo_req_status status = req->status;
+
+		follower->abort_code = req->abort_code;
+		follower->is_size_indicated = req->is_size_indicated;
+
+		if (status == SDO_REQ_OK && follower->type == SDO_REQ_UPLOAD)
+			status = sdo_req__copy_data(follower, req);
+
+		follower->status = status;
+
+		sdo_req_fn on_done = follower->on_done;
+		if (on_done)
+			on_done(follower);
+
+		sdo_req_unref(follower);
+	}
+}
+
+static void sdo_req__reject_list(struct sdo_req_list* list)
+{
+	struct sdo_req* req;
+
+	while ((req = TAILQ_FIRST(list)) != NULL) {
+		TAILQ_REMOVE(list, req, links);
+
+		req->status = SDO_REQ_NODE_DOWN;
+
+		sdo_req_fn on_done = req->on_done;
+		if (on_done)
+			on_done(req);
+
+		sdo_req__complete_followers(req, &req->followers);
+		sdo_req_unref(req);
+	}
+}
+
+static void sdo_req__update_breaker(struct sdo_req_queue* self,
+				    const struct sdo_async* async)
+{
+	switch (async->status) {
+	case SDO_REQ_LOCAL_ABORT:
+		if (async->abort_code == SDO_ABORT_TIMEOUT) {
+			sdo_req__breaker_on_timeout(self);
+			break;
+		}
+		/* fall through */
+	case SDO_REQ_OK:
+	case SDO_REQ_REMOTE_ABORT:
+		/* The node is there */
+		sdo_req__breaker_close(self);
+		break;
+	default:
+		break;
+	}
+}
+
+static int sdo_req__is_transient(enum sdo_abort_code code)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(sdo_req__transient_aborts); ++i)
+		if (sdo_req__transient_aborts[i] == code)
+			return 1;
+
+	return 0;
+}
+
+static int sdo_req__should_retry(const struct sdo_req_queue* self,
+				 const struct sdo_req* req,
+				 const struct sdo_async* async)
+{
+	return req->n_retries < self->max_retries
+	    && async->status == SDO_REQ_REMOTE_ABORT
+	    && sdo_req__is_transient(async->abort_code);
+}
+
+/* Put the request back at the head of its queue and pause the queue for a
+ * while. The queue gets a new reference; the old one is dropped by on_stop.
+ */
+static void sdo_req__retry(struct sdo_req_queue* self, struct sdo_req* req)
+{
+	unsigned long delay = SDO_REQ_RETRY_DELAY << req->n_retries;
+
+	req->n_retries++;
+	req->is_requeued = 1;
+	sdo_req_ref(req);
+	sdo_req_queue__requeue(self, req);
+
+	self->stats.retries++;
+	self->is_retry_pending = 1;
+
+	mloop_timer_set_time(self->retry_timer,
+			     sdo_req__jitter(delay) * 1000000ULL);
+	mloop_timer_start(self->retry_timer);
 }
 
 void sdo_req__on_done(struct sdo_async* async)
@@ -319,19 +1258,55 @@ void sdo_req__on_done(struct sdo_async* async)
 	struct sdo_req* req = async->context;
 	assert(req != NULL);
 
+	struct sdo_req_list followers;
+	TAILQ_INIT(&followers);
+
+	sdo_req_queue__lock(queue);
+	sdo_req_channel__from_async(async)->current = NULL;
+	queue->is_blocked = 0;
+
+	sdo_req__update_breaker(queue, async);
+
+	if (sdo_req__should_retry(queue, req, async)) {
+		sdo_req__retry(queue, req);
+		sdo_req_queue__unlock(queue);
+		return;
+	}
+
+	TAILQ_CONCAT(&followers, &req->followers, links);
+	sdo_req_queue__unlock(queue);
+
 	assert(async->status != SDO_REQ_PENDING);
-	req->status = async->status;
 	req->abort_code = async->abort_code;
 	req->is_size_indicated = async->is_size_indicated;
 
-	if (req->type == SDO_REQ_UPLOAD)
-		if (vector_copy(&req->data, &async->buffer) < 0)
-			req->status = SDO_REQ_NOMEM;
+	if (req->type == SDO_REQ_UPLOAD) {
+		req->transferred = async->ul_size;
+
+		if (req->is_data_borrowed)
+			req->data.index = async->ul_size;
+		else if (!req->write_fn)
+			vector_swap(&req->data, &async->buffer);
+	} else {
+		req->transferred = async->status == SDO_REQ_OK ? async->dl_size
+							       : async->pos;
+	}
+
+	/* Set last so that waiters do not see the data before it's ready */
+	req->status = async->status;
+
+	if (req->status == SDO_REQ_OK && !req->read_fn && !req->write_fn)
+		sdo_cache_store(queue->nodeid, req->index, req->subindex,
+				req->data.data, req->data.index,
+				req->type == SDO_REQ_DOWNLOAD
+				|| req->is_size_indicated);
 
 	sdo_req_fn on_done = req->on_done;
 	if (on_done)
 		on_done(req);
 
+	sdo_req__complete_followers(req, &followers);
+
 	mloop_iterate(mloop_default());
 }
 
@@ -24,6 +24,7 @@
 #include "socketcan.h"
 #include "net-util.h"
 #include "can-tcp.h"
+#include "canopen/frame-ring.h"
 
 size_t strlcpy(char* dst, const char* src, size_t size);
 
@@ -68,14 +69,34 @@ sock__frame_ntohl(const struct sock* sock, struct can_frame* cf)
 	return cf;
 }
 
+/* The frame is converted in place for sending, so the ring gets a copy of it
+ * as it was.
+ */
+static inline void sock__write_ring(const struct can_frame* cf, canid_t can_id)
+{
+	struct can_frame copy = *cf;
+	copy.can_id = can_id;
+	frame_ring_write(&copy, FRAME_RING_TX);
+}
+
 ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags)
 {
-	return send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf), flags);
+	canid_t can_id = cf->can_id;
+	ssize_t rc = send(sock->fd, sock__frame_htonl(sock, cf), sizeof(*cf),
+			  flags);
+	if (rc > 0)
+		sock__write_ring(cf, can_id);
+	return rc;
 }
 
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout)
 {
-	return net_write_frame(sock->fd, sock__frame_htonl(sock, cf), timeout);
+	canid_t can_id = cf->can_id;
+	int rc = net_write_frame(sock->fd, sock__frame_htonl(sock, cf),
+				 timeout);
+	if (rc > 0)
+		sock__write_ring(cf, can_id);
+	return rc;
 }
 
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
@@ -84,6 +105,7 @@ ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
 	if (rsize <= 0)
 		return rsize;
 	sock__frame_ntohl(sock, cf);
+	frame_ring_write(cf, 0);
 	return rsize;
 }
 
@@ -91,6 +113,8 @@ int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout)
 {
 	int rc = net_read_frame(sock->fd, cf, timeout);
 	sock__frame_ntohl(sock, cf);
+	if (rc > 0)
+		frame_ring_write(cf, 0);
 	return rc;
 }
 
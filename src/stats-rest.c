@@ -0,0 +1,130 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Runtime statistics
+ *
+ * GET /stats/<name> replies with a JSON document describing the named
+ * subsystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canopen/sdo-cache.h"
+#include "canopen/sdo-governor.h"
+#include "canopen/sdo-poll.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sync-cycle.h"
+#include "canopen/rpdo-stage.h"
+#include "canopen/tpdo-filter.h"
+#include "canopen/pdo-stats.h"
+#include "canopen/boot-cache.h"
+#include "canopen/node-manifest.h"
+#include "rest.h"
+#include "stats-rest.h"
+#include "type-macros.h"
+
+typedef void (*stats_rest_print_fn)(FILE* out);
+
+struct stats_rest_entry {
+	const char* name;
+	stats_rest_print_fn print;
+};
+
+static const struct stats_rest_entry stats_rest__entries[] = {
+	{ "sdo-cache", sdo_cache_print_stats },
+	{ "sdo-queue", sdo_req_print_stats },
+	{ "sdo-rtt", sdo_req_print_rtt_stats },
+	{ "sdo-governor", sdo_governor_print_stats },
+	{ "sdo-breaker", sdo_req_print_breaker_stats },
+	{ "sdo-poll", sdo_poll_print_stats },
+	{ "sync", sync_cycle_print_stats },
+	{ "rpdo", rpdo_stage_print_stats },
+	{ "tpdo-filter", tpdo_filter_print_stats },
+	{ "pdo", pdo_stats_print_stats },
+	{ "boot-cache", boot_cache_print_stats },
+	{ "manifest", node_manifest_print_stats },
+};
+
+static void stats_rest__reply(struct rest_client* client,
+			      const char* status_code,
+			      const char* content_type, const char* message,
+			      size_t length)
+{
+	struct rest_reply_data reply = {
+		.status_code = status_code,
+		.content_type = content_type,
+		.content_length = length,
+		.content = message
+	};
+
+	rest_reply(client->output, &reply);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+static void stats_rest__not_found(struct rest_client* client)
+{
+	static const char message[] =
+		"Wrong URL format. Must be /stats/<name>\r\n";
+
+	stats_rest__reply(client, "404 Not Found", "text/plain", message,
+			  strlen(message));
+}
+
+static const struct stats_rest_entry* stats_rest__find(const char* name)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(stats_rest__entries); ++i)
+		if (strcmp(stats_rest__entries[i].name, name) == 0)
+			return &stats_rest__entries[i];
+
+	return NULL;
+}
+
+void stats_rest_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (client->req.url_index != 2) {
+		stats_rest__not_found(client);
+		return;
+	}
+
+	const struct stats_rest_entry* entry;
+	entry = stats_rest__find(client->req.url[1]);
+	if (!entry) {
+		stats_rest__not_found(client);
+		return;
+	}
+
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		static const char message[] = "Out of memory\r\n";
+		stats_rest__reply(client, "500 Internal Server Error",
+				  "text/plain", message, strlen(message));
+		return;
+	}
+
+	entry->print(out);
+	fclose(out);
+
+	stats_rest__reply(client, "200 OK", "application/json", buffer, size);
+
+	free(buffer);
+}
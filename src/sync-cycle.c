@@ -0,0 +1,430 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+/* SYNC producer and cycle engine
+ *
+ * SYNC is sent from a thread that sleeps until absolute points in time, so
+ * the period does not drift with the time it takes to send. The thread may
+ * run with real-time priority without the rest of the master doing so. Right
+ * after each SYNC it sends the RPDOs that were queued during the cycle, which
+ * puts them inside the synchronous window of nodes that act on SYNC.
+ *
+ * The queue is double buffered: the thread swaps buffers under the lock and
+ * sends from the one it took while new RPDOs go into the other.
+ *
+ * The thread tells the main loop about each SYNC through an eventfd. The main
+ * loop then hands the TPDOs collected since the previous SYNC to the done
+ * function and begins a new cycle. If more than one SYNC has gone out by the
+ * time the main loop gets to it, the cycles in between are counted as
+ * overruns.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/sync-cycle.h"
+#include "socketcan.h"
+#include "sock.h"
+#include "co_atomic.h"
+#include "time-utils.h"
+#include "plog.h"
+
+/* Weight of a new sample in the jitter average is 1/2^n */
+#define SYNC_CYCLE_JITTER_SHIFT 4
+
+static struct sync_cycle_config sync_cycle__config;
+static struct sock sync_cycle__sock;
+
+static pthread_t sync_cycle__thread;
+static int sync_cycle__is_running = 0;
+
+static int sync_cycle__eventfd = -1;
+static struct mloop_socket* sync_cycle__event = NULL;
+
+/* Written by the producer before it signals the main loop */
+static unsigned int sync_cycle__last_counter = 0;
+static uint64_t sync_cycle__last_time = 0;
+
+static pthread_mutex_t sync_cycle__rpdo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct can_frame sync_cycle__rpdos[2][SYNC_CYCLE_RPDOS_MAX];
+/* Where each RPDO is in the queue, plus one; 0 means not queued */
+static uint16_t sync_cycle__rpdo_slots[2][SYNC_CYCLE_NODES][SYNC_CYCLE_PDOS];
+static size_t sync_cycle__n_rpdos = 0;
+static int sync_cycle__rpdo_buffer = 0;
+
+static struct co_cycle sync_cycle__cycle;
+static int sync_cycle__is_cycle_started = 0;
+
+static pthread_mutex_t sync_cycle__stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sync_cycle_stats sync_cycle__stats;
+
+static void sync_cycle__add_jitter(uint64_t jitter)
+{
+	struct sync_cycle_stats* stats = &sync_cycle__stats;
+
+	pthread_mutex_lock(&sync_cycle__stats_mutex);
+
+	if (stats->n_cycles == 0) {
+		stats->jitter_min = jitter;
+		stats->jitter_max = jitter;
+		stats->jitter_avg = jitter;
+	} else {
+		if (jitter < stats->jitter_min)
+			stats->jitter_min = jitter;
+		if (jitter > stats->jitter_max)
+			stats->jitter_max = jitter;
+
+		int64_t diff = (int64_t)jitter - (int64_t)stats->jitter_avg;
+		stats->jitter_avg += diff / (1 << SYNC_CYCLE_JITTER_SHIFT);
+	}
+
+	stats->n_cycles++;
+
+	pthread_mutex_unlock(&sync_cycle__stats_mutex);
+}
+
+static void sync_cycle__add_stat(uint64_t* stat, uint64_t n)
+{
+	pthread_mutex_lock(&sync_cycle__stats_mutex);
+	*stat += n;
+	pthread_mutex_unlock(&sync_cycle__stats_mutex);
+}
+
+static unsigned int sync_cycle__next_counter(unsigned int counter)
+{
+	unsigned int overflow = sync_cycle__config.counter_overflow;
+
+	if (overflow == 0)
+		return 0;
+
+	return counter >= overflow ? 1 : counter + 1;
+}
+
+static void sync_cycle__send_sync(unsigned int counter)
+{
+	struct can_frame cf = { .can_id = R_SYNC, .can_dlc = 0 };
+
+	if (counter) {
+		cf.can_dlc = 1;
+		cf.data[0] = counter;
+	}
+
+	sock_send(&sync_cycle__sock, &cf, 0);
+}
+
+static void sync_cycle__send_rpdos(void)
+{
+	pthread_mutex_lock(&sync_cycle__rpdo_mutex);
+	int buffer = sync_cycle__rpdo_buffer;
+	size_t n = sync_cycle__n_rpdos;
+	sync_cycle__rpdo_buffer ^= 1;
+	sync_cycle__n_rpdos = 0;
+	pthread_mutex_unlock(&sync_cycle__rpdo_mutex);
+
+	struct can_frame* rpdos = sync_cycle__rpdos[buffer];
+
+	for (size_t i = 0; i < n; ++i)
+		sock_send(&sync_cycle__sock, &rpdos[i], 0);
+
+	if (n == 0)
+		return;
+
+	/* The buffer is not written to again until the next swap */
+	memset(sync_cycle__rpdo_slots[buffer], 0,
+	       sizeof(sync_cycle__rpdo_slots[buffer]));
+
+	sync_cycle__add_stat(&sync_cycle__stats.n_rpdos, n);
+}
+
+static void sync_cycle__set_priority(void)
+{
+	if (sync_cycle__config.priority <= 0)
+		return;
+
+	struct sched_param param = {
+		.sched_priority = sync_cycle__config.priority
+	};
+
+	int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (rc != 0)
+		plog(LOG_WARNING, "sync: Could not set real-time priority: %s",
+		     strerror(rc));
+}
+
+static void* sync_cycle__run(void* arg)
+{
+	(void)arg;
+
+	uint64_t period = sync_cycle__config.period * 1000ULL;
+	unsigned int counter = 0;
+	uint64_t next = gettime_us(CLOCK_MONOTONIC) * 1000ULL + period;
+
+	/* The thread is only cancelled while it sleeps */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	sync_cycle__set_priority();
+
+	while (1) {
+		struct timespec ts = {
+			.tv_sec = next / 1000000000ULL,
+			.tv_nsec = next % 1000000000ULL
+		};
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					 NULL);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (rc == EINTR)
+			continue;
+
+		uint64_t now = gettime_us(CLOCK_MONOTONIC) * 1000ULL;
+		uint64_t late = now > next ? now - next : 0;
+
+		/* Whole periods that were slept through are skipped rather
+		 * than sent in a burst.
+		 */
+		if (late >= period) {
+			uint64_t n_missed = late / period;
+			sync_cycle__add_stat(&sync_cycle__stats.n_missed,
+					     n_missed);
+			next += n_missed * period;
+			late -= n_missed * period;
+		}
+
+		counter = sync_cycle__next_counter(counter);
+		sync_cycle__send_sync(counter);
+		sync_cycle__send_rpdos();
+
+		sync_cycle__add_jitter(late / 1000);
+
+		co_atomic_store(&sync_cycle__last_counter, counter);
+		co_atomic_store(&sync_cycle__last_time, now / 1000);
+
+		uint64_t one = 1;
+		write(sync_cycle__eventfd, &one, sizeof(one));
+
+		next += period;
+	}
+
+	return NULL;
+}
+
+void sync_cycle__begin(unsigned int counter, uint64_t time)
+{
+	struct co_cycle* cycle = &sync_cycle__cycle;
+
+	if (sync_cycle__is_cycle_started && sync_cycle__config.done_fn)
+		sync_cycle__config.done_fn(cycle);
+
+	memset(cycle->is_received, 0, sizeof(cycle->is_received));
+	cycle->counter = counter;
+	cycle->time = time;
+	sync_cycle__is_cycle_started = 1;
+
+	if (sync_cycle__config.sync_fn)
+		sync_cycle__config.sync_fn();
+}
+
+static void sync_cycle__on_event(struct mloop_socket* socket)
+{
+	uint64_t n = 0;
+
+	if (read(mloop_socket_get_fd(socket), &n, sizeof(n)) != sizeof(n))
+		return;
+
+	if (n > 1)
+		sync_cycle__add_stat(&sync_cycle__stats.n_overruns, n - 1);
+
+	sync_cycle__begin(co_atomic_load(&sync_cycle__last_counter),
+			  co_atomic_load(&sync_cycle__last_time));
+}
+
+static int sync_cycle__is_config_valid(const struct sync_cycle_config* config)
+{
+	unsigned int overflow = config->counter_overflow;
+
+	if (config->period == 0)
+		return 0;
+
+	return overflow == 0 || (SYNC_CYCLE_COUNTER_MIN <= overflow
+			      && overflow <= SYNC_CYCLE_COUNTER_MAX);
+}
+
+int sync_cycle_init(const struct sync_cycle_config* config,
+		    const struct sock* sock)
+{
+	if (!sync_cycle__is_config_valid(config))
+		return -1;
+
+	sync_cycle__config = *config;
+	sync_cycle__sock = *sock;
+	sync_cycle__is_cycle_started = 0;
+	sync_cycle__n_rpdos = 0;
+	memset(sync_cycle__rpdo_slots, 0, sizeof(sync_cycle__rpdo_slots));
+	memset(&sync_cycle__stats, 0, sizeof(sync_cycle__stats));
+
+	sync_cycle__eventfd = eventfd(0, EFD_NONBLOCK);
+	if (sync_cycle__eventfd < 0)
+		return -1;
+
+	sync_cycle__event = mloop_socket_new(mloop_default());
+	if (!sync_cycle__event)
+		goto event_failure;
+
+	mloop_socket_set_fd(sync_cycle__event, sync_cycle__eventfd);
+	mloop_socket_set_callback(sync_cycle__event, sync_cycle__on_event);
+
+	if (mloop_socket_start(sync_cycle__event) < 0)
+		goto event_start_failure;
+
+	if (pthread_create(&sync_cycle__thread, NULL, sync_cycle__run,
+			   NULL) != 0)
+		goto thread_failure;
+
+	sync_cycle__is_running = 1;
+	return 0;
+
+thread_failure:
+	mloop_socket_stop(sync_cycle__event);
+event_start_failure:
+	mloop_socket_set_fd(sync_cycle__event, -1);
+	mloop_socket_unref(sync_cycle__event);
+	sync_cycle__event = NULL;
+event_failure:
+	close(sync_cycle__eventfd);
+	sync_cycle__eventfd = -1;
+	return -1;
+}
+
+void sync_cycle_cleanup(void)
+{
+	if (!sync_cycle__is_running)
+		return;
+
+	pthread_cancel(sync_cycle__thread);
+	pthread_join(sync_cycle__thread, NULL);
+	sync_cycle__is_running = 0;
+
+	mloop_socket_stop(sync_cycle__event);
+	mloop_socket_set_fd(sync_cycle__event, -1);
+	mloop_socket_unref(sync_cycle__event);
+	sync_cycle__event = NULL;
+
+	close(sync_cycle__eventfd);
+	sync_cycle__eventfd = -1;
+}
+
+int sync_cycle_is_running(void)
+{
+	return sync_cycle__is_running;
+}
+
+int sync_cycle_queue_rpdo(int nodeid, int pdo, const void* data, size_t size)
+{
+	static const int types[SYNC_CYCLE_PDOS] = {
+		R_RPDO1, R_RPDO2, R_RPDO3, R_RPDO4
+	};
+
+	if (nodeid < 1 || nodeid >= SYNC_CYCLE_NODES)
+		return -1;
+
+	if (pdo < 1 || pdo > SYNC_CYCLE_PDOS || !data || size > CAN_MAX_DLEN)
+		return -1;
+
+	pthread_mutex_lock(&sync_cycle__rpdo_mutex);
+
+	int buffer = sync_cycle__rpdo_buffer;
+	uint16_t* slot = &sync_cycle__rpdo_slots[buffer][nodeid][pdo - 1];
+	int is_replaced = *slot != 0;
+
+	if (!is_replaced)
+		*slot = ++sync_cycle__n_rpdos;
+
+	struct can_frame* cf = &sync_cycle__rpdos[buffer][*slot - 1];
+
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = types[pdo - 1] + nodeid;
+	cf->can_dlc = size;
+	memcpy(cf->data, data, size);
+
+	pthread_mutex_unlock(&sync_cycle__rpdo_mutex);
+
+	if (is_replaced)
+		sync_cycle__add_stat(&sync_cycle__stats.n_rpdos_replaced, 1);
+
+	return 0;
+}
+
+void sync_cycle_feed(const struct can_frame* cf)
+{
+	if (!sync_cycle__is_cycle_started)
+		return;
+
+	uint32_t id = cf->can_id & CAN_SFF_MASK;
+	if (id < R_TPDO1 || cf->can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG))
+		return;
+
+	/* TPDOn is 0x180 + 0x100 * (n - 1) + nodeid; RPDOs have bit 7 set */
+	unsigned int offset = id - R_TPDO1;
+	unsigned int pdo = offset >> 8;
+	unsigned int nodeid = offset & 0xff;
+
+	if (pdo >= SYNC_CYCLE_PDOS || nodeid == 0 || nodeid >= SYNC_CYCLE_NODES)
+		return;
+
+	struct co_cycle* cycle = &sync_cycle__cycle;
+	size_t size = cf->can_dlc <= 8 ? cf->can_dlc : 8;
+
+	cycle->is_received[nodeid] |= 1 << pdo;
+	cycle->tpdos[nodeid][pdo].size = size;
+	memcpy(cycle->tpdos[nodeid][pdo].data, cf->data, size);
+}
+
+void sync_cycle_get_stats(struct sync_cycle_stats* stats)
+{
+	pthread_mutex_lock(&sync_cycle__stats_mutex);
+	*stats = sync_cycle__stats;
+	pthread_mutex_unlock(&sync_cycle__stats_mutex);
+}
+
+void sync_cycle_print_stats(FILE* out)
+{
+	struct sync_cycle_stats stats;
+	sync_cycle_get_stats(&stats);
+
+	fprintf(out, "{\n \"running\": %s,\n \"period\": %lu,\n"
+		" \"cycles\": %llu,\n \"missed\": %llu,\n \"overruns\": %llu,\n"
+		" \"rpdos\": %llu,\n \"rpdos_replaced\": %llu,\n"
+		" \"jitter\": { \"min\": %llu, \"max\": %llu, \"avg\": %llu }\n"
+		"}\n",
+		sync_cycle__is_running ? "true" : "false",
+		sync_cycle__config.period,
+		(unsigned long long)stats.n_cycles,
+		(unsigned long long)stats.n_missed,
+		(unsigned long long)stats.n_overruns,
+		(unsigned long long)stats.n_rpdos,
+		(unsigned long long)stats.n_rpdos_replaced,
+		(unsigned long long)stats.jitter_min,
+		(unsigned long long)stats.jitter_max,
+		(unsigned long long)stats.jitter_avg);
+}
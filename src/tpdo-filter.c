@@ -0,0 +1,207 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "canopen/pdo-map.h"
+#include "canopen/tpdo-filter.h"
+#include "time-utils.h"
+
+enum tpdo_filter__setting {
+	TPDO_FILTER__DEFAULT = 0,
+	TPDO_FILTER__ENABLED,
+	TPDO_FILTER__DISABLED,
+};
+
+struct tpdo_filter__pdo {
+	enum tpdo_filter__setting setting;
+	const struct pdo_map* map;
+	double deadband;
+
+	int has_passed;
+	uint64_t pass_time; /* us */
+	size_t size;
+	unsigned char data[8];
+
+	struct tpdo_filter_stats stats;
+};
+
+static int tpdo_filter__is_enabled = 0;
+static uint64_t tpdo_filter__keepalive = 0; /* us */
+
+static struct tpdo_filter__pdo
+tpdo_filter__pdos[TPDO_FILTER_NODES][TPDO_FILTER_PDOS];
+
+static struct tpdo_filter__pdo* tpdo_filter__get(int nodeid, int pdo)
+{
+	if (nodeid < 1 || nodeid >= TPDO_FILTER_NODES)
+		return NULL;
+
+	if (pdo < 1 || pdo > TPDO_FILTER_PDOS)
+		return NULL;
+
+	return &tpdo_filter__pdos[nodeid][pdo - 1];
+}
+
+void tpdo_filter_set_default(int is_enabled, unsigned long keepalive)
+{
+	tpdo_filter__is_enabled = is_enabled;
+	tpdo_filter__keepalive = keepalive * 1000ULL;
+}
+
+int tpdo_filter_set_enabled(int nodeid, int pdo, int is_enabled)
+{
+	struct tpdo_filter__pdo* self = tpdo_filter__get(nodeid, pdo);
+	if (!self)
+		return -1;
+
+	self->setting = is_enabled ? TPDO_FILTER__ENABLED
+				   : TPDO_FILTER__DISABLED;
+	return 0;
+}
+
+int tpdo_filter_set_deadband(int nodeid, int pdo, const struct pdo_map* map,
+			     double deadband)
+{
+	struct tpdo_filter__pdo* self = tpdo_filter__get(nodeid, pdo);
+	if (!self)
+		return -1;
+
+	self->map = map;
+	self->deadband = deadband;
+	return 0;
+}
+
+void tpdo_filter_reset(int nodeid)
+{
+	for (int pdo = 1; pdo <= TPDO_FILTER_PDOS; ++pdo) {
+		struct tpdo_filter__pdo* self = tpdo_filter__get(nodeid, pdo);
+		if (self)
+			memset(self, 0, sizeof(*self));
+	}
+}
+
+static int tpdo_filter__is_active(const struct tpdo_filter__pdo* self)
+{
+	switch (self->setting) {
+	case TPDO_FILTER__ENABLED: return 1;
+	case TPDO_FILTER__DISABLED: return 0;
+	case TPDO_FILTER__DEFAULT: break;
+	}
+
+	return tpdo_filter__is_enabled;
+}
+
+static int tpdo_filter__is_changed(const struct tpdo_filter__pdo* self,
+				   const void* data, size_t size)
+{
+	if (!self->has_passed || size != self->size)
+		return 1;
+
+	if (self->map && self->deadband > 0.0) {
+		int rc = pdo_map_differs(self->map, data, self->data, size,
+					 self->deadband);
+		if (rc >= 0)
+			return rc;
+	}
+
+	return memcmp(data, self->data, size) != 0;
+}
+
+static int tpdo_filter__pass(struct tpdo_filter__pdo* self, const void* data,
+			     size_t size, uint64_t now)
+{
+	if (size > sizeof(self->data))
+		size = sizeof(self->data);
+
+	self->has_passed = 1;
+	self->pass_time = now;
+	self->size = size;
+	memcpy(self->data, data, size);
+
+	self->stats.n_passed++;
+	return 1;
+}
+
+int tpdo_filter_pass(int nodeid, int pdo, const void* data, size_t size)
+{
+	struct tpdo_filter__pdo* self = tpdo_filter__get(nodeid, pdo);
+	if (!self)
+		return 1;
+
+	self->stats.n_received++;
+
+	if (!tpdo_filter__is_active(self)) {
+		self->stats.n_passed++;
+		return 1;
+	}
+
+	uint64_t now = tpdo_filter__keepalive > 0
+		     ? gettime_us(CLOCK_MONOTONIC) : 0;
+
+	if (tpdo_filter__is_changed(self, data, size))
+		return tpdo_filter__pass(self, data, size, now);
+
+	if (tpdo_filter__keepalive > 0
+	 && now - self->pass_time >= tpdo_filter__keepalive) {
+		self->stats.n_keepalive++;
+		return tpdo_filter__pass(self, data, size, now);
+	}
+
+	self->stats.n_unchanged++;
+	return 0;
+}
+
+int tpdo_filter_get_stats(int nodeid, int pdo,
+			  struct tpdo_filter_stats* stats)
+{
+	const struct tpdo_filter__pdo* self = tpdo_filter__get(nodeid, pdo);
+	if (!self)
+		return -1;
+
+	*stats = self->stats;
+	return 0;
+}
+
+void tpdo_filter_print_stats(FILE* out)
+{
+	int is_first = 1;
+
+	fprintf(out, "[");
+
+	for (int nodeid = 1; nodeid < TPDO_FILTER_NODES; ++nodeid)
+		for (int pdo = 1; pdo <= TPDO_FILTER_PDOS; ++pdo) {
+			const struct tpdo_filter__pdo* self =
+				tpdo_filter__get(nodeid, pdo);
+
+			if (self->stats.n_received == 0)
+				continue;
+
+			fprintf(out, "%s\n { \"node\": %d, \"pdo\": %d, "
+				"\"filtered\": %s, \"deadband\": %g, "
+				"\"received\": %lu, \"passed\": %lu, "
+				"\"unchanged\": %lu, \"keepalive\": %lu }",
+				is_first ? "" : ",", nodeid, pdo,
+				tpdo_filter__is_active(self) ? "true" : "false",
+				self->map ? self->deadband : 0.0,
+				self->stats.n_received, self->stats.n_passed,
+				self->stats.n_unchanged,
+				self->stats.n_keepalive);
+			is_first = 0;
+		}
+
+	fprintf(out, "\n]\n");
+}
@@ -0,0 +1,253 @@
+/* Copyright (c) 2014-2016, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Precompiled object dictionary for virtual nodes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "ini_parser.h"
+#include "conversions.h"
+#include "vnode-od.h"
+
+#define VNODE_OD_VALUE_MAX 256
+
+enum eds_obj_access eds__get_access_type(const char* str);
+
+static int vnode_od__parse_section(uint32_t* mux, const char* name)
+{
+	unsigned int index, subindex = 0;
+	char* end = NULL;
+
+	index = strtoul(name, &end, 16);
+	if (end == name || index > 0xffff)
+		return -1;
+
+	if (*end != '\0') {
+		if (strncmp(end, "sub", 3) != 0)
+			return -1;
+
+		const char* sub = end + 3;
+		subindex = strtoul(sub, &end, 16);
+		if (end == sub || *end != '\0' || subindex > 0xff)
+			return -1;
+	}
+
+	*mux = VNODE_OD_MUX(index, subindex);
+	return 0;
+}
+
+static enum canopen_type vnode_od__get_type(const struct ini_section* s)
+{
+	const char* type = ini_find_key(s, "type");
+	if (type)
+		return canopen_type_from_string(type);
+
+	type = ini_find_key(s, "datatype");
+	if (type)
+		return strtoul(type, NULL, 0);
+
+	return CANOPEN_UNKNOWN;
+}
+
+static enum eds_obj_access vnode_od__get_access(const struct ini_section* s)
+{
+	const char* access = ini_find_key(s, "access");
+	if (!access)
+		access = ini_find_key(s, "accesstype");
+
+	enum eds_obj_access type = access ? eds__get_access_type(access) : 0;
+	return type ? type : EDS_OBJ_R;
+}
+
+/* Values such as "$NODEID+0x180" are relative to the node id */
+static const char* vnode_od__expand(char* buffer, size_t size,
+				    const char* value, int nodeid)
+{
+	if (strncasecmp(value, "$nodeid", 7) != 0)
+		return value;
+
+	const char* rest = value + 7;
+	while (*rest == ' ')
+		++rest;
+
+	unsigned long offset = *rest == '+' ? strtoul(rest + 1, NULL, 0) : 0;
+
+	snprintf(buffer, size, "%lu", nodeid + offset);
+	return buffer;
+}
+
+static const char* vnode_od__get_value(char* buffer, size_t size,
+				       const struct ini_section* s,
+				       enum canopen_type type, int nodeid)
+{
+	const char* value = ini_find_key(s, "value");
+	if (!value)
+		value = ini_find_key(s, "defaultvalue");
+
+	if (!value || *value == '\0')
+		return canopen_type_is_string(type) || type == CANOPEN_DOMAIN
+		     ? "" : "0";
+
+	return vnode_od__expand(buffer, size, value, nodeid);
+}
+
+static int vnode_od__load_entry(struct vnode_od_entry* entry,
+				const struct ini_section* s, int nodeid)
+{
+	char buffer[VNODE_OD_VALUE_MAX];
+	struct canopen_data data;
+
+	if (vnode_od__parse_section(&entry->mux, s->section) < 0)
+		return -1;
+
+	entry->type = vnode_od__get_type(s);
+	if (entry->type == CANOPEN_UNKNOWN)
+		return -1;
+
+	entry->access = vnode_od__get_access(s);
+
+	const char* value = vnode_od__get_value(buffer, sizeof(buffer), s,
+						entry->type, nodeid);
+
+	/* Domains are treated as strings when they are configured */
+	enum canopen_type type = entry->type == CANOPEN_DOMAIN
+			       ? CANOPEN_OCTET_STRING : entry->type;
+
+	if (canopen_data_fromstring(&data, type, value) < 0)
+		return -1;
+
+	if (vector_init(&entry->value, data.size ? data.size : 1) < 0)
+		return -1;
+
+	if (vector_assign(&entry->value, data.data, data.size) < 0) {
+		vector_destroy(&entry->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int vnode_od__cmp(const void* key, const void* elem)
+{
+	uint32_t mux = *(const uint32_t*)key;
+	const struct vnode_od_entry* entry = elem;
+
+	return mux < entry->mux ? -1 : mux > entry->mux;
+}
+
+/* Find the position at which an entry for mux belongs */
+static size_t vnode_od__lower_bound(const struct vnode_od* self, uint32_t mux)
+{
+	size_t low = 0, high = self->length;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (self->entries[mid].mux < mux)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* The first definition of an object wins, as it did when the configuration was
+ * searched for each request.
+ */
+static void vnode_od__insert(struct vnode_od* self,
+			     struct vnode_od_entry* entry)
+{
+	size_t i = vnode_od__lower_bound(self, entry->mux);
+
+	if (i < self->length && self->entries[i].mux == entry->mux) {
+		vector_destroy(&entry->value);
+		return;
+	}
+
+	memmove(&self->entries[i + 1], &self->entries[i],
+		(self->length - i) * sizeof(*self->entries));
+	self->entries[i] = *entry;
+	self->length++;
+}
+
+int vnode_od_load(struct vnode_od* self, const struct ini_file* ini,
+		  int nodeid)
+{
+	size_t n_sections = ini_get_length(ini);
+
+	memset(self, 0, sizeof(*self));
+
+	if (n_sections == 0)
+		return 0;
+
+	self->entries = malloc(n_sections * sizeof(*self->entries));
+	if (!self->entries)
+		return -1;
+
+	for (size_t i = 0; i < n_sections; ++i) {
+		struct vnode_od_entry entry;
+		memset(&entry, 0, sizeof(entry));
+
+		/* Other sections, e.g. [device], are not objects */
+		if (vnode_od__load_entry(&entry, ini_get_section(ini, i),
+					 nodeid) < 0)
+			continue;
+
+		vnode_od__insert(self, &entry);
+	}
+
+	return 0;
+}
+
+void vnode_od_destroy(struct vnode_od* self)
+{
+	for (size_t i = 0; i < self->length; ++i)
+		vector_destroy(&self->entries[i].value);
+
+	free(self->entries);
+	memset(self, 0, sizeof(*self));
+}
+
+struct vnode_od_entry* vnode_od_find(const struct vnode_od* self, int index,
+				     int subindex)
+{
+	uint32_t mux = VNODE_OD_MUX(index, subindex);
+
+	return bsearch(&mux, self->entries, self->length,
+		       sizeof(*self->entries), vnode_od__cmp);
+}
+
+enum sdo_abort_code vnode_od_write(struct vnode_od_entry* entry,
+				   const void* data, size_t size)
+{
+	if (!(entry->access & EDS_OBJ_W))
+		return SDO_ABORT_RO;
+
+	size_t expected_size = canopen_type_size(entry->type);
+
+	if (expected_size && size > expected_size)
+		return SDO_ABORT_TOO_LONG;
+
+	if (expected_size && size < expected_size)
+		return SDO_ABORT_TOO_SHORT;
+
+	if (vector_assign(&entry->value, data, size) < 0)
+		return SDO_ABORT_NOMEM;
+
+	return 0;
+}
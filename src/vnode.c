@@ -32,6 +32,7 @@
 #include "ini_parser.h"
 #include "conversions.h"
 #include "vnode.h"
+#include "vnode-od.h"
 #include "type-macros.h"
 
 #define SDO_MUX(index, subindex) ((index << 16) | subindex)
@@ -47,6 +48,7 @@ enum vnode__bootup_method {
 struct vnode {
 	int is_running;
 	struct ini_file config;
+	struct vnode_od od;
 	int nodeid;
 	enum nmt_state state;
 	struct sdo_srv sdo_srv;
@@ -109,7 +111,8 @@ static void vnode__load_device_info(struct vnode* self)
 	self->bootup_method = vnode__get_bootup_method(s);
 }
 
-static int vnode__load_config(struct vnode* self, const char* path)
+static int vnode__load_config(struct vnode* self, const char* path,
+			      int nodeid)
 {
 	FILE* stream = fopen(path, "r");
 	if (!stream) {
@@ -118,14 +121,22 @@ static int vnode__load_config(struct vnode* self, const char* path)
 	}
 
 	int rc = ini_parse(&self->config, stream);
-	if (rc < 0)
-		perror("Could not parse config");
-
 	fclose(stream);
 
+	if (rc < 0) {
+		perror("Could not parse config");
+		return -1;
+	}
+
 	vnode__load_device_info(self);
 
-	return rc;
+	if (vnode_od_load(&self->od, &self->config, nodeid) < 0) {
+		perror("Could not load object dictionary");
+		ini_destroy(&self->config);
+		return -1;
+	}
+
+	return 0;
 }
 
 static void vnode__send_state(struct vnode* self)
@@ -238,45 +249,32 @@ static int vnode__sdo_get_heartbeat(struct vnode* self, struct sdo_srv* srv)
 	return 0;
 }
 
-static const char* vnode__make_section_string(int index, int subindex)
+static int vnode__sdo_get_config(struct vnode* self, struct sdo_srv* srv)
 {
-	static char buffer[256];
-	snprintf(buffer, sizeof(buffer), "%xsub%x", index, subindex);
-	return buffer;
-}
+	const struct vnode_od_entry* entry;
+	entry = vnode_od_find(&self->od, srv->index, srv->subindex);
+	if (!entry)
+		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
 
-static enum canopen_type vnode__get_section_type(const struct ini_section* s)
-{
-	const char* type_str = ini_find_key(s, "type");
-	if (!type_str)
-		return CANOPEN_UNKNOWN;
+	if (!(entry->access & (EDS_OBJ_R | EDS_OBJ_CONST)))
+		return sdo_srv_abort(srv, SDO_ABORT_WO);
+
+	if (vector_assign(&srv->buffer, entry->value.data,
+			  entry->value.index) < 0)
+		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
 
-	return canopen_type_from_string(type_str);
+	return 0;
 }
 
-static int vnode__sdo_get_config(struct vnode* self, struct sdo_srv* srv)
+static int vnode__sdo_check_config(struct vnode* self, struct sdo_srv* srv)
 {
-	const char* section;
-	section = vnode__make_section_string(srv->index, srv->subindex);
-
-	const struct ini_section* s = ini_find_section(&self->config, section);
-	if (!s)
-		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
-
-	enum canopen_type type = vnode__get_section_type(s);
-	if (type == CANOPEN_UNKNOWN)
-		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
-
-	const char* value = ini_find_key(s, "value");
-	if (!value)
+	const struct vnode_od_entry* entry;
+	entry = vnode_od_find(&self->od, srv->index, srv->subindex);
+	if (!entry)
 		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
 
-	struct canopen_data data;
-	if (canopen_data_fromstring(&data, type, value) < 0)
-		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
-
-	if (vector_assign(&srv->buffer, data.data, data.size) < 0)
-		return sdo_srv_abort(srv, SDO_ABORT_NOMEM);
+	if (!(entry->access & EDS_OBJ_W))
+		return sdo_srv_abort(srv, SDO_ABORT_RO);
 
 	return 0;
 }
@@ -294,7 +292,7 @@ static int vnode__on_sdo_init(struct sdo_srv* srv)
 	default:
 		return srv->req_type == SDO_REQ_UPLOAD
 		     ? vnode__sdo_get_config(self, srv)
-		     : sdo_srv_abort(srv, SDO_ABORT_RO);
+		     : vnode__sdo_check_config(self, srv);
 	}
 
 	abort();
@@ -334,9 +332,16 @@ static int vnode__sdo_set_heartbeat(struct vnode* self, struct sdo_srv* srv)
 	return 0;
 }
 
-static int vnode__sdo_set_config(struct sdo_srv* srv)
+static int vnode__sdo_set_config(struct vnode* self, struct sdo_srv* srv)
 {
-	return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
+	struct vnode_od_entry* entry;
+	entry = vnode_od_find(&self->od, srv->index, srv->subindex);
+	if (!entry)
+		return sdo_srv_abort(srv, SDO_ABORT_NEXIST);
+
+	enum sdo_abort_code code = vnode_od_write(entry, srv->buffer.data,
+						  srv->buffer.index);
+	return code ? sdo_srv_abort(srv, code) : 0;
 }
 
 static int vnode__on_sdo_done(struct sdo_srv* srv)
@@ -353,7 +358,7 @@ static int vnode__on_sdo_done(struct sdo_srv* srv)
 	case HEARTBEAT_PERIOD:
 		return vnode__sdo_set_heartbeat(self, srv);
 	default:
-		return vnode__sdo_set_config(srv);
+		return vnode__sdo_set_config(self, srv);
 	}
 
 	abort();
@@ -495,7 +500,7 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 		return NULL;
 
 	if (config_path)
-		if (vnode__load_config(self, config_path) < 0)
+		if (vnode__load_config(self, config_path, nodeid) < 0)
 			goto config_failure;
 
 	self->nodeid = nodeid;
@@ -519,8 +524,10 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 
 	sdo_srv_destroy(&self->sdo_srv);
 srv_failure:
-	if (config_path)
+	if (config_path) {
+		vnode_od_destroy(&self->od);
 		ini_destroy(&self->config);
+	}
 config_failure:
 	vnode__cleanup_mloop();
 	return NULL;
@@ -533,6 +540,7 @@ void co_vnode_destroy(struct vnode* self)
 		mloop_timer_unref(self->heartbeat_timer);
 
 	sdo_srv_destroy(&self->sdo_srv);
+	vnode_od_destroy(&self->od);
 	ini_destroy(&self->config);
 	vnode__cleanup_mloop();
 	self->is_running = 0;
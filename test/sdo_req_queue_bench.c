@@ -0,0 +1,177 @@
+/* Contention benchmark for the SDO request queue
+ *
+ * A number of producer threads start requests on the same queue while the
+ * main thread consumes them, as the main loop would. For comparison, the same
+ * is done with a list that is protected by a mutex, which is how the queue
+ * used to work.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include "canopen/sdo_req.h"
+#include "time-utils.h"
+
+#define N_PRODUCERS 8
+#define N_REQS_PER_PRODUCER 100000
+#define N_REQS (N_PRODUCERS * N_REQS_PER_PRODUCER)
+#define QUEUE_LIMIT N_REQS
+
+/* Stubs; these are not thread safe when using fff */
+struct mloop* mloop_default(void) { return NULL; }
+void mloop_iterate(struct mloop* loop) { (void)loop; }
+struct mloop_idle* mloop_idle_new(struct mloop* loop)
+{
+	(void)loop;
+	return (void*)1;
+}
+void mloop_idle_set_idle_fn(struct mloop_idle* idle, mloop_idle_fn fn)
+{
+	(void)idle; (void)fn;
+}
+void mloop_idle_set_cond_fn(struct mloop_idle* idle, mloop_idle_cond_fn fn)
+{
+	(void)idle; (void)fn;
+}
+void mloop_idle_set_context(struct mloop_idle* idle, void* context,
+			    mloop_free_fn fn)
+{
+	(void)idle; (void)context; (void)fn;
+}
+int mloop_idle_start(struct mloop_idle* idle) { (void)idle; return 0; }
+int mloop_idle_unref(struct mloop_idle* idle) { (void)idle; return 0; }
+struct mloop_timer* mloop_timer_new(struct mloop* loop)
+{
+	(void)loop;
+	return (void*)1;
+}
+void mloop_timer_set_context(struct mloop_timer* timer, void* context,
+			     mloop_free_fn fn)
+{
+	(void)timer; (void)context; (void)fn;
+}
+void mloop_timer_set_callback(struct mloop_timer* timer, mloop_timer_fn fn)
+{
+	(void)timer; (void)fn;
+}
+int mloop_timer_stop(struct mloop_timer* timer) { (void)timer; return 0; }
+int mloop_timer_unref(struct mloop_timer* timer) { (void)timer; return 0; }
+int sdo_async_init(struct sdo_async* async, const struct sock* sock, int id)
+{
+	(void)async; (void)sock; (void)id;
+	return 0;
+}
+void sdo_async_destroy(struct sdo_async* async) { (void)async; }
+
+static struct sdo_req reqs[N_REQS];
+
+struct locked_queue {
+	pthread_mutex_t mutex;
+	size_t size;
+	struct sdo_req_list list;
+};
+
+static struct sdo_req_queue queue;
+static struct locked_queue locked_queue;
+
+static pthread_barrier_t barrier;
+
+static void* produce(void* ptr)
+{
+	struct sdo_req* req = ptr;
+
+	pthread_barrier_wait(&barrier);
+
+	for (int i = 0; i < N_REQS_PER_PRODUCER; ++i)
+		while (sdo_req_queue__enqueue(&queue, &req[i]) < 0)
+			sched_yield();
+
+	return NULL;
+}
+
+static void* produce_locked(void* ptr)
+{
+	struct sdo_req* req = ptr;
+
+	pthread_barrier_wait(&barrier);
+
+	for (int i = 0; i < N_REQS_PER_PRODUCER; ) {
+		pthread_mutex_lock(&locked_queue.mutex);
+
+		if (locked_queue.size < QUEUE_LIMIT) {
+			TAILQ_INSERT_TAIL(&locked_queue.list, &req[i], links);
+			++locked_queue.size;
+			++i;
+		}
+
+		pthread_mutex_unlock(&locked_queue.mutex);
+	}
+
+	return NULL;
+}
+
+static int consume(void)
+{
+	return sdo_req_queue__dequeue(&queue) != NULL;
+}
+
+static int consume_locked(void)
+{
+	pthread_mutex_lock(&locked_queue.mutex);
+
+	struct sdo_req* req = TAILQ_FIRST(&locked_queue.list);
+	if (req) {
+		TAILQ_REMOVE(&locked_queue.list, req, links);
+		--locked_queue.size;
+	}
+
+	pthread_mutex_unlock(&locked_queue.mutex);
+	return req != NULL;
+}
+
+static void run(const char* name, void* (*producer)(void*),
+		int (*consumer)(void))
+{
+	pthread_t threads[N_PRODUCERS];
+
+	memset(reqs, 0, sizeof(reqs));
+
+	for (int i = 0; i < N_PRODUCERS; ++i)
+		pthread_create(&threads[i], NULL, producer,
+			       &reqs[i * N_REQS_PER_PRODUCER]);
+
+	pthread_barrier_wait(&barrier);
+	uint64_t start = gettime_us(CLOCK_MONOTONIC);
+
+	for (int n = 0; n < N_REQS; )
+		n += consumer();
+
+	uint64_t elapsed = gettime_us(CLOCK_MONOTONIC) - start;
+
+	for (int i = 0; i < N_PRODUCERS; ++i)
+		pthread_join(threads[i], NULL);
+
+	printf("%-10s %d producers: %d requests in %llu us (%.1f ns/request)\n",
+	       name, N_PRODUCERS, N_REQS, (unsigned long long)elapsed,
+	       elapsed * 1000.0 / N_REQS);
+}
+
+int main()
+{
+	pthread_barrier_init(&barrier, NULL, N_PRODUCERS + 1);
+
+	sdo_req__queue_init(&queue, NULL, 1, QUEUE_LIMIT, 0);
+	run("lock-free", produce, consume);
+	assert(queue.size == 0);
+	sdo_req__queue_destroy(&queue);
+
+	pthread_mutex_init(&locked_queue.mutex, NULL);
+	TAILQ_INIT(&locked_queue.list);
+	run("mutex", produce_locked, consume_locked);
+	assert(locked_queue.size == 0);
+	pthread_mutex_destroy(&locked_queue.mutex);
+
+	pthread_barrier_destroy(&barrier);
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "tst.h"
+#include "canopen/boot-cache.h"
+
+static char path_[256];
+
+static void make_entry(struct boot_cache_entry* entry, uint32_t serial)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->verify_index = 0x1018;
+	entry->verify_subindex = 4;
+	entry->verify_value = serial;
+	entry->device_type = 0x20192;
+	entry->vendor_id = 0x1234;
+	entry->n_channels = 1;
+	entry->channels[0].req_cobid = 0x641;
+	entry->channels[0].res_cobid = 0x5c1;
+	strcpy(entry->name, "node");
+	strcpy(entry->sw_version, "1.0");
+}
+
+static int test_disabled()
+{
+	struct boot_cache_entry entry;
+	make_entry(&entry, 1);
+
+	ASSERT_FALSE(boot_cache_is_enabled());
+	ASSERT_INT_EQ(-1, boot_cache_put(1, &entry));
+	ASSERT_INT_EQ(-1, boot_cache_get(1, &entry));
+
+	return 0;
+}
+
+static int test_put_get()
+{
+	unlink(path_);
+	ASSERT_INT_EQ(0, boot_cache_init(path_));
+	ASSERT_TRUE(boot_cache_is_enabled());
+
+	struct boot_cache_entry entry, cached;
+	make_entry(&entry, 42);
+
+	ASSERT_INT_EQ(-1, boot_cache_get(5, &cached));
+	ASSERT_INT_EQ(0, boot_cache_put(5, &entry));
+	ASSERT_INT_EQ(0, boot_cache_get(5, &cached));
+	ASSERT_UINT_EQ(42, cached.verify_value);
+	ASSERT_STR_EQ("node", cached.name);
+	ASSERT_UINT_EQ(0x5c1, cached.channels[0].res_cobid);
+
+	ASSERT_INT_EQ(-1, boot_cache_put(0, &entry));
+	ASSERT_INT_EQ(-1, boot_cache_put(128, &entry));
+
+	boot_cache_invalidate(5);
+	ASSERT_INT_EQ(-1, boot_cache_get(5, &cached));
+
+	struct boot_cache_stats stats;
+	boot_cache_get_stats(&stats);
+	ASSERT_UINT_EQ(1, stats.n_hits);
+	ASSERT_UINT_EQ(2, stats.n_misses);
+	ASSERT_UINT_EQ(1, stats.n_invalidated);
+
+	boot_cache_cleanup();
+	return 0;
+}
+
+static int test_persistence()
+{
+	unlink(path_);
+	ASSERT_INT_EQ(0, boot_cache_init(path_));
+
+	struct boot_cache_entry entry, cached;
+	make_entry(&entry, 7);
+	ASSERT_INT_EQ(0, boot_cache_put(127, &entry));
+	make_entry(&entry, 8);
+	ASSERT_INT_EQ(0, boot_cache_put(3, &entry));
+	boot_cache_invalidate(3);
+
+	boot_cache_cleanup();
+	ASSERT_INT_EQ(-1, boot_cache_get(127, &cached));
+
+	ASSERT_INT_EQ(0, boot_cache_init(path_));
+	ASSERT_INT_EQ(0, boot_cache_get(127, &cached));
+	ASSERT_UINT_EQ(7, cached.verify_value);
+	ASSERT_INT_EQ(-1, boot_cache_get(3, &cached));
+
+	boot_cache_cleanup();
+	return 0;
+}
+
+static int test_foreign_file()
+{
+	FILE* output = fopen(path_, "w");
+	ASSERT_TRUE(output != NULL);
+	fprintf(output, "this is not a boot cache\n");
+	fclose(output);
+
+	ASSERT_INT_EQ(0, boot_cache_init(path_));
+
+	struct boot_cache_entry entry;
+	for (int nodeid = 1; nodeid < BOOT_CACHE_NODES; ++nodeid)
+		ASSERT_INT_EQ(-1, boot_cache_get(nodeid, &entry));
+
+	/* The file is replaced on the first write */
+	make_entry(&entry, 9);
+	ASSERT_INT_EQ(0, boot_cache_put(9, &entry));
+	boot_cache_cleanup();
+
+	ASSERT_INT_EQ(0, boot_cache_init(path_));
+	ASSERT_INT_EQ(0, boot_cache_get(9, &entry));
+	boot_cache_cleanup();
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	snprintf(path_, sizeof(path_), "/tmp/unit_boot-cache.%d", getpid());
+
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_put_get);
+	RUN_TEST(test_persistence);
+	RUN_TEST(test_foreign_file);
+
+	unlink(path_);
+	return r;
+}
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen-coro.h"
+
+DEFINE_FFF_GLOBALS;
+
+struct co_sdo_req {
+	int dummy;
+};
+
+static struct co_sdo_req req;
+static co_sdo_done_fn done_fn;
+static void* req_context;
+
+FAKE_VALUE_FUNC(struct co_sdo_req*, co_sdo_req_new, struct co_drv*);
+FAKE_VALUE_FUNC(int, co_sdo_req_unref, struct co_sdo_req*);
+FAKE_VALUE_FUNC(int, co_sdo_req_start, struct co_sdo_req*);
+FAKE_VOID_FUNC(co_sdo_req_set_type, struct co_sdo_req*, enum co_sdo_type);
+FAKE_VOID_FUNC(co_sdo_req_set_indices, struct co_sdo_req*, int, int);
+FAKE_VOID_FUNC(co_sdo_req_set_data, struct co_sdo_req*, const void*, size_t);
+FAKE_VOID_FUNC(co_sdo_req_set_done_fn, struct co_sdo_req*, co_sdo_done_fn);
+FAKE_VOID_FUNC(co_sdo_req_set_context, struct co_sdo_req*, void*, co_free_fn);
+FAKE_VALUE_FUNC(void*, co_sdo_req_get_context, const struct co_sdo_req*);
+FAKE_VALUE_FUNC(enum co_sdo_status, co_sdo_req_get_status,
+		const struct co_sdo_req*);
+FAKE_VALUE_FUNC(const void*, co_sdo_req_get_data, const struct co_sdo_req*);
+FAKE_VALUE_FUNC(size_t, co_sdo_req_get_size, const struct co_sdo_req*);
+
+static void set_done_fn(struct co_sdo_req* r, co_sdo_done_fn fn)
+{
+	(void)r;
+	done_fn = fn;
+}
+
+static void set_context(struct co_sdo_req* r, void* context, co_free_fn fn)
+{
+	(void)r;
+	(void)fn;
+	req_context = context;
+}
+
+static void* get_context(const struct co_sdo_req* r)
+{
+	(void)r;
+	return req_context;
+}
+
+static void finish(enum co_sdo_status status, const void* data, size_t size)
+{
+	co_sdo_req_get_status_fake.return_val = status;
+	co_sdo_req_get_data_fake.return_val = data;
+	co_sdo_req_get_size_fake.return_val = size;
+
+	done_fn(NULL, &req);
+}
+
+struct context {
+	int step;
+	uint32_t value;
+	int result;
+	int n_done;
+};
+
+static int sequence(struct co_coro* coro)
+{
+	struct context* self = co_coro_get_context(coro);
+
+	CO_CORO_BEGIN(coro);
+
+	self->step = 1;
+	CO_AWAIT_SDO_READ(coro, 0x1000, 0);
+	if (co_coro_get_status(coro) != CO_SDO_REQ_OK)
+		CO_CORO_RETURN(coro, -1);
+
+	memcpy(&self->value, co_coro_get_data(coro), sizeof(self->value));
+
+	self->step = 2;
+	CO_AWAIT_SDO_WRITE(coro, 0x1017, 0, &self->value, 2);
+	if (co_coro_get_status(coro) != CO_SDO_REQ_OK)
+		CO_CORO_RETURN(coro, -2);
+
+	self->step = 3;
+	CO_CORO_END(coro);
+}
+
+static void on_done(struct co_coro* coro, int result)
+{
+	struct context* self = co_coro_get_context(coro);
+	self->result = result;
+	self->n_done++;
+}
+
+static void init(struct co_coro* coro, struct context* context)
+{
+	RESET_FAKE(co_sdo_req_new);
+	RESET_FAKE(co_sdo_req_unref);
+	RESET_FAKE(co_sdo_req_start);
+	RESET_FAKE(co_sdo_req_set_indices);
+	RESET_FAKE(co_sdo_req_set_data);
+	RESET_FAKE(co_sdo_req_set_done_fn);
+
+	co_sdo_req_new_fake.return_val = &req;
+	co_sdo_req_set_done_fn_fake.custom_fake = set_done_fn;
+	co_sdo_req_set_context_fake.custom_fake = set_context;
+	co_sdo_req_get_context_fake.custom_fake = get_context;
+
+	memset(context, 0, sizeof(*context));
+	co_coro_init(coro, NULL, sequence, context);
+	co_coro_set_done_fn(coro, on_done);
+}
+
+static int test_sequence()
+{
+	struct co_coro coro;
+	struct context context;
+	uint32_t device_type = 0x00020192;
+
+	init(&coro, &context);
+
+	ASSERT_INT_EQ(CO_CORO_SUSPENDED, co_coro_start(&coro));
+	ASSERT_INT_EQ(1, context.step);
+	ASSERT_INT_EQ(0x1000, co_sdo_req_set_indices_fake.arg1_val);
+	ASSERT_INT_EQ(0, co_sdo_req_set_data_fake.call_count);
+
+	finish(CO_SDO_REQ_OK, &device_type, sizeof(device_type));
+	ASSERT_INT_EQ(2, context.step);
+	ASSERT_UINT_EQ(device_type, context.value);
+	ASSERT_INT_EQ(0x1017, co_sdo_req_set_indices_fake.arg1_val);
+	ASSERT_INT_EQ(1, co_sdo_req_set_data_fake.call_count);
+	ASSERT_UINT_EQ(2, co_sdo_req_set_data_fake.arg2_val);
+
+	/* The first request is released when the second one starts */
+	ASSERT_INT_EQ(1, co_sdo_req_unref_fake.call_count);
+	ASSERT_INT_EQ(0, context.n_done);
+
+	finish(CO_SDO_REQ_OK, NULL, 0);
+	ASSERT_INT_EQ(3, context.step);
+	ASSERT_INT_EQ(1, context.n_done);
+	ASSERT_INT_EQ(0, context.result);
+	ASSERT_INT_EQ(2, co_sdo_req_unref_fake.call_count);
+
+	return 0;
+}
+
+static int test_failed_request()
+{
+	struct co_coro coro;
+	struct context context;
+
+	init(&coro, &context);
+
+	ASSERT_INT_EQ(CO_CORO_SUSPENDED, co_coro_start(&coro));
+
+	finish(CO_SDO_REQ_REMOTE_ABORT, NULL, 0);
+	ASSERT_INT_EQ(1, context.step);
+	ASSERT_INT_EQ(1, context.n_done);
+	ASSERT_INT_EQ(-1, context.result);
+	ASSERT_INT_EQ(1, co_sdo_req_unref_fake.call_count);
+
+	return 0;
+}
+
+static int test_start_failure()
+{
+	struct co_coro coro;
+	struct context context;
+
+	init(&coro, &context);
+	co_sdo_req_start_fake.return_val = -1;
+
+	/* The coroutine carries on and finds out from the status */
+	ASSERT_INT_EQ(-1, co_coro_start(&coro));
+	ASSERT_INT_EQ(CO_SDO_REQ_NOMEM, co_coro_get_status(&coro));
+	ASSERT_INT_EQ(1, context.n_done);
+	ASSERT_INT_EQ(-1, context.result);
+	ASSERT_INT_EQ(1, co_sdo_req_unref_fake.call_count);
+
+	return 0;
+}
+
+static int test_cancel()
+{
+	struct co_coro coro;
+	struct context context;
+
+	init(&coro, &context);
+
+	ASSERT_INT_EQ(CO_CORO_SUSPENDED, co_coro_start(&coro));
+
+	co_coro_cancel(&coro);
+	ASSERT_PTR_EQ(NULL, co_sdo_req_set_done_fn_fake.arg1_val);
+	ASSERT_INT_EQ(1, co_sdo_req_unref_fake.call_count);
+	ASSERT_INT_EQ(0, context.n_done);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_sequence);
+	RUN_TEST(test_failed_request);
+	RUN_TEST(test_start_failure);
+	RUN_TEST(test_cancel);
+	return r;
+}
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mloop.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen/master.h"
+#include "canopen/sdo-poll.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_type, struct mloop_timer*,
+	       enum mloop_timer_type);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+FAKE_VALUE_FUNC(int, dlclose, void*);
+FAKE_VALUE_FUNC(int, sdo_poll_register, const struct sdo_poll_info*);
+FAKE_VOID_FUNC(sdo_poll_unregister, int);
+
+/* Needed to link with driver.c */
+struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
+
+static int dummy_timer;
+static void* timer_context;
+static mloop_timer_fn timeout_fn;
+static int n_calls;
+static int n_context_frees;
+
+static void set_context(struct mloop_timer* timer, void* context,
+			mloop_free_fn fn)
+{
+	(void)timer;
+	(void)fn;
+	timer_context = context;
+}
+
+static void set_callback(struct mloop_timer* timer, mloop_timer_fn fn)
+{
+	(void)timer;
+	timeout_fn = fn;
+}
+
+static void* get_context(const struct mloop_timer* timer)
+{
+	(void)timer;
+	return timer_context;
+}
+
+static void free_context(void* context)
+{
+	(void)context;
+	n_context_frees++;
+}
+
+static void init()
+{
+	RESET_FAKE(mloop_timer_unref);
+	RESET_FAKE(mloop_timer_start);
+	RESET_FAKE(mloop_timer_stop);
+	RESET_FAKE(mloop_timer_set_time);
+
+	mloop_timer_new_fake.return_val = (struct mloop_timer*)&dummy_timer;
+	mloop_timer_set_context_fake.custom_fake = set_context;
+	mloop_timer_set_callback_fake.custom_fake = set_callback;
+	mloop_timer_get_context_fake.custom_fake = get_context;
+
+	n_calls = 0;
+	n_context_frees = 0;
+}
+
+static void count_calls(struct co_drv* drv, struct co_timer* timer)
+{
+	(void)drv;
+	(void)timer;
+	n_calls++;
+}
+
+static void free_self(struct co_drv* drv, struct co_timer* timer)
+{
+	(void)drv;
+	n_calls++;
+	co_timer_free(timer);
+}
+
+static void restart_self(struct co_drv* drv, struct co_timer* timer)
+{
+	(void)drv;
+	n_calls++;
+	co_timer_start(timer, 10);
+}
+
+static int test_sync_period()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	struct co_timer* timer = co_timer_new(drv, CO_TIMER_SYNC, count_calls);
+	ASSERT_TRUE(timer != NULL);
+
+	co_drv_process_sync();
+	ASSERT_INT_EQ(0, n_calls);
+
+	ASSERT_INT_EQ(0, co_timer_start(timer, 3));
+	ASSERT_INT_EQ(0, mloop_timer_start_fake.call_count);
+
+	for (int i = 0; i < 7; ++i)
+		co_drv_process_sync();
+
+	ASSERT_INT_EQ(2, n_calls);
+
+	ASSERT_INT_EQ(0, co_timer_stop(timer));
+	co_drv_process_sync();
+	co_drv_process_sync();
+	ASSERT_INT_EQ(2, n_calls);
+
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(1, mloop_timer_unref_fake.call_count);
+
+	co_drv_process_sync();
+	ASSERT_INT_EQ(2, n_calls);
+
+	return 0;
+}
+
+static int test_sync_free_in_callback()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	struct co_timer* a = co_timer_new(drv, CO_TIMER_SYNC, free_self);
+	struct co_timer* b = co_timer_new(drv, CO_TIMER_SYNC, count_calls);
+	co_timer_start(a, 1);
+	co_timer_start(b, 1);
+
+	co_drv_process_sync();
+	ASSERT_INT_EQ(2, n_calls);
+
+	co_drv_process_sync();
+	ASSERT_INT_EQ(3, n_calls);
+
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(2, mloop_timer_unref_fake.call_count);
+
+	return 0;
+}
+
+static int test_oneshot()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	struct co_timer* timer = co_timer_new(drv, CO_TIMER_ONESHOT,
+					      count_calls);
+	ASSERT_TRUE(timer != NULL);
+	ASSERT_INT_EQ(MLOOP_TIMER_PERIODIC, mloop_timer_set_type_fake.arg1_val);
+
+	ASSERT_INT_EQ(0, co_timer_start(timer, 25));
+	ASSERT_UINT_EQ(25000000ULL, mloop_timer_set_time_fake.arg1_val);
+
+	timeout_fn((struct mloop_timer*)&dummy_timer);
+	ASSERT_INT_EQ(1, n_calls);
+	ASSERT_INT_EQ(1, mloop_timer_stop_fake.call_count);
+
+	/* Already stopped */
+	ASSERT_INT_EQ(-1, co_timer_stop(timer));
+
+	co_drv_unload(drv);
+	return 0;
+}
+
+static int test_restart_oneshot_in_callback()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	struct co_timer* timer = co_timer_new(drv, CO_TIMER_ONESHOT,
+					      restart_self);
+	co_timer_start(timer, 10);
+
+	timeout_fn((struct mloop_timer*)&dummy_timer);
+	ASSERT_INT_EQ(1, n_calls);
+	ASSERT_INT_EQ(2, mloop_timer_start_fake.call_count);
+
+	/* Stopped by unload since it is running again */
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(2, mloop_timer_stop_fake.call_count);
+
+	return 0;
+}
+
+static int test_unload_frees_context()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	struct co_timer* timer = co_timer_new(drv, CO_TIMER_PERIODIC,
+					      count_calls);
+	co_timer_set_context(timer, &n_calls, free_context);
+	ASSERT_PTR_EQ(&n_calls, co_timer_get_context(timer));
+
+	co_timer_start(timer, 100);
+	timeout_fn((struct mloop_timer*)&dummy_timer);
+	timeout_fn((struct mloop_timer*)&dummy_timer);
+	ASSERT_INT_EQ(2, n_calls);
+	ASSERT_INT_EQ(0, mloop_timer_stop_fake.call_count);
+
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(1, n_context_frees);
+	ASSERT_INT_EQ(1, mloop_timer_stop_fake.call_count);
+	ASSERT_INT_EQ(1, mloop_timer_unref_fake.call_count);
+
+	return 0;
+}
+
+static struct co_timer* driver_timer;
+
+static void free_driver(void* context)
+{
+	(void)context;
+	co_timer_free(driver_timer);
+}
+
+static int test_unload_with_driver_freeing_timer()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	driver_timer = co_timer_new(drv, CO_TIMER_PERIODIC, count_calls);
+	co_timer_set_context(driver_timer, &n_calls, free_context);
+	co_timer_start(driver_timer, 100);
+
+	drv->context = &driver_timer;
+	drv->free_fn = free_driver;
+
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(1, n_context_frees);
+	ASSERT_INT_EQ(1, mloop_timer_stop_fake.call_count);
+	ASSERT_INT_EQ(1, mloop_timer_unref_fake.call_count);
+	ASSERT_PTR_EQ(NULL, drv->free_fn);
+
+	free(driver_timer);
+	return 0;
+}
+
+static int test_unload_stops_polls()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	init();
+
+	RESET_FAKE(sdo_poll_register);
+	RESET_FAKE(sdo_poll_unregister);
+
+	sdo_poll_register_fake.return_val = 7;
+	ASSERT_INT_EQ(7, co_sdo_poll_start(drv, 0x6000, 1, 100));
+	sdo_poll_register_fake.return_val = 8;
+	ASSERT_INT_EQ(8, co_sdo_poll_start(drv, 0x6000, 2, 100));
+
+	co_sdo_poll_stop(drv, 7);
+	ASSERT_INT_EQ(1, sdo_poll_unregister_fake.call_count);
+	ASSERT_INT_EQ(7, sdo_poll_unregister_fake.arg0_val);
+
+	co_drv_unload(drv);
+	ASSERT_INT_EQ(2, sdo_poll_unregister_fake.call_count);
+	ASSERT_INT_EQ(8, sdo_poll_unregister_fake.arg0_val);
+
+	/* The handle may have been reused by someone else by now */
+	co_sdo_poll_stop(drv, 8);
+	ASSERT_INT_EQ(2, sdo_poll_unregister_fake.call_count);
+
+	return 0;
+}
+
+static int test_sdo_req_data_after_upload_buffer()
+{
+	struct co_drv* drv = &co_master_node_[1].ndrv;
+	char buffer[4] = "abc";
+
+	struct co_sdo_req* req = co_sdo_req_new(drv);
+	ASSERT_TRUE(req != NULL);
+
+	co_sdo_req_set_upload_buffer(req, buffer, sizeof(buffer));
+	co_sdo_req_set_data(req, "foobarbaz", sizeof("foobarbaz"));
+
+	/* The driver's buffer is neither written nor reallocated */
+	ASSERT_STR_EQ("abc", buffer);
+	ASSERT_TRUE(co_sdo_req_get_data(req) != buffer);
+	ASSERT_STR_EQ("foobarbaz", co_sdo_req_get_data(req));
+	ASSERT_UINT_EQ(sizeof("foobarbaz"), co_sdo_req_get_size(req));
+
+	co_sdo_req_unref(req);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_sync_period);
+	RUN_TEST(test_sync_free_in_callback);
+	RUN_TEST(test_oneshot);
+	RUN_TEST(test_restart_oneshot_in_callback);
+	RUN_TEST(test_unload_frees_context);
+	RUN_TEST(test_unload_with_driver_freeing_timer);
+	RUN_TEST(test_unload_stops_polls);
+	RUN_TEST(test_sdo_req_data_after_upload_buffer);
+	return r;
+}
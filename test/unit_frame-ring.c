@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tst.h"
+#include "canopen/frame-ring.h"
+
+static char iface[64];
+
+static void make_frame(struct can_frame* cf, unsigned int i)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = 0x180 + (i & 0x7f);
+	cf->can_dlc = 8;
+	memset(cf->data, i, sizeof(cf->data));
+}
+
+static int test_read_batch()
+{
+	ASSERT_INT_EQ(0, frame_ring_init(iface, 100));
+
+	/* Frames written before the reader attaches are not seen */
+	struct can_frame cf;
+	make_frame(&cf, 42);
+	frame_ring_write(&cf, 0);
+
+	struct frame_ring_reader reader;
+	ASSERT_INT_EQ(0, frame_ring_reader_open(&reader, iface));
+	ASSERT_UINT_EQ(128, reader.ring->capacity);
+
+	struct frame_ring_frame frames[8];
+	ASSERT_UINT_EQ(0, frame_ring_read(&reader, frames, 8));
+	ASSERT_INT_EQ(0, frame_ring_wait(&reader, 0));
+
+	for (unsigned int i = 0; i < 5; ++i) {
+		make_frame(&cf, i);
+		frame_ring_write(&cf, i == 2 ? FRAME_RING_TX : 0);
+	}
+
+	ASSERT_INT_EQ(1, frame_ring_wait(&reader, 0));
+	ASSERT_UINT_EQ(3, frame_ring_read(&reader, frames, 3));
+	ASSERT_UINT_EQ(0x180, frames[0].cf.can_id);
+	ASSERT_UINT_EQ(0, frames[0].flags);
+	ASSERT_UINT_EQ(FRAME_RING_TX, frames[2].flags);
+	ASSERT_UINT_EQ(2, frames[2].cf.data[7]);
+	ASSERT_TRUE(frames[2].timestamp != 0);
+
+	ASSERT_UINT_EQ(2, frame_ring_read(&reader, frames, 8));
+	ASSERT_UINT_EQ(0x184, frames[1].cf.can_id);
+	ASSERT_UINT_EQ(0, frame_ring_read(&reader, frames, 8));
+	ASSERT_UINT_EQ(0, reader.n_lost);
+
+	frame_ring_reader_close(&reader);
+	frame_ring_cleanup();
+	return 0;
+}
+
+static int test_overrun()
+{
+	ASSERT_INT_EQ(0, frame_ring_init(iface, 64));
+
+	struct frame_ring_reader reader;
+	ASSERT_INT_EQ(0, frame_ring_reader_open(&reader, iface));
+
+	struct can_frame cf;
+	for (unsigned int i = 0; i < 100; ++i) {
+		make_frame(&cf, i);
+		frame_ring_write(&cf, 0);
+	}
+
+	struct frame_ring_frame frames[100];
+	ASSERT_UINT_EQ(64, frame_ring_read(&reader, frames, 100));
+	ASSERT_UINT_EQ(36, reader.n_lost);
+	ASSERT_UINT_EQ(36, frames[0].cf.data[0]);
+	ASSERT_UINT_EQ(99, frames[63].cf.data[0]);
+
+	frame_ring_reader_close(&reader);
+	frame_ring_cleanup();
+	return 0;
+}
+
+static int test_readers_are_independent()
+{
+	ASSERT_INT_EQ(0, frame_ring_init(iface, 64));
+
+	struct frame_ring_reader a, b;
+	ASSERT_INT_EQ(0, frame_ring_reader_open(&a, iface));
+	ASSERT_INT_EQ(0, frame_ring_reader_open(&b, iface));
+
+	struct can_frame cf;
+	for (unsigned int i = 0; i < 10; ++i) {
+		make_frame(&cf, i);
+		frame_ring_write(&cf, 0);
+	}
+
+	struct frame_ring_frame frames[10];
+	ASSERT_UINT_EQ(10, frame_ring_read(&a, frames, 10));
+	ASSERT_UINT_EQ(4, frame_ring_read(&b, frames, 4));
+	ASSERT_UINT_EQ(6, frame_ring_read(&b, frames, 10));
+	ASSERT_UINT_EQ(4, frames[0].cf.data[0]);
+
+	frame_ring_reader_close(&a);
+	frame_ring_reader_close(&b);
+	frame_ring_cleanup();
+	return 0;
+}
+
+static int test_not_initialised()
+{
+	struct frame_ring_reader reader;
+	ASSERT_INT_EQ(-1, frame_ring_reader_open(&reader, iface));
+
+	/* Writes are ignored */
+	struct can_frame cf;
+	make_frame(&cf, 0);
+	frame_ring_write(&cf, 0);
+
+	return 0;
+}
+
+#define N_WRITERS 4
+#define N_FRAMES_PER_WRITER 100000
+
+static void* write_frames(void* ptr)
+{
+	unsigned int id = (uintptr_t)ptr;
+	struct can_frame cf;
+
+	for (unsigned int i = 0; i < N_FRAMES_PER_WRITER; ++i) {
+		make_frame(&cf, i);
+		cf.can_id = id;
+		frame_ring_write(&cf, 0);
+	}
+
+	return NULL;
+}
+
+static int test_concurrent_writers()
+{
+	pthread_t writers[N_WRITERS];
+
+	ASSERT_INT_EQ(0, frame_ring_init(iface, 1024));
+
+	struct frame_ring_reader reader;
+	ASSERT_INT_EQ(0, frame_ring_reader_open(&reader, iface));
+
+	for (uintptr_t i = 0; i < N_WRITERS; ++i)
+		pthread_create(&writers[i], NULL, write_frames, (void*)i);
+
+	uint64_t n_read = 0;
+	uint64_t total = N_WRITERS * N_FRAMES_PER_WRITER;
+
+	while (n_read + reader.n_lost < total) {
+		struct frame_ring_frame frames[64];
+		size_t n = frame_ring_read(&reader, frames, 64);
+
+		/* Frames are never torn */
+		for (size_t i = 0; i < n; ++i) {
+			ASSERT_TRUE(frames[i].cf.can_id < N_WRITERS);
+			for (int k = 1; k < 8; ++k)
+				ASSERT_UINT_EQ(frames[i].cf.data[0],
+					       frames[i].cf.data[k]);
+		}
+
+		n_read += n;
+	}
+
+	ASSERT_TRUE(n_read + reader.n_lost == total);
+
+	for (int i = 0; i < N_WRITERS; ++i)
+		pthread_join(writers[i], NULL);
+
+	frame_ring_reader_close(&reader);
+	frame_ring_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	snprintf(iface, sizeof(iface), "unit-test-%d", (int)getpid());
+
+	RUN_TEST(test_read_batch);
+	RUN_TEST(test_overrun);
+	RUN_TEST(test_readers_are_independent);
+	RUN_TEST(test_not_initialised);
+	RUN_TEST(test_concurrent_writers);
+	return r;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include "tst.h"
+#include "canopen/node-manifest.h"
+
+static FILE* open_text(char* text)
+{
+	return fmemopen(text, strlen(text), "r");
+}
+
+static int test_parse()
+{
+	char text[] =
+		"# Expected nodes\n"
+		"\n"
+		"5\n"
+		"  6 0x1234   # vendor only\n"
+		"127 0x1234 0x55 2\r\n";
+
+	ASSERT_FALSE(node_manifest_is_loaded());
+
+	FILE* input = open_text(text);
+	ASSERT_INT_EQ(0, node_manifest_parse(input));
+	fclose(input);
+
+	ASSERT_TRUE(node_manifest_is_loaded());
+	ASSERT_FALSE(node_manifest_is_expected(1));
+	ASSERT_TRUE(node_manifest_is_expected(5));
+	ASSERT_TRUE(node_manifest_is_expected(6));
+	ASSERT_TRUE(node_manifest_is_expected(127));
+	ASSERT_FALSE(node_manifest_is_expected(128));
+
+	char expected[NODE_MANIFEST_NODES];
+	node_manifest_get_expected(expected);
+	ASSERT_INT_EQ(0, expected[4]);
+	ASSERT_INT_EQ(1, expected[5]);
+	ASSERT_INT_EQ(1, expected[127]);
+
+	node_manifest_cleanup();
+	ASSERT_FALSE(node_manifest_is_loaded());
+	ASSERT_FALSE(node_manifest_is_expected(5));
+
+	return 0;
+}
+
+static int test_syntax_error()
+{
+	char* bad[] = {
+		"0\n",
+		"128\n",
+		"five\n",
+		"5 0x1234 1 2 3\n",
+		"5 0x1234x\n",
+		"5 0x100000000\n",
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		char text[64];
+		strcpy(text, bad[i]);
+
+		FILE* input = open_text(text);
+		ASSERT_INT_EQ(-1, node_manifest_parse(input));
+		fclose(input);
+
+		ASSERT_FALSE(node_manifest_is_loaded());
+		ASSERT_FALSE(node_manifest_is_expected(5));
+	}
+
+	return 0;
+}
+
+static int test_identity()
+{
+	char text[] = "5\n6 0x1234\n7 0x1234 0x55 2\n";
+
+	FILE* input = open_text(text);
+	ASSERT_INT_EQ(0, node_manifest_parse(input));
+	fclose(input);
+
+	ASSERT_INT_EQ(NODE_MANIFEST_UNKNOWN, node_manifest_get_state(5));
+
+	ASSERT_INT_EQ(0, node_manifest_check_identity(5, 1, 2, 3));
+	ASSERT_INT_EQ(NODE_MANIFEST_PRESENT, node_manifest_get_state(5));
+
+	ASSERT_INT_EQ(0, node_manifest_check_identity(6, 0x1234, 2, 3));
+	ASSERT_INT_EQ(-1, node_manifest_check_identity(6, 0x4321, 2, 3));
+	ASSERT_INT_EQ(NODE_MANIFEST_MISMATCH, node_manifest_get_state(6));
+
+	ASSERT_INT_EQ(0, node_manifest_check_identity(7, 0x1234, 0x55, 2));
+	ASSERT_INT_EQ(-1, node_manifest_check_identity(7, 0x1234, 0x55, 3));
+
+	/* Nodes that are not in the manifest are not checked */
+	ASSERT_INT_EQ(0, node_manifest_check_identity(8, 1, 2, 3));
+	ASSERT_INT_EQ(NODE_MANIFEST_UNKNOWN, node_manifest_get_state(8));
+
+	node_manifest_set_present(7, 0);
+	ASSERT_INT_EQ(NODE_MANIFEST_MISSING, node_manifest_get_state(7));
+	node_manifest_set_present(8, 1);
+	ASSERT_INT_EQ(NODE_MANIFEST_UNKNOWN, node_manifest_get_state(8));
+
+	node_manifest_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parse);
+	RUN_TEST(test_syntax_error);
+	RUN_TEST(test_identity);
+	return r;
+}
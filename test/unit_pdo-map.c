@@ -0,0 +1,191 @@
+#include <string.h>
+#include "tst.h"
+#include "canopen/pdo-map.h"
+
+#define MAPPING(index, subindex, length) \
+	((uint32_t)(index) << 16 | (subindex) << 8 | (length))
+
+static int test_layout()
+{
+	struct pdo_map map;
+	pdo_map_init(&map);
+
+	ASSERT_INT_EQ(0, pdo_map_add(&map, MAPPING(0x6000, 1, 8),
+				     CANOPEN_UNSIGNED8));
+	ASSERT_INT_EQ(0, pdo_map_add(&map, MAPPING(0x0005, 0, 8),
+				     CANOPEN_UNKNOWN));
+	ASSERT_INT_EQ(0, pdo_map_add(&map, MAPPING(0x6064, 0, 32),
+				     CANOPEN_INTEGER32));
+
+	ASSERT_UINT_EQ(2, map.n_entries);
+	ASSERT_UINT_EQ(48, map.length);
+	ASSERT_UINT_EQ(6, pdo_map_size(&map));
+	ASSERT_UINT_EQ(16, map.entries[1].offset);
+	ASSERT_TRUE(pdo_map_find(&map, 0x6064, 0) == &map.entries[1]);
+	ASSERT_PTR_EQ(NULL, pdo_map_find(&map, 0x0005, 0));
+
+	return 0;
+}
+
+static int test_invalid()
+{
+	struct pdo_map map;
+	pdo_map_init(&map);
+
+	ASSERT_INT_EQ(-1, pdo_map_add(&map, MAPPING(0x6000, 1, 0),
+				      CANOPEN_UNSIGNED8));
+	ASSERT_INT_EQ(-1, pdo_map_add(&map, MAPPING(0x6000, 1, 16),
+				      CANOPEN_REAL32));
+	ASSERT_INT_EQ(0, pdo_map_add(&map, MAPPING(0x6000, 1, 60),
+				     CANOPEN_UNKNOWN));
+	ASSERT_INT_EQ(-1, pdo_map_add(&map, MAPPING(0x6000, 2, 8),
+				      CANOPEN_UNSIGNED8));
+	ASSERT_UINT_EQ(1, map.n_entries);
+
+	return 0;
+}
+
+static int test_decode()
+{
+	struct pdo_map map;
+	struct co_pdo_signal signals[PDO_MAP_ENTRIES_MAX];
+	pdo_map_init(&map);
+
+	pdo_map_add(&map, MAPPING(0x6041, 0, 16), CANOPEN_UNSIGNED16);
+	pdo_map_add(&map, MAPPING(0x2000, 1, 1), CANOPEN_BOOLEAN);
+	pdo_map_add(&map, MAPPING(0x2000, 2, 1), CANOPEN_BOOLEAN);
+	pdo_map_add(&map, MAPPING(0x2001, 0, 6), CANOPEN_INTEGER8);
+	pdo_map_add(&map, MAPPING(0x6064, 0, 32), CANOPEN_INTEGER32);
+
+	const unsigned char data[] = {
+		0x37, 0x12, /* 0x1237 */
+		0xc2, /* 0, 1, -16 */
+		0xfe, 0xff, 0xff, 0xff, /* -2 */
+	};
+
+	ASSERT_INT_EQ(-1, pdo_map_decode(&map, signals, data, 6));
+	ASSERT_INT_EQ(5, pdo_map_decode(&map, signals, data, sizeof(data)));
+
+	ASSERT_INT_EQ(0x6041, signals[0].index);
+	ASSERT_INT_EQ(CO_PDO_SIGNAL_UNSIGNED, signals[0].type);
+	ASSERT_UINT_EQ(0x1237, signals[0].value.u);
+	ASSERT_UINT_EQ(0, signals[1].value.u);
+	ASSERT_UINT_EQ(1, signals[2].value.u);
+	ASSERT_INT_EQ(CO_PDO_SIGNAL_SIGNED, signals[3].type);
+	ASSERT_INT_EQ(-16, signals[3].value.i);
+	ASSERT_INT_EQ(-2, signals[4].value.i);
+
+	return 0;
+}
+
+static int test_real()
+{
+	struct pdo_map map;
+	struct co_pdo_signal signals[PDO_MAP_ENTRIES_MAX];
+	unsigned char data[8];
+	float value = 0;
+	pdo_map_init(&map);
+
+	pdo_map_add(&map, MAPPING(0x2100, 0, 32), CANOPEN_REAL32);
+	pdo_map_add(&map, MAPPING(0x2101, 0, 16), CANOPEN_INTEGER16);
+
+	signals[0].value.real = 1.5;
+	signals[1].value.i = -300;
+	ASSERT_UINT_EQ(6, pdo_map_encode(&map, data, signals));
+
+	ASSERT_INT_EQ(0, pdo_map_bind(&map, 0x2100, 0, &value, sizeof(value)));
+
+	memset(signals, 0, sizeof(signals));
+	ASSERT_INT_EQ(2, pdo_map_decode(&map, signals, data, 6));
+	ASSERT_TRUE(signals[0].value.real == 1.5);
+	ASSERT_INT_EQ(-300, signals[1].value.i);
+	ASSERT_TRUE(value == 1.5f);
+
+	return 0;
+}
+
+static int test_bindings()
+{
+	struct pdo_map map;
+	struct co_pdo_signal signals[PDO_MAP_ENTRIES_MAX];
+	unsigned char data[8];
+	pdo_map_init(&map);
+
+	struct {
+		uint16_t control;
+		int32_t target;
+		uint8_t mode;
+	} out = { 0x000f, -1000, 3 }, in;
+
+	pdo_map_add(&map, MAPPING(0x6040, 0, 16), CANOPEN_UNSIGNED16);
+	pdo_map_add(&map, MAPPING(0x607a, 0, 32), CANOPEN_INTEGER32);
+	pdo_map_add(&map, MAPPING(0x6060, 0, 8), CANOPEN_INTEGER8);
+
+	ASSERT_INT_EQ(-1, pdo_map_bind(&map, 0x6041, 0, &out.control, 2));
+	ASSERT_INT_EQ(-1, pdo_map_bind(&map, 0x6040, 0, &out.control, 3));
+	ASSERT_INT_EQ(0, pdo_map_bind(&map, 0x6040, 0, &out.control, 2));
+	ASSERT_INT_EQ(0, pdo_map_bind(&map, 0x607a, 0, &out.target, 4));
+	ASSERT_INT_EQ(0, pdo_map_bind(&map, 0x6060, 0, &out.mode, 1));
+
+	ASSERT_UINT_EQ(7, pdo_map_encode(&map, data, NULL));
+	ASSERT_UINT_EQ(0x0f, data[0]);
+	ASSERT_UINT_EQ(0x00, data[1]);
+	ASSERT_UINT_EQ(0x18, data[2]);
+	ASSERT_UINT_EQ(0xfc, data[3]);
+	ASSERT_UINT_EQ(0xff, data[5]);
+	ASSERT_UINT_EQ(3, data[6]);
+
+	pdo_map_bind(&map, 0x6040, 0, &in.control, 2);
+	pdo_map_bind(&map, 0x607a, 0, &in.target, 4);
+	pdo_map_bind(&map, 0x6060, 0, &in.mode, 1);
+
+	memset(&in, 0, sizeof(in));
+	ASSERT_INT_EQ(3, pdo_map_decode(&map, signals, data, 7));
+	ASSERT_UINT_EQ(0x000f, in.control);
+	ASSERT_INT_EQ(-1000, in.target);
+	ASSERT_UINT_EQ(3, in.mode);
+
+	return 0;
+}
+
+static int test_differs()
+{
+	struct pdo_map map;
+	pdo_map_init(&map);
+
+	pdo_map_add(&map, MAPPING(0x6041, 0, 16), CANOPEN_UNSIGNED16);
+	pdo_map_add(&map, 0x00050008, CANOPEN_UNKNOWN); /* dummy */
+	pdo_map_add(&map, MAPPING(0x2001, 0, 16), CANOPEN_INTEGER16);
+
+	const unsigned char a[] = { 0x10, 0x00, 0xaa, 0xfe, 0xff }; /* -2 */
+	const unsigned char b[] = { 0x10, 0x00, 0xbb, 0x01, 0x00 }; /* 1 */
+	const unsigned char c[] = { 0x13, 0x00, 0xaa, 0xfe, 0xff };
+
+	/* Dummy entries are ignored */
+	unsigned char d[sizeof(a)];
+	memcpy(d, a, sizeof(a));
+	d[2] = 0;
+	ASSERT_INT_EQ(0, pdo_map_differs(&map, a, d, sizeof(a), 0.0));
+
+	ASSERT_INT_EQ(1, pdo_map_differs(&map, a, b, sizeof(a), 0.0));
+	ASSERT_INT_EQ(1, pdo_map_differs(&map, a, b, sizeof(a), 2.9));
+	ASSERT_INT_EQ(0, pdo_map_differs(&map, a, b, sizeof(a), 3.0));
+	ASSERT_INT_EQ(0, pdo_map_differs(&map, a, c, sizeof(a), 3.0));
+	ASSERT_INT_EQ(1, pdo_map_differs(&map, c, a, sizeof(a), 2.0));
+
+	ASSERT_INT_EQ(-1, pdo_map_differs(&map, a, b, 4, 0.0));
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_layout);
+	RUN_TEST(test_invalid);
+	RUN_TEST(test_decode);
+	RUN_TEST(test_real);
+	RUN_TEST(test_bindings);
+	RUN_TEST(test_differs);
+	return r;
+}
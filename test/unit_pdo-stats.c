@@ -0,0 +1,155 @@
+#include <string.h>
+#include <linux/can.h>
+#include "tst.h"
+#include "canopen.h"
+#include "canopen/pdo-stats.h"
+
+static int test_learned_period()
+{
+	struct pdo_stats stats;
+	uint64_t t = 1000000;
+
+	pdo_stats_add(1, 1, t);
+	ASSERT_INT_EQ(0, pdo_stats_get(1, 1, &stats));
+	ASSERT_UINT_EQ(1, stats.n_frames);
+	ASSERT_UINT_EQ(0, stats.interval);
+
+	for (int i = 0; i < PDO_STATS_LEARN_FRAMES; ++i)
+		pdo_stats_add(1, 1, t += 10000);
+
+	pdo_stats_get(1, 1, &stats);
+	ASSERT_UINT_EQ(10000, stats.interval);
+	ASSERT_UINT_EQ(0, stats.n_timed);
+
+	/* From now on the average is the expected period */
+	pdo_stats_add(1, 1, t += 10400);
+	pdo_stats_add(1, 1, t += 9800);
+
+	pdo_stats_get(1, 1, &stats);
+	ASSERT_UINT_EQ(2, stats.n_timed);
+	ASSERT_INT_EQ(-250, stats.jitter_min); /* The average is now 10050 */
+	ASSERT_INT_EQ(400, stats.jitter_max);
+	ASSERT_UINT_EQ(t, stats.last_seen);
+	ASSERT_UINT_EQ(0, stats.n_gaps);
+
+	/* A missing frame is a gap */
+	pdo_stats_add(1, 1, t += 20000);
+
+	pdo_stats_get(1, 1, &stats);
+	ASSERT_UINT_EQ(1, stats.n_gaps);
+	ASSERT_UINT_EQ(20000, stats.gap_max);
+	ASSERT_INT_EQ(400, stats.jitter_max);
+	ASSERT_TRUE(stats.interval < 10100);
+
+	return 0;
+}
+
+static int test_relearn_period()
+{
+	struct pdo_stats stats;
+	uint64_t t = 1000000;
+
+	pdo_stats_add(4, 1, t);
+	for (int i = 0; i < PDO_STATS_LEARN_FRAMES; ++i)
+		pdo_stats_add(4, 1, t += 10000);
+
+	/* The node slows down for good */
+	for (int i = 0; i < PDO_STATS_RELEARN_GAPS - 1; ++i)
+		pdo_stats_add(4, 1, t += 30000);
+
+	pdo_stats_get(4, 1, &stats);
+	ASSERT_UINT_EQ(PDO_STATS_RELEARN_GAPS - 1, stats.n_gaps);
+	ASSERT_UINT_EQ(10000, stats.interval);
+	ASSERT_UINT_EQ(0, stats.n_relearned);
+
+	pdo_stats_add(4, 1, t += 30000);
+
+	pdo_stats_get(4, 1, &stats);
+	ASSERT_UINT_EQ(1, stats.n_relearned);
+	ASSERT_UINT_EQ(30000, stats.interval);
+
+	for (int i = 0; i < 2 * PDO_STATS_LEARN_FRAMES; ++i)
+		pdo_stats_add(4, 1, t += 30000);
+
+	pdo_stats_get(4, 1, &stats);
+	ASSERT_UINT_EQ(PDO_STATS_RELEARN_GAPS, stats.n_gaps);
+	ASSERT_UINT_EQ(30000, stats.interval);
+	ASSERT_UINT_EQ(PDO_STATS_LEARN_FRAMES + 1, stats.n_timed);
+	ASSERT_INT_EQ(0, stats.jitter_max);
+
+	/* A period set by a driver is never relearned */
+	ASSERT_INT_EQ(0, pdo_stats_set_expected_period(4, 1, 10000));
+	for (int i = 0; i < 2 * PDO_STATS_RELEARN_GAPS; ++i)
+		pdo_stats_add(4, 1, t += 30000);
+
+	pdo_stats_get(4, 1, &stats);
+	ASSERT_UINT_EQ(1, stats.n_relearned);
+	ASSERT_UINT_EQ(3 * PDO_STATS_RELEARN_GAPS, stats.n_gaps);
+
+	return 0;
+}
+
+static int test_expected_period()
+{
+	struct pdo_stats stats;
+	uint64_t t = 1000000;
+
+	ASSERT_INT_EQ(0, pdo_stats_set_expected_period(2, 3, 5000));
+	ASSERT_INT_EQ(-1, pdo_stats_set_expected_period(2, 5, 5000));
+	ASSERT_INT_EQ(-1, pdo_stats_set_expected_period(128, 1, 5000));
+
+	pdo_stats_add(2, 3, t);
+	pdo_stats_add(2, 3, t += 5000);
+	pdo_stats_add(2, 3, t += 7000);
+	pdo_stats_add(2, 3, t += 8000);
+
+	pdo_stats_get(2, 3, &stats);
+	ASSERT_UINT_EQ(4, stats.n_frames);
+	ASSERT_UINT_EQ(2, stats.n_timed);
+	ASSERT_INT_EQ(0, stats.jitter_min);
+	ASSERT_INT_EQ(2000, stats.jitter_max);
+	ASSERT_UINT_EQ(1, stats.n_gaps);
+	ASSERT_UINT_EQ(8000, stats.gap_max);
+
+	return 0;
+}
+
+static int test_feed()
+{
+	struct can_frame cf;
+	memset(&cf, 0, sizeof(cf));
+
+	struct pdo_stats stats;
+
+	cf.can_id = R_TPDO4 + 127;
+	pdo_stats_feed(&cf);
+	pdo_stats_get(127, 4, &stats);
+	ASSERT_UINT_EQ(1, stats.n_frames);
+
+	/* Not TPDOs */
+	cf.can_id = R_RPDO1 + 127;
+	pdo_stats_feed(&cf);
+	cf.can_id = R_TSDO + 127;
+	pdo_stats_feed(&cf);
+	cf.can_id = R_TPDO1;
+	pdo_stats_feed(&cf);
+	cf.can_id = (R_TPDO1 + 3) | CAN_RTR_FLAG;
+	pdo_stats_feed(&cf);
+
+	pdo_stats_get(127, 1, &stats);
+	ASSERT_UINT_EQ(0, stats.n_frames);
+	pdo_stats_get(3, 1, &stats);
+	ASSERT_UINT_EQ(0, stats.n_frames);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_learned_period);
+	RUN_TEST(test_relearn_period);
+	RUN_TEST(test_expected_period);
+	RUN_TEST(test_feed);
+	return r;
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tst.h"
+#include "canopen/process-image.h"
+
+static char iface[64];
+
+static int test_node()
+{
+	ASSERT_INT_EQ(0, process_image_init(iface));
+
+	const struct process_image* image = process_image_open(iface);
+	ASSERT_TRUE(image != NULL);
+
+	struct process_image_identity identity = {
+		.device_type = 0x20192,
+		.vendor_id = 0x42,
+		.name = "MyNode",
+	};
+
+	process_image_set_active(5, 1, &identity);
+	process_image_set_state(5, 5);
+	process_image_set_error_register(5, 0x81);
+	process_image_set_state(200, 5);
+
+	struct process_image_node node;
+	ASSERT_INT_EQ(0, process_image_read_node(image, 5, &node));
+	ASSERT_UINT_EQ(1, node.is_active);
+	ASSERT_UINT_EQ(5, node.state);
+	ASSERT_UINT_EQ(0x81, node.error_register);
+	ASSERT_TRUE(node.last_seen != 0);
+	ASSERT_UINT_EQ(0x20192, node.identity.device_type);
+	ASSERT_STR_EQ("MyNode", node.identity.name);
+	ASSERT_TRUE((node.seq & 1) == 0);
+
+	process_image_set_active(5, 0, NULL);
+	ASSERT_INT_EQ(0, process_image_read_node(image, 5, &node));
+	ASSERT_UINT_EQ(0, node.is_active);
+	ASSERT_STR_EQ("MyNode", node.identity.name);
+
+	ASSERT_INT_EQ(-1, process_image_read_node(image, 0, &node));
+	ASSERT_INT_EQ(-1, process_image_read_node(image, 128, &node));
+
+	process_image_close(image);
+	process_image_cleanup();
+	return 0;
+}
+
+static int test_tpdo()
+{
+	ASSERT_INT_EQ(0, process_image_init(iface));
+
+	const struct process_image* image = process_image_open(iface);
+	ASSERT_TRUE(image != NULL);
+
+	const unsigned char data[] = { 1, 2, 3, 4 };
+	struct co_pdo_signal signals[] = {
+		{ .index = 0x6041, .subindex = 0,
+		  .type = CO_PDO_SIGNAL_UNSIGNED, .value.u = 0x201 },
+		{ .index = 0x2000, .subindex = 1,
+		  .type = CO_PDO_SIGNAL_SIGNED, .value.i = -1 },
+	};
+
+	process_image_set_tpdo(7, 2, data, sizeof(data), NULL, 0);
+	process_image_set_tpdo(7, 2, data, sizeof(data), signals, 2);
+	process_image_set_tpdo(7, 5, data, sizeof(data), NULL, 0);
+
+	struct process_image_pdo tpdo;
+	ASSERT_INT_EQ(0, process_image_read_tpdo(image, 7, 2, &tpdo));
+	ASSERT_UINT_EQ(2, tpdo.count);
+	ASSERT_UINT_EQ(4, tpdo.size);
+	ASSERT_INT_EQ(0, memcmp(data, tpdo.data, sizeof(data)));
+	ASSERT_UINT_EQ(2, tpdo.n_signals);
+	ASSERT_UINT_EQ(0x6041, tpdo.signals[0].index);
+	ASSERT_UINT_EQ(0x201, tpdo.signals[0].value.u);
+	ASSERT_UINT_EQ(CO_PDO_SIGNAL_SIGNED, tpdo.signals[1].type);
+	ASSERT_INT_EQ(-1, tpdo.signals[1].value.i);
+
+	ASSERT_INT_EQ(0, process_image_read_tpdo(image, 7, 1, &tpdo));
+	ASSERT_UINT_EQ(0, tpdo.count);
+	ASSERT_INT_EQ(-1, process_image_read_tpdo(image, 7, 5, &tpdo));
+
+	process_image_close(image);
+	process_image_cleanup();
+	return 0;
+}
+
+static int test_not_initialised()
+{
+	ASSERT_TRUE(process_image_open(iface) == NULL);
+
+	/* Writes are ignored */
+	process_image_set_state(1, 5);
+	process_image_set_tpdo(1, 1, "", 0, NULL, 0);
+
+	return 0;
+}
+
+static int test_write_never_finished()
+{
+	struct process_image* image = calloc(1, sizeof(*image));
+	ASSERT_TRUE(image != NULL);
+
+	/* As if the master had died in the middle of writing */
+	image->nodes[5].seq = 1;
+	image->tpdos[5][0].seq = 1;
+
+	struct process_image_node node;
+	errno = 0;
+	ASSERT_INT_EQ(-1, process_image_read_node(image, 5, &node));
+	ASSERT_INT_EQ(EAGAIN, errno);
+	ASSERT_INT_EQ(0, process_image_read_node(image, 6, &node));
+
+	struct process_image_pdo tpdo;
+	errno = 0;
+	ASSERT_INT_EQ(-1, process_image_read_tpdo(image, 5, 1, &tpdo));
+	ASSERT_INT_EQ(EAGAIN, errno);
+	ASSERT_INT_EQ(0, process_image_read_tpdo(image, 5, 2, &tpdo));
+
+	free(image);
+	return 0;
+}
+
+static volatile int is_writing;
+
+static void* write_tpdos(void* ptr)
+{
+	(void)ptr;
+	unsigned char data[8];
+
+	for (unsigned int i = 0; is_writing; ++i) {
+		memset(data, i, sizeof(data));
+		process_image_set_tpdo(1, 1, data, sizeof(data), NULL, 0);
+	}
+
+	return NULL;
+}
+
+static int test_consistent_reads()
+{
+	pthread_t writer;
+
+	ASSERT_INT_EQ(0, process_image_init(iface));
+
+	const struct process_image* image = process_image_open(iface);
+	ASSERT_TRUE(image != NULL);
+
+	is_writing = 1;
+	pthread_create(&writer, NULL, write_tpdos, NULL);
+
+	for (int i = 0; i < 100000; ++i) {
+		struct process_image_pdo tpdo;
+		ASSERT_INT_EQ(0, process_image_read_tpdo(image, 1, 1, &tpdo));
+
+		for (size_t k = 1; k < tpdo.size; ++k)
+			ASSERT_UINT_EQ(tpdo.data[0], tpdo.data[k]);
+	}
+
+	is_writing = 0;
+	pthread_join(writer, NULL);
+
+	process_image_close(image);
+	process_image_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	snprintf(iface, sizeof(iface), "unit-test-%d", (int)getpid());
+
+	RUN_TEST(test_node);
+	RUN_TEST(test_tpdo);
+	RUN_TEST(test_not_initialised);
+	RUN_TEST(test_write_never_finished);
+	RUN_TEST(test_consistent_reads);
+	return r;
+}
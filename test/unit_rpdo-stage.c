@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mloop.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen.h"
+#include "canopen/master.h"
+#include "canopen/pdo-map.h"
+#include "canopen/rpdo-stage.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_is_started, const struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_type, struct mloop_timer*,
+	       enum mloop_timer_type);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+FAKE_VALUE_FUNC(int, co__rpdox, int, int, const void*, size_t);
+FAKE_VALUE_FUNC(int, sync_cycle_is_running);
+FAKE_VALUE_FUNC(int, sync_cycle_queue_rpdo, int, int, const void*, size_t);
+
+#define MAPPING(index, subindex, length) \
+	((uint32_t)(index) << 16 | (subindex) << 8 | (length))
+
+static int dummy_timer;
+static void* timer_context;
+static mloop_free_fn timer_free_fn;
+static mloop_timer_fn timeout_fn;
+static int is_timer_started;
+
+static unsigned char sent_data[8];
+static size_t sent_size;
+
+static void set_context(struct mloop_timer* timer, void* context,
+			mloop_free_fn fn)
+{
+	(void)timer;
+	timer_context = context;
+	timer_free_fn = fn;
+}
+
+static void set_callback(struct mloop_timer* timer, mloop_timer_fn fn)
+{
+	(void)timer;
+	timeout_fn = fn;
+}
+
+static void* get_context(const struct mloop_timer* timer)
+{
+	(void)timer;
+	return timer_context;
+}
+
+static int start_timer(struct mloop_timer* timer)
+{
+	(void)timer;
+	is_timer_started = 1;
+	return 0;
+}
+
+static int stop_timer(struct mloop_timer* timer)
+{
+	(void)timer;
+	is_timer_started = 0;
+	return 0;
+}
+
+static int is_started(const struct mloop_timer* timer)
+{
+	(void)timer;
+	return is_timer_started;
+}
+
+/* The event loop would free the context along with the timer */
+static int unref_timer(struct mloop_timer* timer)
+{
+	(void)timer;
+	timer_free_fn(timer_context);
+	return 0;
+}
+
+static int send_rpdo(int nodeid, int type, const void* data, size_t size)
+{
+	(void)nodeid;
+	(void)type;
+	memcpy(sent_data, data, size);
+	sent_size = size;
+	return 0;
+}
+
+static void init()
+{
+	RESET_FAKE(mloop_timer_start);
+	RESET_FAKE(mloop_timer_stop);
+	RESET_FAKE(mloop_timer_set_time);
+	RESET_FAKE(co__rpdox);
+	RESET_FAKE(sync_cycle_is_running);
+	RESET_FAKE(sync_cycle_queue_rpdo);
+
+	mloop_timer_new_fake.return_val = (struct mloop_timer*)&dummy_timer;
+	mloop_timer_set_context_fake.custom_fake = set_context;
+	mloop_timer_set_callback_fake.custom_fake = set_callback;
+	mloop_timer_get_context_fake.custom_fake = get_context;
+	mloop_timer_start_fake.custom_fake = start_timer;
+	mloop_timer_stop_fake.custom_fake = stop_timer;
+	mloop_timer_is_started_fake.custom_fake = is_started;
+	mloop_timer_unref_fake.custom_fake = unref_timer;
+	co__rpdox_fake.custom_fake = send_rpdo;
+
+	is_timer_started = 0;
+	sent_size = 0;
+}
+
+static int test_immediate()
+{
+	init();
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 2, NULL);
+	ASSERT_TRUE(stage != NULL);
+	ASSERT_TRUE(rpdo_stage_new(5, 5, NULL) == NULL);
+
+	const char data[] = { 1, 2, 3 };
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, data, sizeof(data)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, data, sizeof(data)));
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+	ASSERT_INT_EQ(5, co__rpdox_fake.arg0_val);
+	ASSERT_INT_EQ(R_RPDO2, co__rpdox_fake.arg1_val);
+	ASSERT_UINT_EQ(3, sent_size);
+
+	char too_long[9] = { 0 };
+	ASSERT_INT_EQ(-1, rpdo_stage_write(stage, too_long, sizeof(too_long)));
+
+	/* Nothing is left to flush */
+	ASSERT_INT_EQ(0, rpdo_stage_flush(stage));
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+static int test_inhibit_time()
+{
+	init();
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 1, NULL);
+	rpdo_stage_set_inhibit_time(stage, 1000);
+
+	const char a[] = { 1 }, b[] = { 2 }, c[] = { 3, 3 };
+
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	/* Held back until the inhibit time has passed */
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, b, sizeof(b)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, c, sizeof(c)));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+	ASSERT_TRUE(mloop_timer_set_time_fake.arg1_val > 990000000ULL);
+	ASSERT_TRUE(mloop_timer_set_time_fake.arg1_val <= 1000000000ULL);
+
+	/* Only the latest value goes out */
+	timeout_fn((struct mloop_timer*)&dummy_timer);
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+	ASSERT_UINT_EQ(2, sent_size);
+	ASSERT_UINT_EQ(3, sent_data[0]);
+	ASSERT_FALSE(is_timer_started);
+
+	/* A value that was flushed is not sent again by the timer */
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(0, rpdo_stage_flush(stage));
+	ASSERT_INT_EQ(3, co__rpdox_fake.call_count);
+	ASSERT_FALSE(is_timer_started);
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+static int test_on_change()
+{
+	init();
+
+	struct pdo_map map;
+	pdo_map_init(&map);
+	pdo_map_add(&map, MAPPING(0x6071, 0, 16), CANOPEN_INTEGER16);
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 1, &map);
+	rpdo_stage_set_mode(stage, CO_RPDO_ON_CHANGE);
+	rpdo_stage_set_deadband(stage, 10.0);
+
+	const unsigned char a[] = { 100, 0 };
+	const unsigned char b[] = { 105, 0 };
+	const unsigned char c[] = { 111, 0 };
+
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, b, sizeof(b)));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, c, sizeof(c)));
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+	ASSERT_UINT_EQ(111, sent_data[0]);
+
+	/* Compared with what was sent, not with what was written */
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, b, sizeof(b)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(3, co__rpdox_fake.call_count);
+	ASSERT_UINT_EQ(100, sent_data[0]);
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+static int test_send_failure()
+{
+	init();
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 1, NULL);
+	rpdo_stage_set_mode(stage, CO_RPDO_ON_CHANGE);
+
+	const unsigned char a[] = { 1 };
+
+	co__rpdox_fake.custom_fake = NULL;
+	co__rpdox_fake.return_val = -1;
+	ASSERT_INT_EQ(-1, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	/* The value that failed has not been sent, so it is still a change */
+	co__rpdox_fake.custom_fake = send_rpdo;
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+	ASSERT_UINT_EQ(1, sent_data[0]);
+
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(2, co__rpdox_fake.call_count);
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+static int test_on_flush()
+{
+	init();
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 3, NULL);
+	rpdo_stage_set_mode(stage, CO_RPDO_ON_FLUSH);
+
+	const char a[] = { 1 }, b[] = { 2 };
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, b, sizeof(b)));
+	rpdo_stage_process_sync();
+	ASSERT_INT_EQ(0, co__rpdox_fake.call_count);
+
+	ASSERT_INT_EQ(0, rpdo_stage_flush(stage));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+	ASSERT_INT_EQ(R_RPDO3, co__rpdox_fake.arg1_val);
+	ASSERT_UINT_EQ(2, sent_data[0]);
+
+	ASSERT_INT_EQ(0, rpdo_stage_flush(stage));
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+static int test_on_sync()
+{
+	init();
+
+	struct rpdo_stage* stage = rpdo_stage_new(5, 4, NULL);
+	rpdo_stage_set_mode(stage, CO_RPDO_ON_SYNC);
+
+	const char a[] = { 1 }, b[] = { 2 };
+
+	/* Without a SYNC producer, staged values are sent on SYNC */
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, b, sizeof(b)));
+	ASSERT_INT_EQ(0, co__rpdox_fake.call_count);
+
+	rpdo_stage_process_sync();
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+	ASSERT_INT_EQ(R_RPDO4, co__rpdox_fake.arg1_val);
+	ASSERT_UINT_EQ(2, sent_data[0]);
+
+	rpdo_stage_process_sync();
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	/* With one, they are handed to it */
+	sync_cycle_is_running_fake.return_val = 1;
+	ASSERT_INT_EQ(0, rpdo_stage_write(stage, a, sizeof(a)));
+	ASSERT_INT_EQ(1, sync_cycle_queue_rpdo_fake.call_count);
+	ASSERT_INT_EQ(5, sync_cycle_queue_rpdo_fake.arg0_val);
+	ASSERT_INT_EQ(4, sync_cycle_queue_rpdo_fake.arg1_val);
+
+	rpdo_stage_process_sync();
+	ASSERT_INT_EQ(1, co__rpdox_fake.call_count);
+
+	sync_cycle_queue_rpdo_fake.return_val = -1;
+	ASSERT_INT_EQ(-1, rpdo_stage_write(stage, b, sizeof(b)));
+
+	rpdo_stage_free(stage);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_immediate);
+	RUN_TEST(test_inhibit_time);
+	RUN_TEST(test_on_change);
+	RUN_TEST(test_send_failure);
+	RUN_TEST(test_on_flush);
+	RUN_TEST(test_on_sync);
+	return r;
+}
@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <string.h>
+#include "tst.h"
+#include "canopen/sdo-cache.h"
+
+static int test_disabled()
+{
+	struct vector value = { 0 };
+	ASSERT_FALSE(sdo_cache_is_enabled());
+	ASSERT_UINT_EQ(0, sdo_cache_max_age(0x2000, EDS_OBJ_R));
+
+	sdo_cache_store(1, 0x2000, 0, "foo", 3, 1);
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(1, 0x2000, 0, 1000, &value, NULL));
+	return 0;
+}
+
+static int test_max_age()
+{
+	sdo_cache_init(500);
+	ASSERT_TRUE(sdo_cache_max_age(0x1018, EDS_OBJ_R) == SDO_CACHE_FOREVER);
+	ASSERT_TRUE(sdo_cache_max_age(0x2000, EDS_OBJ_CONST)
+		    == SDO_CACHE_FOREVER);
+	ASSERT_UINT_EQ(500, sdo_cache_max_age(0x2000, EDS_OBJ_R));
+	ASSERT_UINT_EQ(0, sdo_cache_max_age(0x2000, EDS_OBJ_W));
+	ASSERT_UINT_EQ(0, sdo_cache_max_age(0x1010, EDS_OBJ_R | EDS_OBJ_W));
+	sdo_cache_cleanup();
+	return 0;
+}
+
+static int test_store_lookup()
+{
+	struct vector value = { 0 };
+	int is_size_indicated = 0;
+
+	sdo_cache_init(500);
+
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(1, 0x2000, 1, 500, &value, NULL));
+
+	sdo_cache_store(1, 0x2000, 1, "foo", 3, 1);
+	sdo_cache_store(1, 0x2000, 2, "bar", 3, 0);
+
+	ASSERT_INT_EQ(0, sdo_cache_lookup(1, 0x2000, 1, 500, &value,
+					  &is_size_indicated));
+	ASSERT_UINT_EQ(3, value.index);
+	ASSERT_INT_EQ(0, memcmp("foo", value.data, 3));
+	ASSERT_TRUE(is_size_indicated);
+
+	ASSERT_INT_EQ(0, sdo_cache_lookup(1, 0x2000, 2, 500, &value,
+					  &is_size_indicated));
+	ASSERT_INT_EQ(0, memcmp("bar", value.data, 3));
+	ASSERT_FALSE(is_size_indicated);
+
+	/* Overwrite */
+	sdo_cache_store(1, 0x2000, 1, "quux", 4, 1);
+	ASSERT_INT_EQ(0, sdo_cache_lookup(1, 0x2000, 1, 500, &value, NULL));
+	ASSERT_UINT_EQ(4, value.index);
+	ASSERT_INT_EQ(0, memcmp("quux", value.data, 4));
+
+	/* Other nodes are unaffected */
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(2, 0x2000, 1, 500, &value, NULL));
+
+	vector_destroy(&value);
+	sdo_cache_cleanup();
+	return 0;
+}
+
+static int test_expiry()
+{
+	struct vector value = { 0 };
+
+	sdo_cache_init(10);
+
+	sdo_cache_store(1, 0x2000, 0, "foo", 3, 1);
+	sdo_cache_store(1, 0x1018, 1, "bar", 3, 1);
+	usleep(20000);
+
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(1, 0x2000, 0, 10, &value, NULL));
+	ASSERT_INT_EQ(0, sdo_cache_lookup(1, 0x1018, 1, SDO_CACHE_FOREVER,
+					  &value, NULL));
+
+	vector_destroy(&value);
+	sdo_cache_cleanup();
+	return 0;
+}
+
+static int test_commands_are_not_stored()
+{
+	struct vector value = { 0 };
+
+	sdo_cache_init(500);
+
+	sdo_cache_store(1, 0x1010, 1, "save", 4, 1);
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(1, 0x1010, 1, 500, &value, NULL));
+
+	sdo_cache_cleanup();
+	return 0;
+}
+
+static int test_invalidate_and_stats()
+{
+	struct vector value = { 0 };
+	struct sdo_cache_stats stats;
+
+	sdo_cache_init(500);
+
+	sdo_cache_store(1, 0x2000, 0, "foo", 3, 1);
+	sdo_cache_store(1, 0x2001, 0, "bar", 3, 1);
+	sdo_cache_lookup(1, 0x2000, 0, 500, &value, NULL);
+	sdo_cache_lookup(1, 0x2002, 0, 500, &value, NULL);
+
+	sdo_cache_get_stats(1, &stats);
+	ASSERT_UINT_EQ(1, stats.hits);
+	ASSERT_UINT_EQ(1, stats.misses);
+	ASSERT_UINT_EQ(2, stats.stores);
+	ASSERT_UINT_EQ(2, stats.entries);
+
+	sdo_cache_invalidate(1);
+	ASSERT_INT_EQ(-1, sdo_cache_lookup(1, 0x2000, 0, 500, &value, NULL));
+
+	sdo_cache_get_stats(1, &stats);
+	ASSERT_UINT_EQ(1, stats.invalidations);
+	ASSERT_UINT_EQ(0, stats.entries);
+
+	vector_destroy(&value);
+	sdo_cache_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_max_age);
+	RUN_TEST(test_store_lookup);
+	RUN_TEST(test_expiry);
+	RUN_TEST(test_commands_are_not_stored);
+	RUN_TEST(test_invalidate_and_stats);
+	return r;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen/sdo_req.h"
+#include "canopen/sdo-file.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(struct sdo_req*, sdo_req_new, struct sdo_req_info*);
+
+static char path[] = "/tmp/unit_sdo-file.XXXXXX";
+
+static void write_file(const char* data, size_t size)
+{
+	FILE* file = fopen(path, "w");
+	fwrite(data, 1, size, file);
+	fclose(file);
+}
+
+static size_t read_file(char* dst, size_t size)
+{
+	FILE* file = fopen(path, "r");
+	size_t rc = fread(dst, 1, size, file);
+	fclose(file);
+	return rc;
+}
+
+static int test_source()
+{
+	char buffer[8];
+
+	write_file("foobarbaz", 9);
+
+	struct sdo_file* file = sdo_file_open_source(path);
+	ASSERT_TRUE(file != NULL);
+	ASSERT_UINT_EQ(9, file->size);
+
+	ASSERT_INT_EQ(7, sdo_file_read(file, buffer, 7, 0));
+	ASSERT_INT_EQ(0, memcmp("foobarb", buffer, 7));
+
+	ASSERT_INT_EQ(2, sdo_file_read(file, buffer, 2, 7));
+	ASSERT_INT_EQ(0, memcmp("az", buffer, 2));
+
+	/* Reading past the end fails */
+	ASSERT_INT_EQ(-1, sdo_file_read(file, buffer, 3, 7));
+	ASSERT_INT_EQ(-1, sdo_file_read(file, buffer, 1, 10));
+
+	sdo_file_close(file);
+	return 0;
+}
+
+static int test_empty_source()
+{
+	write_file("", 0);
+	ASSERT_PTR_EQ(NULL, sdo_file_open_source(path));
+	return 0;
+}
+
+static int test_sink()
+{
+	char buffer[16];
+
+	struct sdo_file* file = sdo_file_open_sink(path);
+	ASSERT_TRUE(file != NULL);
+
+	ASSERT_INT_EQ(0, sdo_file_write(file, "foobarb", 7, 0));
+	ASSERT_INT_EQ(0, sdo_file_write(file, "az", 2, 7));
+	ASSERT_UINT_EQ(9, read_file(buffer, sizeof(buffer)));
+	ASSERT_INT_EQ(0, memcmp("foobarbaz", buffer, 9));
+
+	/* A restarted transfer replaces what was written before */
+	ASSERT_INT_EQ(0, sdo_file_write(file, "quux", 4, 0));
+	ASSERT_UINT_EQ(4, read_file(buffer, sizeof(buffer)));
+	ASSERT_INT_EQ(0, memcmp("quux", buffer, 4));
+
+	sdo_file_close(file);
+	return 0;
+}
+
+static int test_new_download()
+{
+	RESET_FAKE(sdo_req_new);
+	sdo_req_new_fake.return_val = (struct sdo_req*)0xdeadbeef;
+
+	write_file("foobarbaz", 9);
+
+	struct sdo_req_info info = {
+		.index = 0x1f50,
+		.subindex = 1,
+	};
+
+	ASSERT_PTR_EQ((void*)0xdeadbeef, sdo_file_new_download(&info, path));
+	ASSERT_INT_EQ(1, sdo_req_new_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_DOWNLOAD, info.type);
+	ASSERT_UINT_EQ(9, info.dl_size);
+	ASSERT_PTR_EQ(sdo_file_read, info.dl_source);
+	ASSERT_PTR_EQ(sdo_file_close, info.stream_free_fn);
+
+	info.stream_free_fn(info.stream_context);
+
+	/* The file is closed if the request cannot be created */
+	sdo_req_new_fake.return_val = NULL;
+	ASSERT_PTR_EQ(NULL, sdo_file_new_download(&info, path));
+
+	unlink(path);
+	ASSERT_PTR_EQ(NULL, sdo_file_new_download(&info, path));
+	ASSERT_INT_EQ(2, sdo_req_new_fake.call_count);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+
+	close(fd);
+
+	RUN_TEST(test_source);
+	RUN_TEST(test_empty_source);
+	RUN_TEST(test_sink);
+	RUN_TEST(test_new_download);
+
+	unlink(path);
+	return r;
+}
@@ -0,0 +1,116 @@
+#include "tst.h"
+
+#include "sdo-gateway.h"
+
+static int test_parse_read()
+{
+	struct sdo_gateway_cmd cmd;
+	char line[] = "[42] r 5 0x1017 0 u16";
+
+	ASSERT_INT_EQ(0, sdo_gateway__parse(&cmd, line));
+	ASSERT_UINT_EQ(42, cmd.seq);
+	ASSERT_INT_EQ(SDO_GATEWAY_READ, cmd.type);
+	ASSERT_INT_EQ(5, cmd.nodeid);
+	ASSERT_INT_EQ(0x1017, cmd.index);
+	ASSERT_INT_EQ(0, cmd.subindex);
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED16, cmd.datatype);
+	ASSERT_PTR_EQ(NULL, cmd.value);
+
+	return 0;
+}
+
+static int test_parse_write()
+{
+	struct sdo_gateway_cmd cmd;
+	char line[] = "  [7]  write 127 0x2000 3 i32   -1000 ";
+
+	ASSERT_INT_EQ(0, sdo_gateway__parse(&cmd, line));
+	ASSERT_UINT_EQ(7, cmd.seq);
+	ASSERT_INT_EQ(SDO_GATEWAY_WRITE, cmd.type);
+	ASSERT_INT_EQ(127, cmd.nodeid);
+	ASSERT_INT_EQ(0x2000, cmd.index);
+	ASSERT_INT_EQ(3, cmd.subindex);
+	ASSERT_INT_EQ(CANOPEN_INTEGER32, cmd.datatype);
+	ASSERT_STR_EQ("-1000", cmd.value);
+
+	return 0;
+}
+
+static int test_parse_string()
+{
+	struct sdo_gateway_cmd cmd;
+	char line[] = "[1] w 1 0x1008 0 VISIBLE_STRING \" two words \"";
+
+	ASSERT_INT_EQ(0, sdo_gateway__parse(&cmd, line));
+	ASSERT_INT_EQ(CANOPEN_VISIBLE_STRING, cmd.datatype);
+	ASSERT_STR_EQ(" two words ", cmd.value);
+
+	return 0;
+}
+
+static int test_parse_errors()
+{
+	struct sdo_gateway_cmd cmd;
+
+	char no_seq[] = "r 5 0x1017 0 u16";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, no_seq));
+
+	char no_type[] = "[1] r 5 0x1017 0";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, no_type));
+	ASSERT_UINT_EQ(1, cmd.seq);
+
+	char bad_cmd[] = "[2] x 5 0x1017 0 u16";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_NOT_SUPPORTED,
+		      sdo_gateway__parse(&cmd, bad_cmd));
+
+	char bad_node[] = "[3] r 128 0x1017 0 u16";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_UNSUPPORTED_NODE,
+		      sdo_gateway__parse(&cmd, bad_node));
+
+	char bad_index[] = "[4] r 5 0x10170 0 u16";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, bad_index));
+
+	char bad_datatype[] = "[5] r 5 0x1017 0 u17";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, bad_datatype));
+
+	char domain[] = "[6] r 5 0x1f50 1 d";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_NOT_SUPPORTED,
+		      sdo_gateway__parse(&cmd, domain));
+
+	char no_value[] = "[7] w 5 0x1017 0 u16";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, no_value));
+
+	char read_value[] = "[8] r 5 0x1017 0 u16 10";
+	ASSERT_INT_EQ(-SDO_GATEWAY_ERROR_SYNTAX,
+		      sdo_gateway__parse(&cmd, read_value));
+
+	return 0;
+}
+
+static int test_type_from_string()
+{
+	ASSERT_INT_EQ(CANOPEN_BOOLEAN, sdo_gateway__type_from_string("b"));
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED64, sdo_gateway__type_from_string("U64"));
+	ASSERT_INT_EQ(CANOPEN_REAL32, sdo_gateway__type_from_string("r32"));
+	ASSERT_INT_EQ(CANOPEN_OCTET_STRING, sdo_gateway__type_from_string("os"));
+	ASSERT_INT_EQ(CANOPEN_INTEGER8,
+		      sdo_gateway__type_from_string("integer8"));
+	ASSERT_INT_EQ(CANOPEN_UNKNOWN, sdo_gateway__type_from_string("x"));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parse_read);
+	RUN_TEST(test_parse_write);
+	RUN_TEST(test_parse_string);
+	RUN_TEST(test_parse_errors);
+	RUN_TEST(test_type_from_string);
+	return r;
+}
@@ -0,0 +1,142 @@
+#include <unistd.h>
+#include <mloop.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen/sdo-governor.h"
+
+DEFINE_FFF_GLOBALS;
+
+struct mloop_timer {
+	int dummy;
+};
+
+static struct mloop_timer timer;
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_is_started, const struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+
+static int init(unsigned long rate)
+{
+	mloop_timer_new_fake.return_val = &timer;
+
+	struct sdo_governor_config config = {
+		.rate = rate,
+		.share = {
+			[SDO_REQ_PRIO_HIGH] = 100,
+			[SDO_REQ_PRIO_NORMAL] = 50,
+			[SDO_REQ_PRIO_LOW] = 10,
+		}
+	};
+
+	return sdo_governor_init(&config);
+}
+
+static int test_disabled()
+{
+	ASSERT_INT_EQ(0, init(0));
+	ASSERT_FALSE(sdo_governor_is_enabled());
+
+	for (int i = 0; i < 1000; ++i)
+		ASSERT_UINT_EQ(0, sdo_governor_acquire(SDO_REQ_PRIO_LOW));
+
+	sdo_governor_cleanup();
+	return 0;
+}
+
+static int test_burst_and_wait()
+{
+	struct sdo_governor_stats stats;
+
+	/* 50 ms worth of 1000 frames/s */
+	ASSERT_INT_EQ(0, init(1000));
+	ASSERT_TRUE(sdo_governor_is_enabled());
+
+	for (int i = 0; i < 50; ++i)
+		ASSERT_UINT_EQ(0, sdo_governor_acquire(SDO_REQ_PRIO_HIGH));
+
+	ASSERT_UINT_EQ(1, sdo_governor_acquire(SDO_REQ_PRIO_HIGH));
+
+	usleep(5000);
+	ASSERT_UINT_EQ(0, sdo_governor_acquire(SDO_REQ_PRIO_HIGH));
+
+	sdo_governor_get_stats(SDO_REQ_PRIO_HIGH, &stats);
+	ASSERT_UINT_EQ(51, stats.frames);
+	ASSERT_UINT_EQ(1, stats.throttled);
+
+	sdo_governor_cleanup();
+	return 0;
+}
+
+static int test_class_share()
+{
+	struct sdo_governor_stats stats;
+
+	/* Low priority gets 10% of 1000 frames/s; i.e. a burst of 5 */
+	ASSERT_INT_EQ(0, init(1000));
+
+	for (int i = 0; i < 5; ++i)
+		ASSERT_UINT_EQ(0, sdo_governor_acquire(SDO_REQ_PRIO_LOW));
+
+	unsigned long delay = sdo_governor_acquire(SDO_REQ_PRIO_LOW);
+	ASSERT_UINT_GE(9, delay);
+	ASSERT_UINT_LE(10, delay);
+
+	/* Other classes are not affected */
+	ASSERT_UINT_EQ(0, sdo_governor_acquire(SDO_REQ_PRIO_HIGH));
+
+	sdo_governor_get_stats(SDO_REQ_PRIO_LOW, &stats);
+	ASSERT_UINT_EQ(5, stats.frames);
+	ASSERT_UINT_EQ(1, stats.throttled);
+
+	sdo_governor_cleanup();
+	return 0;
+}
+
+static int test_wakeup()
+{
+	ASSERT_INT_EQ(0, init(1000));
+
+	RESET_FAKE(mloop_timer_start);
+	RESET_FAKE(mloop_timer_set_time);
+	RESET_FAKE(mloop_timer_is_started);
+
+	sdo_governor_request_wakeup(10);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+	ASSERT_UINT_EQ(10000000ULL, mloop_timer_set_time_fake.arg1_val);
+
+	/* A later wakeup does not delay the earlier one */
+	mloop_timer_is_started_fake.return_val = 1;
+	sdo_governor_request_wakeup(20);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+
+	sdo_governor_request_wakeup(5);
+	ASSERT_INT_EQ(2, mloop_timer_start_fake.call_count);
+	ASSERT_UINT_EQ(5000000ULL, mloop_timer_set_time_fake.arg1_val);
+
+	sdo_governor_cleanup();
+	return 0;
+}
+
+static int test_rate_from_bitrate()
+{
+	ASSERT_UINT_EQ(185, sdo_governor_rate_from_bitrate(250000, 10));
+	ASSERT_UINT_EQ(0, sdo_governor_rate_from_bitrate(250000, 0));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_burst_and_wait);
+	RUN_TEST(test_class_share);
+	RUN_TEST(test_wakeup);
+	RUN_TEST(test_rate_from_bitrate);
+	return r;
+}
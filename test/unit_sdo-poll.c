@@ -0,0 +1,311 @@
+#include <string.h>
+#include <mloop.h>
+#include "tst.h"
+#include "fff.h"
+#include "canopen/sdo-poll.h"
+#include "canopen/sdo_req.h"
+#include "time-utils.h"
+
+DEFINE_FFF_GLOBALS;
+
+struct mloop_timer {
+	int dummy;
+};
+
+static struct mloop_timer timer;
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_is_started, const struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_type, struct mloop_timer*,
+	       enum mloop_timer_type);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+
+FAKE_VALUE_FUNC(struct sdo_req*, sdo_req_new, struct sdo_req_info*);
+FAKE_VALUE_FUNC(int, sdo_req_start, struct sdo_req*, struct sdo_req_queue*);
+FAKE_VALUE_FUNC(int, sdo_req_unref, struct sdo_req*);
+FAKE_VALUE_FUNC(struct sdo_req_queue*, sdo_req_queue_get, int);
+
+static struct sdo_req reqs[16];
+static unsigned int n_reqs;
+
+static struct sdo_req* new_req(struct sdo_req_info* info)
+{
+	struct sdo_req* req = &reqs[n_reqs++ % 16];
+
+	memset(req, 0, sizeof(*req));
+	req->type = info->type;
+	req->index = info->index;
+	req->subindex = info->subindex;
+	req->on_done = info->on_done;
+	req->context = info->context;
+	req->prio = info->prio;
+
+	return req;
+}
+
+static void finish(struct sdo_req* req, enum sdo_req_status status,
+		   const void* data, size_t size)
+{
+	req->status = status;
+	req->data.data = (char*)data;
+	req->data.size = size;
+	req->data.index = size;
+
+	if (status == SDO_REQ_REMOTE_ABORT)
+		req->abort_code = SDO_ABORT_NEXIST;
+
+	req->on_done(req);
+}
+
+static int init(unsigned long rate)
+{
+	RESET_FAKE(sdo_req_new);
+	RESET_FAKE(sdo_req_start);
+	RESET_FAKE(mloop_timer_set_time);
+	RESET_FAKE(mloop_timer_start);
+
+	mloop_timer_new_fake.return_val = &timer;
+	sdo_req_new_fake.custom_fake = new_req;
+	n_reqs = 0;
+
+	return sdo_poll_init(rate);
+}
+
+static uint64_t now(void)
+{
+	return gettime_us(CLOCK_MONOTONIC);
+}
+
+static int test_poll_and_read()
+{
+	struct sdo_poll_value value;
+	uint32_t data = 0xdeadbeef;
+
+	ASSERT_INT_EQ(0, init(0));
+
+	struct sdo_poll_info info = {
+		.nodeid = 5, .index = 0x2000, .subindex = 1, .period = 100,
+		.type = CANOPEN_UNSIGNED32
+	};
+
+	int handle = sdo_poll_register(&info);
+	ASSERT_INT_GE(0, handle);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+
+	ASSERT_INT_EQ(0, sdo_poll_read(5, 0x2000, 1, &value));
+	ASSERT_INT_EQ(SDO_REQ_PENDING, value.status);
+	ASSERT_UINT_EQ(0, value.timestamp);
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED32, value.type);
+
+	sdo_poll__run(now() + 1000000);
+
+	ASSERT_INT_EQ(1, sdo_req_start_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_UPLOAD, reqs[0].type);
+	ASSERT_INT_EQ(0x2000, reqs[0].index);
+	ASSERT_INT_EQ(1, reqs[0].subindex);
+	ASSERT_INT_EQ(SDO_REQ_PRIO_LOW, reqs[0].prio);
+	ASSERT_INT_EQ(5, sdo_req_queue_get_fake.arg0_val);
+
+	finish(&reqs[0], SDO_REQ_OK, &data, sizeof(data));
+
+	ASSERT_INT_EQ(0, sdo_poll_read(5, 0x2000, 1, &value));
+	ASSERT_INT_EQ(SDO_REQ_OK, value.status);
+	ASSERT_UINT_EQ(sizeof(data), value.size);
+	ASSERT_TRUE(memcmp(&data, value.data, sizeof(data)) == 0);
+	ASSERT_TRUE(value.timestamp != 0);
+
+	ASSERT_INT_EQ(-1, sdo_poll_read(5, 0x2000, 2, &value));
+
+	sdo_poll_unregister(handle);
+	ASSERT_INT_EQ(-1, sdo_poll_read(5, 0x2000, 1, &value));
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+static int test_merge()
+{
+	struct sdo_poll_info info = {
+		.nodeid = 5, .index = 0x2000, .subindex = 1, .period = 100
+	};
+
+	ASSERT_INT_EQ(0, init(0));
+
+	int a = sdo_poll_register(&info);
+	info.period = 50;
+	info.type = CANOPEN_INTEGER16;
+	int b = sdo_poll_register(&info);
+	ASSERT_INT_GE(0, a);
+	ASSERT_INT_GE(0, b);
+	ASSERT_TRUE(a != b);
+
+	/* Conflicting types are not merged */
+	info.type = CANOPEN_UNSIGNED8;
+	ASSERT_INT_EQ(-1, sdo_poll_register(&info));
+
+	sdo_poll__run(now() + 1000000);
+	ASSERT_INT_EQ(1, sdo_req_start_fake.call_count);
+
+	/* Still in flight */
+	sdo_poll__run(now() + 2000000);
+	ASSERT_INT_EQ(1, sdo_req_start_fake.call_count);
+
+	sdo_poll_unregister(a);
+
+	struct sdo_poll_value value;
+	ASSERT_INT_EQ(0, sdo_poll_read(5, 0x2000, 1, &value));
+	ASSERT_INT_EQ(CANOPEN_INTEGER16, value.type);
+
+	/* The poll in flight finds its object gone */
+	sdo_poll_unregister(b);
+	finish(&reqs[0], SDO_REQ_OK, "\1\0", 2);
+	ASSERT_INT_EQ(-1, sdo_poll_read(5, 0x2000, 1, &value));
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+static int test_spread()
+{
+	struct sdo_poll_info info = {
+		.nodeid = 1, .index = 0x6000, .period = 1000
+	};
+
+	ASSERT_INT_EQ(0, init(0));
+
+	uint64_t t0 = now();
+
+	for (int i = 0; i < 8; ++i) {
+		info.subindex = i;
+		ASSERT_INT_GE(0, sdo_poll_register(&info));
+	}
+
+	sdo_poll__run(t0 + 500000);
+	ASSERT_INT_EQ(4, sdo_req_start_fake.call_count);
+
+	sdo_poll__run(t0 + 1000000);
+	ASSERT_INT_EQ(8, sdo_req_start_fake.call_count);
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+static int test_budget()
+{
+	struct sdo_poll_info info = {
+		.nodeid = 1, .index = 0x6000, .period = 10
+	};
+
+	/* A burst of 1 at 20 polls/s */
+	ASSERT_INT_EQ(0, init(20));
+
+	for (int i = 0; i < 4; ++i) {
+		info.subindex = i;
+		ASSERT_INT_GE(0, sdo_poll_register(&info));
+	}
+
+	uint64_t t = now() + 100000;
+
+	RESET_FAKE(mloop_timer_set_time);
+	sdo_poll__run(t);
+	ASSERT_INT_EQ(1, sdo_req_start_fake.call_count);
+
+	/* Woken up when the next token is due */
+	ASSERT_INT_EQ(1, mloop_timer_set_time_fake.call_count);
+	ASSERT_UINT_EQ(50000000ULL, mloop_timer_set_time_fake.arg1_val);
+
+	sdo_poll__run(t + 50000);
+	ASSERT_INT_EQ(2, sdo_req_start_fake.call_count);
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+static int test_failure_keeps_value()
+{
+	struct sdo_poll_value value;
+	struct sdo_poll_info info = {
+		.nodeid = 7, .index = 0x1017, .period = 10
+	};
+
+	ASSERT_INT_EQ(0, init(0));
+	ASSERT_INT_GE(0, sdo_poll_register(&info));
+
+	uint64_t t = now() + 100000;
+
+	sdo_poll__run(t);
+	finish(&reqs[0], SDO_REQ_OK, "\x10\x27", 2);
+
+	sdo_poll__run(t + 100000);
+	ASSERT_INT_EQ(2, sdo_req_start_fake.call_count);
+	finish(&reqs[1], SDO_REQ_REMOTE_ABORT, NULL, 0);
+
+	ASSERT_INT_EQ(0, sdo_poll_read(7, 0x1017, 0, &value));
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, value.status);
+	ASSERT_INT_EQ(SDO_ABORT_NEXIST, value.abort_code);
+	ASSERT_UINT_EQ(2, value.size);
+	ASSERT_TRUE(memcmp("\x10\x27", value.data, 2) == 0);
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+static int test_tombstones_cleared()
+{
+	struct sdo_poll_value value;
+	struct sdo_poll_info info = {
+		.nodeid = 9, .period = 100
+	};
+	int handles[512];
+
+	ASSERT_INT_EQ(0, init(0));
+
+	for (int round = 0; round < 4; ++round) {
+		for (int i = 0; i < 512; ++i) {
+			info.index = 0x2000 + round;
+			info.subindex = i & 0xff;
+			info.nodeid = 9 + (i >> 8);
+			handles[i] = sdo_poll_register(&info);
+			ASSERT_INT_GE(0, handles[i]);
+		}
+
+		for (int i = 0; i < 512; ++i)
+			sdo_poll_unregister(handles[i]);
+
+		ASSERT_UINT_EQ(0, sdo_poll__count_tombstones());
+	}
+
+	/* A slot that is still being polled is only cleared afterwards */
+	info.index = 0x3000;
+	info.subindex = 0;
+	int handle = sdo_poll_register(&info);
+	sdo_poll__run(now() + 1000000);
+	ASSERT_INT_EQ(1, sdo_req_start_fake.call_count);
+
+	sdo_poll_unregister(handle);
+	ASSERT_UINT_EQ(1, sdo_poll__count_tombstones());
+
+	finish(&reqs[0], SDO_REQ_OK, "\1", 1);
+	ASSERT_UINT_EQ(0, sdo_poll__count_tombstones());
+	ASSERT_INT_EQ(-1, sdo_poll_read(9, 0x3000, 0, &value));
+
+	sdo_poll_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_poll_and_read);
+	RUN_TEST(test_merge);
+	RUN_TEST(test_spread);
+	RUN_TEST(test_budget);
+	RUN_TEST(test_failure_keeps_value);
+	RUN_TEST(test_tombstones_cleared);
+	return r;
+}
@@ -4,6 +4,7 @@
 #include <sys/socket.h>
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_srv.h"
+#include "canopen/sdo-governor.h"
 #include "net-util.h"
 #include "canopen.h"
 #include "tst.h"
@@ -32,9 +33,13 @@ FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
 FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
 FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
 FAKE_VOID_FUNC(on_done, struct sdo_async*);
+FAKE_VOID_FUNC(on_progress, struct sdo_async*);
 
 struct mloop_timer timer;
 
+/* Not part of the public interface */
+void sdo_async__on_timeout(struct mloop_timer* timer);
+
 static struct sdo_srv server;
 static struct sdo_async client;
 
@@ -197,7 +202,8 @@ static int download(const char* str)
 	reset_srv_data();
 	push_to_server();
 	ASSERT_STR_EQ(str, srv_data);
-	ASSERT_UINT_EQ(size, client.buffer.index);
+	ASSERT_PTR_EQ(str, client.dl_data);
+	ASSERT_UINT_EQ(size, client.dl_size);
 	ASSERT_INT_EQ(0x1234, srv_index);
 	ASSERT_INT_EQ(42, srv_subindex);
 	ASSERT_INT_EQ(1, on_done_fake.call_count);
@@ -229,6 +235,193 @@ static int upload(const char* str)
 	return 0;
 }
 
+static int upload_to_buffer(const char* str)
+{
+	char buffer[1024];
+	memset(buffer, '.', sizeof(buffer));
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.ul_buffer = buffer,
+		.ul_buffer_size = sizeof(buffer),
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_STR_EQ(str, buffer);
+	ASSERT_UINT_EQ(strlen(str) + 1, client.ul_size);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+
+	return 0;
+}
+
+static int upload_to_small_buffer(const char* str, size_t size)
+{
+	char buffer[8];
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.ul_buffer = buffer,
+		.ul_buffer_size = size,
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_LOCAL_ABORT, client.status);
+	ASSERT_INT_EQ(SDO_ABORT_TOO_LONG, client.abort_code);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+
+	/* Deliver the abort frame to the server */
+	push_to_server();
+
+	return 0;
+}
+
+static char stream_data[1024];
+static size_t stream_size;
+
+static ssize_t read_stream(void* context, void* dst, size_t size,
+			   size_t offset)
+{
+	const char* src = context;
+	memcpy(dst, src + offset, size);
+	return size;
+}
+
+static int write_stream(void* context, const void* src, size_t size,
+			size_t offset)
+{
+	(void)context;
+
+	if (offset + size > sizeof(stream_data))
+		return -1;
+
+	memcpy(stream_data + offset, src, size);
+	stream_size = offset + size;
+	return 0;
+}
+
+static int write_stream_failure(void* context, const void* src, size_t size,
+				size_t offset)
+{
+	(void)context;
+	(void)src;
+	(void)size;
+	(void)offset;
+	return -1;
+}
+
+static size_t n_segments(size_t size)
+{
+	return size > SDO_EXPEDIATED_DATA_SIZE
+	     ? (size + SDO_SEGMENT_MAX_SIZE - 1) / SDO_SEGMENT_MAX_SIZE : 0;
+}
+
+static int download_stream(const char* str)
+{
+	size_t size = strlen(str) + 1;
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.size = size,
+		.read_fn = read_stream,
+		.stream_context = (void*)str,
+		.on_progress = on_progress,
+		.on_done = on_done
+	};
+
+	RESET_FAKE(on_done);
+	RESET_FAKE(on_progress);
+
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	reset_srv_data();
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_STR_EQ(str, srv_data);
+	ASSERT_UINT_EQ(size, srv_size);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_UINT_EQ(n_segments(size), on_progress_fake.call_count);
+
+	return 0;
+}
+
+static int upload_stream(const char* str)
+{
+	size_t size = strlen(str) + 1;
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.write_fn = write_stream,
+		.on_progress = on_progress,
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+	RESET_FAKE(on_progress);
+
+	memset(stream_data, '.', sizeof(stream_data));
+	stream_size = 0;
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_STR_EQ(str, stream_data);
+	ASSERT_UINT_EQ(size, stream_size);
+	ASSERT_UINT_EQ(size, client.ul_size);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+	ASSERT_UINT_EQ(n_segments(size), on_progress_fake.call_count);
+
+	return 0;
+}
+
+static int upload_stream_failure(const char* str)
+{
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.write_fn = write_stream_failure,
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+
+	set_srv_data(str);
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_LOCAL_ABORT, client.status);
+	ASSERT_INT_EQ(SDO_ABORT_STORE, client.abort_code);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+
+	/* Deliver the abort frame to the server */
+	push_to_server();
+
+	return 0;
+}
+
 static int test_download()
 {
 	return download("")
@@ -263,6 +456,150 @@ static int test_upload_big()
 	return upload(loremipsum);
 }
 
+static int test_upload_to_buffer()
+{
+	return upload_to_buffer("")
+	    || upload_to_buffer("foo")
+	    || upload_to_buffer("foobarx")
+	    || upload_to_buffer(loremipsum);
+}
+
+static int test_upload_to_small_buffer()
+{
+	return upload_to_small_buffer("foo", 2)
+	    || upload_to_small_buffer("foobarx", sizeof("foobarx") - 1);
+}
+
+static int test_download_stream()
+{
+	return download_stream("")
+	    || download_stream("foo")
+	    || download_stream("foobarx")
+	    || download_stream(loremipsum);
+}
+
+static int test_upload_stream()
+{
+	return upload_stream("")
+	    || upload_stream("foo")
+	    || upload_stream("foobarx")
+	    || upload_stream(loremipsum)
+	    || upload_stream_failure("foo")
+	    || upload_stream_failure(loremipsum);
+}
+
+static int test_rtt_timeout()
+{
+	struct sdo_async_rtt rtt = {
+		.min_timeout = 10,
+		.max_timeout = 1000
+	};
+
+	/* No samples yet */
+	ASSERT_UINT_EQ(1000, sdo_async_rtt_timeout(&rtt));
+
+	sdo_async_rtt_update(&rtt, 20000);
+	ASSERT_UINT_EQ(20000, rtt.srtt);
+	ASSERT_UINT_EQ(10000, rtt.rttvar);
+	ASSERT_UINT_EQ(60, sdo_async_rtt_timeout(&rtt));
+
+	for (int i = 0; i < 100; ++i)
+		sdo_async_rtt_update(&rtt, 1000);
+
+	/* Clamped to lower bound */
+	ASSERT_UINT_EQ(10, sdo_async_rtt_timeout(&rtt));
+
+	rtt.backoff = 3;
+	ASSERT_UINT_EQ(80, sdo_async_rtt_timeout(&rtt));
+
+	rtt.backoff = 10;
+	ASSERT_UINT_EQ(1000, sdo_async_rtt_timeout(&rtt));
+
+	sdo_async_rtt_update(&rtt, 1000);
+	ASSERT_UINT_EQ(0, rtt.backoff);
+	return 0;
+}
+
+static int test_adaptive_timeout()
+{
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.on_done = on_done,
+	};
+
+	sdo_async_set_timeout_bounds(&client, 20, 500);
+	client.rtt.n_samples = 0;
+
+	RESET_FAKE(mloop_timer_set_time);
+	set_srv_data("foo");
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	ASSERT_UINT_EQ(500000000ULL, mloop_timer_set_time_fake.arg1_val);
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_UINT_EQ(1, client.rtt.n_samples);
+
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	ASSERT_UINT_EQ(20000000ULL, mloop_timer_set_time_fake.arg1_val);
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+
+	info.timeout = 1234;
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	ASSERT_UINT_EQ(1234000000ULL, mloop_timer_set_time_fake.arg1_val);
+	push_to_server();
+
+	return 0;
+}
+
+static int test_frame_while_deferred()
+{
+	struct sdo_governor_config config = {
+		.rate = 1,
+		.share = { 100, 100, 100 }
+	};
+
+	struct sdo_async_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.timeout = 1000,
+		.on_done = on_done,
+	};
+
+	RESET_FAKE(on_done);
+
+	/* There is only a token for the first segment request */
+	ASSERT_INT_EQ(0, sdo_governor_init(&config));
+
+	set_srv_data("foobarx");
+	ASSERT_INT_EQ(0, sdo_async_start(&client, &info));
+	push_to_server();
+	ASSERT_TRUE(client.is_deferred);
+
+	unsigned long n_samples = client.rtt.n_samples;
+	RESET_FAKE(mloop_timer_stop);
+
+	struct can_frame late = { .can_id = client.res_cobid, .can_dlc = 8 };
+	ASSERT_INT_EQ(-1, sdo_async_feed(&client, &late));
+	ASSERT_TRUE(client.is_deferred);
+	ASSERT_INT_EQ(0, mloop_timer_stop_fake.call_count);
+	ASSERT_UINT_EQ(n_samples, client.rtt.n_samples);
+	ASSERT_INT_EQ(0, on_done_fake.call_count);
+
+	sdo_governor_cleanup();
+
+	mloop_timer_get_context_fake.return_val = &client;
+	sdo_async__on_timeout(&timer);
+	push_to_server();
+	ASSERT_INT_EQ(SDO_REQ_OK, client.status);
+	ASSERT_STR_EQ("foobarx", client.buffer.data);
+	ASSERT_INT_EQ(1, on_done_fake.call_count);
+
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -271,6 +608,13 @@ int main()
 	RUN_TEST(test_download_big);
 	RUN_TEST(test_upload);
 	RUN_TEST(test_upload_big);
+	RUN_TEST(test_upload_to_buffer);
+	RUN_TEST(test_upload_to_small_buffer);
+	RUN_TEST(test_download_stream);
+	RUN_TEST(test_upload_stream);
+	RUN_TEST(test_rtt_timeout);
+	RUN_TEST(test_adaptive_timeout);
+	RUN_TEST(test_frame_while_deferred);
 	cleanup();
 	return r;
 }
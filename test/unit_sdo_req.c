@@ -16,12 +16,32 @@ FAKE_VALUE_FUNC(void*, mloop_idle_get_context, const struct mloop_idle*);
 FAKE_VOID_FUNC(mloop_idle_set_idle_fn, struct mloop_idle*, mloop_idle_fn);
 FAKE_VOID_FUNC(mloop_idle_set_cond_fn, struct mloop_idle*, mloop_idle_cond_fn);
 FAKE_VOID_FUNC(mloop_idle_set_priority, struct mloop_idle*, unsigned long);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
 FAKE_VALUE_FUNC(int, sdo_async_init, struct sdo_async*, const struct sock*,
 		int);
 FAKE_VALUE_FUNC(int, sdo_async_stop, struct sdo_async*);
 FAKE_VOID_FUNC(sdo_async_destroy, struct sdo_async*);
 FAKE_VALUE_FUNC(int, sdo_async_start, struct sdo_async*,
 		const struct sdo_async_info*);
+FAKE_VOID_FUNC(sdo_async_set_cobids, struct sdo_async*, unsigned int,
+	       unsigned int);
+FAKE_VOID_FUNC(sdo_async_set_timeout_bounds, struct sdo_async*,
+	       unsigned long, unsigned long);
+void sdo_req__on_done(struct sdo_async* async);
+void sdo_req__on_stop(void* ptr);
+void sdo_req__process_queue(struct mloop_idle* idle);
+int sdo_req__have_req(struct mloop_idle* idle);
+struct sdo_req* sdo_req_queue_head(struct sdo_req_queue* self);
+
+FAKE_VOID_FUNC(sdo_cache_store, int, int, int, const void*, size_t, int);
 
 static int test_req_new_free()
 {
@@ -50,6 +70,29 @@ static int test_req_new_free()
 	return 0;
 }
 
+static int test_req_new_with_ul_buffer()
+{
+	char buffer[16];
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1234,
+		.subindex = 42,
+		.ul_buffer = buffer,
+		.ul_buffer_size = sizeof(buffer)
+	};
+
+	struct sdo_req* req = sdo_req_new(&info);
+
+	ASSERT_PTR_EQ(buffer, req->data.data);
+	ASSERT_UINT_EQ(sizeof(buffer), req->data.size);
+	ASSERT_UINT_EQ(0, req->data.index);
+	ASSERT_TRUE(req->is_data_borrowed);
+
+	sdo_req_free(req);
+	return 0;
+}
+
 static int test_req_queue_init_destroy()
 {
 	RESET_FAKE(sdo_async_init);
@@ -105,19 +148,683 @@ static int test_req_queue_enqueue_dequeue()
 	return 0;
 }
 
+static struct sdo_req* new_req(enum sdo_req_type type, int index,
+			       int subindex)
+{
+	struct sdo_req_info info = {
+		.type = type,
+		.index = index,
+		.subindex = subindex,
+	};
+
+	return sdo_req_new(&info);
+}
+
+static int test_req_queue_coalesce_uploads()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.return_val = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 10, 0);
+
+	struct sdo_req* a = new_req(SDO_REQ_UPLOAD, 0x2000, 1);
+	struct sdo_req* b = new_req(SDO_REQ_UPLOAD, 0x2000, 2);
+	struct sdo_req* c = new_req(SDO_REQ_UPLOAD, 0x2000, 1);
+
+	ASSERT_INT_EQ(0, sdo_req_start(a, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(b, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(c, &queue));
+
+	/* Requests are coalesced when the main loop picks them up */
+	ASSERT_UINT_EQ(3, queue.size);
+	ASSERT_PTR_EQ(a, sdo_req_queue_head(&queue));
+
+	ASSERT_UINT_EQ(2, queue.size);
+	ASSERT_PTR_EQ(c, TAILQ_FIRST(&a->followers));
+	ASSERT_PTR_EQ(&queue, c->parent);
+	ASSERT_UINT_EQ(1, queue.stats.coalesced_uploads);
+
+	/* Complete the first transfer */
+	ASSERT_PTR_EQ(a, sdo_req_queue__dequeue(&queue));
+	queue.channel[0].current = a;
+
+	vector_init(&queue.channel[0].client.buffer, 8);
+	vector_assign(&queue.channel[0].client.buffer, "foo", 3);
+	queue.channel[0].client.context = a;
+	queue.channel[0].client.status = SDO_REQ_OK;
+	queue.channel[0].client.is_size_indicated = 1;
+
+	sdo_req__on_done(&queue.channel[0].client);
+
+	ASSERT_PTR_EQ(NULL, queue.channel[0].current);
+	ASSERT_INT_EQ(SDO_REQ_OK, a->status);
+	ASSERT_INT_EQ(SDO_REQ_OK, c->status);
+	ASSERT_UINT_EQ(3, c->data.index);
+	ASSERT_INT_EQ(0, memcmp("foo", c->data.data, 3));
+	ASSERT_TRUE(c->is_size_indicated);
+	ASSERT_TRUE(TAILQ_EMPTY(&a->followers));
+
+	/* The queue's references to a and b are dropped here */
+	sdo_req_unref(a);
+	sdo_req_unref(a);
+	sdo_req_unref(c);
+	vector_destroy(&queue.channel[0].client.buffer);
+	sdo_req__queue_destroy(&queue);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, b->status);
+	sdo_req_unref(b);
+	return 0;
+}
+
+static int test_req_queue_upload_after_download()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.return_val = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 10, 0);
+
+	struct sdo_req* a = new_req(SDO_REQ_UPLOAD, 0x2000, 1);
+	struct sdo_req* b = new_req(SDO_REQ_DOWNLOAD, 0x2000, 1);
+	struct sdo_req* c = new_req(SDO_REQ_UPLOAD, 0x2000, 1);
+
+	sdo_req_start(a, &queue);
+	sdo_req_start(b, &queue);
+	sdo_req_start(c, &queue);
+	sdo_req_queue_head(&queue);
+
+	/* c must see the value written by b */
+	ASSERT_UINT_EQ(3, queue.size);
+	ASSERT_TRUE(TAILQ_EMPTY(&a->followers));
+
+	sdo_req__queue_destroy(&queue);
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+	sdo_req_unref(c);
+	return 0;
+}
+
+static int test_req_queue_last_writer_wins()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.return_val = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 1, 10, 0);
+
+	struct sdo_req* a = new_req(SDO_REQ_DOWNLOAD, 0x2000, 1);
+	struct sdo_req* b = new_req(SDO_REQ_DOWNLOAD, 0x2000, 1);
+	struct sdo_req* c = new_req(SDO_REQ_DOWNLOAD, 0x2000, 1);
+
+	/* Disabled by default */
+	sdo_req_start(a, &queue);
+	sdo_req_start(b, &queue);
+	sdo_req_queue_head(&queue);
+	ASSERT_UINT_EQ(2, queue.size);
+
+	sdo_req_queue_set_flags(&queue, SDO_REQ_QUEUE_LAST_WRITER_WINS);
+	sdo_req_start(c, &queue);
+	sdo_req_queue_head(&queue);
+
+	ASSERT_UINT_EQ(2, queue.size);
+	ASSERT_PTR_EQ(a, TAILQ_FIRST(&queue.list[SDO_REQ_PRIO_NORMAL]));
+	ASSERT_PTR_EQ(c, TAILQ_LAST(&queue.list[SDO_REQ_PRIO_NORMAL],
+				    sdo_req_list));
+	ASSERT_PTR_EQ(b, TAILQ_FIRST(&c->followers));
+	ASSERT_UINT_EQ(1, queue.stats.superseded_downloads);
+
+	sdo_req__queue_destroy(&queue);
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, b->status);
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+	sdo_req_unref(c);
+	return 0;
+}
+
+static int test_req_queue_priorities()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.return_val = 0;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 0, 100, 0);
+
+	struct sdo_req high[10], normal[5], low[2];
+	memset(high, 0, sizeof(high));
+	memset(normal, 0, sizeof(normal));
+	memset(low, 0, sizeof(low));
+
+	for (int i = 0; i < 2; ++i) {
+		low[i].prio = SDO_REQ_PRIO_LOW;
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &low[i]));
+	}
+
+	for (int i = 0; i < 5; ++i)
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &normal[i]));
+
+	for (int i = 0; i < 10; ++i) {
+		high[i].prio = SDO_REQ_PRIO_HIGH;
+		ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &high[i]));
+	}
+
+	ASSERT_PTR_EQ(&high[0], sdo_req_queue_head(&queue));
+
+	/* Each class gets its share in order of precedence */
+	for (int i = 0; i < 8; ++i)
+		ASSERT_PTR_EQ(&high[i], sdo_req_queue__dequeue(&queue));
+
+	for (int i = 0; i < 4; ++i)
+		ASSERT_PTR_EQ(&normal[i], sdo_req_queue__dequeue(&queue));
+
+	ASSERT_PTR_EQ(&low[0], sdo_req_queue__dequeue(&queue));
+
+	/* Next round */
+	ASSERT_PTR_EQ(&high[8], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&high[9], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&normal[4], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(&low[1], sdo_req_queue__dequeue(&queue));
+	ASSERT_PTR_EQ(NULL, sdo_req_queue__dequeue(&queue));
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static struct sdo_req* new_upload(int index)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = index,
+	};
+
+	return sdo_req_new(&info);
+}
+
+static int stop_client(struct sdo_async* async)
+{
+	async->is_running = 0;
+	sdo_req__on_stop(async->context);
+	return 0;
+}
+
+static void set_client_cobids(struct sdo_async* async, unsigned int req,
+			      unsigned int res)
+{
+	async->req_cobid = req;
+	async->res_cobid = res;
+}
+
+static struct sdo_async_info last_info;
+
+static int start_client(struct sdo_async* async,
+			const struct sdo_async_info* info)
+{
+	last_info = *info;
+	async->is_running = 1;
+	async->context = info->context;
+	return 0;
+}
+
+/* Simulate the SDO client of a channel finishing its request */
+static void finish_channel(struct sdo_req_channel* channel,
+			   enum sdo_req_status status,
+			   enum sdo_abort_code abort_code)
+{
+	struct sdo_req* req = channel->current;
+
+	channel->client.is_running = 0;
+	channel->client.status = status;
+	channel->client.abort_code = abort_code;
+	channel->client.context = req;
+
+	sdo_req__on_done(&channel->client);
+	sdo_req__on_stop(req);
+}
+
+static void finish_current(struct sdo_req_queue* queue,
+			   enum sdo_req_status status,
+			   enum sdo_abort_code abort_code)
+{
+	finish_channel(&queue->channel[0], status, abort_code);
+}
+
+static int test_req_queue_breaker()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	sdo_req_queue_set_breaker(&queue, 2);
+
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	struct sdo_req* req[5];
+	for (int i = 0; i < 5; ++i) {
+		req[i] = new_upload(0x2000 + i);
+		ASSERT_INT_EQ(0, sdo_req_start(req[i], &queue));
+	}
+
+	/* Two consecutive timeouts open the breaker */
+	for (int i = 0; i < 2; ++i) {
+		sdo_req__process_queue(NULL);
+		ASSERT_PTR_EQ(req[i], queue.channel[0].current);
+		finish_current(&queue, SDO_REQ_LOCAL_ABORT, SDO_ABORT_TIMEOUT);
+		ASSERT_INT_EQ(SDO_REQ_LOCAL_ABORT, req[i]->status);
+	}
+
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_OPEN, queue.breaker.state);
+	ASSERT_UINT_EQ(1, queue.breaker.n_trips);
+
+	/* The rest fail without being sent */
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+	sdo_req__process_queue(NULL);
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_NODE_DOWN, req[2]->status);
+	ASSERT_INT_EQ(SDO_REQ_NODE_DOWN, req[3]->status);
+	ASSERT_INT_EQ(SDO_REQ_NODE_DOWN, req[4]->status);
+	ASSERT_UINT_EQ(3, queue.breaker.n_rejected);
+	ASSERT_PTR_EQ(NULL, sdo_req_queue_head(&queue));
+
+	/* A probe that times out doubles the back-off */
+	struct sdo_req* probe = new_upload(0x1000);
+	ASSERT_INT_EQ(0, sdo_req_start(probe, &queue));
+	queue.breaker.next_probe = 0;
+	sdo_req__process_queue(NULL);
+	ASSERT_PTR_EQ(probe, queue.channel[0].current);
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_HALF_OPEN, queue.breaker.state);
+	finish_current(&queue, SDO_REQ_LOCAL_ABORT, SDO_ABORT_TIMEOUT);
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_OPEN, queue.breaker.state);
+	ASSERT_UINT_EQ(2000, queue.breaker.backoff);
+
+	/* A heartbeat or boot-up closes it again */
+	sdo_req_queue_close_breaker(&queue);
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_CLOSED, queue.breaker.state);
+
+	struct sdo_req* after = new_upload(0x1000);
+	ASSERT_INT_EQ(0, sdo_req_start(after, &queue));
+	sdo_req__process_queue(NULL);
+	ASSERT_PTR_EQ(after, queue.channel[0].current);
+	finish_current(&queue, SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(SDO_REQ_OK, after->status);
+	ASSERT_UINT_EQ(0, queue.breaker.n_timeouts);
+
+	for (int i = 0; i < 5; ++i)
+		sdo_req_unref(req[i]);
+	sdo_req_unref(probe);
+	sdo_req_unref(after);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_retry()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+	RESET_FAKE(mloop_timer_start);
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	sdo_req_queue_set_max_retries(&queue, 1);
+
+	mloop_idle_get_context_fake.return_val = &queue;
+	mloop_timer_get_context_fake.return_val = &queue;
+
+	struct sdo_req* req = new_upload(0x2000);
+	struct sdo_req* follower = new_upload(0x2000);
+	ASSERT_INT_EQ(0, sdo_req_start(req, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(follower, &queue));
+
+	sdo_req__process_queue(NULL);
+	finish_current(&queue, SDO_REQ_REMOTE_ABORT, SDO_ABORT_DEVICE_STATE);
+
+	/* The request is put back and the queue waits for the retry timer */
+	ASSERT_INT_EQ(SDO_REQ_PENDING, req->status);
+	ASSERT_INT_EQ(SDO_REQ_PENDING, follower->status);
+	ASSERT_PTR_EQ(req, sdo_req_queue_head(&queue));
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+	ASSERT_FALSE(sdo_req__have_req(NULL));
+
+	mloop_timer_set_callback_fake.arg1_val(NULL);
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+
+	/* The number of retries is limited */
+	sdo_req__process_queue(NULL);
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	finish_current(&queue, SDO_REQ_REMOTE_ABORT, SDO_ABORT_DEVICE_STATE);
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, req->status);
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, follower->status);
+	ASSERT_UINT_EQ(1, queue.stats.retries);
+
+	/* Other abort codes are not retried */
+	struct sdo_req* other = new_upload(0x2001);
+	ASSERT_INT_EQ(0, sdo_req_start(other, &queue));
+	sdo_req__process_queue(NULL);
+	finish_current(&queue, SDO_REQ_REMOTE_ABORT, SDO_ABORT_NEXIST);
+	ASSERT_INT_EQ(SDO_REQ_REMOTE_ABORT, other->status);
+
+	sdo_req_unref(req);
+	sdo_req_unref(follower);
+	sdo_req_unref(other);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_channels()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+
+	RESET_FAKE(sdo_async_set_cobids);
+	sdo_async_set_cobids_fake.custom_fake = set_client_cobids;
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	ASSERT_INT_EQ(0, sdo_req_queue_add_channel(&queue, 0x301, 0x281));
+	ASSERT_UINT_EQ(2, queue.n_channels);
+	ASSERT_PTR_EQ(&queue.channel[1].client, sdo_req_find_channel(0x281));
+	ASSERT_PTR_EQ(NULL, sdo_req_find_channel(0x282));
+	ASSERT_PTR_EQ(&queue, sdo_req_queue__from_async(&queue.channel[1].client));
+
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	struct sdo_req* domain = new_upload(0x2000);
+	struct sdo_req* param = new_upload(0x2001);
+	struct sdo_req* again = new_req(SDO_REQ_DOWNLOAD, 0x2001, 0);
+	ASSERT_INT_EQ(0, sdo_req_start(domain, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(param, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(again, &queue));
+
+	/* Different objects run in parallel, the same object does not */
+	sdo_req__process_queue(NULL);
+	ASSERT_PTR_EQ(domain, queue.channel[0].current);
+	ASSERT_PTR_EQ(param, queue.channel[1].current);
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_FALSE(sdo_req__have_req(NULL));
+
+	finish_channel(&queue.channel[1], SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(SDO_REQ_OK, param->status);
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+
+	sdo_req__process_queue(NULL);
+	ASSERT_PTR_EQ(again, queue.channel[1].current);
+	ASSERT_PTR_EQ(domain, queue.channel[0].current);
+
+	/* Removing the channel cancels its transfer */
+	RESET_FAKE(sdo_async_stop);
+	sdo_async_stop_fake.custom_fake = stop_client;
+	sdo_req_queue_remove_channels(&queue);
+	ASSERT_INT_EQ(1, sdo_async_stop_fake.call_count);
+	ASSERT_PTR_EQ(&queue.channel[1].client, sdo_async_stop_fake.arg0_val);
+	ASSERT_PTR_EQ(NULL, queue.channel[1].current);
+	ASSERT_UINT_EQ(1, queue.n_channels);
+	ASSERT_PTR_EQ(NULL, sdo_req_find_channel(0x281));
+
+	finish_current(&queue, SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(SDO_REQ_OK, domain->status);
+
+	sdo_async_stop_fake.custom_fake = NULL;
+
+	sdo_req_unref(domain);
+	sdo_req_unref(param);
+	sdo_req_unref(again);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+/* Run the idle part of the main loop and count how often the queue is
+ * processed
+ */
+static int run_idle(int n_iterations)
+{
+	int n_calls = 0;
+
+	for (int i = 0; i < n_iterations; ++i) {
+		if (!sdo_req__have_req(NULL))
+			continue;
+
+		sdo_req__process_queue(NULL);
+		++n_calls;
+	}
+
+	return n_calls;
+}
+
+static int test_req_queue_blocked_on_same_object()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+
+	RESET_FAKE(sdo_async_set_cobids);
+	sdo_async_set_cobids_fake.custom_fake = set_client_cobids;
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	ASSERT_INT_EQ(0, sdo_req_queue_add_channel(&queue, 0x301, 0x281));
+
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	struct sdo_req* write = new_req(SDO_REQ_DOWNLOAD, 0x2000, 0);
+	struct sdo_req* read = new_upload(0x2000);
+	ASSERT_INT_EQ(0, sdo_req_start(write, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(read, &queue));
+
+	/* The read has to wait, so the idle channel must not keep the main
+	 * loop spinning
+	 */
+	ASSERT_INT_EQ(1, run_idle(100));
+	ASSERT_PTR_EQ(write, queue.channel[0].current);
+	ASSERT_PTR_EQ(NULL, queue.channel[1].current);
+	ASSERT_INT_EQ(1, sdo_async_start_fake.call_count);
+
+	finish_channel(&queue.channel[0], SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(1, run_idle(100));
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(read, queue.channel[0].current);
+
+	sdo_req_queue_remove_channels(&queue);
+	finish_current(&queue, SDO_REQ_OK, 0);
+
+	sdo_req_unref(write);
+	sdo_req_unref(read);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_queue_blocked_on_probe()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+
+	RESET_FAKE(sdo_async_set_cobids);
+	sdo_async_set_cobids_fake.custom_fake = set_client_cobids;
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	ASSERT_INT_EQ(0, sdo_req_queue_add_channel(&queue, 0x301, 0x281));
+	sdo_req_queue_set_breaker(&queue, 1);
+
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	struct sdo_req* req = new_upload(0x2000);
+	ASSERT_INT_EQ(0, sdo_req_start(req, &queue));
+	ASSERT_INT_EQ(1, run_idle(1));
+	finish_channel(&queue.channel[0], SDO_REQ_LOCAL_ABORT,
+		       SDO_ABORT_TIMEOUT);
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_OPEN, queue.breaker.state);
+
+	struct sdo_req* probe = new_upload(0x2001);
+	struct sdo_req* other = new_upload(0x2002);
+	ASSERT_INT_EQ(0, sdo_req_start(probe, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(other, &queue));
+	queue.breaker.next_probe = 0;
+
+	/* Nothing else is sent while the probe is in flight */
+	ASSERT_INT_EQ(1, run_idle(100));
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_HALF_OPEN, queue.breaker.state);
+	ASSERT_PTR_EQ(probe, queue.channel[0].current);
+	ASSERT_PTR_EQ(NULL, queue.channel[1].current);
+
+	finish_channel(&queue.channel[0], SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(SDO_REQ_BREAKER_CLOSED, queue.breaker.state);
+	ASSERT_INT_EQ(1, run_idle(100));
+	ASSERT_PTR_EQ(other, queue.channel[0].current);
+
+	sdo_req_queue_remove_channels(&queue);
+	finish_current(&queue, SDO_REQ_OK, 0);
+
+	sdo_req_unref(req);
+	sdo_req_unref(probe);
+	sdo_req_unref(other);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static ssize_t read_stream(void* context, void* dst, size_t size,
+			   size_t offset)
+{
+	memcpy(dst, (const char*)context + offset, size);
+	return size;
+}
+
+static int write_stream(void* context, const void* src, size_t size,
+			size_t offset)
+{
+	(void)context;
+	(void)src;
+	(void)size;
+	(void)offset;
+	return 0;
+}
+
+static size_t progress_done, progress_total;
+
+static void on_progress(struct sdo_req* req, size_t done, size_t total)
+{
+	(void)req;
+	progress_done = done;
+	progress_total = total;
+}
+
+static int test_req_stream()
+{
+	RESET_FAKE(sdo_async_init);
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = start_client;
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	/* Small objects are read up front */
+	struct sdo_req_info small_info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x2000,
+		.dl_source = read_stream,
+		.dl_size = 3,
+		.stream_context = "foo",
+	};
+
+	struct sdo_req* small = sdo_req_new(&small_info);
+	ASSERT_PTR_EQ(NULL, small->read_fn);
+	ASSERT_UINT_EQ(3, small->data.index);
+	ASSERT_INT_EQ(0, memcmp("foo", small->data.data, 3));
+	sdo_req_unref(small);
+
+	struct sdo_req_info dl_info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x1f50,
+		.subindex = 1,
+		.dl_source = read_stream,
+		.dl_size = 1000,
+		.on_progress = on_progress,
+	};
+
+	struct sdo_req* dl = sdo_req_new(&dl_info);
+	ASSERT_INT_EQ(0, sdo_req_start(dl, &queue));
+	sdo_req__process_queue(NULL);
+	ASSERT_PTR_EQ(dl, queue.channel[0].current);
+	ASSERT_PTR_EQ(read_stream, last_info.read_fn);
+	ASSERT_UINT_EQ(1000, last_info.size);
+
+	/* Progress is forwarded from the client */
+	queue.channel[0].client.type = SDO_REQ_DOWNLOAD;
+	queue.channel[0].client.pos = 700;
+	queue.channel[0].client.dl_size = 1000;
+	last_info.on_progress(&queue.channel[0].client);
+	ASSERT_UINT_EQ(700, progress_done);
+	ASSERT_UINT_EQ(1000, progress_total);
+	ASSERT_UINT_EQ(700, dl->transferred);
+
+	queue.channel[0].client.pos = 1000;
+	finish_current(&queue, SDO_REQ_OK, 0);
+	ASSERT_INT_EQ(SDO_REQ_OK, dl->status);
+	ASSERT_UINT_EQ(1000, dl->transferred);
+
+	/* Uploads into a sink are not coalesced */
+	struct sdo_req_info ul_info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x2001,
+		.ul_sink = write_stream,
+	};
+
+	struct sdo_req* a = sdo_req_new(&ul_info);
+	struct sdo_req* b = new_upload(0x2001);
+	ASSERT_INT_EQ(0, sdo_req_start(a, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(b, &queue));
+	ASSERT_PTR_EQ(a, sdo_req_queue_head(&queue));
+	ASSERT_UINT_EQ(2, queue.size);
+	ASSERT_UINT_EQ(0, queue.stats.coalesced_uploads);
+
+	sdo_req_queue_flush(&queue);
+
+	sdo_req_unref(dl);
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
 static int test_req_queue_from_async()
 {
+	RESET_FAKE(sdo_async_init);
+
 	struct sdo_req_queue queue;
-	ASSERT_PTR_EQ(&queue, sdo_req_queue__from_async(&queue.sdo_client));
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 1, 100, 0));
+	ASSERT_PTR_EQ(&queue, sdo_req_queue__from_async(&queue.channel[0].client));
+	sdo_req__queue_destroy(&queue);
 	return 0;
 }
 
 int main()
 {
 	int r = 0;
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
 	RUN_TEST(test_req_new_free);
+	RUN_TEST(test_req_new_with_ul_buffer);
 	RUN_TEST(test_req_queue_init_destroy);
 	RUN_TEST(test_req_queue_enqueue_dequeue);
+	RUN_TEST(test_req_queue_coalesce_uploads);
+	RUN_TEST(test_req_queue_upload_after_download);
+	RUN_TEST(test_req_queue_last_writer_wins);
+	RUN_TEST(test_req_queue_priorities);
+	RUN_TEST(test_req_queue_breaker);
+	RUN_TEST(test_req_queue_retry);
+	RUN_TEST(test_req_queue_channels);
+	RUN_TEST(test_req_queue_blocked_on_same_object);
+	RUN_TEST(test_req_queue_blocked_on_probe);
+	RUN_TEST(test_req_stream);
 	RUN_TEST(test_req_queue_from_async);
 	return r;
 }
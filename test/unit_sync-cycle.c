@@ -0,0 +1,235 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <mloop.h>
+#include "tst.h"
+#include "socketcan.h"
+#include "sock.h"
+#include "canopen.h"
+#include "canopen/sync-cycle.h"
+
+static struct sock sock_[2];
+
+static int n_syncs_;
+static int n_done_;
+static struct co_cycle done_cycle_;
+
+static void on_sync(void)
+{
+	++n_syncs_;
+}
+
+static void on_done(const struct co_cycle* cycle)
+{
+	++n_done_;
+	memcpy(&done_cycle_, cycle, sizeof(done_cycle_));
+}
+
+static int open_socks(void)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		return -1;
+
+	sock_init(&sock_[0], SOCK_TYPE_TCP, fds[0]);
+	sock_init(&sock_[1], SOCK_TYPE_TCP, fds[1]);
+	return 0;
+}
+
+static void close_socks(void)
+{
+	sock_close(&sock_[0]);
+	sock_close(&sock_[1]);
+}
+
+static void make_frame(struct can_frame* cf, int id, int size, int value)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = id;
+	cf->can_dlc = size;
+	memset(cf->data, value, size);
+}
+
+static int test_invalid_config()
+{
+	ASSERT_INT_EQ(0, open_socks());
+
+	struct sync_cycle_config config = { .period = 0 };
+	ASSERT_INT_EQ(-1, sync_cycle_init(&config, &sock_[0]));
+
+	config.period = 1000;
+	config.counter_overflow = 1;
+	ASSERT_INT_EQ(-1, sync_cycle_init(&config, &sock_[0]));
+
+	config.counter_overflow = 241;
+	ASSERT_INT_EQ(-1, sync_cycle_init(&config, &sock_[0]));
+
+	ASSERT_FALSE(sync_cycle_is_running());
+
+	close_socks();
+	return 0;
+}
+
+static int test_cycle_collects_tpdos()
+{
+	ASSERT_INT_EQ(0, open_socks());
+
+	/* Long enough for the producer to stay out of the way */
+	struct sync_cycle_config config = {
+		.period = 10000000,
+		.sync_fn = on_sync,
+		.done_fn = on_done,
+	};
+	ASSERT_INT_EQ(0, sync_cycle_init(&config, &sock_[0]));
+	ASSERT_TRUE(sync_cycle_is_running());
+
+	n_syncs_ = 0;
+	n_done_ = 0;
+
+	struct can_frame cf;
+
+	/* Nothing is collected before the first SYNC */
+	make_frame(&cf, R_TPDO1 + 5, 8, 0xaa);
+	sync_cycle_feed(&cf);
+
+	sync_cycle__begin(1, 100);
+	ASSERT_INT_EQ(1, n_syncs_);
+	ASSERT_INT_EQ(0, n_done_);
+
+	make_frame(&cf, R_TPDO1 + 5, 2, 0x11);
+	sync_cycle_feed(&cf);
+	make_frame(&cf, R_TPDO3 + 5, 4, 0x22);
+	sync_cycle_feed(&cf);
+	make_frame(&cf, R_TPDO3 + 5, 4, 0x33);
+	sync_cycle_feed(&cf);
+	make_frame(&cf, R_TPDO4 + 127, 8, 0x44);
+	sync_cycle_feed(&cf);
+
+	/* Not TPDOs */
+	make_frame(&cf, R_RPDO1 + 6, 8, 0x55);
+	sync_cycle_feed(&cf);
+	make_frame(&cf, R_TSDO + 6, 8, 0x55);
+	sync_cycle_feed(&cf);
+	make_frame(&cf, R_EMCY + 6, 8, 0x55);
+	sync_cycle_feed(&cf);
+
+	sync_cycle__begin(2, 200);
+	ASSERT_INT_EQ(2, n_syncs_);
+	ASSERT_INT_EQ(1, n_done_);
+
+	ASSERT_UINT_EQ(1, done_cycle_.counter);
+	ASSERT_UINT_EQ(100, done_cycle_.time);
+	ASSERT_UINT_EQ(0x5, done_cycle_.is_received[5]);
+	ASSERT_UINT_EQ(0x8, done_cycle_.is_received[127]);
+	ASSERT_UINT_EQ(0, done_cycle_.is_received[6]);
+	ASSERT_UINT_EQ(2, done_cycle_.tpdos[5][0].size);
+	ASSERT_UINT_EQ(0x11, done_cycle_.tpdos[5][0].data[1]);
+	ASSERT_UINT_EQ(4, done_cycle_.tpdos[5][2].size);
+	ASSERT_UINT_EQ(0x33, done_cycle_.tpdos[5][2].data[0]);
+
+	/* The next cycle starts out empty */
+	sync_cycle__begin(3, 300);
+	ASSERT_UINT_EQ(2, done_cycle_.counter);
+	ASSERT_UINT_EQ(0, done_cycle_.is_received[5]);
+
+	sync_cycle_cleanup();
+	ASSERT_FALSE(sync_cycle_is_running());
+
+	close_socks();
+	return 0;
+}
+
+static int test_queue_latest_wins()
+{
+	ASSERT_INT_EQ(0, open_socks());
+
+	struct sync_cycle_config config = { .period = 10000000 };
+	ASSERT_INT_EQ(0, sync_cycle_init(&config, &sock_[0]));
+
+	const char data[] = { 1, 2 };
+
+	ASSERT_INT_EQ(-1, sync_cycle_queue_rpdo(0, 1, data, sizeof(data)));
+	ASSERT_INT_EQ(-1, sync_cycle_queue_rpdo(1, 5, data, sizeof(data)));
+
+	/* The queue never fills up because each RPDO has a slot of its own */
+	for (int i = 0; i < 2 * SYNC_CYCLE_RPDOS_MAX; ++i)
+		ASSERT_INT_EQ(0, sync_cycle_queue_rpdo(1, 1, data,
+						       sizeof(data)));
+
+	for (int nodeid = 1; nodeid < SYNC_CYCLE_NODES; ++nodeid)
+		for (int pdo = 1; pdo <= SYNC_CYCLE_PDOS; ++pdo)
+			ASSERT_INT_EQ(0, sync_cycle_queue_rpdo(nodeid, pdo,
+							       data, 1));
+
+	struct sync_cycle_stats stats;
+	sync_cycle_get_stats(&stats);
+	ASSERT_UINT_EQ(2 * SYNC_CYCLE_RPDOS_MAX, stats.n_rpdos_replaced);
+
+	sync_cycle_cleanup();
+	close_socks();
+	return 0;
+}
+
+static int test_sync_then_rpdos()
+{
+	ASSERT_INT_EQ(0, open_socks());
+
+	struct sync_cycle_config config = {
+		.period = 20000,
+		.counter_overflow = 3,
+	};
+	ASSERT_INT_EQ(0, sync_cycle_init(&config, &sock_[0]));
+
+	const char stale[] = { 0x1, 0x1, 0x1 };
+	const char a[] = { 0xa };
+	const char b[] = { 0xb, 0xb };
+	ASSERT_INT_EQ(0, sync_cycle_queue_rpdo(7, 1, stale, sizeof(stale)));
+	ASSERT_INT_EQ(0, sync_cycle_queue_rpdo(8, 4, b, sizeof(b)));
+	ASSERT_INT_EQ(0, sync_cycle_queue_rpdo(7, 1, a, sizeof(a)));
+
+	struct can_frame cf;
+
+	ASSERT_INT_GE(1, sock_timed_recv(&sock_[1], &cf, 1000));
+	ASSERT_UINT_EQ(R_SYNC, cf.can_id);
+	ASSERT_UINT_EQ(1, cf.can_dlc);
+	ASSERT_UINT_EQ(1, cf.data[0]);
+
+	/* The replaced value keeps its place in the queue */
+	ASSERT_INT_GE(1, sock_timed_recv(&sock_[1], &cf, 1000));
+	ASSERT_UINT_EQ(R_RPDO1 + 7, cf.can_id);
+	ASSERT_UINT_EQ(1, cf.can_dlc);
+	ASSERT_UINT_EQ(0xa, cf.data[0]);
+
+	ASSERT_INT_GE(1, sock_timed_recv(&sock_[1], &cf, 1000));
+	ASSERT_UINT_EQ(R_RPDO4 + 8, cf.can_id);
+	ASSERT_UINT_EQ(2, cf.can_dlc);
+
+	for (int counter = 2; counter <= 4; ++counter) {
+		ASSERT_INT_GE(1, sock_timed_recv(&sock_[1], &cf, 1000));
+		ASSERT_UINT_EQ(R_SYNC, cf.can_id);
+		ASSERT_UINT_EQ(counter > 3 ? 1 : counter, cf.data[0]);
+	}
+
+	sync_cycle_cleanup();
+
+	struct sync_cycle_stats stats;
+	sync_cycle_get_stats(&stats);
+	ASSERT_UINT_EQ(2, stats.n_rpdos);
+	ASSERT_UINT_EQ(1, stats.n_rpdos_replaced);
+	ASSERT_TRUE(stats.n_cycles >= 4);
+	ASSERT_TRUE(stats.jitter_min <= stats.jitter_max);
+
+	close_socks();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	RUN_TEST(test_invalid_config);
+	RUN_TEST(test_cycle_collects_tpdos);
+	RUN_TEST(test_queue_latest_wins);
+	RUN_TEST(test_sync_then_rpdos);
+	return r;
+}
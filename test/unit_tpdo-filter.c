@@ -0,0 +1,140 @@
+#include <string.h>
+#include <unistd.h>
+#include "tst.h"
+#include "canopen/pdo-map.h"
+#include "canopen/tpdo-filter.h"
+
+#define MAPPING(index, subindex, length) \
+	((uint32_t)(index) << 16 | (subindex) << 8 | (length))
+
+static int test_disabled()
+{
+	tpdo_filter_set_default(0, 0);
+	tpdo_filter_reset(1);
+
+	const char data[] = { 1, 2, 3 };
+	ASSERT_INT_EQ(1, tpdo_filter_pass(1, 1, data, sizeof(data)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(1, 1, data, sizeof(data)));
+
+	/* Invalid PDOs are never dropped */
+	ASSERT_INT_EQ(1, tpdo_filter_pass(0, 1, data, sizeof(data)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(1, 5, data, sizeof(data)));
+
+	struct tpdo_filter_stats stats;
+	ASSERT_INT_EQ(0, tpdo_filter_get_stats(1, 1, &stats));
+	ASSERT_UINT_EQ(2, stats.n_received);
+	ASSERT_UINT_EQ(2, stats.n_passed);
+	ASSERT_INT_EQ(-1, tpdo_filter_get_stats(1, 5, &stats));
+
+	return 0;
+}
+
+static int test_identical()
+{
+	tpdo_filter_set_default(1, 0);
+	tpdo_filter_reset(2);
+
+	const char a[] = { 1, 2, 3 }, b[] = { 1, 2, 4 };
+
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 1, a, sizeof(a)));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(2, 1, a, sizeof(a)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 1, b, sizeof(b)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 1, b, 2));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(2, 1, b, 2));
+
+	/* Each PDO is filtered on its own */
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 2, b, 2));
+
+	/* A driver can opt out */
+	ASSERT_INT_EQ(0, tpdo_filter_set_enabled(2, 1, 0));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 1, b, 2));
+
+	struct tpdo_filter_stats stats;
+	tpdo_filter_get_stats(2, 1, &stats);
+	ASSERT_UINT_EQ(6, stats.n_received);
+	ASSERT_UINT_EQ(4, stats.n_passed);
+	ASSERT_UINT_EQ(2, stats.n_unchanged);
+
+	/* Settings are forgotten along with the node */
+	tpdo_filter_reset(2);
+	ASSERT_INT_EQ(1, tpdo_filter_pass(2, 1, b, 2));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(2, 1, b, 2));
+
+	return 0;
+}
+
+static int test_enabled_by_driver()
+{
+	tpdo_filter_set_default(0, 0);
+	tpdo_filter_reset(3);
+
+	const char a[] = { 1 };
+	ASSERT_INT_EQ(0, tpdo_filter_set_enabled(3, 4, 1));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(3, 4, a, sizeof(a)));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(3, 4, a, sizeof(a)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(3, 3, a, sizeof(a)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(3, 3, a, sizeof(a)));
+
+	return 0;
+}
+
+static int test_deadband()
+{
+	tpdo_filter_set_default(1, 0);
+	tpdo_filter_reset(4);
+
+	struct pdo_map map;
+	pdo_map_init(&map);
+	pdo_map_add(&map, MAPPING(0x6041, 0, 16), CANOPEN_UNSIGNED16);
+	pdo_map_add(&map, MAPPING(0x6064, 0, 16), CANOPEN_INTEGER16);
+
+	ASSERT_INT_EQ(0, tpdo_filter_set_deadband(4, 1, &map, 5.0));
+
+	const unsigned char a[] = { 0x37, 0x02, 100, 0 };
+	const unsigned char b[] = { 0x37, 0x02, 104, 0 };
+	const unsigned char c[] = { 0x37, 0x02, 106, 0 };
+	const unsigned char d[] = { 0x37, 0x06, 100, 0 };
+
+	ASSERT_INT_EQ(1, tpdo_filter_pass(4, 1, a, sizeof(a)));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(4, 1, b, sizeof(b)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(4, 1, c, sizeof(c)));
+
+	/* Every object is compared on its own */
+	ASSERT_INT_EQ(0, tpdo_filter_pass(4, 1, b, sizeof(b)));
+	ASSERT_INT_EQ(1, tpdo_filter_pass(4, 1, d, sizeof(d)));
+
+	return 0;
+}
+
+static int test_keepalive()
+{
+	tpdo_filter_set_default(1, 20);
+	tpdo_filter_reset(5);
+
+	const char a[] = { 1 };
+	ASSERT_INT_EQ(1, tpdo_filter_pass(5, 1, a, sizeof(a)));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(5, 1, a, sizeof(a)));
+
+	usleep(25000);
+	ASSERT_INT_EQ(1, tpdo_filter_pass(5, 1, a, sizeof(a)));
+	ASSERT_INT_EQ(0, tpdo_filter_pass(5, 1, a, sizeof(a)));
+
+	struct tpdo_filter_stats stats;
+	tpdo_filter_get_stats(5, 1, &stats);
+	ASSERT_UINT_EQ(1, stats.n_keepalive);
+	ASSERT_UINT_EQ(2, stats.n_unchanged);
+
+	tpdo_filter_set_default(0, 0);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_identical);
+	RUN_TEST(test_enabled_by_driver);
+	RUN_TEST(test_deadband);
+	RUN_TEST(test_keepalive);
+	return r;
+}
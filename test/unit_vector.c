@@ -112,6 +112,25 @@ static int test_vector_fill()
 	return 0;
 }
 
+static int test_vector_swap()
+{
+	struct vector a, b;
+	vector_init(&a, 1);
+	vector_init(&b, 42);
+	vector_assign(&a, "foo", 4);
+	void* a_data = a.data;
+	void* b_data = b.data;
+	vector_swap(&a, &b);
+	ASSERT_PTR_EQ(b_data, a.data);
+	ASSERT_PTR_EQ(a_data, b.data);
+	ASSERT_UINT_EQ(0, a.index);
+	ASSERT_UINT_EQ(4, b.index);
+	ASSERT_STR_EQ("foo", b.data);
+	vector_destroy(&a);
+	vector_destroy(&b);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -124,5 +143,6 @@ int main()
 	RUN_TEST(test_vector_assign_once);
 	RUN_TEST(test_vector_assign_twice);
 	RUN_TEST(test_vector_fill);
+	RUN_TEST(test_vector_swap);
 	return r;
 }
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include "tst.h"
+#include "ini_parser.h"
+#include "vnode-od.h"
+
+static const char config[] =
+	"[device]\n"
+	"heartbeat=yes\n"
+	"\n"
+	"[1000sub0]\n"
+	"type=UNSIGNED32\n"
+	"value=0x401\n"
+	"\n"
+	"[100Asub0]\n"
+	"type=VISIBLE_STRING\n"
+	"value=canopen-vnode\n"
+	"\n"
+	"[2000sub1]\n"
+	"type=UNSIGNED16\n"
+	"value=42\n"
+	"access=rw\n"
+	"\n"
+	"[2000sub1]\n"
+	"type=UNSIGNED8\n"
+	"value=1\n"
+	"\n"
+	"[2001sub0]\n"
+	"type=DOMAIN\n"
+	"access=wo\n";
+
+static const char eds[] =
+	"[DeviceInfo]\n"
+	"VendorNumber=0x42\n"
+	"\n"
+	"[1018]\n"
+	"SubNumber=2\n"
+	"\n"
+	"[1018sub1]\n"
+	"DataType=0x0007\n"
+	"AccessType=ro\n"
+	"DefaultValue=0x42\n"
+	"\n"
+	"[1400sub1]\n"
+	"DataType=0x0007\n"
+	"AccessType=rw\n"
+	"DefaultValue=$NODEID+0x200\n"
+	"\n"
+	"[1017]\n"
+	"DataType=0x0006\n"
+	"AccessType=rw\n";
+
+static int load(struct vnode_od* od, const char* str, int nodeid)
+{
+	struct ini_file ini;
+
+	FILE* stream = fmemopen((void*)str, strlen(str), "r");
+	if (!stream)
+		return -1;
+
+	int rc = ini_parse(&ini, stream);
+	fclose(stream);
+	if (rc < 0)
+		return -1;
+
+	rc = vnode_od_load(od, &ini, nodeid);
+	ini_destroy(&ini);
+	return rc;
+}
+
+static int test_load_config()
+{
+	struct vnode_od od;
+	ASSERT_INT_EQ(0, load(&od, config, 1));
+	ASSERT_UINT_EQ(4, od.length);
+
+	const struct vnode_od_entry* entry = vnode_od_find(&od, 0x1000, 0);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED32, entry->type);
+	ASSERT_INT_EQ(EDS_OBJ_R, entry->access);
+	ASSERT_UINT_EQ(4, entry->value.index);
+	ASSERT_INT_EQ(0, memcmp("\x01\x04\x00\x00", entry->value.data, 4));
+
+	entry = vnode_od_find(&od, 0x100a, 0);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_UINT_EQ(strlen("canopen-vnode"), entry->value.index);
+	ASSERT_INT_EQ(0, memcmp("canopen-vnode", entry->value.data,
+				entry->value.index));
+
+	/* The first definition wins */
+	entry = vnode_od_find(&od, 0x2000, 1);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_INT_EQ(CANOPEN_UNSIGNED16, entry->type);
+	ASSERT_INT_EQ(EDS_OBJ_RW, entry->access);
+
+	entry = vnode_od_find(&od, 0x2001, 0);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_INT_EQ(EDS_OBJ_W, entry->access);
+	ASSERT_UINT_EQ(0, entry->value.index);
+
+	ASSERT_PTR_EQ(NULL, vnode_od_find(&od, 0x1001, 0));
+	ASSERT_PTR_EQ(NULL, vnode_od_find(&od, 0x2000, 0));
+
+	vnode_od_destroy(&od);
+	return 0;
+}
+
+static int test_load_eds()
+{
+	struct vnode_od od;
+	ASSERT_INT_EQ(0, load(&od, eds, 5));
+	ASSERT_UINT_EQ(3, od.length);
+
+	const struct vnode_od_entry* entry = vnode_od_find(&od, 0x1018, 1);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_INT_EQ(0, memcmp("\x42\x00\x00\x00", entry->value.data, 4));
+
+	entry = vnode_od_find(&od, 0x1400, 1);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_INT_EQ(EDS_OBJ_RW, entry->access);
+	ASSERT_INT_EQ(0, memcmp("\x05\x02\x00\x00", entry->value.data, 4));
+
+	/* Objects without a default value are zero */
+	entry = vnode_od_find(&od, 0x1017, 0);
+	ASSERT_TRUE(entry != NULL);
+	ASSERT_UINT_EQ(2, entry->value.index);
+	ASSERT_INT_EQ(0, memcmp("\x00\x00", entry->value.data, 2));
+
+	vnode_od_destroy(&od);
+	return 0;
+}
+
+static int test_write()
+{
+	struct vnode_od od;
+	ASSERT_INT_EQ(0, load(&od, config, 1));
+
+	struct vnode_od_entry* ro = vnode_od_find(&od, 0x1000, 0);
+	ASSERT_INT_EQ(SDO_ABORT_RO, vnode_od_write(ro, "\0\0\0\0", 4));
+
+	struct vnode_od_entry* rw = vnode_od_find(&od, 0x2000, 1);
+	ASSERT_INT_EQ(SDO_ABORT_TOO_LONG, vnode_od_write(rw, "abc", 3));
+	ASSERT_INT_EQ(SDO_ABORT_TOO_SHORT, vnode_od_write(rw, "a", 1));
+	ASSERT_INT_EQ(0, vnode_od_write(rw, "\x37\x13", 2));
+	ASSERT_INT_EQ(0, memcmp("\x37\x13", rw->value.data, 2));
+
+	/* Domains take any size */
+	struct vnode_od_entry* domain = vnode_od_find(&od, 0x2001, 0);
+	ASSERT_INT_EQ(0, vnode_od_write(domain, "foobarbaz", 9));
+	ASSERT_UINT_EQ(9, domain->value.index);
+
+	vnode_od_destroy(&od);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_load_config);
+	RUN_TEST(test_load_eds);
+	RUN_TEST(test_write);
+	return r;
+}